@@ -34,6 +34,7 @@
 
 #include "lib/base/common.h"
 #include "lib/base/compiler_specific.h"
+#include "lib/base/data_parallel.h"
 #include "lib/base/memory_manager.h"
 #include "lib/extras/image.h"
 
@@ -73,6 +74,32 @@ static const double wmul[9] = {
     29.2353797994, 0.844626970982, 0.703646627719,
 };
 
+// Number of image rows processed by one thread pool task. With 4-byte floats
+// and 64-byte aligned rows, 16 rows per band also keeps the transposed output
+// of ConvolutionWithTranspose free of false sharing between tasks.
+constexpr size_t kRowsPerTask = 16;
+
+// Calls process_row(y) for every row y of an image with ysize rows, with bands
+// of kRowsPerTask rows distributed over the thread pool. Every pass must only
+// write the row it was called with; reads of neighbouring rows (halos) must
+// go to images that were completed by an earlier pass.
+template <class ProcessRow>
+Status RunOnRows(ThreadPool* pool, size_t ysize, const ProcessRow& process_row,
+                 const char* caller) {
+  const auto process_band = [&](const uint32_t task,
+                                size_t /*thread*/) -> Status {
+    const size_t y_begin = task * kRowsPerTask;
+    const size_t y_end = std::min(ysize, y_begin + kRowsPerTask);
+    for (size_t y = y_begin; y < y_end; ++y) {
+      process_row(y);
+    }
+    return true;
+  };
+  const uint32_t num_tasks = DivCeil(ysize, kRowsPerTask);
+  return RunOnPool(pool, 0, num_tasks, ThreadPool::NoInit, process_band,
+                   caller);
+}
+
 std::vector<float> ComputeKernel(float sigma) {
   const float m = 2.25;  // Accuracy increases when m is increased.
   const double scaler = -1.0 / (2.0 * sigma * sigma);
@@ -85,7 +112,9 @@ std::vector<float> ComputeKernel(float sigma) {
 }
 
 void ConvolveBorderColumn(const ImageF& in, const std::vector<float>& kernel,
-                          const size_t x, float* BUTTERAUGLI_RESTRICT row_out) {
+                          const size_t x, const size_t y_begin,
+                          const size_t y_end,
+                          float* BUTTERAUGLI_RESTRICT row_out) {
   const size_t offset = kernel.size() / 2;
   int minx = x < offset ? 0 : x - offset;
   int maxx = std::min<int>(in.xsize() - 1, x + offset);
@@ -94,7 +123,7 @@ void ConvolveBorderColumn(const ImageF& in, const std::vector<float>& kernel,
     weight += kernel[j - x + offset];
   }
   float scale = 1.0f / weight;
-  for (size_t y = 0; y < in.ysize(); ++y) {
+  for (size_t y = y_begin; y < y_end; ++y) {
     const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y);
     float sum = 0.0f;
     for (int j = minx; j <= maxx; ++j) {
@@ -107,10 +136,15 @@ void ConvolveBorderColumn(const ImageF& in, const std::vector<float>& kernel,
 // Computes a horizontal convolution and transposes the result.
 Status ConvolutionWithTranspose(const ImageF& in,
                                 const std::vector<float>& kernel,
+                                ThreadPool* pool,
                                 ImageF* BUTTERAUGLI_RESTRICT out) {
   JPEGLI_ENSURE(out->xsize() == in.ysize());
   JPEGLI_ENSURE(out->ysize() == in.xsize());
   const size_t len = kernel.size();
+  if (len != 7 && len != 13 && len != 15 && len != 33) {
+    return JPEGLI_UNREACHABLE("kernel size %d not implemented",
+                              static_cast<int>(len));
+  }
   const size_t offset = len / 2;
   float weight_no_border = 0.0f;
   for (size_t j = 0; j < len; ++j) {
@@ -124,100 +158,114 @@ Status ConvolutionWithTranspose(const ImageF& in,
     scaled_kernel[i] = kernel[i] * scale_no_border;
   }
 
-  // middle
-  switch (len) {
-    case 7: {
-      const float sk0 = scaled_kernel[0];
-      const float sk1 = scaled_kernel[1];
-      const float sk2 = scaled_kernel[2];
-      const float sk3 = scaled_kernel[3];
-      for (size_t y = 0; y < in.ysize(); ++y) {
-        const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
-        for (size_t x = border1; x < border2; ++x, ++row_in) {
-          const float sum0 = (row_in[0] + row_in[6]) * sk0;
-          const float sum1 = (row_in[1] + row_in[5]) * sk1;
-          const float sum2 = (row_in[2] + row_in[4]) * sk2;
-          const float sum = (row_in[3]) * sk3 + sum0 + sum1 + sum2;
-          float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
-          row_out[y] = sum;
+  // Each task convolves a band of input rows, i.e. fills a band of columns of
+  // the transposed output.
+  const auto process_band = [&](const uint32_t task,
+                                size_t /*thread*/) -> Status {
+    const size_t y_begin = task * kRowsPerTask;
+    const size_t y_end = std::min(in.ysize(), y_begin + kRowsPerTask);
+    // middle
+    switch (len) {
+      case 7: {
+        const float sk0 = scaled_kernel[0];
+        const float sk1 = scaled_kernel[1];
+        const float sk2 = scaled_kernel[2];
+        const float sk3 = scaled_kernel[3];
+        for (size_t y = y_begin; y < y_end; ++y) {
+          const float* BUTTERAUGLI_RESTRICT row_in =
+              in.Row(y) + border1 - offset;
+          for (size_t x = border1; x < border2; ++x, ++row_in) {
+            const float sum0 = (row_in[0] + row_in[6]) * sk0;
+            const float sum1 = (row_in[1] + row_in[5]) * sk1;
+            const float sum2 = (row_in[2] + row_in[4]) * sk2;
+            const float sum = (row_in[3]) * sk3 + sum0 + sum1 + sum2;
+            float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
+            row_out[y] = sum;
+          }
         }
-      }
-    } break;
-    case 13: {
-      for (size_t y = 0; y < in.ysize(); ++y) {
-        const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
-        for (size_t x = border1; x < border2; ++x, ++row_in) {
-          float sum0 = (row_in[0] + row_in[12]) * scaled_kernel[0];
-          float sum1 = (row_in[1] + row_in[11]) * scaled_kernel[1];
-          float sum2 = (row_in[2] + row_in[10]) * scaled_kernel[2];
-          float sum3 = (row_in[3] + row_in[9]) * scaled_kernel[3];
-          sum0 += (row_in[4] + row_in[8]) * scaled_kernel[4];
-          sum1 += (row_in[5] + row_in[7]) * scaled_kernel[5];
-          const float sum = (row_in[6]) * scaled_kernel[6];
-          float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
-          row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+      } break;
+      case 13: {
+        for (size_t y = y_begin; y < y_end; ++y) {
+          const float* BUTTERAUGLI_RESTRICT row_in =
+              in.Row(y) + border1 - offset;
+          for (size_t x = border1; x < border2; ++x, ++row_in) {
+            float sum0 = (row_in[0] + row_in[12]) * scaled_kernel[0];
+            float sum1 = (row_in[1] + row_in[11]) * scaled_kernel[1];
+            float sum2 = (row_in[2] + row_in[10]) * scaled_kernel[2];
+            float sum3 = (row_in[3] + row_in[9]) * scaled_kernel[3];
+            sum0 += (row_in[4] + row_in[8]) * scaled_kernel[4];
+            sum1 += (row_in[5] + row_in[7]) * scaled_kernel[5];
+            const float sum = (row_in[6]) * scaled_kernel[6];
+            float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
+            row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+          }
         }
+        break;
       }
-      break;
-    }
-    case 15: {
-      for (size_t y = 0; y < in.ysize(); ++y) {
-        const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
-        for (size_t x = border1; x < border2; ++x, ++row_in) {
-          float sum0 = (row_in[0] + row_in[14]) * scaled_kernel[0];
-          float sum1 = (row_in[1] + row_in[13]) * scaled_kernel[1];
-          float sum2 = (row_in[2] + row_in[12]) * scaled_kernel[2];
-          float sum3 = (row_in[3] + row_in[11]) * scaled_kernel[3];
-          sum0 += (row_in[4] + row_in[10]) * scaled_kernel[4];
-          sum1 += (row_in[5] + row_in[9]) * scaled_kernel[5];
-          sum2 += (row_in[6] + row_in[8]) * scaled_kernel[6];
-          const float sum = (row_in[7]) * scaled_kernel[7];
-          float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
-          row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+      case 15: {
+        for (size_t y = y_begin; y < y_end; ++y) {
+          const float* BUTTERAUGLI_RESTRICT row_in =
+              in.Row(y) + border1 - offset;
+          for (size_t x = border1; x < border2; ++x, ++row_in) {
+            float sum0 = (row_in[0] + row_in[14]) * scaled_kernel[0];
+            float sum1 = (row_in[1] + row_in[13]) * scaled_kernel[1];
+            float sum2 = (row_in[2] + row_in[12]) * scaled_kernel[2];
+            float sum3 = (row_in[3] + row_in[11]) * scaled_kernel[3];
+            sum0 += (row_in[4] + row_in[10]) * scaled_kernel[4];
+            sum1 += (row_in[5] + row_in[9]) * scaled_kernel[5];
+            sum2 += (row_in[6] + row_in[8]) * scaled_kernel[6];
+            const float sum = (row_in[7]) * scaled_kernel[7];
+            float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
+            row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+          }
         }
+        break;
       }
-      break;
-    }
-    case 33: {
-      for (size_t y = 0; y < in.ysize(); ++y) {
-        const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
-        for (size_t x = border1; x < border2; ++x, ++row_in) {
-          float sum0 = (row_in[0] + row_in[32]) * scaled_kernel[0];
-          float sum1 = (row_in[1] + row_in[31]) * scaled_kernel[1];
-          float sum2 = (row_in[2] + row_in[30]) * scaled_kernel[2];
-          float sum3 = (row_in[3] + row_in[29]) * scaled_kernel[3];
-          sum0 += (row_in[4] + row_in[28]) * scaled_kernel[4];
-          sum1 += (row_in[5] + row_in[27]) * scaled_kernel[5];
-          sum2 += (row_in[6] + row_in[26]) * scaled_kernel[6];
-          sum3 += (row_in[7] + row_in[25]) * scaled_kernel[7];
-          sum0 += (row_in[8] + row_in[24]) * scaled_kernel[8];
-          sum1 += (row_in[9] + row_in[23]) * scaled_kernel[9];
-          sum2 += (row_in[10] + row_in[22]) * scaled_kernel[10];
-          sum3 += (row_in[11] + row_in[21]) * scaled_kernel[11];
-          sum0 += (row_in[12] + row_in[20]) * scaled_kernel[12];
-          sum1 += (row_in[13] + row_in[19]) * scaled_kernel[13];
-          sum2 += (row_in[14] + row_in[18]) * scaled_kernel[14];
-          sum3 += (row_in[15] + row_in[17]) * scaled_kernel[15];
-          const float sum = (row_in[16]) * scaled_kernel[16];
-          float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
-          row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+      case 33: {
+        for (size_t y = y_begin; y < y_end; ++y) {
+          const float* BUTTERAUGLI_RESTRICT row_in =
+              in.Row(y) + border1 - offset;
+          for (size_t x = border1; x < border2; ++x, ++row_in) {
+            float sum0 = (row_in[0] + row_in[32]) * scaled_kernel[0];
+            float sum1 = (row_in[1] + row_in[31]) * scaled_kernel[1];
+            float sum2 = (row_in[2] + row_in[30]) * scaled_kernel[2];
+            float sum3 = (row_in[3] + row_in[29]) * scaled_kernel[3];
+            sum0 += (row_in[4] + row_in[28]) * scaled_kernel[4];
+            sum1 += (row_in[5] + row_in[27]) * scaled_kernel[5];
+            sum2 += (row_in[6] + row_in[26]) * scaled_kernel[6];
+            sum3 += (row_in[7] + row_in[25]) * scaled_kernel[7];
+            sum0 += (row_in[8] + row_in[24]) * scaled_kernel[8];
+            sum1 += (row_in[9] + row_in[23]) * scaled_kernel[9];
+            sum2 += (row_in[10] + row_in[22]) * scaled_kernel[10];
+            sum3 += (row_in[11] + row_in[21]) * scaled_kernel[11];
+            sum0 += (row_in[12] + row_in[20]) * scaled_kernel[12];
+            sum1 += (row_in[13] + row_in[19]) * scaled_kernel[13];
+            sum2 += (row_in[14] + row_in[18]) * scaled_kernel[14];
+            sum3 += (row_in[15] + row_in[17]) * scaled_kernel[15];
+            const float sum = (row_in[16]) * scaled_kernel[16];
+            float* BUTTERAUGLI_RESTRICT row_out = out->Row(x);
+            row_out[y] = sum + sum0 + sum1 + sum2 + sum3;
+          }
         }
+        break;
       }
-      break;
+      default:
+        break;
+    }
+    // left border
+    for (size_t x = 0; x < border1; ++x) {
+      ConvolveBorderColumn(in, kernel, x, y_begin, y_end, out->Row(x));
     }
-    default:
-      return JPEGLI_UNREACHABLE("kernel size %d not implemented",
-                                static_cast<int>(len));
-  }
-  // left border
-  for (size_t x = 0; x < border1; ++x) {
-    ConvolveBorderColumn(in, kernel, x, out->Row(x));
-  }
 
-  // right border
-  for (size_t x = border2; x < in.xsize(); ++x) {
-    ConvolveBorderColumn(in, kernel, x, out->Row(x));
-  }
+    // right border
+    for (size_t x = border2; x < in.xsize(); ++x) {
+      ConvolveBorderColumn(in, kernel, x, y_begin, y_end, out->Row(x));
+    }
+    return true;
+  };
+  const uint32_t num_tasks = DivCeil(in.ysize(), kRowsPerTask);
+  JPEGLI_RETURN_IF_ERROR(RunOnPool(pool, 0, num_tasks, ThreadPool::NoInit,
+                                   process_band, "ConvolutionWithTranspose"));
   return true;
 }
 
@@ -232,7 +280,7 @@ Status ConvolutionWithTranspose(const ImageF& in,
 // optionally use gauss_blur followed by fixup of the borders for large images,
 // or fall back to the previous truncated FIR followed by a transpose.
 Status Blur(const ImageF& in, float sigma, const ButteraugliParams& params,
-            BlurTemp* temp, ImageF* out) {
+            BlurTemp* temp, ThreadPool* pool, ImageF* out) {
   std::vector<float> kernel = ComputeKernel(sigma);
   // Separable5 does an in-place convolution, so this fast path is not safe if
   // in aliases out.
@@ -250,14 +298,14 @@ Status Blur(const ImageF& in, float sigma, const ButteraugliParams& params,
         {HWY_REP4(w0), HWY_REP4(w1), HWY_REP4(w2)},
     };
     JPEGLI_RETURN_IF_ERROR(
-        Separable5(in, Rect(in), weights, /*pool=*/nullptr, out));
+        Separable5(in, Rect(in), weights, pool, out));
     return true;
   }
 
   ImageF* temp_t;
   JPEGLI_RETURN_IF_ERROR(temp->GetTransposed(in, &temp_t));
-  JPEGLI_RETURN_IF_ERROR(ConvolutionWithTranspose(in, kernel, temp_t));
-  JPEGLI_RETURN_IF_ERROR(ConvolutionWithTranspose(*temp_t, kernel, out));
+  JPEGLI_RETURN_IF_ERROR(ConvolutionWithTranspose(in, kernel, pool, temp_t));
+  JPEGLI_RETURN_IF_ERROR(ConvolutionWithTranspose(*temp_t, kernel, pool, out));
   return true;
 }
 
@@ -339,13 +387,13 @@ HWY_INLINE void XybLowFreqToVals(const D d, const V& x, const V& y,
   *valy = Mul(y, ymul);
 }
 
-void XybLowFreqToVals(Image3F* xyb_lf) {
+Status XybLowFreqToVals(ThreadPool* pool, Image3F* xyb_lf) {
   // Modify range around zero code only concerns the high frequency
   // planes and only the X and Y channels.
   // Convert low freq xyb to vals space so that we can do a simple squared sum
   // diff on the low frequencies later.
   const HWY_FULL(float) d;
-  for (size_t y = 0; y < xyb_lf->ysize(); ++y) {
+  const auto process_row = [&](const size_t y) {
     float* BUTTERAUGLI_RESTRICT row_x = xyb_lf->PlaneRow(0, y);
     float* BUTTERAUGLI_RESTRICT row_y = xyb_lf->PlaneRow(1, y);
     float* BUTTERAUGLI_RESTRICT row_b = xyb_lf->PlaneRow(2, y);
@@ -359,21 +407,23 @@ void XybLowFreqToVals(Image3F* xyb_lf) {
       Store(valy, d, row_y + x);
       Store(valb, d, row_b + x);
     }
-  }
+  };
+  return RunOnRows(pool, xyb_lf->ysize(), process_row, "XybLowFreqToVals");
 }
 
-Status SuppressXByY(const ImageF& in_y, ImageF* HWY_RESTRICT inout_x) {
+Status SuppressXByY(const ImageF& in_y, ThreadPool* pool,
+                    ImageF* HWY_RESTRICT inout_x) {
   JPEGLI_ENSURE(SameSize(*inout_x, in_y));
   const size_t xsize = in_y.xsize();
   const size_t ysize = in_y.ysize();
   const HWY_FULL(float) d;
   static const double suppress = 46.0;
   static const double s = 0.653020556257;
-  const auto sv = Set(d, s);
-  const auto one_minus_s = Set(d, 1.0 - s);
-  const auto ywv = Set(d, suppress);
 
-  for (size_t y = 0; y < ysize; ++y) {
+  const auto process_row = [&](const size_t y) {
+    const auto sv = Set(d, s);
+    const auto one_minus_s = Set(d, 1.0 - s);
+    const auto ywv = Set(d, suppress);
     const float* HWY_RESTRICT row_y = in_y.ConstRow(y);
     float* HWY_RESTRICT row_x = inout_x->Row(y);
     for (size_t x = 0; x < xsize; x += Lanes(d)) {
@@ -383,38 +433,42 @@ Status SuppressXByY(const ImageF& in_y, ImageF* HWY_RESTRICT inout_x) {
           MulAdd(Div(ywv, MulAdd(vy, vy, ywv)), one_minus_s, sv);
       Store(Mul(scaler, vx), d, row_x + x);
     }
-  }
-  return true;
+  };
+  return RunOnRows(pool, ysize, process_row, "SuppressXByY");
 }
 
-void Subtract(const ImageF& a, const ImageF& b, ImageF* c) {
+Status Subtract(const ImageF& a, const ImageF& b, ThreadPool* pool,
+                ImageF* c) {
   const HWY_FULL(float) d;
-  for (size_t y = 0; y < a.ysize(); ++y) {
+  const auto process_row = [&](const size_t y) {
     const float* row_a = a.ConstRow(y);
     const float* row_b = b.ConstRow(y);
     float* row_c = c->Row(y);
     for (size_t x = 0; x < a.xsize(); x += Lanes(d)) {
       Store(Sub(Load(d, row_a + x), Load(d, row_b + x)), d, row_c + x);
     }
-  }
+  };
+  return RunOnRows(pool, a.ysize(), process_row, "Subtract");
 }
 
 Status SeparateLFAndMF(const ButteraugliParams& params, const Image3F& xyb,
-                       Image3F* lf, Image3F* mf, BlurTemp* blur_temp) {
+                       Image3F* lf, Image3F* mf, BlurTemp* blur_temp,
+                       ThreadPool* pool) {
   static const double kSigmaLf = 7.15593339443;
   for (int i = 0; i < 3; ++i) {
     // Extract lf ...
     JPEGLI_RETURN_IF_ERROR(
-        Blur(xyb.Plane(i), kSigmaLf, params, blur_temp, &lf->Plane(i)));
+        Blur(xyb.Plane(i), kSigmaLf, params, blur_temp, pool, &lf->Plane(i)));
     // ... and keep everything else in mf.
-    Subtract(xyb.Plane(i), lf->Plane(i), &mf->Plane(i));
+    JPEGLI_RETURN_IF_ERROR(
+        Subtract(xyb.Plane(i), lf->Plane(i), pool, &mf->Plane(i)));
   }
-  XybLowFreqToVals(lf);
+  JPEGLI_RETURN_IF_ERROR(XybLowFreqToVals(pool, lf));
   return true;
 }
 
 Status SeparateMFAndHF(const ButteraugliParams& params, Image3F* mf, ImageF* hf,
-                       BlurTemp* blur_temp) {
+                       BlurTemp* blur_temp, ThreadPool* pool) {
   const HWY_FULL(float) d;
   static const double kSigmaHf = 3.22489901262;
   const size_t xsize = mf->xsize();
@@ -424,23 +478,24 @@ Status SeparateMFAndHF(const ButteraugliParams& params, Image3F* mf, ImageF* hf,
   JPEGLI_ASSIGN_OR_RETURN(hf[1], ImageF::Create(memory_manager, xsize, ysize));
   for (int i = 0; i < 3; ++i) {
     if (i == 2) {
-      JPEGLI_RETURN_IF_ERROR(
-          Blur(mf->Plane(i), kSigmaHf, params, blur_temp, &mf->Plane(i)));
+      JPEGLI_RETURN_IF_ERROR(Blur(mf->Plane(i), kSigmaHf, params, blur_temp,
+                                  pool, &mf->Plane(i)));
       break;
     }
-    for (size_t y = 0; y < ysize; ++y) {
+    const auto copy_row = [&](const size_t y) {
       float* BUTTERAUGLI_RESTRICT row_mf = mf->PlaneRow(i, y);
       float* BUTTERAUGLI_RESTRICT row_hf = hf[i].Row(y);
       for (size_t x = 0; x < xsize; x += Lanes(d)) {
         Store(Load(d, row_mf + x), d, row_hf + x);
       }
-    }
-    JPEGLI_RETURN_IF_ERROR(
-        Blur(mf->Plane(i), kSigmaHf, params, blur_temp, &mf->Plane(i)));
+    };
+    JPEGLI_RETURN_IF_ERROR(RunOnRows(pool, ysize, copy_row, "SeparateMFAndHF"));
+    JPEGLI_RETURN_IF_ERROR(Blur(mf->Plane(i), kSigmaHf, params, blur_temp,
+                                pool, &mf->Plane(i)));
     static const double kRemoveMfRange = 0.29;
     static const double kAddMfRange = 0.1;
     if (i == 0) {
-      for (size_t y = 0; y < ysize; ++y) {
+      const auto process_row = [&](const size_t y) {
         float* BUTTERAUGLI_RESTRICT row_mf = mf->PlaneRow(0, y);
         float* BUTTERAUGLI_RESTRICT row_hf = hf[0].Row(y);
         for (size_t x = 0; x < xsize; x += Lanes(d)) {
@@ -450,9 +505,11 @@ Status SeparateMFAndHF(const ButteraugliParams& params, Image3F* mf, ImageF* hf,
           Store(mfv, d, row_mf + x);
           Store(hfv, d, row_hf + x);
         }
-      }
+      };
+      JPEGLI_RETURN_IF_ERROR(
+          RunOnRows(pool, ysize, process_row, "SeparateMFAndHF"));
     } else {
-      for (size_t y = 0; y < ysize; ++y) {
+      const auto process_row = [&](const size_t y) {
         float* BUTTERAUGLI_RESTRICT row_mf = mf->PlaneRow(1, y);
         float* BUTTERAUGLI_RESTRICT row_hf = hf[1].Row(y);
         for (size_t x = 0; x < xsize; x += Lanes(d)) {
@@ -463,16 +520,18 @@ Status SeparateMFAndHF(const ButteraugliParams& params, Image3F* mf, ImageF* hf,
           Store(mfv, d, row_mf + x);
           Store(hfv, d, row_hf + x);
         }
-      }
+      };
+      JPEGLI_RETURN_IF_ERROR(
+          RunOnRows(pool, ysize, process_row, "SeparateMFAndHF"));
     }
   }
   // Suppress red-green by intensity change in the high freq channels.
-  JPEGLI_RETURN_IF_ERROR(SuppressXByY(hf[1], &hf[0]));
+  JPEGLI_RETURN_IF_ERROR(SuppressXByY(hf[1], pool, &hf[0]));
   return true;
 }
 
 Status SeparateHFAndUHF(const ButteraugliParams& params, ImageF* hf,
-                        ImageF* uhf, BlurTemp* blur_temp) {
+                        ImageF* uhf, BlurTemp* blur_temp, ThreadPool* pool) {
   const HWY_FULL(float) d;
   const size_t xsize = hf[0].xsize();
   const size_t ysize = hf[0].ysize();
@@ -482,14 +541,17 @@ Status SeparateHFAndUHF(const ButteraugliParams& params, ImageF* hf,
   JPEGLI_ASSIGN_OR_RETURN(uhf[1], ImageF::Create(memory_manager, xsize, ysize));
   for (int i = 0; i < 2; ++i) {
     // Divide hf into hf and uhf.
-    for (size_t y = 0; y < ysize; ++y) {
+    const auto copy_row = [&](const size_t y) {
       float* BUTTERAUGLI_RESTRICT row_uhf = uhf[i].Row(y);
       float* BUTTERAUGLI_RESTRICT row_hf = hf[i].Row(y);
       for (size_t x = 0; x < xsize; ++x) {
         row_uhf[x] = row_hf[x];
       }
-    }
-    JPEGLI_RETURN_IF_ERROR(Blur(hf[i], kSigmaUhf, params, blur_temp, &hf[i]));
+    };
+    JPEGLI_RETURN_IF_ERROR(
+        RunOnRows(pool, ysize, copy_row, "SeparateHFAndUHF"));
+    JPEGLI_RETURN_IF_ERROR(
+        Blur(hf[i], kSigmaUhf, params, blur_temp, pool, &hf[i]));
     static const double kRemoveHfRange = 1.5;
     static const double kAddHfRange = 0.132;
     static const double kRemoveUhfRange = 0.04;
@@ -498,7 +560,7 @@ Status SeparateHFAndUHF(const ButteraugliParams& params, ImageF* hf,
     static double kMulYHf = 2.155;
     static double kMulYUhf = 2.69313763794;
     if (i == 0) {
-      for (size_t y = 0; y < ysize; ++y) {
+      const auto process_row = [&](const size_t y) {
         float* BUTTERAUGLI_RESTRICT row_uhf = uhf[0].Row(y);
         float* BUTTERAUGLI_RESTRICT row_hf = hf[0].Row(y);
         for (size_t x = 0; x < xsize; x += Lanes(d)) {
@@ -509,9 +571,11 @@ Status SeparateHFAndUHF(const ButteraugliParams& params, ImageF* hf,
           Store(hfv, d, row_hf + x);
           Store(uhfv, d, row_uhf + x);
         }
-      }
+      };
+      JPEGLI_RETURN_IF_ERROR(
+          RunOnRows(pool, ysize, process_row, "SeparateHFAndUHF"));
     } else {
-      for (size_t y = 0; y < ysize; ++y) {
+      const auto process_row = [&](const size_t y) {
         float* BUTTERAUGLI_RESTRICT row_uhf = uhf[1].Row(y);
         float* BUTTERAUGLI_RESTRICT row_hf = hf[1].Row(y);
         for (size_t x = 0; x < xsize; x += Lanes(d)) {
@@ -527,7 +591,9 @@ Status SeparateHFAndUHF(const ButteraugliParams& params, ImageF* hf,
           hfv = AmplifyRangeAroundZero(d, kAddHfRange, hfv);
           Store(hfv, d, row_hf + x);
         }
-      }
+      };
+      JPEGLI_RETURN_IF_ERROR(
+          RunOnRows(pool, ysize, process_row, "SeparateHFAndUHF"));
     }
   }
   return true;
@@ -542,17 +608,19 @@ void DeallocateHFAndUHF(ImageF* hf, ImageF* uhf) {
 
 Status SeparateFrequencies(size_t xsize, size_t ysize,
                            const ButteraugliParams& params, BlurTemp* blur_temp,
-                           const Image3F& xyb, PsychoImage& ps) {
+                           ThreadPool* pool, const Image3F& xyb,
+                           PsychoImage& ps) {
   JpegliMemoryManager* memory_manager = xyb.memory_manager();
   JPEGLI_ASSIGN_OR_RETURN(
       ps.lf, Image3F::Create(memory_manager, xyb.xsize(), xyb.ysize()));
   JPEGLI_ASSIGN_OR_RETURN(
       ps.mf, Image3F::Create(memory_manager, xyb.xsize(), xyb.ysize()));
   JPEGLI_RETURN_IF_ERROR(
-      SeparateLFAndMF(params, xyb, &ps.lf, &ps.mf, blur_temp));
-  JPEGLI_RETURN_IF_ERROR(SeparateMFAndHF(params, &ps.mf, &ps.hf[0], blur_temp));
+      SeparateLFAndMF(params, xyb, &ps.lf, &ps.mf, blur_temp, pool));
+  JPEGLI_RETURN_IF_ERROR(
+      SeparateMFAndHF(params, &ps.mf, &ps.hf[0], blur_temp, pool));
   JPEGLI_RETURN_IF_ERROR(
-      SeparateHFAndUHF(params, &ps.hf[0], &ps.uhf[0], blur_temp));
+      SeparateHFAndUHF(params, &ps.hf[0], &ps.uhf[0], blur_temp, pool));
   return true;
 }
 
@@ -988,7 +1056,7 @@ static Status MaltaDiffMapT(const Tag tag, const ImageF& lum0,
                             const ImageF& lum1, const double w_0gt1,
                             const double w_0lt1, const double norm1,
                             const double len, const double mulli,
-                            ImageF* HWY_RESTRICT diffs,
+                            ThreadPool* pool, ImageF* HWY_RESTRICT diffs,
                             ImageF* HWY_RESTRICT block_diff_ac) {
   JPEGLI_ENSURE(SameSize(lum0, lum1) && SameSize(lum0, *diffs));
   const size_t xsize_ = lum0.xsize();
@@ -1002,7 +1070,7 @@ static Status MaltaDiffMapT(const Tag tag, const ImageF& lum0,
   const float norm2_0gt1 = w_pre0gt1 * norm1;
   const float norm2_0lt1 = w_pre0lt1 * norm1;
 
-  for (size_t y = 0; y < ysize_; ++y) {
+  const auto diffs_row = [&](const size_t y) {
     const float* HWY_RESTRICT row0 = lum0.ConstRow(y);
     const float* HWY_RESTRICT row1 = lum1.ConstRow(y);
     float* HWY_RESTRICT row_diffs = diffs->Row(y);
@@ -1039,25 +1107,27 @@ static Status MaltaDiffMapT(const Tag tag, const ImageF& lum0,
         }
       }
     }
-  }
-
-  size_t y0 = 0;
-  // Top
-  for (; y0 < 4; ++y0) {
-    float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->Row(y0);
-    for (size_t x0 = 0; x0 < xsize_; ++x0) {
-      row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
-    }
-  }
+  };
+  // The Malta units below read a 9x9 neighbourhood of diffs, so all rows of
+  // diffs have to be complete before the second pass starts.
+  JPEGLI_RETURN_IF_ERROR(RunOnRows(pool, ysize_, diffs_row, "MaltaDiffMap"));
 
   const HWY_FULL(float) df;
   const size_t aligned_x = std::max(static_cast<size_t>(4), Lanes(df));
   const ptrdiff_t stride = diffs->PixelsPerRow();
 
-  // Middle
-  for (; y0 < ysize_ - 4; ++y0) {
-    const float* BUTTERAUGLI_RESTRICT row_in = diffs->ConstRow(y0);
+  const auto malta_row = [&](const size_t y0) {
     float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->Row(y0);
+    // Top and bottom
+    if (y0 < 4 || y0 + 4 >= ysize_) {
+      for (size_t x0 = 0; x0 < xsize_; ++x0) {
+        row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
+      }
+      return;
+    }
+
+    // Middle
+    const float* BUTTERAUGLI_RESTRICT row_in = diffs->ConstRow(y0);
     size_t x0 = 0;
     for (; x0 < aligned_x; ++x0) {
       row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
@@ -1071,45 +1141,39 @@ static Status MaltaDiffMapT(const Tag tag, const ImageF& lum0,
     for (; x0 < xsize_; ++x0) {
       row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
     }
-  }
-
-  // Bottom
-  for (; y0 < ysize_; ++y0) {
-    float* BUTTERAUGLI_RESTRICT row_diff = block_diff_ac->Row(y0);
-    for (size_t x0 = 0; x0 < xsize_; ++x0) {
-      row_diff[x0] += PaddedMaltaUnit<Tag>(*diffs, x0, y0);
-    }
-  }
+  };
+  JPEGLI_RETURN_IF_ERROR(RunOnRows(pool, ysize_, malta_row, "MaltaDiffMap"));
   return true;
 }
 
 // Need non-template wrapper functions for HWY_EXPORT.
 Status MaltaDiffMap(const ImageF& lum0, const ImageF& lum1, const double w_0gt1,
-                    const double w_0lt1, const double norm1,
+                    const double w_0lt1, const double norm1, ThreadPool* pool,
                     ImageF* HWY_RESTRICT diffs,
                     ImageF* HWY_RESTRICT block_diff_ac) {
   const double len = 3.75;
   static const double mulli = 0.39905817637;
   JPEGLI_RETURN_IF_ERROR(MaltaDiffMapT(MaltaTag(), lum0, lum1, w_0gt1, w_0lt1,
-                                       norm1, len, mulli, diffs,
+                                       norm1, len, mulli, pool, diffs,
                                        block_diff_ac));
   return true;
 }
 
 Status MaltaDiffMapLF(const ImageF& lum0, const ImageF& lum1,
                       const double w_0gt1, const double w_0lt1,
-                      const double norm1, ImageF* HWY_RESTRICT diffs,
+                      const double norm1, ThreadPool* pool,
+                      ImageF* HWY_RESTRICT diffs,
                       ImageF* HWY_RESTRICT block_diff_ac) {
   const double len = 3.75;
   static const double mulli = 0.611612573796;
   JPEGLI_RETURN_IF_ERROR(MaltaDiffMapT(MaltaTagLF(), lum0, lum1, w_0gt1, w_0lt1,
-                                       norm1, len, mulli, diffs,
+                                       norm1, len, mulli, pool, diffs,
                                        block_diff_ac));
   return true;
 }
 
-void CombineChannelsForMasking(const ImageF* hf, const ImageF* uhf,
-                               ImageF* out) {
+Status CombineChannelsForMasking(const ImageF* hf, const ImageF* uhf,
+                                 ThreadPool* pool, ImageF* out) {
   // Only X and Y components are involved in masking. B's influence
   // is considered less important in the high frequency area, and we
   // don't model masking from lower frequency signals.
@@ -1119,7 +1183,7 @@ void CombineChannelsForMasking(const ImageF* hf, const ImageF* uhf,
       0.4f,
   };
   // Silly and unoptimized approach here. TODO(jyrki): rework this.
-  for (size_t y = 0; y < hf[0].ysize(); ++y) {
+  const auto process_row = [&](const size_t y) {
     const float* BUTTERAUGLI_RESTRICT row_y_hf = hf[1].Row(y);
     const float* BUTTERAUGLI_RESTRICT row_y_uhf = uhf[1].Row(y);
     const float* BUTTERAUGLI_RESTRICT row_x_hf = hf[0].Row(y);
@@ -1131,22 +1195,26 @@ void CombineChannelsForMasking(const ImageF* hf, const ImageF* uhf,
       row[x] = xdiff * xdiff + ydiff * ydiff;
       row[x] = std::sqrt(row[x]);
     }
-  }
+  };
+  return RunOnRows(pool, hf[0].ysize(), process_row,
+                   "CombineChannelsForMasking");
 }
 
-void DiffPrecompute(const ImageF& xyb, float mul, float bias_arg, ImageF* out) {
+Status DiffPrecompute(const ImageF& xyb, float mul, float bias_arg,
+                      ThreadPool* pool, ImageF* out) {
   const size_t xsize = xyb.xsize();
   const size_t ysize = xyb.ysize();
   const float bias = mul * bias_arg;
   const float sqrt_bias = std::sqrt(bias);
-  for (size_t y = 0; y < ysize; ++y) {
+  const auto process_row = [&](const size_t y) {
     const float* BUTTERAUGLI_RESTRICT row_in = xyb.Row(y);
     float* BUTTERAUGLI_RESTRICT row_out = out->Row(y);
     for (size_t x = 0; x < xsize; ++x) {
       // kBias makes sqrt behave more linearly.
       row_out[x] = std::sqrt(mul * std::abs(row_in[x]) + bias) - sqrt_bias;
     }
-  }
+  };
+  return RunOnRows(pool, ysize, process_row, "DiffPrecompute");
 }
 
 // std::log(80.0) / std::log(255.0);
@@ -1172,11 +1240,11 @@ void StoreMin3(const float v, float& min0, float& min1, float& min2) {
 
 // Look for smooth areas near the area of degradation.
 // If the areas area generally smooth, don't do masking.
-void FuzzyErosion(const ImageF& from, ImageF* to) {
+Status FuzzyErosion(const ImageF& from, ThreadPool* pool, ImageF* to) {
   const size_t xsize = from.xsize();
   const size_t ysize = from.ysize();
   static const int kStep = 3;
-  for (size_t y = 0; y < ysize; ++y) {
+  const auto process_row = [&](const size_t y) {
     for (size_t x = 0; x < xsize; ++x) {
       float min0 = from.Row(y)[x];
       float min1 = 2 * min0;
@@ -1207,14 +1275,15 @@ void FuzzyErosion(const ImageF& from, ImageF* to) {
       }
       to->Row(y)[x] = (0.45f * min0 + 0.3f * min1 + 0.25f * min2);
     }
-  }
+  };
+  return RunOnRows(pool, ysize, process_row, "FuzzyErosion");
 }
 
 // Compute values of local frequency and dc masking based on the activity
 // in the two images. img_diff_ac may be null.
 Status Mask(const ImageF& mask0, const ImageF& mask1,
             const ButteraugliParams& params, BlurTemp* blur_temp,
-            ImageF* BUTTERAUGLI_RESTRICT mask,
+            ThreadPool* pool, ImageF* BUTTERAUGLI_RESTRICT mask,
             ImageF* BUTTERAUGLI_RESTRICT diff_ac) {
   const size_t xsize = mask0.xsize();
   const size_t ysize = mask0.ysize();
@@ -1231,12 +1300,14 @@ Status Mask(const ImageF& mask0, const ImageF& mask1,
                           ImageF::Create(memory_manager, xsize, ysize));
   JPEGLI_ASSIGN_OR_RETURN(ImageF blurred1,
                           ImageF::Create(memory_manager, xsize, ysize));
-  DiffPrecompute(mask0, kMul, kBias, &diff0);
-  DiffPrecompute(mask1, kMul, kBias, &diff1);
-  JPEGLI_RETURN_IF_ERROR(Blur(diff0, kRadius, params, blur_temp, &blurred0));
-  FuzzyErosion(blurred0, &diff0);
-  JPEGLI_RETURN_IF_ERROR(Blur(diff1, kRadius, params, blur_temp, &blurred1));
-  for (size_t y = 0; y < ysize; ++y) {
+  JPEGLI_RETURN_IF_ERROR(DiffPrecompute(mask0, kMul, kBias, pool, &diff0));
+  JPEGLI_RETURN_IF_ERROR(DiffPrecompute(mask1, kMul, kBias, pool, &diff1));
+  JPEGLI_RETURN_IF_ERROR(
+      Blur(diff0, kRadius, params, blur_temp, pool, &blurred0));
+  JPEGLI_RETURN_IF_ERROR(FuzzyErosion(blurred0, pool, &diff0));
+  JPEGLI_RETURN_IF_ERROR(
+      Blur(diff1, kRadius, params, blur_temp, pool, &blurred1));
+  const auto process_row = [&](const size_t y) {
     for (size_t x = 0; x < xsize; ++x) {
       mask->Row(y)[x] = diff0.Row(y)[x];
       if (diff_ac != nullptr) {
@@ -1245,24 +1316,27 @@ Status Mask(const ImageF& mask0, const ImageF& mask1,
         diff_ac->Row(y)[x] += kMaskToErrorMul * diff * diff;
       }
     }
-  }
-  return true;
+  };
+  return RunOnRows(pool, ysize, process_row, "Mask");
 }
 
 // `diff_ac` may be null.
 Status MaskPsychoImage(const PsychoImage& pi0, const PsychoImage& pi1,
                        const size_t xsize, const size_t ysize,
                        const ButteraugliParams& params, BlurTemp* blur_temp,
-                       ImageF* BUTTERAUGLI_RESTRICT mask,
+                       ThreadPool* pool, ImageF* BUTTERAUGLI_RESTRICT mask,
                        ImageF* BUTTERAUGLI_RESTRICT diff_ac) {
   JpegliMemoryManager* memory_manager = pi0.hf[0].memory_manager();
   JPEGLI_ASSIGN_OR_RETURN(ImageF mask0,
                           ImageF::Create(memory_manager, xsize, ysize));
   JPEGLI_ASSIGN_OR_RETURN(ImageF mask1,
                           ImageF::Create(memory_manager, xsize, ysize));
-  CombineChannelsForMasking(&pi0.hf[0], &pi0.uhf[0], &mask0);
-  CombineChannelsForMasking(&pi1.hf[0], &pi1.uhf[0], &mask1);
-  JPEGLI_RETURN_IF_ERROR(Mask(mask0, mask1, params, blur_temp, mask, diff_ac));
+  JPEGLI_RETURN_IF_ERROR(
+      CombineChannelsForMasking(&pi0.hf[0], &pi0.uhf[0], pool, &mask0));
+  JPEGLI_RETURN_IF_ERROR(
+      CombineChannelsForMasking(&pi1.hf[0], &pi1.uhf[0], pool, &mask1));
+  JPEGLI_RETURN_IF_ERROR(
+      Mask(mask0, mask1, params, blur_temp, pool, mask, diff_ac));
   return true;
 }
 
@@ -1292,11 +1366,11 @@ inline float MaskColor(const float color[3], const float mask) {
 Status CombineChannelsToDiffmap(const ImageF& mask,
                                 const Image3F& block_diff_dc,
                                 const Image3F& block_diff_ac, float xmul,
-                                ImageF* result) {
+                                ThreadPool* pool, ImageF* result) {
   JPEGLI_ENSURE(SameSize(mask, *result));
   size_t xsize = mask.xsize();
   size_t ysize = mask.ysize();
-  for (size_t y = 0; y < ysize; ++y) {
+  const auto process_row = [&](const size_t y) {
     float* BUTTERAUGLI_RESTRICT row_out = result->Row(y);
     for (size_t x = 0; x < xsize; ++x) {
       float val = mask.Row(y)[x];
@@ -1313,19 +1387,19 @@ Status CombineChannelsToDiffmap(const ImageF& mask,
       row_out[x] = std::sqrt(MaskColor(diff_dc, dc_maskval) +
                              MaskColor(diff_ac, maskval));
     }
-  }
-  return true;
+  };
+  return RunOnRows(pool, ysize, process_row, "CombineChannelsToDiffmap");
 }
 
 // Adds weighted L2 difference between i0 and i1 to diffmap.
-static void L2Diff(const ImageF& i0, const ImageF& i1, const float w,
-                   ImageF* BUTTERAUGLI_RESTRICT diffmap) {
-  if (w == 0) return;
+static Status L2Diff(const ImageF& i0, const ImageF& i1, const float w,
+                     ThreadPool* pool, ImageF* BUTTERAUGLI_RESTRICT diffmap) {
+  if (w == 0) return true;
 
   const HWY_FULL(float) d;
-  const auto weight = Set(d, w);
 
-  for (size_t y = 0; y < i0.ysize(); ++y) {
+  const auto process_row = [&](const size_t y) {
+    const auto weight = Set(d, w);
     const float* BUTTERAUGLI_RESTRICT row0 = i0.ConstRow(y);
     const float* BUTTERAUGLI_RESTRICT row1 = i1.ConstRow(y);
     float* BUTTERAUGLI_RESTRICT row_diff = diffmap->Row(y);
@@ -1336,18 +1410,20 @@ static void L2Diff(const ImageF& i0, const ImageF& i1, const float w,
       const auto prev = Load(d, row_diff + x);
       Store(MulAdd(diff2, weight, prev), d, row_diff + x);
     }
-  }
+  };
+  return RunOnRows(pool, i0.ysize(), process_row, "L2Diff");
 }
 
 // Initializes diffmap to the weighted L2 difference between i0 and i1.
-static void SetL2Diff(const ImageF& i0, const ImageF& i1, const float w,
-                      ImageF* BUTTERAUGLI_RESTRICT diffmap) {
-  if (w == 0) return;
+static Status SetL2Diff(const ImageF& i0, const ImageF& i1, const float w,
+                        ThreadPool* pool,
+                        ImageF* BUTTERAUGLI_RESTRICT diffmap) {
+  if (w == 0) return true;
 
   const HWY_FULL(float) d;
-  const auto weight = Set(d, w);
 
-  for (size_t y = 0; y < i0.ysize(); ++y) {
+  const auto process_row = [&](const size_t y) {
+    const auto weight = Set(d, w);
     const float* BUTTERAUGLI_RESTRICT row0 = i0.ConstRow(y);
     const float* BUTTERAUGLI_RESTRICT row1 = i1.ConstRow(y);
     float* BUTTERAUGLI_RESTRICT row_diff = diffmap->Row(y);
@@ -1357,23 +1433,24 @@ static void SetL2Diff(const ImageF& i0, const ImageF& i1, const float w,
       const auto diff2 = Mul(diff, diff);
       Store(Mul(diff2, weight), d, row_diff + x);
     }
-  }
+  };
+  return RunOnRows(pool, i0.ysize(), process_row, "SetL2Diff");
 }
 
 // i0 is the original image.
 // i1 is the deformed copy.
-static void L2DiffAsymmetric(const ImageF& i0, const ImageF& i1, float w_0gt1,
-                             float w_0lt1,
-                             ImageF* BUTTERAUGLI_RESTRICT diffmap) {
+static Status L2DiffAsymmetric(const ImageF& i0, const ImageF& i1,
+                               float w_0gt1, float w_0lt1, ThreadPool* pool,
+                               ImageF* BUTTERAUGLI_RESTRICT diffmap) {
   if (w_0gt1 == 0 && w_0lt1 == 0) {
-    return;
+    return true;
   }
 
   const HWY_FULL(float) d;
-  const auto vw_0gt1 = Set(d, w_0gt1 * 0.8);
-  const auto vw_0lt1 = Set(d, w_0lt1 * 0.8);
 
-  for (size_t y = 0; y < i0.ysize(); ++y) {
+  const auto process_row = [&](const size_t y) {
+    const auto vw_0gt1 = Set(d, w_0gt1 * 0.8);
+    const auto vw_0lt1 = Set(d, w_0lt1 * 0.8);
     const float* BUTTERAUGLI_RESTRICT row0 = i0.Row(y);
     const float* BUTTERAUGLI_RESTRICT row1 = i1.Row(y);
     float* BUTTERAUGLI_RESTRICT row_diff = diffmap->Row(y);
@@ -1401,7 +1478,8 @@ static void L2DiffAsymmetric(const ImageF& i0, const ImageF& i1, float w_0gt1,
       total = MulAdd(vw_0lt1, Mul(v, v), total);
       Store(total, d, row_diff + x);
     }
-  }
+  };
+  return RunOnRows(pool, i0.ysize(), process_row, "L2DiffAsymmetric");
 }
 
 // A simple HDR compatible gamma function.
@@ -1467,18 +1545,17 @@ BUTTERAUGLI_INLINE void OpsinAbsorbance(const DF df, const V& in0, const V& in1,
 
 // `blurred` is a temporary image used inside this function and not returned.
 Status OpsinDynamicsImage(const Image3F& rgb, const ButteraugliParams& params,
-                          Image3F* blurred, BlurTemp* blur_temp, Image3F* xyb) {
+                          Image3F* blurred, BlurTemp* blur_temp,
+                          ThreadPool* pool, Image3F* xyb) {
   JPEGLI_ENSURE(blurred != nullptr);
   const double kSigma = 1.2;
-  JPEGLI_RETURN_IF_ERROR(
-      Blur(rgb.Plane(0), kSigma, params, blur_temp, &blurred->Plane(0)));
-  JPEGLI_RETURN_IF_ERROR(
-      Blur(rgb.Plane(1), kSigma, params, blur_temp, &blurred->Plane(1)));
-  JPEGLI_RETURN_IF_ERROR(
-      Blur(rgb.Plane(2), kSigma, params, blur_temp, &blurred->Plane(2)));
+  for (size_t c = 0; c < 3; ++c) {
+    JPEGLI_RETURN_IF_ERROR(Blur(rgb.Plane(c), kSigma, params, blur_temp, pool,
+                                &blurred->Plane(c)));
+  }
   const HWY_FULL(float) df;
-  const auto intensity_target_multiplier = Set(df, params.intensity_target);
-  for (size_t y = 0; y < rgb.ysize(); ++y) {
+  const auto process_row = [&](const size_t y) {
+    const auto intensity_target_multiplier = Set(df, params.intensity_target);
     const float* row_r = rgb.ConstPlaneRow(0, y);
     const float* row_g = rgb.ConstPlaneRow(1, y);
     const float* row_b = rgb.ConstPlaneRow(2, y);
@@ -1536,13 +1613,13 @@ Status OpsinDynamicsImage(const Image3F& rgb, const ButteraugliParams& params,
       Store(Add(cur_mixed0, cur_mixed1), df, row_out_y + x);
       Store(cur_mixed2, df, row_out_b + x);
     }
-  }
-  return true;
+  };
+  return RunOnRows(pool, rgb.ysize(), process_row, "OpsinDynamicsImage");
 }
 
 Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
                                  const ButteraugliParams& params,
-                                 ImageF& diffmap) {
+                                 ThreadPool* pool, ImageF& diffmap) {
   // image0 and image1 are in linear sRGB color space
   const size_t xsize = image0.xsize();
   const size_t ysize = image0.ysize();
@@ -1553,9 +1630,9 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
     JPEGLI_ASSIGN_OR_RETURN(Image3F temp,
                             Image3F::Create(memory_manager, xsize, ysize));
     JPEGLI_RETURN_IF_ERROR(
-        OpsinDynamicsImage(image0, params, &temp, &blur_temp, &image0));
+        OpsinDynamicsImage(image0, params, &temp, &blur_temp, pool, &image0));
     JPEGLI_RETURN_IF_ERROR(
-        OpsinDynamicsImage(image1, params, &temp, &blur_temp, &image1));
+        OpsinDynamicsImage(image1, params, &temp, &blur_temp, pool, &image1));
   }
   // image0 and image1 are in XYB color space
   JPEGLI_ASSIGN_OR_RETURN(ImageF block_diff_dc,
@@ -1569,18 +1646,21 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
     JPEGLI_ASSIGN_OR_RETURN(Image3F lf1,
                             Image3F::Create(memory_manager, xsize, ysize));
     JPEGLI_RETURN_IF_ERROR(
-        SeparateLFAndMF(params, image0, &lf0, &image0, &blur_temp));
+        SeparateLFAndMF(params, image0, &lf0, &image0, &blur_temp, pool));
     JPEGLI_RETURN_IF_ERROR(
-        SeparateLFAndMF(params, image1, &lf1, &image1, &blur_temp));
+        SeparateLFAndMF(params, image1, &lf1, &image1, &blur_temp, pool));
     for (size_t c = 0; c < 3; ++c) {
-      L2Diff(lf0.Plane(c), lf1.Plane(c), wmul[6 + c], &block_diff_dc);
+      JPEGLI_RETURN_IF_ERROR(L2Diff(lf0.Plane(c), lf1.Plane(c), wmul[6 + c],
+                                    pool, &block_diff_dc));
     }
   }
   // image0 and image1 are MF residuals (before blurring) in XYB color space
   ImageF hf0[2];
   ImageF hf1[2];
-  JPEGLI_RETURN_IF_ERROR(SeparateMFAndHF(params, &image0, &hf0[0], &blur_temp));
-  JPEGLI_RETURN_IF_ERROR(SeparateMFAndHF(params, &image1, &hf1[0], &blur_temp));
+  JPEGLI_RETURN_IF_ERROR(
+      SeparateMFAndHF(params, &image0, &hf0[0], &blur_temp, pool));
+  JPEGLI_RETURN_IF_ERROR(
+      SeparateMFAndHF(params, &image1, &hf1[0], &blur_temp, pool));
   // image0 and image1 are MF-images in XYB color space
 
   JPEGLI_ASSIGN_OR_RETURN(ImageF block_diff_ac,
@@ -1591,14 +1671,15 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
     JPEGLI_ASSIGN_OR_RETURN(ImageF diffs,
                             ImageF::Create(memory_manager, xsize, ysize));
     JPEGLI_RETURN_IF_ERROR(MaltaDiffMapLF(image0.Plane(1), image1.Plane(1),
-                                          wMfMalta, wMfMalta, norm1Mf, &diffs,
-                                          &block_diff_ac));
+                                          wMfMalta, wMfMalta, norm1Mf, pool,
+                                          &diffs, &block_diff_ac));
     JPEGLI_RETURN_IF_ERROR(MaltaDiffMapLF(image0.Plane(0), image1.Plane(0),
-                                          wMfMaltaX, wMfMaltaX, norm1MfX,
+                                          wMfMaltaX, wMfMaltaX, norm1MfX, pool,
                                           &diffs, &block_diff_ac));
   }
   for (size_t c = 0; c < 3; ++c) {
-    L2Diff(image0.Plane(c), image1.Plane(c), wmul[3 + c], &block_diff_ac);
+    JPEGLI_RETURN_IF_ERROR(L2Diff(image0.Plane(c), image1.Plane(c),
+                                  wmul[3 + c], pool, &block_diff_ac));
   }
   // we will not need the MF-images and more, so we deallocate them to reduce
   // peak memory usage
@@ -1608,9 +1689,9 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
   ImageF uhf0[2];
   ImageF uhf1[2];
   JPEGLI_RETURN_IF_ERROR(
-      SeparateHFAndUHF(params, &hf0[0], &uhf0[0], &blur_temp));
+      SeparateHFAndUHF(params, &hf0[0], &uhf0[0], &blur_temp, pool));
   JPEGLI_RETURN_IF_ERROR(
-      SeparateHFAndUHF(params, &hf1[0], &uhf1[0], &blur_temp));
+      SeparateHFAndUHF(params, &hf1[0], &uhf1[0], &blur_temp, pool));
 
   // continue accumulating ac diff image from HF and UHF images
   const float hf_asymmetry = params.hf_asymmetry;
@@ -1619,20 +1700,23 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
                             ImageF::Create(memory_manager, xsize, ysize));
     JPEGLI_RETURN_IF_ERROR(MaltaDiffMap(
         uhf0[1], uhf1[1], wUhfMalta * hf_asymmetry, wUhfMalta / hf_asymmetry,
-        norm1Uhf, &diffs, &block_diff_ac));
+        norm1Uhf, pool, &diffs, &block_diff_ac));
     JPEGLI_RETURN_IF_ERROR(MaltaDiffMap(
         uhf0[0], uhf1[0], wUhfMaltaX * hf_asymmetry, wUhfMaltaX / hf_asymmetry,
-        norm1UhfX, &diffs, &block_diff_ac));
+        norm1UhfX, pool, &diffs, &block_diff_ac));
     JPEGLI_RETURN_IF_ERROR(MaltaDiffMapLF(
         hf0[1], hf1[1], wHfMalta * std::sqrt(hf_asymmetry),
-        wHfMalta / std::sqrt(hf_asymmetry), norm1Hf, &diffs, &block_diff_ac));
+        wHfMalta / std::sqrt(hf_asymmetry), norm1Hf, pool, &diffs,
+        &block_diff_ac));
     JPEGLI_RETURN_IF_ERROR(MaltaDiffMapLF(
         hf0[0], hf1[0], wHfMaltaX * std::sqrt(hf_asymmetry),
-        wHfMaltaX / std::sqrt(hf_asymmetry), norm1HfX, &diffs, &block_diff_ac));
+        wHfMaltaX / std::sqrt(hf_asymmetry), norm1HfX, pool, &diffs,
+        &block_diff_ac));
   }
   for (size_t c = 0; c < 2; ++c) {
-    L2DiffAsymmetric(hf0[c], hf1[c], wmul[c] * hf_asymmetry,
-                     wmul[c] / hf_asymmetry, &block_diff_ac);
+    JPEGLI_RETURN_IF_ERROR(L2DiffAsymmetric(
+        hf0[c], hf1[c], wmul[c] * hf_asymmetry, wmul[c] / hf_asymmetry, pool,
+        &block_diff_ac));
   }
 
   // compute mask image from HF and UHF X and Y images
@@ -1643,18 +1727,20 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
                             ImageF::Create(memory_manager, xsize, ysize));
     JPEGLI_ASSIGN_OR_RETURN(ImageF mask1,
                             ImageF::Create(memory_manager, xsize, ysize));
-    CombineChannelsForMasking(&hf0[0], &uhf0[0], &mask0);
-    CombineChannelsForMasking(&hf1[0], &uhf1[0], &mask1);
+    JPEGLI_RETURN_IF_ERROR(
+        CombineChannelsForMasking(&hf0[0], &uhf0[0], pool, &mask0));
+    JPEGLI_RETURN_IF_ERROR(
+        CombineChannelsForMasking(&hf1[0], &uhf1[0], pool, &mask1));
     DeallocateHFAndUHF(&hf1[0], &uhf1[0]);
     DeallocateHFAndUHF(&hf0[0], &uhf0[0]);
     JPEGLI_RETURN_IF_ERROR(
-        Mask(mask0, mask1, params, &blur_temp, &mask, &block_diff_ac));
+        Mask(mask0, mask1, params, &blur_temp, pool, &mask, &block_diff_ac));
   }
 
   // compute final diffmap from mask image and ac and dc diff images
   JPEGLI_ASSIGN_OR_RETURN(diffmap,
                           ImageF::Create(memory_manager, xsize, ysize));
-  for (size_t y = 0; y < ysize; ++y) {
+  const auto process_row = [&](const size_t y) {
     const float* row_dc = block_diff_dc.Row(y);
     const float* row_ac = block_diff_ac.Row(y);
     float* row_out = diffmap.Row(y);
@@ -1662,8 +1748,8 @@ Status ButteraugliDiffmapInPlace(Image3F& image0, Image3F& image1,
       const float val = mask.Row(y)[x];
       row_out[x] = sqrt(row_dc[x] * MaskDcY(val) + row_ac[x] * MaskY(val));
     }
-  }
-  return true;
+  };
+  return RunOnRows(pool, ysize, process_row, "ButteraugliDiffmapInPlace");
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -1791,17 +1877,18 @@ Image3F* ButteraugliComparator::Temp() const {
 void ButteraugliComparator::ReleaseTemp() const { temp_in_use_.clear(); }
 
 ButteraugliComparator::ButteraugliComparator(size_t xsize, size_t ysize,
-                                             const ButteraugliParams& params)
-    : xsize_(xsize), ysize_(ysize), params_(params) {}
+                                             const ButteraugliParams& params,
+                                             ThreadPool* pool)
+    : xsize_(xsize), ysize_(ysize), params_(params), pool_(pool) {}
 
 StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Make(
-    const Image3F& rgb0, const ButteraugliParams& params) {
+    const Image3F& rgb0, const ButteraugliParams& params, ThreadPool* pool) {
   size_t xsize = rgb0.xsize();
   size_t ysize = rgb0.ysize();
   JpegliMemoryManager* memory_manager = rgb0.memory_manager();
   std::unique_ptr<ButteraugliComparator> result =
       std::unique_ptr<ButteraugliComparator>(
-          new ButteraugliComparator(xsize, ysize, params));
+          new ButteraugliComparator(xsize, ysize, params, pool));
   JPEGLI_ASSIGN_OR_RETURN(result->temp_,
                           Image3F::Create(memory_manager, xsize, ysize));
 
@@ -1811,24 +1898,42 @@ StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Make(
 
   JPEGLI_ASSIGN_OR_RETURN(Image3F xyb0,
                           Image3F::Create(memory_manager, xsize, ysize));
-  JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(
-      rgb0, params, result->Temp(), &result->blur_temp_, &xyb0));
-  result->ReleaseTemp();
+  JPEGLI_RETURN_IF_ERROR(result->ComputeOpsinDynamicsImage(rgb0, &xyb0));
+  BlurTemp blur_temp;
   JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(SeparateFrequencies)(
-      xsize, ysize, params, &result->blur_temp_, xyb0, result->pi0_));
+      xsize, ysize, params, &blur_temp, pool, xyb0, result->pi0_));
 
   // Awful recursive construction of samples of different resolution.
   // This is an after-thought and possibly somewhat parallel in
   // functionality with the PsychoImage multi-resolution approach.
   JPEGLI_ASSIGN_OR_RETURN(Image3F subsampledRgb0, SubSample2x(rgb0));
-  JPEGLI_ASSIGN_OR_RETURN(result->sub_,
-                          ButteraugliComparator::Make(subsampledRgb0, params));
+  JPEGLI_ASSIGN_OR_RETURN(
+      result->sub_, ButteraugliComparator::Make(subsampledRgb0, params, pool));
   return result;
 }
 
+Status ButteraugliComparator::ComputeOpsinDynamicsImage(const Image3F& rgb,
+                                                        Image3F* xyb) const {
+  Image3F* blurred = Temp();
+  Image3F own_blurred;
+  if (blurred == nullptr) {
+    // Another Diffmap() call is using the shared temporary image.
+    JPEGLI_ASSIGN_OR_RETURN(
+        own_blurred,
+        Image3F::Create(rgb.memory_manager(), rgb.xsize(), rgb.ysize()));
+    blurred = &own_blurred;
+  }
+  BlurTemp blur_temp;
+  Status status = HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(
+      rgb, params_, blurred, &blur_temp, pool_, xyb);
+  if (blurred == &temp_) ReleaseTemp();
+  return status;
+}
+
 Status ButteraugliComparator::Mask(ImageF* BUTTERAUGLI_RESTRICT mask) const {
+  BlurTemp blur_temp;
   return HWY_DYNAMIC_DISPATCH(MaskPsychoImage)(
-      pi0_, pi0_, xsize_, ysize_, params_, &blur_temp_, mask, nullptr);
+      pi0_, pi0_, xsize_, ysize_, params_, &blur_temp, pool_, mask, nullptr);
 }
 
 Status ButteraugliComparator::Diffmap(const Image3F& rgb1,
@@ -1840,9 +1945,7 @@ Status ButteraugliComparator::Diffmap(const Image3F& rgb1,
   }
   JPEGLI_ASSIGN_OR_RETURN(Image3F xyb1,
                           Image3F::Create(memory_manager, xsize_, ysize_));
-  JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(
-      rgb1, params_, Temp(), &blur_temp_, &xyb1));
-  ReleaseTemp();
+  JPEGLI_RETURN_IF_ERROR(ComputeOpsinDynamicsImage(rgb1, &xyb1));
   JPEGLI_RETURN_IF_ERROR(DiffmapOpsinDynamicsImage(xyb1, result));
   if (sub_) {
     if (sub_->xsize_ < 8 || sub_->ysize_ < 8) {
@@ -1852,9 +1955,8 @@ Status ButteraugliComparator::Diffmap(const Image3F& rgb1,
         Image3F sub_xyb,
         Image3F::Create(memory_manager, sub_->xsize_, sub_->ysize_));
     JPEGLI_ASSIGN_OR_RETURN(Image3F subsampledRgb1, SubSample2x(rgb1));
-    JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(OpsinDynamicsImage)(
-        subsampledRgb1, params_, sub_->Temp(), &sub_->blur_temp_, &sub_xyb));
-    sub_->ReleaseTemp();
+    JPEGLI_RETURN_IF_ERROR(
+        sub_->ComputeOpsinDynamicsImage(subsampledRgb1, &sub_xyb));
     ImageF subresult;
     JPEGLI_RETURN_IF_ERROR(sub_->DiffmapOpsinDynamicsImage(sub_xyb, subresult));
     AddSupersampled2x(subresult, 0.5, result);
@@ -1870,8 +1972,9 @@ Status ButteraugliComparator::DiffmapOpsinDynamicsImage(const Image3F& xyb1,
     return true;
   }
   PsychoImage pi1;
+  BlurTemp blur_temp;
   JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(SeparateFrequencies)(
-      xsize_, ysize_, params_, &blur_temp_, xyb1, pi1));
+      xsize_, ysize_, params_, &blur_temp, pool_, xyb1, pi1));
   JPEGLI_ASSIGN_OR_RETURN(result,
                           ImageF::Create(memory_manager, xsize_, ysize_));
   return DiffmapPsychoImage(pi1, result);
@@ -1880,19 +1983,22 @@ Status ButteraugliComparator::DiffmapOpsinDynamicsImage(const Image3F& xyb1,
 namespace {
 
 Status MaltaDiffMap(const ImageF& lum0, const ImageF& lum1, const double w_0gt1,
-                    const double w_0lt1, const double norm1,
+                    const double w_0lt1, const double norm1, ThreadPool* pool,
                     ImageF* HWY_RESTRICT diffs,
                     Image3F* HWY_RESTRICT block_diff_ac, size_t c) {
   return HWY_DYNAMIC_DISPATCH(MaltaDiffMap)(lum0, lum1, w_0gt1, w_0lt1, norm1,
-                                            diffs, &block_diff_ac->Plane(c));
+                                            pool, diffs,
+                                            &block_diff_ac->Plane(c));
 }
 
 Status MaltaDiffMapLF(const ImageF& lum0, const ImageF& lum1,
                       const double w_0gt1, const double w_0lt1,
-                      const double norm1, ImageF* HWY_RESTRICT diffs,
+                      const double norm1, ThreadPool* pool,
+                      ImageF* HWY_RESTRICT diffs,
                       Image3F* HWY_RESTRICT block_diff_ac, size_t c) {
   return HWY_DYNAMIC_DISPATCH(MaltaDiffMapLF)(lum0, lum1, w_0gt1, w_0lt1, norm1,
-                                              diffs, &block_diff_ac->Plane(c));
+                                              pool, diffs,
+                                              &block_diff_ac->Plane(c));
 }
 
 }  // namespace
@@ -1915,45 +2021,49 @@ Status ButteraugliComparator::DiffmapPsychoImage(const PsychoImage& pi1,
   ZeroFillImage(&block_diff_ac);
   JPEGLI_RETURN_IF_ERROR(MaltaDiffMap(
       pi0_.uhf[1], pi1.uhf[1], wUhfMalta * hf_asymmetry_,
-      wUhfMalta / hf_asymmetry_, norm1Uhf, &diffs, &block_diff_ac, 1));
+      wUhfMalta / hf_asymmetry_, norm1Uhf, pool_, &diffs, &block_diff_ac, 1));
   JPEGLI_RETURN_IF_ERROR(MaltaDiffMap(
       pi0_.uhf[0], pi1.uhf[0], wUhfMaltaX * hf_asymmetry_,
-      wUhfMaltaX / hf_asymmetry_, norm1UhfX, &diffs, &block_diff_ac, 0));
+      wUhfMaltaX / hf_asymmetry_, norm1UhfX, pool_, &diffs, &block_diff_ac, 0));
   JPEGLI_RETURN_IF_ERROR(MaltaDiffMapLF(
       pi0_.hf[1], pi1.hf[1], wHfMalta * std::sqrt(hf_asymmetry_),
-      wHfMalta / std::sqrt(hf_asymmetry_), norm1Hf, &diffs, &block_diff_ac, 1));
-  JPEGLI_RETURN_IF_ERROR(MaltaDiffMapLF(pi0_.hf[0], pi1.hf[0],
-                                        wHfMaltaX * std::sqrt(hf_asymmetry_),
-                                        wHfMaltaX / std::sqrt(hf_asymmetry_),
-                                        norm1HfX, &diffs, &block_diff_ac, 0));
+      wHfMalta / std::sqrt(hf_asymmetry_), norm1Hf, pool_, &diffs,
+      &block_diff_ac, 1));
+  JPEGLI_RETURN_IF_ERROR(MaltaDiffMapLF(
+      pi0_.hf[0], pi1.hf[0], wHfMaltaX * std::sqrt(hf_asymmetry_),
+      wHfMaltaX / std::sqrt(hf_asymmetry_), norm1HfX, pool_, &diffs,
+      &block_diff_ac, 0));
   JPEGLI_RETURN_IF_ERROR(MaltaDiffMapLF(pi0_.mf.Plane(1), pi1.mf.Plane(1),
-                                        wMfMalta, wMfMalta, norm1Mf, &diffs,
-                                        &block_diff_ac, 1));
+                                        wMfMalta, wMfMalta, norm1Mf, pool_,
+                                        &diffs, &block_diff_ac, 1));
   JPEGLI_RETURN_IF_ERROR(MaltaDiffMapLF(pi0_.mf.Plane(0), pi1.mf.Plane(0),
-                                        wMfMaltaX, wMfMaltaX, norm1MfX, &diffs,
-                                        &block_diff_ac, 0));
+                                        wMfMaltaX, wMfMaltaX, norm1MfX, pool_,
+                                        &diffs, &block_diff_ac, 0));
 
   JPEGLI_ASSIGN_OR_RETURN(Image3F block_diff_dc,
                           Image3F::Create(memory_manager, xsize_, ysize_));
   for (size_t c = 0; c < 3; ++c) {
     if (c < 2) {  // No blue channel error accumulated at HF.
-      HWY_DYNAMIC_DISPATCH(L2DiffAsymmetric)
-      (pi0_.hf[c], pi1.hf[c], wmul[c] * hf_asymmetry_, wmul[c] / hf_asymmetry_,
-       &block_diff_ac.Plane(c));
+      JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(L2DiffAsymmetric)(
+          pi0_.hf[c], pi1.hf[c], wmul[c] * hf_asymmetry_,
+          wmul[c] / hf_asymmetry_, pool_, &block_diff_ac.Plane(c)));
     }
-    HWY_DYNAMIC_DISPATCH(L2Diff)
-    (pi0_.mf.Plane(c), pi1.mf.Plane(c), wmul[3 + c], &block_diff_ac.Plane(c));
-    HWY_DYNAMIC_DISPATCH(SetL2Diff)
-    (pi0_.lf.Plane(c), pi1.lf.Plane(c), wmul[6 + c], &block_diff_dc.Plane(c));
+    JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(L2Diff)(
+        pi0_.mf.Plane(c), pi1.mf.Plane(c), wmul[3 + c], pool_,
+        &block_diff_ac.Plane(c)));
+    JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(SetL2Diff)(
+        pi0_.lf.Plane(c), pi1.lf.Plane(c), wmul[6 + c], pool_,
+        &block_diff_dc.Plane(c)));
   }
 
   ImageF mask;
+  BlurTemp blur_temp;
   JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(MaskPsychoImage)(
-      pi0_, pi1, xsize_, ysize_, params_, &blur_temp_, &mask,
+      pi0_, pi1, xsize_, ysize_, params_, &blur_temp, pool_, &mask,
       &block_diff_ac.Plane(1)));
 
   JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(CombineChannelsToDiffmap)(
-      mask, block_diff_dc, block_diff_ac, xmul_, &diffmap));
+      mask, block_diff_dc, block_diff_ac, xmul_, pool_, &diffmap));
   return true;
 }
 
@@ -1979,7 +2089,8 @@ Status ButteraugliDiffmap(const Image3F& rgb0, const Image3F& rgb1,
 
 template <size_t kMax>
 bool ButteraugliDiffmapSmall(const Image3F& rgb0, const Image3F& rgb1,
-                             const ButteraugliParams& params, ImageF& diffmap) {
+                             const ButteraugliParams& params, ThreadPool* pool,
+                             ImageF& diffmap) {
   const size_t xsize = rgb0.xsize();
   const size_t ysize = rgb0.ysize();
   JpegliMemoryManager* memory_manager = rgb0.memory_manager();
@@ -2006,7 +2117,8 @@ bool ButteraugliDiffmapSmall(const Image3F& rgb0, const Image3F& rgb1,
     }
   }
   ImageF diffmap_scaled;
-  const bool ok = ButteraugliDiffmap(scaled0, scaled1, params, diffmap_scaled);
+  const bool ok =
+      ButteraugliDiffmap(scaled0, scaled1, params, diffmap_scaled, pool);
   JPEGLI_ASSIGN_OR_RETURN(diffmap,
                           ImageF::Create(memory_manager, xsize, ysize));
   for (size_t y = 0; y < ysize; ++y) {
@@ -2018,7 +2130,8 @@ bool ButteraugliDiffmapSmall(const Image3F& rgb0, const Image3F& rgb1,
 }
 
 Status ButteraugliDiffmap(const Image3F& rgb0, const Image3F& rgb1,
-                          const ButteraugliParams& params, ImageF& diffmap) {
+                          const ButteraugliParams& params, ImageF& diffmap,
+                          ThreadPool* pool) {
   const size_t xsize = rgb0.xsize();
   const size_t ysize = rgb0.ysize();
   if (xsize < 1 || ysize < 1) {
@@ -2029,10 +2142,10 @@ Status ButteraugliDiffmap(const Image3F& rgb0, const Image3F& rgb1,
   }
   static const int kMax = 8;
   if (xsize < kMax || ysize < kMax) {
-    return ButteraugliDiffmapSmall<kMax>(rgb0, rgb1, params, diffmap);
+    return ButteraugliDiffmapSmall<kMax>(rgb0, rgb1, params, pool, diffmap);
   }
   JPEGLI_ASSIGN_OR_RETURN(std::unique_ptr<ButteraugliComparator> butteraugli,
-                          ButteraugliComparator::Make(rgb0, params));
+                          ButteraugliComparator::Make(rgb0, params, pool));
   JPEGLI_RETURN_IF_ERROR(butteraugli->Diffmap(rgb1, diffmap));
   return true;
 }
@@ -2048,8 +2161,8 @@ bool ButteraugliInterface(const Image3F& rgb0, const Image3F& rgb1,
 
 bool ButteraugliInterface(const Image3F& rgb0, const Image3F& rgb1,
                           const ButteraugliParams& params, ImageF& diffmap,
-                          double& diffvalue) {
-  if (!ButteraugliDiffmap(rgb0, rgb1, params, diffmap)) {
+                          double& diffvalue, ThreadPool* pool) {
+  if (!ButteraugliDiffmap(rgb0, rgb1, params, diffmap, pool)) {
     return false;
   }
   diffvalue = ButteraugliScoreFromDiffmap(diffmap, &params);
@@ -2058,7 +2171,8 @@ bool ButteraugliInterface(const Image3F& rgb0, const Image3F& rgb1,
 
 Status ButteraugliInterfaceInPlace(Image3F&& rgb0, Image3F&& rgb1,
                                    const ButteraugliParams& params,
-                                   ImageF& diffmap, double& diffvalue) {
+                                   ImageF& diffmap, double& diffvalue,
+                                   ThreadPool* pool) {
   const size_t xsize = rgb0.xsize();
   const size_t ysize = rgb0.ysize();
   if (xsize < 1 || ysize < 1) {
@@ -2069,7 +2183,8 @@ Status ButteraugliInterfaceInPlace(Image3F&& rgb0, Image3F&& rgb1,
   }
   static const int kMax = 8;
   if (xsize < kMax || ysize < kMax) {
-    bool ok = ButteraugliDiffmapSmall<kMax>(rgb0, rgb1, params, diffmap);
+    bool ok =
+        ButteraugliDiffmapSmall<kMax>(rgb0, rgb1, params, pool, diffmap);
     diffvalue = ButteraugliScoreFromDiffmap(diffmap, &params);
     return ok;
   }
@@ -2078,10 +2193,10 @@ Status ButteraugliInterfaceInPlace(Image3F&& rgb0, Image3F&& rgb1,
     JPEGLI_ASSIGN_OR_RETURN(Image3F rgb0_sub, SubSample2x(rgb0));
     JPEGLI_ASSIGN_OR_RETURN(Image3F rgb1_sub, SubSample2x(rgb1));
     JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(ButteraugliDiffmapInPlace)(
-        rgb0_sub, rgb1_sub, params, subdiffmap));
+        rgb0_sub, rgb1_sub, params, pool, subdiffmap));
   }
   JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(ButteraugliDiffmapInPlace)(
-      rgb0, rgb1, params, diffmap));
+      rgb0, rgb1, params, pool, diffmap));
   if (xsize >= 15 && ysize >= 15) {
     AddSupersampled2x(subdiffmap, 0.5, diffmap);
   }
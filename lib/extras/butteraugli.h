@@ -16,6 +16,7 @@
 #include <memory>
 
 #include "lib/base/compiler_specific.h"
+#include "lib/base/data_parallel.h"
 #include "lib/base/memory_manager.h"
 #include "lib/base/status.h"
 #include "lib/extras/image.h"
@@ -76,10 +77,13 @@ struct ButteraugliParams {
 // A diffvalue between kButteraugliGood and kButteraugliBad indicates that
 // a subtle difference can be observed between the images.
 //
+// If pool is not null, the image is processed in bands of rows on the thread
+// pool; the result does not depend on the number of threads.
+//
 // Returns true on success.
 bool ButteraugliInterface(const Image3F &rgb0, const Image3F &rgb1,
                           const ButteraugliParams &params, ImageF &diffmap,
-                          double &diffvalue);
+                          double &diffvalue, ThreadPool *pool = nullptr);
 
 // Deprecated (calls the previous function)
 bool ButteraugliInterface(const Image3F &rgb0, const Image3F &rgb1,
@@ -91,7 +95,8 @@ bool ButteraugliInterface(const Image3F &rgb0, const Image3F &rgb1,
 // params.xmul.
 Status ButteraugliInterfaceInPlace(Image3F &&rgb0, Image3F &&rgb1,
                                    const ButteraugliParams &params,
-                                   ImageF &diffmap, double &diffvalue);
+                                   ImageF &diffmap, double &diffvalue,
+                                   ThreadPool *pool = nullptr);
 
 // Converts the butteraugli score into fuzzy class values that are continuous
 // at the class boundary. The class boundary location is based on human
@@ -171,8 +176,12 @@ class ButteraugliComparator {
   // improve results at higher Butteraugli values.
   virtual ~ButteraugliComparator() = default;
 
+  // The optional pool is used by Make() and by all subsequent Diffmap() and
+  // Mask() calls. A ThreadPool does not allow overlapping runs, so concurrent
+  // Diffmap() calls on one comparator are only supported without a pool.
   static StatusOr<std::unique_ptr<ButteraugliComparator>> Make(
-      const Image3F &rgb0, const ButteraugliParams &params);
+      const Image3F &rgb0, const ButteraugliParams &params,
+      ThreadPool *pool = nullptr);
 
   // Computes the butteraugli map between the original image given in the
   // constructor and the distorted image give here.
@@ -188,13 +197,18 @@ class ButteraugliComparator {
 
  private:
   ButteraugliComparator(size_t xsize, size_t ysize,
-                        const ButteraugliParams &params);
+                        const ButteraugliParams &params, ThreadPool *pool);
   Image3F *Temp() const;
   void ReleaseTemp() const;
 
+  // Applies OpsinDynamicsImage using the shared temporary image if it is not
+  // in use by another thread.
+  Status ComputeOpsinDynamicsImage(const Image3F &rgb, Image3F *xyb) const;
+
   const size_t xsize_;
   const size_t ysize_;
   ButteraugliParams params_;
+  ThreadPool *pool_;
   PsychoImage pi0_;
 
   // Shared temporary image storage to reduce the number of allocations;
@@ -202,7 +216,6 @@ class ButteraugliComparator {
   mutable Image3F temp_;
   mutable std::atomic_flag temp_in_use_ = ATOMIC_FLAG_INIT;
 
-  mutable BlurTemp blur_temp_;
   std::unique_ptr<ButteraugliComparator> sub_;
 };
 
@@ -211,7 +224,8 @@ Status ButteraugliDiffmap(const Image3F &rgb0, const Image3F &rgb1,
                           double hf_asymmetry, double xmul, ImageF &diffmap);
 
 Status ButteraugliDiffmap(const Image3F &rgb0, const Image3F &rgb1,
-                          const ButteraugliParams &params, ImageF &diffmap);
+                          const ButteraugliParams &params, ImageF &diffmap,
+                          ThreadPool *pool = nullptr);
 
 double ButteraugliScoreFromDiffmap(const ImageF &diffmap,
                                    const ButteraugliParams *params = nullptr);
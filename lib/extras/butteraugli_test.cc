@@ -20,12 +20,14 @@
 #include "lib/extras/test_image.h"
 #include "lib/extras/test_memory_manager.h"
 #include "lib/extras/test_utils.h"
+#include "lib/threads/test_utils.h"
 
 namespace jpegli {
 namespace {
 
 using ::jpegli::test::GetColorImage;
 using ::jpegli::test::TestImage;
+using ::jpegli::test::ThreadPoolForTests;
 
 Image3F SinglePixelImage(float red, float green, float blue) {
   JpegliMemoryManager* memory_manager = jpegli::test::MemoryManager();
@@ -108,5 +110,43 @@ TEST(ButteraugliInPlaceTest, LargeImage) {
   EXPECT_NEAR(distp, distp2, 1e-7);
 }
 
+TEST(ButteraugliTest, ThreadPoolGivesSameResult) {
+  JpegliMemoryManager* memory_manager = jpegli::test::MemoryManager();
+  const size_t xsize = 517;
+  const size_t ysize = 389;
+  TestImage img;
+  ASSERT_TRUE(img.SetDimensions(xsize, ysize));
+  JPEGLI_TEST_ASSIGN_OR_DIE(auto frame, img.AddFrame());
+  frame.RandomFill(777);
+  JPEGLI_TEST_ASSIGN_OR_DIE(Image3F rgb0, GetColorImage(img.ppf()));
+  JPEGLI_TEST_ASSIGN_OR_DIE(Image3F rgb1,
+                            Image3F::Create(memory_manager, xsize, ysize));
+  ASSERT_TRUE(CopyImageTo(rgb0, &rgb1));
+  AddUniformNoise(&rgb1, 0.02f, 7777);
+  AddEdge(&rgb1, 0.1f, xsize / 2, ysize / 2);
+  ButteraugliParams butteraugli_params;
+  ImageF diffmap;
+  double diffval;
+  ASSERT_TRUE(
+      ButteraugliInterface(rgb0, rgb1, butteraugli_params, diffmap, diffval));
+  ThreadPoolForTests pool(8);
+  ImageF diffmap_mt;
+  double diffval_mt;
+  ASSERT_TRUE(ButteraugliInterface(rgb0, rgb1, butteraugli_params, diffmap_mt,
+                                   diffval_mt, pool.get()));
+  EXPECT_EQ(diffval, diffval_mt);
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      ASSERT_EQ(diffmap.ConstRow(y)[x], diffmap_mt.ConstRow(y)[x]);
+    }
+  }
+  ImageF diffmap2;
+  double diffval2;
+  ASSERT_TRUE(ButteraugliInterfaceInPlace(std::move(rgb0), std::move(rgb1),
+                                          butteraugli_params, diffmap2,
+                                          diffval2, pool.get()));
+  EXPECT_NEAR(diffval, diffval2, 5e-7);
+}
+
 }  // namespace
 }  // namespace jpegli
@@ -31,6 +31,7 @@
 #include "lib/extras/codestream_header.h"
 #include "lib/extras/dec/color_hints.h"
 #include "lib/extras/dec/decode.h"
+#include "lib/extras/dec/row_reader.h"
 #include "lib/extras/enc/encode.h"
 #include "lib/extras/packed_image.h"
 #include "lib/extras/test_utils.h"
@@ -597,6 +598,28 @@ TEST(CodecTest, TestPNM) {
   ASSERT_TRUE(std::abs(d - -3.141592) < 1E-15);
 }
 
+TEST(CodecTest, TruncatedPGX) {
+  for (size_t bits : {8, 16}) {
+    const size_t xsize = 4;
+    const size_t ysize = 3;
+    std::string header =
+        "PG ML + " + std::to_string(bits) + " " + std::to_string(xsize) + " " +
+        std::to_string(ysize) + "\n";
+    std::vector<uint8_t> pgx(header.begin(), header.end());
+    pgx.resize(pgx.size() + xsize * ysize * bits / 8, 0x40);
+    PackedPixelFile ppf;
+    std::unique_ptr<RowReader> rows;
+    ASSERT_TRUE(DecodeBytes(Bytes(pgx), ColorHints(), &ppf));
+    ASSERT_TRUE(DecodeBytesRows(Bytes(pgx), ColorHints(), &ppf, &rows));
+    EXPECT_EQ(ysize, rows->ysize);
+#if (!JPEGLI_CRASH_ON_ERROR)
+    pgx.pop_back();
+    EXPECT_FALSE(DecodeBytes(Bytes(pgx), ColorHints(), &ppf));
+    EXPECT_FALSE(DecodeBytesRows(Bytes(pgx), ColorHints(), &ppf, &rows));
+#endif
+  }
+}
+
 TEST(CodecTest, EncodeToPNG) {
   ThreadPool* const pool = nullptr;
 
@@ -11,6 +11,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <locale>
+#include <memory>
 #include <string>
 
 #include "lib/base/compiler_specific.h"
@@ -26,6 +27,7 @@
 #include "lib/extras/dec/jpg.h"
 #include "lib/extras/dec/pgx.h"
 #include "lib/extras/dec/pnm.h"
+#include "lib/extras/dec/row_reader.h"
 #include "lib/extras/packed_image.h"
 
 namespace jpegli {
@@ -167,6 +169,31 @@ Status DecodeBytes(const Span<const uint8_t> bytes,
   return true;
 }
 
+Status DecodeBytesRows(const Span<const uint8_t> bytes,
+                       const ColorHints& color_hints,
+                       extras::PackedPixelFile* ppf,
+                       std::unique_ptr<RowReader>* rows,
+                       const SizeConstraints* constraints) {
+  if (bytes.size() < kMinBytes) return JPEGLI_FAILURE("Too few bytes");
+
+  *ppf = extras::PackedPixelFile();
+
+  // Default values when not set by decoders.
+  ppf->info.uses_original_profile = JPEGLI_TRUE;
+  ppf->info.orientation = JPEGLI_ORIENT_IDENTITY;
+
+  switch (DetectCodec(bytes)) {
+    case Codec::kPGX:
+      return DecodeImagePGXRows(bytes, color_hints, ppf, rows, constraints);
+
+    case Codec::kPNM:
+      return DecodeImagePNMRows(bytes, color_hints, ppf, rows, constraints);
+
+    default:
+      return JPEGLI_FAILURE("Codec can not be decoded by rows");
+  }
+}
+
 template <size_t N, size_t L>
 bool CheckSignatures(const Span<const uint8_t>& bytes,
                      const std::array<std::array<uint8_t, L>, N>& signatures) {
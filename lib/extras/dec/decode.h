@@ -11,6 +11,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
 
 #include "lib/base/compiler_specific.h"
@@ -18,6 +19,7 @@
 #include "lib/base/span.h"
 #include "lib/base/status.h"
 #include "lib/extras/dec/color_hints.h"
+#include "lib/extras/dec/row_reader.h"
 #include "lib/extras/packed_image.h"
 
 namespace jpegli {
@@ -59,6 +61,14 @@ Status DecodeBytes(Span<const uint8_t> bytes, const ColorHints& color_hints,
                    JpegliMemoryManager* memory_manager = nullptr,
                    bool coalescing = true);
 
+// Decodes the metadata of "bytes" into *ppf without decoding the pixels, which
+// *rows then reads from "bytes" on demand. Only supported for the uncompressed
+// PNM and PGX formats; fails for other codecs. "bytes" must outlive *rows.
+Status DecodeBytesRows(Span<const uint8_t> bytes, const ColorHints& color_hints,
+                       extras::PackedPixelFile* ppf,
+                       std::unique_ptr<RowReader>* rows,
+                       const SizeConstraints* constraints = nullptr);
+
 }  // namespace extras
 }  // namespace jpegli
 
@@ -26,6 +26,7 @@
 #include "lib/cms/color_encoding.h"
 #include "lib/extras/codestream_header.h"
 #include "lib/extras/packed_image.h"
+#include "lib/extras/size_constraints.h"
 #include "lib/jpegli/common.h"
 #include "lib/jpegli/decode.h"
 #include "lib/jpegli/types.h"
@@ -40,7 +41,7 @@ constexpr unsigned char kExifSignature[6] = {0x45, 0x78, 0x69,
 constexpr int kExifMarker = JPEG_APP0 + 1;
 constexpr int kICCMarker = JPEG_APP0 + 2;
 
-inline bool IsJPG(const std::vector<uint8_t>& bytes) {
+inline bool IsJPG(Span<const uint8_t> bytes) {
   if (bytes.size() < 2) return false;
   if (bytes[0] != 0xFF || bytes[1] != 0xD8) return false;
   return true;
@@ -100,6 +101,14 @@ void MyErrorExit(j_common_ptr cinfo) {
   longjmp(*env, 1);
 }
 
+// Unlike MyErrorExit, leaves the decompress object alive so that the caller
+// can reuse it for the next image.
+void ReusableErrorExit(j_common_ptr cinfo) {
+  jmp_buf* env = static_cast<jmp_buf*>(cinfo->client_data);
+  (*cinfo->err->output_message)(cinfo);
+  longjmp(*env, 1);
+}
+
 void MyOutputMessage(j_common_ptr cinfo) {
   if (JPEGLI_IS_DEBUG_BUILD) {
     char buf[JMSG_LENGTH_MAX + 1];
@@ -123,11 +132,13 @@ Status UnmapColors(uint8_t* row, size_t xsize, int components,
   return true;
 }
 
-}  // namespace
-
-Status DecodeJpeg(const std::vector<uint8_t>& compressed,
-                  const JpegDecompressParams& dparams, ThreadPool* pool,
-                  PackedPixelFile* ppf) {
+// Decodes with reused_cinfo if it is not null, otherwise with a temporary
+// decompress object.
+Status DecodeJpegImpl(Span<const uint8_t> compressed,
+                      const JpegDecompressParams& dparams,
+                      j_decompress_ptr reused_cinfo, ThreadPool* pool,
+                      PackedPixelFile* ppf,
+                      const SizeConstraints* constraints) {
   // Don't do anything for non-JPEG files (no need to report an error)
   if (!IsJPG(compressed)) return false;
 
@@ -137,48 +148,57 @@ Status DecodeJpeg(const std::vector<uint8_t>& compressed,
   // the call to setjmp().
   std::unique_ptr<JSAMPLE[]> row;
 
-  jpeg_decompress_struct cinfo;
+  jpeg_decompress_struct local_cinfo;
+  j_decompress_ptr cinfo = reused_cinfo ? reused_cinfo : &local_cinfo;
+  // The error manager of a reused object is only replaced during this call.
+  jpeg_error_mgr* saved_err = nullptr;
+  void* saved_client_data = nullptr;
+  if (reused_cinfo) {
+    saved_err = reused_cinfo->err;
+    saved_client_data = reused_cinfo->client_data;
+  }
   const auto try_catch_block = [&]() -> bool {
     // Setup error handling in jpeg library so we can deal with broken jpegs in
     // the fuzzer.
     jpeg_error_mgr jerr;
     jmp_buf env;
-    cinfo.err = jpegli_std_error(&jerr);
-    jerr.error_exit = &MyErrorExit;
+    cinfo->err = jpegli_std_error(&jerr);
+    jerr.error_exit = reused_cinfo ? &ReusableErrorExit : &MyErrorExit;
     jerr.output_message = &MyOutputMessage;
     if (setjmp(env)) {
       return false;
     }
-    cinfo.client_data = static_cast<void*>(&env);
-
-    jpegli_create_decompress(&cinfo);
-    jpegli_mem_src(&cinfo,
-                   reinterpret_cast<const unsigned char*>(compressed.data()),
-                   compressed.size());
-    jpegli_save_markers(&cinfo, kICCMarker, 0xFFFF);
-    jpegli_save_markers(&cinfo, kExifMarker, 0xFFFF);
-    const auto failure = [&cinfo](const char* str) -> Status {
-      jpegli_abort_decompress(&cinfo);
-      jpegli_destroy_decompress(&cinfo);
+    cinfo->client_data = static_cast<void*>(&env);
+
+    if (!reused_cinfo) jpegli_create_decompress(cinfo);
+    jpegli_mem_src(cinfo, compressed.data(), compressed.size());
+    jpegli_save_markers(cinfo, kICCMarker, 0xFFFF);
+    jpegli_save_markers(cinfo, kExifMarker, 0xFFFF);
+    const auto failure = [cinfo](const char* str) -> Status {
+      jpegli_abort_decompress(cinfo);
       return JPEGLI_FAILURE("%s", str);
     };
-    jpegli_read_header(&cinfo, TRUE);
+    jpegli_read_header(cinfo, TRUE);
+    if (!VerifyDimensions(constraints, cinfo->image_width,
+                          cinfo->image_height)) {
+      return failure("image too big");
+    }
     // Might cause CPU-zip bomb.
-    if (cinfo.arith_code) {
+    if (cinfo->arith_code) {
       return failure("arithmetic code JPEGs are not supported");
     }
-    int nbcomp = cinfo.num_components;
+    int nbcomp = cinfo->num_components;
     if (nbcomp != 1 && nbcomp != 3) {
       std::string msg =
           "unsupported number of components in JPEG: " + std::to_string(nbcomp);
       return failure(msg.c_str());
     }
     if (dparams.force_rgb) {
-      cinfo.out_color_space = JCS_RGB;
+      cinfo->out_color_space = JCS_RGB;
     } else if (dparams.force_grayscale) {
-      cinfo.out_color_space = JCS_GRAYSCALE;
+      cinfo->out_color_space = JCS_GRAYSCALE;
     }
-    if (ReadICCProfile(&cinfo, &ppf->icc)) {
+    if (ReadICCProfile(cinfo, &ppf->icc)) {
       ppf->primary_color_representation = PackedPixelFile::kIccIsPrimary;
     } else {
       ppf->primary_color_representation =
@@ -186,16 +206,16 @@ Status DecodeJpeg(const std::vector<uint8_t>& compressed,
       ppf->icc.clear();
       // Default to SRGB
       ppf->color_encoding.color_space =
-          ConvertColorSpace(cinfo.out_color_space);
+          ConvertColorSpace(cinfo->out_color_space);
       ppf->color_encoding.white_point = JPEGLI_WHITE_POINT_D65;
       ppf->color_encoding.primaries = JPEGLI_PRIMARIES_SRGB;
       ppf->color_encoding.transfer_function = JPEGLI_TRANSFER_FUNCTION_SRGB;
       ppf->color_encoding.rendering_intent = JPEGLI_RENDERING_INTENT_PERCEPTUAL;
     }
-    ReadExif(&cinfo, &ppf->metadata.exif);
+    ReadExif(cinfo, &ppf->metadata.exif);
 
-    ppf->info.xsize = cinfo.image_width;
-    ppf->info.ysize = cinfo.image_height;
+    ppf->info.xsize = cinfo->image_width;
+    ppf->info.ysize = cinfo->image_height;
     if (dparams.output_data_type == JPEGLI_TYPE_UINT8) {
       ppf->info.bits_per_sample = 8;
       ppf->info.exponent_bits_per_sample = 0;
@@ -215,21 +235,21 @@ Status DecodeJpeg(const std::vector<uint8_t>& compressed,
     ppf->info.alpha_exponent_bits = 0;
     ppf->info.orientation = JPEGLI_ORIENT_IDENTITY;
 
-    jpegli_set_output_format(&cinfo, dparams.output_data_type,
+    jpegli_set_output_format(cinfo, dparams.output_data_type,
                              dparams.output_endianness);
 
     if (dparams.num_colors > 0) {
-      cinfo.quantize_colors = TRUE;
-      cinfo.desired_number_of_colors = dparams.num_colors;
-      cinfo.two_pass_quantize = static_cast<boolean>(dparams.two_pass_quant);
-      cinfo.dither_mode = static_cast<J_DITHER_MODE>(dparams.dither_mode);
+      cinfo->quantize_colors = TRUE;
+      cinfo->desired_number_of_colors = dparams.num_colors;
+      cinfo->two_pass_quantize = static_cast<boolean>(dparams.two_pass_quant);
+      cinfo->dither_mode = static_cast<J_DITHER_MODE>(dparams.dither_mode);
     }
 
-    jpegli_start_decompress(&cinfo);
+    jpegli_start_decompress(cinfo);
 
-    ppf->info.num_color_channels = cinfo.out_color_components;
+    ppf->info.num_color_channels = cinfo->out_color_components;
     const JpegliPixelFormat format{
-        /*num_channels=*/static_cast<uint32_t>(cinfo.out_color_components),
+        /*num_channels=*/static_cast<uint32_t>(cinfo->out_color_components),
         dparams.output_data_type,
         dparams.output_endianness,
         /*align=*/0,
@@ -239,34 +259,57 @@ Status DecodeJpeg(const std::vector<uint8_t>& compressed,
     {
       JPEGLI_ASSIGN_OR_RETURN(
           PackedFrame frame,
-          PackedFrame::Create(cinfo.image_width, cinfo.image_height, format));
+          PackedFrame::Create(cinfo->image_width, cinfo->image_height, format));
       ppf->frames.emplace_back(std::move(frame));
     }
     const auto& frame = ppf->frames.back();
-    JPEGLI_ENSURE(sizeof(JSAMPLE) * cinfo.out_color_components *
-                      cinfo.image_width <=
+    JPEGLI_ENSURE(sizeof(JSAMPLE) * cinfo->out_color_components *
+                      cinfo->image_width <=
                   frame.color.stride);
-    if (dparams.num_colors > 0) JPEGLI_ENSURE(cinfo.colormap != nullptr);
+    if (dparams.num_colors > 0) JPEGLI_ENSURE(cinfo->colormap != nullptr);
 
-    for (size_t y = 0; y < cinfo.image_height; ++y) {
+    for (size_t y = 0; y < cinfo->image_height; ++y) {
       JSAMPROW rows[] = {reinterpret_cast<JSAMPLE*>(
           static_cast<uint8_t*>(frame.color.pixels()) +
           frame.color.stride * y)};
-      jpegli_read_scanlines(&cinfo, rows, 1);
+      jpegli_read_scanlines(cinfo, rows, 1);
       if (dparams.num_colors > 0) {
         JPEGLI_RETURN_IF_ERROR(
-            UnmapColors(rows[0], cinfo.output_width, cinfo.out_color_components,
-                        cinfo.colormap, cinfo.actual_number_of_colors));
+            UnmapColors(rows[0], cinfo->output_width,
+                        cinfo->out_color_components, cinfo->colormap,
+                        cinfo->actual_number_of_colors));
       }
     }
 
-    jpegli_finish_decompress(&cinfo);
+    jpegli_finish_decompress(cinfo);
     return true;
   };
   bool success = try_catch_block();
-  jpegli_destroy_decompress(&cinfo);
+  if (reused_cinfo) {
+    reused_cinfo->err = saved_err;
+    reused_cinfo->client_data = saved_client_data;
+    if (!success) jpegli_abort_decompress(reused_cinfo);
+  } else {
+    jpegli_destroy_decompress(cinfo);
+  }
   return success;
 }
 
+}  // namespace
+
+Status DecodeJpeg(Span<const uint8_t> compressed,
+                  const JpegDecompressParams& dparams, ThreadPool* pool,
+                  PackedPixelFile* ppf, const SizeConstraints* constraints) {
+  return DecodeJpegImpl(compressed, dparams, nullptr, pool, ppf, constraints);
+}
+
+Status DecodeJpeg(Span<const uint8_t> compressed,
+                  const JpegDecompressParams& dparams,
+                  jpeg_decompress_struct* cinfo, ThreadPool* pool,
+                  PackedPixelFile* ppf, const SizeConstraints* constraints) {
+  JPEGLI_ENSURE(cinfo != nullptr);
+  return DecodeJpegImpl(compressed, dparams, cinfo, pool, ppf, constraints);
+}
+
 }  // namespace extras
 }  // namespace jpegli
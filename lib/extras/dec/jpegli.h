@@ -10,11 +10,14 @@
 // Decodes JPG pixels and metadata in memory using the libjpegli library.
 
 #include <cstdint>
-#include <vector>
 
 #include "lib/base/data_parallel.h"
+#include "lib/base/span.h"
 #include "lib/base/status.h"
 #include "lib/base/types.h"
+#include "lib/extras/size_constraints.h"
+
+struct jpeg_decompress_struct;
 
 namespace jpegli {
 namespace extras {
@@ -32,9 +35,21 @@ struct JpegDecompressParams {
   int dither_mode = 2;
 };
 
-Status DecodeJpeg(const std::vector<uint8_t>& compressed,
+// Fails if the image dimensions exceed `constraints`, before any pixels are
+// decoded.
+Status DecodeJpeg(Span<const uint8_t> compressed,
                   const JpegDecompressParams& dparams, ThreadPool* pool,
-                  PackedPixelFile* ppf);
+                  PackedPixelFile* ppf,
+                  const SizeConstraints* constraints = nullptr);
+
+// Same as above, but uses a decompress object that the caller created with
+// jpegli_create_decompress(), so that it can be reused for many images. The
+// object is ready for the next image on return, also on failure.
+Status DecodeJpeg(Span<const uint8_t> compressed,
+                  const JpegDecompressParams& dparams,
+                  jpeg_decompress_struct* cinfo, ThreadPool* pool,
+                  PackedPixelFile* ppf,
+                  const SizeConstraints* constraints = nullptr);
 
 }  // namespace extras
 }  // namespace jpegli
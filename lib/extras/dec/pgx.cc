@@ -8,6 +8,7 @@
 
 #include <cstdint>
 #include <cstring>
+#include <memory>
 #include <utility>
 
 #include "lib/base/span.h"
@@ -15,6 +16,7 @@
 #include "lib/base/types.h"
 #include "lib/extras/codestream_header.h"
 #include "lib/extras/dec/color_hints.h"
+#include "lib/extras/dec/row_reader.h"
 #include "lib/extras/packed_image.h"
 #include "lib/extras/size_constraints.h"
 
@@ -152,15 +154,14 @@ class Parser {
   const uint8_t* const end_;
 };
 
-}  // namespace
-
-Status DecodeImagePGX(const Span<const uint8_t> bytes,
-                      const ColorHints& color_hints, PackedPixelFile* ppf,
-                      const SizeConstraints* constraints) {
+// Parses the header and fills in the metadata of `ppf`. On success, `pos`
+// points to the first pixel.
+Status ParsePGX(const Span<const uint8_t> bytes, const ColorHints& color_hints,
+                const SizeConstraints* constraints, PackedPixelFile* ppf,
+                const uint8_t** pos, JpegliPixelFormat* format) {
   Parser parser(bytes);
   HeaderPGX header = {};
-  const uint8_t* pos = nullptr;
-  if (!parser.ParseHeader(&header, &pos)) return false;
+  if (!parser.ParseHeader(&header, pos)) return false;
   JPEGLI_RETURN_IF_ERROR(
       VerifyDimensions(constraints, header.xsize, header.ysize));
   if (header.bits_per_sample == 0 || header.bits_per_sample > 32) {
@@ -190,29 +191,62 @@ Status DecodeImagePGX(const Span<const uint8_t> bytes,
     data_type = JPEGLI_TYPE_UINT8;
   }
 
-  const JpegliPixelFormat format{
+  const JpegliPixelFormat pgx_format{
       /*num_channels=*/1,
       /*data_type=*/data_type,
       /*endianness=*/header.big_endian ? JPEGLI_BIG_ENDIAN
                                        : JPEGLI_LITTLE_ENDIAN,
       /*align=*/0,
   };
+  size_t required_pgx_size = header.ysize * header.xsize *
+                             PackedImage::BitsPerChannel(data_type) / 8;
+  size_t pgx_remaining_size = bytes.data() + bytes.size() - *pos;
+  if (pgx_remaining_size < required_pgx_size) {
+    return JPEGLI_FAILURE("PGX file too small");
+  }
+  *format = pgx_format;
+  return true;
+}
+
+}  // namespace
+
+Status DecodeImagePGX(const Span<const uint8_t> bytes,
+                      const ColorHints& color_hints, PackedPixelFile* ppf,
+                      const SizeConstraints* constraints) {
+  const uint8_t* pos = nullptr;
+  JpegliPixelFormat format;
+  JPEGLI_RETURN_IF_ERROR(
+      ParsePGX(bytes, color_hints, constraints, ppf, &pos, &format));
+  const size_t xsize = ppf->info.xsize;
+  const size_t ysize = ppf->info.ysize;
   ppf->frames.clear();
   // Allocates the frame buffer.
   {
-    JPEGLI_ASSIGN_OR_RETURN(
-        PackedFrame frame,
-        PackedFrame::Create(header.xsize, header.ysize, format));
+    JPEGLI_ASSIGN_OR_RETURN(PackedFrame frame,
+                            PackedFrame::Create(xsize, ysize, format));
     ppf->frames.emplace_back(std::move(frame));
   }
   const auto& frame = ppf->frames.back();
-  size_t pgx_remaining_size = bytes.data() + bytes.size() - pos;
-  if (pgx_remaining_size < frame.color.pixels_size) {
-    return JPEGLI_FAILURE("PGX file too small");
-  }
   memcpy(frame.color.pixels(), pos, frame.color.pixels_size);
   return true;
 }
 
+Status DecodeImagePGXRows(const Span<const uint8_t> bytes,
+                          const ColorHints& color_hints, PackedPixelFile* ppf,
+                          std::unique_ptr<RowReader>* rows,
+                          const SizeConstraints* constraints) {
+  const uint8_t* pos = nullptr;
+  JpegliPixelFormat format;
+  JPEGLI_RETURN_IF_ERROR(
+      ParsePGX(bytes, color_hints, constraints, ppf, &pos, &format));
+  ppf->frames.clear();
+  const size_t xsize = ppf->info.xsize;
+  const size_t stride =
+      xsize * PackedImage::BitsPerChannel(format.data_type) / 8;
+  rows->reset(
+      new StridedRowReader(pos, stride, xsize, ppf->info.ysize, format));
+  return true;
+}
+
 }  // namespace extras
 }  // namespace jpegli
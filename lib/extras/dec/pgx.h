@@ -10,6 +10,7 @@
 // Decodes PGX pixels in memory.
 
 #include <cstdint>
+#include <memory>
 
 #include "lib/base/span.h"
 #include "lib/base/status.h"
@@ -22,12 +23,21 @@ namespace extras {
 
 class ColorHints;
 class PackedPixelFile;
+class RowReader;
 
 // Decodes `bytes` into `ppf`.
 Status DecodeImagePGX(Span<const uint8_t> bytes, const ColorHints& color_hints,
                       PackedPixelFile* ppf,
                       const SizeConstraints* constraints = nullptr);
 
+// Same as above, but leaves the pixels in `bytes` and only fills in the
+// metadata of `ppf`; `rows` reads the pixels from `bytes`, which must outlive
+// it.
+Status DecodeImagePGXRows(Span<const uint8_t> bytes,
+                          const ColorHints& color_hints, PackedPixelFile* ppf,
+                          std::unique_ptr<RowReader>* rows,
+                          const SizeConstraints* constraints = nullptr);
+
 }  // namespace extras
 }  // namespace jpegli
 
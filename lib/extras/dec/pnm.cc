@@ -12,6 +12,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <utility>
 #include <vector>
 
@@ -21,6 +22,7 @@
 #include "lib/base/types.h"
 #include "lib/extras/codestream_header.h"
 #include "lib/extras/dec/color_hints.h"
+#include "lib/extras/dec/row_reader.h"
 #include "lib/extras/packed_image.h"
 #include "lib/extras/size_constraints.h"
 
@@ -336,14 +338,17 @@ class Parser {
   const uint8_t* const end_;
 };
 
-}  // namespace
-
-Status DecodeImagePNM(const Span<const uint8_t> bytes,
-                      const ColorHints& color_hints, PackedPixelFile* ppf,
-                      const SizeConstraints* constraints) {
+// Parses the header and fills in the metadata of `ppf`. On success, `pos`
+// points to the first pixel and `bytes` is verified to contain all of them.
+Status ParsePNM(const Span<const uint8_t> bytes, const ColorHints& color_hints,
+                const SizeConstraints* constraints, PackedPixelFile* ppf,
+                HeaderPNM* header_out, const uint8_t** pos_out,
+                JpegliPixelFormat* format_out) {
   Parser parser(bytes);
-  HeaderPNM header = {};
-  const uint8_t* pos = nullptr;
+  HeaderPNM& header = *header_out;
+  header = {};
+  const uint8_t*& pos = *pos_out;
+  pos = nullptr;
   if (!parser.ParseHeader(&header, &pos)) return false;
   JPEGLI_RETURN_IF_ERROR(
       VerifyDimensions(constraints, header.xsize, header.ysize));
@@ -408,9 +413,6 @@ Status DecodeImagePNM(const Span<const uint8_t> bytes,
                                        : JPEGLI_LITTLE_ENDIAN,
       kAlign,
   };
-  // EC format is same as color, but 1-channel.
-  JpegliPixelFormat ec_format = format;
-  ec_format.num_channels = 1;
   size_t required_pnm_size =
       header.ysize * header.xsize *
       (num_interleaved_channels + header.ec_types.size()) * twidth;
@@ -418,6 +420,26 @@ Status DecodeImagePNM(const Span<const uint8_t> bytes,
   if (pnm_remaining_size < required_pnm_size) {
     return JPEGLI_FAILURE("PNM file too small");
   }
+  *format_out = format;
+  return true;
+}
+
+}  // namespace
+
+Status DecodeImagePNM(const Span<const uint8_t> bytes,
+                      const ColorHints& color_hints, PackedPixelFile* ppf,
+                      const SizeConstraints* constraints) {
+  HeaderPNM header;
+  const uint8_t* pos;
+  JpegliPixelFormat format;
+  JPEGLI_RETURN_IF_ERROR(ParsePNM(bytes, color_hints, constraints, ppf,
+                                  &header, &pos, &format));
+  const JpegliDataType data_type = format.data_type;
+  const size_t num_interleaved_channels = format.num_channels;
+  const size_t twidth = PackedImage::BitsPerChannel(data_type) / 8;
+  // EC format is same as color, but 1-channel.
+  JpegliPixelFormat ec_format = format;
+  ec_format.num_channels = 1;
 
   ppf->frames.clear();
   {
@@ -479,6 +501,31 @@ Status DecodeImagePNM(const Span<const uint8_t> bytes,
   return true;
 }
 
+Status DecodeImagePNMRows(const Span<const uint8_t> bytes,
+                          const ColorHints& color_hints, PackedPixelFile* ppf,
+                          std::unique_ptr<RowReader>* rows,
+                          const SizeConstraints* constraints) {
+  HeaderPNM header;
+  const uint8_t* pos;
+  JpegliPixelFormat format;
+  JPEGLI_RETURN_IF_ERROR(ParsePNM(bytes, color_hints, constraints, ppf,
+                                  &header, &pos, &format));
+  if (!header.ec_types.empty()) {
+    return JPEGLI_FAILURE("PNM: extra channels can not be read by rows");
+  }
+  ppf->frames.clear();
+  const ptrdiff_t stride = header.xsize * format.num_channels *
+                           PackedImage::BitsPerChannel(format.data_type) / 8;
+  const bool flipped_y = (header.bits_per_sample == 32);  // PFMs are flipped
+  const uint8_t* row0 = flipped_y ? pos + (header.ysize - 1) * stride : pos;
+  rows->reset(new StridedRowReader(row0, flipped_y ? -stride : stride,
+                                   header.xsize, header.ysize, format));
+  if (ppf->info.exponent_bits_per_sample == 0) {
+    ppf->input_bitdepth.type = JPEGLI_BIT_DEPTH_FROM_CODESTREAM;
+  }
+  return true;
+}
+
 // Exposed for testing.
 Status PnmParseSigned(Bytes str, double* v) {
   return Parser(str).ParseSigned(v);
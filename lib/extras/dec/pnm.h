@@ -11,6 +11,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 
 #include "lib/extras/codestream_header.h"
 // TODO(janwas): workaround for incorrect Win64 codegen (cause unknown)
@@ -27,6 +28,7 @@ namespace extras {
 
 class ColorHints;
 class PackedPixelFile;
+class RowReader;
 
 // Decodes `bytes` into `ppf`. color_hints may specify "color_space", which
 // defaults to sRGB.
@@ -34,6 +36,14 @@ Status DecodeImagePNM(Span<const uint8_t> bytes, const ColorHints& color_hints,
                       PackedPixelFile* ppf,
                       const SizeConstraints* constraints = nullptr);
 
+// Same as above, but leaves the pixels in `bytes` and only fills in the
+// metadata of `ppf`; `rows` reads the pixels from `bytes`, which must outlive
+// it. Fails for PAM files with extra channels other than alpha.
+Status DecodeImagePNMRows(Span<const uint8_t> bytes,
+                          const ColorHints& color_hints, PackedPixelFile* ppf,
+                          std::unique_ptr<RowReader>* rows,
+                          const SizeConstraints* constraints = nullptr);
+
 struct HeaderPNM {
   size_t xsize;
   size_t ysize;
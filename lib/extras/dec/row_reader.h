@@ -0,0 +1,57 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#ifndef JPEGLI_LIB_EXTRAS_DEC_ROW_READER_H_
+#define JPEGLI_LIB_EXTRAS_DEC_ROW_READER_H_
+
+// Row by row access to the pixels of a single frame image, for consumers that
+// do not need the whole decoded image in memory at once.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "lib/base/types.h"
+
+namespace jpegli {
+namespace extras {
+
+class RowReader {
+ public:
+  RowReader(size_t xsize, size_t ysize, const JpegliPixelFormat& format)
+      : xsize(xsize), ysize(ysize), format(format) {}
+  virtual ~RowReader() = default;
+
+  // Returns the interleaved pixels of row y, 0 <= y < ysize, in `format`
+  // without row padding. Rows may be requested in any order and more than
+  // once; the returned pointer is only valid until the next call.
+  virtual const uint8_t* Row(size_t y) = 0;
+
+  const size_t xsize;
+  const size_t ysize;
+  const JpegliPixelFormat format;
+};
+
+// Reads rows that are stored at a fixed, possibly negative, distance from each
+// other, e.g. in an in-memory PackedImage or a memory mapped PNM file.
+class StridedRowReader : public RowReader {
+ public:
+  StridedRowReader(const uint8_t* row0, ptrdiff_t row_step, size_t xsize,
+                   size_t ysize, const JpegliPixelFormat& format)
+      : RowReader(xsize, ysize, format), row0_(row0), row_step_(row_step) {}
+
+  const uint8_t* Row(size_t y) override {
+    return row0_ + static_cast<ptrdiff_t>(y) * row_step_;
+  }
+
+ private:
+  const uint8_t* row0_;
+  ptrdiff_t row_step_;
+};
+
+}  // namespace extras
+}  // namespace jpegli
+
+#endif  // JPEGLI_LIB_EXTRAS_DEC_ROW_READER_H_
@@ -28,6 +28,7 @@
 #include "lib/cms/cms.h"
 #include "lib/cms/color_encoding_internal.h"
 #include "lib/extras/codestream_header.h"
+#include "lib/extras/dec/row_reader.h"
 #include "lib/extras/enc/encode.h"
 #include "lib/extras/packed_image.h"
 #include "lib/extras/simd_util.h"
@@ -48,30 +49,43 @@ void MyErrorExit(j_common_ptr cinfo) {
   longjmp(*env, 1);
 }
 
-Status VerifyInput(const PackedPixelFile& ppf) {
-  const JpegliBasicInfo& info = ppf.info;
-  JPEGLI_RETURN_IF_ERROR(Encoder::VerifyBasicInfo(info));
+// Unlike MyErrorExit, leaves the compress object alive so that the caller can
+// reuse it for the next image.
+void ReusableErrorExit(j_common_ptr cinfo) {
+  jmp_buf* env = static_cast<jmp_buf*>(cinfo->client_data);
+  (*cinfo->err->output_message)(cinfo);
+  longjmp(*env, 1);
+}
+
+Status VerifyFrames(const PackedPixelFile& ppf) {
   if (ppf.frames.size() != 1) {
     return JPEGLI_FAILURE("JPEG input must have exactly one frame.");
   }
+  return Encoder::VerifyImageSize(ppf.frames[0].color, ppf.info);
+}
+
+Status VerifyInput(const PackedPixelFile& ppf, const RowReader& rows) {
+  const JpegliBasicInfo& info = ppf.info;
+  JPEGLI_RETURN_IF_ERROR(Encoder::VerifyBasicInfo(info));
   if (info.num_color_channels != 1 && info.num_color_channels != 3) {
     return JPEGLI_FAILURE("Invalid number of color channels %d",
                           info.num_color_channels);
   }
-  const PackedImage& image = ppf.frames[0].color;
-  JPEGLI_RETURN_IF_ERROR(Encoder::VerifyImageSize(image, info));
-  if (image.xsize != info.xsize || image.ysize != info.ysize) {
+  if (rows.xsize != info.xsize || rows.ysize != info.ysize) {
     return JPEGLI_FAILURE("Frame size does not match image size.");
   }
-  if (image.format.data_type == JPEGLI_TYPE_FLOAT16) {
+  if (rows.format.num_channels < info.num_color_channels) {
+    return JPEGLI_FAILURE("Too few channels in the input rows.");
+  }
+  if (rows.format.data_type == JPEGLI_TYPE_FLOAT16) {
     return JPEGLI_FAILURE("FLOAT16 input is not supported.");
   }
   JPEGLI_RETURN_IF_ERROR(
-      Encoder::VerifyBitDepth(image.format.data_type, info.bits_per_sample,
+      Encoder::VerifyBitDepth(rows.format.data_type, info.bits_per_sample,
                               info.exponent_bits_per_sample));
-  if ((image.format.data_type == JPEGLI_TYPE_UINT8 &&
+  if ((rows.format.data_type == JPEGLI_TYPE_UINT8 &&
        info.bits_per_sample != 8) ||
-      (image.format.data_type == JPEGLI_TYPE_UINT16 &&
+      (rows.format.data_type == JPEGLI_TYPE_UINT16 &&
        info.bits_per_sample != 16)) {
     return JPEGLI_FAILURE("Only full bit depth unsigned types are supported.");
   }
@@ -278,10 +292,15 @@ void ToFloatRow(const uint8_t* row_in, JpegliPixelFormat format, size_t xsize,
   }
 }
 
-Status EncodeJpegToTargetSize(const PackedPixelFile& ppf,
+Status EncodeJpegImpl(const PackedPixelFile& ppf, RowReader* rows,
+                      const JpegSettings& jpeg_settings,
+                      j_compress_ptr reused_cinfo, ThreadPool* pool,
+                      std::vector<uint8_t>* compressed);
+
+Status EncodeJpegToTargetSize(const PackedPixelFile& ppf, RowReader* rows,
                               const JpegSettings& jpeg_settings,
-                              size_t target_size, ThreadPool* pool,
-                              std::vector<uint8_t>* output) {
+                              size_t target_size, j_compress_ptr reused_cinfo,
+                              ThreadPool* pool, std::vector<uint8_t>* output) {
   output->clear();
   size_t best_error = std::numeric_limits<size_t>::max();
   float distance0 = -1.0f;
@@ -293,7 +312,8 @@ Status EncodeJpegToTargetSize(const PackedPixelFile& ppf,
     settings.distance = distance;
     settings.target_size = 0;
     std::vector<uint8_t> compressed;
-    JPEGLI_RETURN_IF_ERROR(EncodeJpeg(ppf, settings, pool, &compressed));
+    JPEGLI_RETURN_IF_ERROR(
+        EncodeJpegImpl(ppf, rows, settings, reused_cinfo, pool, &compressed));
     size_t size = compressed.size();
     // prefer being under the target size to being over it
     size_t error = size < target_size
@@ -323,11 +343,16 @@ Status EncodeJpegToTargetSize(const PackedPixelFile& ppf,
   return true;
 }
 
-}  // namespace
-
-Status EncodeJpeg(const PackedPixelFile& ppf, const JpegSettings& jpeg_settings,
-                  ThreadPool* pool, std::vector<uint8_t>* compressed) {
+// Encodes the pixels read from `rows` with the metadata of `ppf`. Uses
+// reused_cinfo if it is not null, otherwise a temporary compress object.
+Status EncodeJpegImpl(const PackedPixelFile& ppf, RowReader* rows,
+                      const JpegSettings& jpeg_settings,
+                      j_compress_ptr reused_cinfo, ThreadPool* pool,
+                      std::vector<uint8_t>* compressed) {
   if (jpeg_settings.libjpeg_quality > 0) {
+    if (ppf.frames.empty()) {
+      return JPEGLI_FAILURE("libjpeg_quality requires the decoded frame.");
+    }
     auto encoder = Encoder::FromExtension(".jpg");
     encoder->SetOption("q", std::to_string(jpeg_settings.libjpeg_quality));
     if (!jpeg_settings.libjpeg_chroma_subsampling.empty()) {
@@ -337,14 +362,15 @@ Status EncodeJpeg(const PackedPixelFile& ppf, const JpegSettings& jpeg_settings,
     EncodedImage encoded;
     JPEGLI_RETURN_IF_ERROR(encoder->Encode(ppf, &encoded, pool));
     size_t target_size = encoded.bitstreams[0].size();
-    return EncodeJpegToTargetSize(ppf, jpeg_settings, target_size, pool,
-                                  compressed);
+    return EncodeJpegToTargetSize(ppf, rows, jpeg_settings, target_size,
+                                  reused_cinfo, pool, compressed);
   }
   if (jpeg_settings.target_size > 0) {
-    return EncodeJpegToTargetSize(ppf, jpeg_settings, jpeg_settings.target_size,
+    return EncodeJpegToTargetSize(ppf, rows, jpeg_settings,
+                                  jpeg_settings.target_size, reused_cinfo,
                                   pool, compressed);
   }
-  JPEGLI_RETURN_IF_ERROR(VerifyInput(ppf));
+  JPEGLI_RETURN_IF_ERROR(VerifyInput(ppf, *rows));
 
   ColorEncoding color_encoding;
   JPEGLI_RETURN_IF_ERROR(GetColorEncoding(ppf, &color_encoding));
@@ -379,30 +405,38 @@ Status EncodeJpeg(const PackedPixelFile& ppf, const JpegSettings& jpeg_settings,
       hwy::AllocateAligned<float>(max_vector_size * 12);
   ComputePremulAbsorb(255.0f, premul_absorb.get());
 
-  jpeg_compress_struct cinfo;
+  jpeg_compress_struct local_cinfo;
+  j_compress_ptr cinfo = reused_cinfo ? reused_cinfo : &local_cinfo;
+  // The error manager of a reused object is only replaced during this call.
+  jpeg_error_mgr* saved_err = nullptr;
+  void* saved_client_data = nullptr;
+  if (reused_cinfo) {
+    saved_err = reused_cinfo->err;
+    saved_client_data = reused_cinfo->client_data;
+  }
   const auto try_catch_block = [&]() -> bool {
     jpeg_error_mgr jerr;
     jmp_buf env;
-    cinfo.err = jpegli_std_error(&jerr);
-    jerr.error_exit = &MyErrorExit;
+    cinfo->err = jpegli_std_error(&jerr);
+    jerr.error_exit = reused_cinfo ? &ReusableErrorExit : &MyErrorExit;
     if (setjmp(env)) {
       return false;
     }
-    cinfo.client_data = static_cast<void*>(&env);
-    jpegli_create_compress(&cinfo);
-    jpegli_mem_dest(&cinfo, &output_buffer, &output_size);
+    cinfo->client_data = static_cast<void*>(&env);
+    if (!reused_cinfo) jpegli_create_compress(cinfo);
+    jpegli_mem_dest(cinfo, &output_buffer, &output_size);
     const JpegliBasicInfo& info = ppf.info;
-    cinfo.image_width = info.xsize;
-    cinfo.image_height = info.ysize;
-    cinfo.input_components = info.num_color_channels;
-    cinfo.in_color_space =
-        cinfo.input_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    cinfo->image_width = info.xsize;
+    cinfo->image_height = info.ysize;
+    cinfo->input_components = info.num_color_channels;
+    cinfo->in_color_space =
+        cinfo->input_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
     if (jpeg_settings.xyb) {
-      jpegli_set_xyb_mode(&cinfo);
-      cinfo.input_components = 3;
-      cinfo.in_color_space = JCS_RGB;
+      jpegli_set_xyb_mode(cinfo);
+      cinfo->input_components = 3;
+      cinfo->in_color_space = JCS_RGB;
     } else if (jpeg_settings.use_std_quant_tables) {
-      jpegli_use_standard_quant_tables(&cinfo);
+      jpegli_use_standard_quant_tables(cinfo);
     }
     uint8_t cicp_tf = kUnknownTf;
     if (!jpeg_settings.app_data.empty()) {
@@ -412,139 +446,190 @@ Status EncodeJpeg(const PackedPixelFile& ppf, const JpegSettings& jpeg_settings,
       cicp_tf = LookupCICPTransferFunctionFromICCProfile(
           output_encoding.ICC().data(), output_encoding.ICC().size());
     }
-    jpegli_set_cicp_transfer_function(&cinfo, cicp_tf);
-    jpegli_set_defaults(&cinfo);
+    jpegli_set_cicp_transfer_function(cinfo, cicp_tf);
+    jpegli_set_defaults(cinfo);
     if (!jpeg_settings.chroma_subsampling.empty()) {
       if (jpeg_settings.chroma_subsampling == "444") {
-        cinfo.comp_info[0].h_samp_factor = 1;
-        cinfo.comp_info[0].v_samp_factor = 1;
+        cinfo->comp_info[0].h_samp_factor = 1;
+        cinfo->comp_info[0].v_samp_factor = 1;
       } else if (jpeg_settings.chroma_subsampling == "440") {
-        cinfo.comp_info[0].h_samp_factor = 1;
-        cinfo.comp_info[0].v_samp_factor = 2;
+        cinfo->comp_info[0].h_samp_factor = 1;
+        cinfo->comp_info[0].v_samp_factor = 2;
       } else if (jpeg_settings.chroma_subsampling == "422") {
-        cinfo.comp_info[0].h_samp_factor = 2;
-        cinfo.comp_info[0].v_samp_factor = 1;
+        cinfo->comp_info[0].h_samp_factor = 2;
+        cinfo->comp_info[0].v_samp_factor = 1;
       } else if (jpeg_settings.chroma_subsampling == "420") {
-        cinfo.comp_info[0].h_samp_factor = 2;
-        cinfo.comp_info[0].v_samp_factor = 2;
+        cinfo->comp_info[0].h_samp_factor = 2;
+        cinfo->comp_info[0].v_samp_factor = 2;
       } else {
         return false;
       }
-      for (int i = 1; i < cinfo.num_components; ++i) {
-        cinfo.comp_info[i].h_samp_factor = 1;
-        cinfo.comp_info[i].v_samp_factor = 1;
+      for (int i = 1; i < cinfo->num_components; ++i) {
+        cinfo->comp_info[i].h_samp_factor = 1;
+        cinfo->comp_info[i].v_samp_factor = 1;
       }
     } else if (!jpeg_settings.xyb) {
       // Default is no chroma subsampling.
-      cinfo.comp_info[0].h_samp_factor = 1;
-      cinfo.comp_info[0].v_samp_factor = 1;
+      cinfo->comp_info[0].h_samp_factor = 1;
+      cinfo->comp_info[0].v_samp_factor = 1;
     }
     jpegli_enable_adaptive_quantization(
-        &cinfo, TO_JPEGLI_BOOL(jpeg_settings.use_adaptive_quantization));
+        cinfo, TO_JPEGLI_BOOL(jpeg_settings.use_adaptive_quantization));
     if (jpeg_settings.psnr_target > 0.0) {
-      jpegli_set_psnr(&cinfo, jpeg_settings.psnr_target,
+      jpegli_set_psnr(cinfo, jpeg_settings.psnr_target,
                       jpeg_settings.search_tolerance,
                       jpeg_settings.min_distance, jpeg_settings.max_distance);
+    } else if (jpeg_settings.block_error_target > 0.0) {
+      // With a zero PSNR target this only sets the distance search range.
+      jpegli_set_psnr(cinfo, 0.0f, jpeg_settings.search_tolerance,
+                      jpeg_settings.min_distance, jpeg_settings.max_distance);
+      jpegli_set_max_block_error_target(cinfo,
+                                        jpeg_settings.block_error_target,
+                                        jpeg_settings.search_tolerance);
     } else if (jpeg_settings.quality > 0.0) {
       float distance = jpegli_quality_to_distance(jpeg_settings.quality);
-      jpegli_set_distance(&cinfo, distance, TRUE);
+      jpegli_set_distance(cinfo, distance, TRUE);
     } else {
-      jpegli_set_distance(&cinfo, jpeg_settings.distance, TRUE);
+      jpegli_set_distance(cinfo, jpeg_settings.distance, TRUE);
     }
-    jpegli_set_progressive_level(&cinfo, jpeg_settings.progressive_level);
-    cinfo.optimize_coding = TO_JPEGLI_BOOL(jpeg_settings.optimize_coding);
+    jpegli_set_progressive_level(cinfo, jpeg_settings.progressive_level);
+    jpegli_set_scan_optimization(cinfo, jpeg_settings.scan_search_ms);
+    cinfo->optimize_coding = TO_JPEGLI_BOOL(jpeg_settings.optimize_coding);
     if (!jpeg_settings.app_data.empty()) {
       // Make sure jpegli_start_compress() does not write any APP markers.
-      cinfo.write_JFIF_header = JPEGLI_FALSE;
-      cinfo.write_Adobe_marker = JPEGLI_FALSE;
+      cinfo->write_JFIF_header = JPEGLI_FALSE;
+      cinfo->write_Adobe_marker = JPEGLI_FALSE;
     }
-    const PackedImage& image = ppf.frames[0].color;
+    const JpegliPixelFormat& format = rows->format;
     if (jpeg_settings.xyb) {
-      jpegli_set_input_format(&cinfo, JPEGLI_TYPE_FLOAT, JPEGLI_NATIVE_ENDIAN);
+      jpegli_set_input_format(cinfo, JPEGLI_TYPE_FLOAT, JPEGLI_NATIVE_ENDIAN);
     } else {
-      jpegli_set_input_format(&cinfo, image.format.data_type,
-                              image.format.endianness);
+      jpegli_set_input_format(cinfo, format.data_type, format.endianness);
     }
-    jpegli_start_compress(&cinfo, TRUE);
+    // Also resets the runner of a reused compress object if there is no pool.
+    jpegli_set_parallel_runner(cinfo, pool ? pool->runner() : nullptr,
+                               pool ? pool->runner_opaque() : nullptr);
+    jpegli_start_compress(cinfo, TRUE);
     if (!jpeg_settings.app_data.empty()) {
-      JPEGLI_RETURN_IF_ERROR(WriteAppData(&cinfo, jpeg_settings.app_data));
+      JPEGLI_RETURN_IF_ERROR(WriteAppData(cinfo, jpeg_settings.app_data));
     }
     if ((jpeg_settings.app_data.empty() && !output_encoding.IsSRGB()) ||
         jpeg_settings.xyb) {
-      jpegli_write_icc_profile(&cinfo, output_encoding.ICC().data(),
+      jpegli_write_icc_profile(cinfo, output_encoding.ICC().data(),
                                output_encoding.ICC().size());
     }
-    const uint8_t* pixels = reinterpret_cast<const uint8_t*>(image.pixels());
+    const size_t xsize = rows->xsize;
     if (jpeg_settings.xyb) {
       float* src_buf = c_transform.BufSrc(0);
       float* dst_buf = c_transform.BufDst(0);
-      for (size_t y = 0; y < image.ysize; ++y) {
+      for (size_t y = 0; y < rows->ysize; ++y) {
         // convert to float
-        ToFloatRow(&pixels[y * image.stride], image.format, image.xsize,
-                   info.num_color_channels, src_buf);
+        ToFloatRow(rows->Row(y), format, xsize, info.num_color_channels,
+                   src_buf);
         // convert to linear srgb
-        if (!c_transform.Run(0, src_buf, dst_buf, image.xsize)) {
+        if (!c_transform.Run(0, src_buf, dst_buf, xsize)) {
           return false;
         }
         // deinterleave channels
         float* row0 = &xyb_tmp[0];
         float* row1 = &xyb_tmp[rowlen];
         float* row2 = &xyb_tmp[2 * rowlen];
-        for (size_t x = 0; x < image.xsize; ++x) {
+        for (size_t x = 0; x < xsize; ++x) {
           row0[x] = dst_buf[3 * x + 0];
           row1[x] = dst_buf[3 * x + 1];
           row2[x] = dst_buf[3 * x + 2];
         }
         // convert to xyb
-        LinearRGBRowToXYB(row0, row1, row2, premul_absorb.get(), image.xsize);
+        LinearRGBRowToXYB(row0, row1, row2, premul_absorb.get(), xsize);
         // scale xyb
-        ScaleXYBRow(row0, row1, row2, image.xsize);
+        ScaleXYBRow(row0, row1, row2, xsize);
         // interleave channels
         float* row_out = &xyb_tmp[3 * rowlen];
-        for (size_t x = 0; x < image.xsize; ++x) {
+        for (size_t x = 0; x < xsize; ++x) {
           row_out[3 * x + 0] = row0[x];
           row_out[3 * x + 1] = row1[x];
           row_out[3 * x + 2] = row2[x];
         }
         // feed to jpegli as native endian floats
         JSAMPROW row[] = {reinterpret_cast<uint8_t*>(row_out)};
-        jpegli_write_scanlines(&cinfo, row, 1);
+        jpegli_write_scanlines(cinfo, row, 1);
       }
     } else {
-      row_bytes.resize(image.stride);
-      if (cinfo.num_components == static_cast<int>(image.format.num_channels)) {
+      JPEGLI_RETURN_IF_ERROR(PackedImage::ValidateDataType(format.data_type));
+      const size_t bytes_per_channel =
+          PackedImage::BitsPerChannel(format.data_type) / 8;
+      const size_t pixel_stride = format.num_channels * bytes_per_channel;
+      row_bytes.resize(xsize * pixel_stride);
+      if (cinfo->num_components == static_cast<int>(format.num_channels)) {
         for (size_t y = 0; y < info.ysize; ++y) {
-          memcpy(row_bytes.data(), pixels + y * image.stride, image.stride);
+          memcpy(row_bytes.data(), rows->Row(y), row_bytes.size());
           JSAMPROW row[] = {row_bytes.data()};
-          jpegli_write_scanlines(&cinfo, row, 1);
+          jpegli_write_scanlines(cinfo, row, 1);
         }
       } else {
+        const size_t bytes_per_pixel =
+            cinfo->num_components * bytes_per_channel;
         for (size_t y = 0; y < info.ysize; ++y) {
-          JPEGLI_RETURN_IF_ERROR(
-              PackedImage::ValidateDataType(image.format.data_type));
-          int bytes_per_channel =
-              PackedImage::BitsPerChannel(image.format.data_type) / 8;
-          int bytes_per_pixel = cinfo.num_components * bytes_per_channel;
+          const uint8_t* pixels = rows->Row(y);
           for (size_t x = 0; x < info.xsize; ++x) {
-            memcpy(&row_bytes[x * bytes_per_pixel],
-                   &pixels[y * image.stride + x * image.pixel_stride()],
+            memcpy(&row_bytes[x * bytes_per_pixel], &pixels[x * pixel_stride],
                    bytes_per_pixel);
           }
           JSAMPROW row[] = {row_bytes.data()};
-          jpegli_write_scanlines(&cinfo, row, 1);
+          jpegli_write_scanlines(cinfo, row, 1);
         }
       }
     }
-    jpegli_finish_compress(&cinfo);
+    jpegli_finish_compress(cinfo);
     compressed->resize(output_size);
     std::copy_n(output_buffer, output_size, compressed->data());
     return true;
   };
   bool success = try_catch_block();
-  jpegli_destroy_compress(&cinfo);
+  if (reused_cinfo) {
+    reused_cinfo->err = saved_err;
+    reused_cinfo->client_data = saved_client_data;
+    if (!success) jpegli_abort_compress(reused_cinfo);
+  } else {
+    jpegli_destroy_compress(cinfo);
+  }
   if (output_buffer) free(output_buffer);
   return success;
 }
 
+// Reads the rows of the single frame of `ppf`.
+StridedRowReader FrameRows(const PackedPixelFile& ppf) {
+  const PackedImage& image = ppf.frames[0].color;
+  return StridedRowReader(reinterpret_cast<const uint8_t*>(image.pixels()),
+                          image.stride, image.xsize, image.ysize,
+                          image.format);
+}
+
+}  // namespace
+
+Status EncodeJpeg(const PackedPixelFile& ppf, const JpegSettings& jpeg_settings,
+                  ThreadPool* pool, std::vector<uint8_t>* compressed) {
+  JPEGLI_RETURN_IF_ERROR(VerifyFrames(ppf));
+  StridedRowReader rows = FrameRows(ppf);
+  return EncodeJpegImpl(ppf, &rows, jpeg_settings, nullptr, pool, compressed);
+}
+
+Status EncodeJpeg(const PackedPixelFile& ppf, const JpegSettings& jpeg_settings,
+                  jpeg_compress_struct* cinfo, ThreadPool* pool,
+                  std::vector<uint8_t>* compressed) {
+  JPEGLI_ENSURE(cinfo != nullptr);
+  JPEGLI_RETURN_IF_ERROR(VerifyFrames(ppf));
+  StridedRowReader rows = FrameRows(ppf);
+  return EncodeJpegImpl(ppf, &rows, jpeg_settings, cinfo, pool, compressed);
+}
+
+Status EncodeJpeg(const PackedPixelFile& ppf, RowReader* rows,
+                  const JpegSettings& jpeg_settings,
+                  jpeg_compress_struct* cinfo, ThreadPool* pool,
+                  std::vector<uint8_t>* compressed) {
+  JPEGLI_ENSURE(rows != nullptr);
+  return EncodeJpegImpl(ppf, rows, jpeg_settings, cinfo, pool, compressed);
+}
+
 }  // namespace extras
 }  // namespace jpegli
@@ -17,10 +17,13 @@
 #include "lib/base/data_parallel.h"
 #include "lib/base/status.h"
 
+struct jpeg_compress_struct;
+
 namespace jpegli {
 namespace extras {
 
 class PackedPixelFile;
+class RowReader;
 
 struct JpegSettings {
   bool xyb = false;
@@ -30,12 +33,16 @@ struct JpegSettings {
   bool use_adaptive_quantization = true;
   bool use_std_quant_tables = false;
   int progressive_level = 2;
+  // If positive, the time budget in milliseconds of the progressive scan
+  // script search, see jpegli_set_scan_optimization().
+  float scan_search_ms = 0.0f;
   bool optimize_coding = true;
   std::string chroma_subsampling;
   int libjpeg_quality = 0;
   std::string libjpeg_chroma_subsampling;
-  // Parameters for selecting distance based on PSNR target.
+  // Parameters for selecting distance based on PSNR or block error target.
   float psnr_target = 0.0f;
+  float block_error_target = 0.0f;
   float search_tolerance = 0.01;
   float min_distance = 0.1f;
   float max_distance = 25.0f;
@@ -49,6 +56,26 @@ struct JpegSettings {
 Status EncodeJpeg(const PackedPixelFile& ppf, const JpegSettings& jpeg_settings,
                   ThreadPool* pool, std::vector<uint8_t>* compressed);
 
+// Same as above, but uses a compress object that the caller created with
+// jpegli_create_compress(), so that it can be reused for many images. The
+// object is ready for the next image on return, also on failure. Parameters
+// that jpegli_set_defaults() does not reset (e.g. XYB mode) are sticky, so all
+// images encoded with the same object must use the same xyb and
+// use_std_quant_tables settings.
+Status EncodeJpeg(const PackedPixelFile& ppf, const JpegSettings& jpeg_settings,
+                  jpeg_compress_struct* cinfo, ThreadPool* pool,
+                  std::vector<uint8_t>* compressed);
+
+// Encodes the pixels read from `rows` with the metadata of `ppf`, whose frames
+// are ignored, e.g. those from DecodeBytesRows(). The pixels are passed to
+// jpegli row by row, so the input image never has to be in memory as a whole.
+// If `cinfo` is not null, it is used as in the overload above. The
+// libjpeg_quality setting is not supported.
+Status EncodeJpeg(const PackedPixelFile& ppf, RowReader* rows,
+                  const JpegSettings& jpeg_settings,
+                  jpeg_compress_struct* cinfo, ThreadPool* pool,
+                  std::vector<uint8_t>* compressed);
+
 }  // namespace extras
 }  // namespace jpegli
 
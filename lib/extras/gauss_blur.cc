@@ -4,7 +4,7 @@
 // license that can be found in the LICENSE file or at
 // https://developers.google.com/open-source/licenses/bsd
 
-#include "tools/gauss_blur.h"
+#include "lib/extras/gauss_blur.h"
 
 #include <algorithm>
 #include <cmath>
@@ -12,14 +12,18 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <utility>
+#include <vector>
 
 #include "lib/base/data_parallel.h"
 #include "lib/base/memory_manager.h"
 #include "lib/base/status.h"
+#include "lib/extras/image.h"
+#include "lib/extras/image_ops.h"
 #include "lib/extras/memory_manager_internal.h"
 
 #undef HWY_TARGET_INCLUDE
-#define HWY_TARGET_INCLUDE "tools/gauss_blur.cc"
+#define HWY_TARGET_INCLUDE "lib/extras/gauss_blur.cc"
 #include <hwy/cache_control.h>  // Prefetch
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
@@ -301,10 +305,10 @@ void VerticalBlock(const V& d1_1, const V& d1_3, const V& d1_5, const V& n2_1,
 }
 
 // Reads/writes one block (kVectors full vectors) in each row.
-template <size_t kVectors>
+template <size_t kVectors, class GetIn, class GetOut>
 void VerticalStrip(const RecursiveGaussian& rg, const size_t x,
                    const size_t ysize, float* ring_buffer, const float* zero,
-                   const GetConstRow& in, const GetRow& out) {
+                   const GetIn& in, const GetOut& out) {
   // We're iterating vertically, so use multiple full-length vectors (each lane
   // is one column of row n).
   using D = HWY_FULL(float);
@@ -373,45 +377,77 @@ void VerticalStrip(const RecursiveGaussian& rg, const size_t x,
   }
 }
 
-// Apply 1D vertical scan to multiple columns (one per vector lane).
-// Not yet parallelized.
-Status FastGaussianVertical(JpegliMemoryManager* memory_manager,
-                            const RecursiveGaussian& rg, const size_t xsize,
-                            const size_t ysize, const GetConstRow& in,
-                            const GetRow& out, ThreadPool* /* pool */) {
+// Apply 1D vertical scan to multiple columns (one per vector lane). Each task
+// processes one strip of columns, full cache lines wide except for the right
+// border, with its own ring buffer.
+template <class GetIn, class GetOut>
+Status FastGaussianVerticalT(JpegliMemoryManager* memory_manager,
+                             const RecursiveGaussian& rg, const size_t xsize,
+                             const size_t ysize, const GetIn& in,
+                             const GetOut& out, ThreadPool* pool) {
   const HWY_FULL(float) df;
   constexpr size_t kCacheLineLanes = 64 / sizeof(float);
   const size_t unroll = std::max<size_t>(kCacheLineLanes / Lanes(df), 4);
+  if (unroll != 4 && unroll != 8 && unroll != 16) {
+    return JPEGLI_UNREACHABLE("Unexpected vector size");
+  }
   const size_t fast_pace = unroll * Lanes(df);
   const size_t scratch_size =
       fast_pace * sizeof(float) * (1 + 3 * kRingBufferLen);
-  JPEGLI_ASSIGN_OR_RETURN(AlignedMemory mem,
-                          AlignedMemory::Create(memory_manager, scratch_size));
-  float* zero = mem.address<float>();
-  float* ring_buffer = zero + fast_pace;
-  memset(zero, 0, fast_pace * sizeof(float));
-  size_t x = 0;
-  if (unroll == 4) {
-    for (; x + fast_pace <= xsize; x += fast_pace) {
-      VerticalStrip<4>(rg, x, ysize, ring_buffer, zero, in, out);
-    }
-  } else if (unroll == 8) {
-    for (; x + fast_pace <= xsize; x += fast_pace) {
-      VerticalStrip<8>(rg, x, ysize, ring_buffer, zero, in, out);
+  const size_t num_fast_strips = xsize / fast_pace;
+  const size_t num_strips =
+      num_fast_strips + DivCeil(xsize - num_fast_strips * fast_pace, Lanes(df));
+  std::vector<AlignedMemory> scratch;
+  const auto init = [&](size_t num_threads) -> Status {
+    for (size_t i = 0; i < num_threads; ++i) {
+      JPEGLI_ASSIGN_OR_RETURN(
+          AlignedMemory mem,
+          AlignedMemory::Create(memory_manager, scratch_size));
+      memset(mem.address<float>(), 0, fast_pace * sizeof(float));
+      scratch.emplace_back(std::move(mem));
     }
-  } else if (unroll == 16) {
-    for (; x + fast_pace <= xsize; x += fast_pace) {
-      VerticalStrip<16>(rg, x, ysize, ring_buffer, zero, in, out);
+    return true;
+  };
+  const auto process_strip = [&](const uint32_t task,
+                                 size_t thread) -> Status {
+    float* zero = scratch[thread].address<float>();
+    float* ring_buffer = zero + fast_pace;
+    if (task < num_fast_strips) {
+      const size_t x = task * fast_pace;
+      if (unroll == 4) {
+        VerticalStrip<4>(rg, x, ysize, ring_buffer, zero, in, out);
+      } else if (unroll == 8) {
+        VerticalStrip<8>(rg, x, ysize, ring_buffer, zero, in, out);
+      } else {
+        VerticalStrip<16>(rg, x, ysize, ring_buffer, zero, in, out);
+      }
+    } else {
+      const size_t x =
+          num_fast_strips * fast_pace + (task - num_fast_strips) * Lanes(df);
+      VerticalStrip<1>(rg, x, ysize, ring_buffer, zero, in, out);
     }
-  } else {
-    return JPEGLI_UNREACHABLE("Unexpected vector size");
-  }
-  for (; x < xsize; x += Lanes(df)) {
-    VerticalStrip<1>(rg, x, ysize, ring_buffer, zero, in, out);
-  }
+    return true;
+  };
+  JPEGLI_RETURN_IF_ERROR(RunOnPool(pool, 0, num_strips, init, process_strip,
+                                   "FastGaussianVertical"));
   return true;
 }
 
+Status FastGaussianVertical(JpegliMemoryManager* memory_manager,
+                            const RecursiveGaussian& rg, const size_t xsize,
+                            const size_t ysize, const GetConstRow& in,
+                            const GetRow& out, ThreadPool* pool) {
+  return FastGaussianVerticalT(memory_manager, rg, xsize, ysize, in, out, pool);
+}
+
+Status FastGaussianVerticalImage(const RecursiveGaussian& rg, const ImageF& in,
+                                 ImageF* out, ThreadPool* pool) {
+  const auto in_row = [&](size_t y) { return in.ConstRow(y); };
+  const auto out_row = [&](size_t y) { return out->Row(y); };
+  return FastGaussianVerticalT(in.memory_manager(), rg, in.xsize(), in.ysize(),
+                               in_row, out_row, pool);
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jpegli
@@ -429,6 +465,7 @@ void FastGaussian1D(const RecursiveGaussian& rg, const size_t xsize,
 }
 
 HWY_EXPORT(FastGaussianVertical);  // Local function.
+HWY_EXPORT(FastGaussianVerticalImage);
 
 // Implements "Recursive Implementation of the Gaussian Filter Using Truncated
 // Cosine Functions" by Charalampidis [2016].
@@ -545,6 +582,27 @@ Status FastGaussianHorizontal(const RecursiveGaussian& rg, const size_t xsize,
 
 }  // namespace
 
+Status FastGaussianVertical(const RecursiveGaussian& rg, const ImageF& in,
+                            ImageF* out, ThreadPool* pool) {
+  JPEGLI_ENSURE(SameSize(in, *out));
+  return HWY_DYNAMIC_DISPATCH(FastGaussianVerticalImage)(rg, in, out, pool);
+}
+
+Status FastGaussian(const RecursiveGaussian& rg, const ImageF& in,
+                    ImageF* temp, ImageF* out, ThreadPool* pool) {
+  JPEGLI_ENSURE(SameSize(in, *temp));
+  JPEGLI_ENSURE(SameSize(in, *out));
+  const auto process_line = [&](const uint32_t task,
+                                size_t /*thread*/) -> Status {
+    const size_t y = task;
+    FastGaussian1D(rg, in.xsize(), in.ConstRow(y), temp->Row(y));
+    return true;
+  };
+  JPEGLI_RETURN_IF_ERROR(RunOnPool(pool, 0, in.ysize(), ThreadPool::NoInit,
+                                   process_line, "FastGaussianHorizontal"));
+  return FastGaussianVertical(rg, *temp, out, pool);
+}
+
 Status FastGaussian(JpegliMemoryManager* memory_manager,
                     const RecursiveGaussian& rg, const size_t xsize,
                     const size_t ysize, const GetConstRow& in,
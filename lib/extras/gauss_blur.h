@@ -4,8 +4,8 @@
 // license that can be found in the LICENSE file or at
 // https://developers.google.com/open-source/licenses/bsd
 
-#ifndef JPEGLI_TOOLS_GAUSS_BLUR_H_
-#define JPEGLI_TOOLS_GAUSS_BLUR_H_
+#ifndef JPEGLI_LIB_EXTRAS_GAUSS_BLUR_H_
+#define JPEGLI_LIB_EXTRAS_GAUSS_BLUR_H_
 
 #include <cstddef>
 #include <functional>
@@ -15,6 +15,7 @@
 #include "lib/base/data_parallel.h"
 #include "lib/base/memory_manager.h"
 #include "lib/base/status.h"
+#include "lib/extras/image.h"
 
 namespace jpegli {
 
@@ -59,6 +60,16 @@ Status FastGaussian(JpegliMemoryManager* memory_manager,
                     const GetConstRow& in, const GetRow& temp,
                     const GetRow& out, ThreadPool* pool = nullptr);
 
+// Same as above, without the per-row callbacks. `in`, `temp` and `out` must
+// have the same size, `temp` and `out` may not alias `in`.
+Status FastGaussian(const RecursiveGaussian& rg, const ImageF& in,
+                    ImageF* temp, ImageF* out, ThreadPool* pool = nullptr);
+
+// Vertical pass of the above, for callers that run their own horizontal pass
+// with FastGaussian1D.
+Status FastGaussianVertical(const RecursiveGaussian& rg, const ImageF& in,
+                            ImageF* out, ThreadPool* pool = nullptr);
+
 }  // namespace jpegli
 
-#endif  // JPEGLI_TOOLS_GAUSS_BLUR_H_
+#endif  // JPEGLI_LIB_EXTRAS_GAUSS_BLUR_H_
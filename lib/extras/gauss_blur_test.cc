@@ -4,7 +4,7 @@
 // license that can be found in the LICENSE file or at
 // https://developers.google.com/open-source/licenses/bsd
 
-#include "tools/gauss_blur.h"
+#include "lib/extras/gauss_blur.h"
 
 #include <algorithm>
 #include <cmath>
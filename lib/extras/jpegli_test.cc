@@ -6,6 +6,7 @@
 
 #include "lib/extras/dec/jpegli.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
@@ -17,6 +18,7 @@
 #include <utility>
 #include <vector>
 
+#include "lib/base/byte_order.h"
 #include "lib/base/memory_manager.h"
 #include "lib/base/span.h"
 #include "lib/base/status.h"
@@ -27,11 +29,13 @@
 #include "lib/extras/dec/color_hints.h"
 #include "lib/extras/dec/decode.h"
 #include "lib/extras/dec/jpg.h"
+#include "lib/extras/dec/row_reader.h"
 #include "lib/extras/enc/encode.h"
 #include "lib/extras/enc/jpegli.h"
 #include "lib/extras/enc/jpg.h"
 #include "lib/extras/metrics.h"
 #include "lib/extras/packed_image.h"
+#include "lib/extras/size_constraints.h"
 #include "lib/extras/test_image.h"
 #include "lib/extras/test_utils.h"
 
@@ -126,7 +130,7 @@ TEST(JpegliTest, JpegliSRGBDecodeTest) {
   ASSERT_TRUE(DecodeWithLibjpeg(compressed, &ppf1));
   PackedPixelFile ppf2;
   JpegDecompressParams dparams;
-  ASSERT_TRUE(DecodeJpeg(compressed, dparams, nullptr, &ppf2));
+  ASSERT_TRUE(DecodeJpeg(Bytes(compressed), dparams, nullptr, &ppf2));
   EXPECT_LT(ButteraugliDistance(memory_manager, ppf0, ppf2),
             ButteraugliDistance(memory_manager, ppf0, ppf1));
 }
@@ -147,11 +151,33 @@ TEST(JpegliTest, JpegliGrayscaleDecodeTest) {
   ASSERT_TRUE(DecodeWithLibjpeg(compressed, &ppf1));
   PackedPixelFile ppf2;
   JpegDecompressParams dparams;
-  ASSERT_TRUE(DecodeJpeg(compressed, dparams, nullptr, &ppf2));
+  ASSERT_TRUE(DecodeJpeg(Bytes(compressed), dparams, nullptr, &ppf2));
   EXPECT_LT(ButteraugliDistance(memory_manager, ppf0, ppf2),
             ButteraugliDistance(memory_manager, ppf0, ppf1));
 }
 
+TEST(JpegliTest, JpegliDecodeSizeConstraints) {
+  TEST_LIBJPEG_SUPPORT();
+  std::string testimage = "jxl/flower/flower_small.rgb.depth8.ppm";
+  PackedPixelFile ppf0;
+  ASSERT_TRUE(ReadTestImage(testimage, &ppf0));
+  std::vector<uint8_t> compressed;
+  ASSERT_TRUE(EncodeWithLibjpeg(ppf0, 90, &compressed));
+
+  const uint64_t num_pixels =
+      static_cast<uint64_t>(ppf0.info.xsize) * ppf0.info.ysize;
+  JpegDecompressParams dparams;
+  SizeConstraints constraints;
+  constraints.dec_max_pixels = num_pixels;
+  PackedPixelFile ppf1;
+  EXPECT_TRUE(DecodeJpeg(Bytes(compressed), dparams, nullptr, &ppf1,
+                         &constraints));
+  constraints.dec_max_pixels = num_pixels - 1;
+  PackedPixelFile ppf2;
+  EXPECT_FALSE(DecodeJpeg(Bytes(compressed), dparams, nullptr, &ppf2,
+                          &constraints));
+}
+
 TEST(JpegliTest, JpegliXYBEncodeTest) {
   TEST_LIBJPEG_SUPPORT();
   JpegliMemoryManager* memory_manager = jpegli::test::MemoryManager();
@@ -201,7 +227,7 @@ TEST(JpegliTest, JpegliDecodeTestLargeSmoothArea) {
 
   PackedPixelFile ppf1;
   JpegDecompressParams dparams;
-  ASSERT_TRUE(DecodeJpeg(compressed, dparams, nullptr, &ppf1));
+  ASSERT_TRUE(DecodeJpeg(Bytes(compressed), dparams, nullptr, &ppf1));
   EXPECT_LT(ButteraugliDistance(memory_manager, ppf0, ppf1), 3.0f);
 }
 
@@ -271,6 +297,32 @@ TEST(JpegliTest, JpegliYUVEncodeTestNoAq) {
                         1.25f);
 }
 
+// The block error target is not a butteraugli distance, this measures how the
+// butteraugli distance of the decoded image follows it.
+TEST(JpegliTest, JpegliBlockErrorTargetTest) {
+  TEST_LIBJPEG_SUPPORT();
+  JpegliMemoryManager* memory_manager = jpegli::test::MemoryManager();
+  std::string testimage = "jxl/flower/flower_small.rgb.depth8.ppm";
+  PackedPixelFile ppf_in;
+  ASSERT_TRUE(ReadTestImage(testimage, &ppf_in));
+  double prev_dist = 0.0;
+  for (float target : {1.0f, 2.0f, 3.0f}) {
+    std::vector<uint8_t> compressed;
+    JpegSettings settings;
+    settings.block_error_target = target;
+    ASSERT_TRUE(EncodeJpeg(ppf_in, settings, nullptr, &compressed));
+    PackedPixelFile ppf_out;
+    ASSERT_TRUE(DecodeWithLibjpeg(compressed, &ppf_out));
+    JPEGLI_TEST_ASSIGN_OR_DIE(
+        double dist, Butteraugli3Norm(memory_manager, ppf_in, ppf_out));
+    printf("target %.1f butteraugli 3-norm %.3f max %.3f\n", target, dist,
+           ButteraugliDistance(memory_manager, ppf_in, ppf_out));
+    EXPECT_LE(dist, target);
+    EXPECT_GT(dist, prev_dist);
+    prev_dist = dist;
+  }
+}
+
 TEST(JpegliTest, JpegliHDRRoundtripTest) {
   JpegliMemoryManager* memory_manager = jpegli::test::MemoryManager();
   std::string testimage = "jxl/hdr_room.png";
@@ -287,7 +339,7 @@ TEST(JpegliTest, JpegliHDRRoundtripTest) {
   PackedPixelFile ppf_out;
   JpegDecompressParams dparams;
   dparams.output_data_type = JPEGLI_TYPE_UINT16;
-  ASSERT_TRUE(DecodeJpeg(compressed, dparams, nullptr, &ppf_out));
+  ASSERT_TRUE(DecodeJpeg(Bytes(compressed), dparams, nullptr, &ppf_out));
   EXPECT_SLIGHTLY_BELOW(BitsPerPixel(ppf_in, compressed), 2.95f);
   EXPECT_SLIGHTLY_BELOW(ButteraugliDistance(memory_manager, ppf_in, ppf_out),
                         1.05f);
@@ -380,6 +432,84 @@ TEST(JpegliTest, JpegliEncodeRejectsMismatchedFrameSize) {
   EXPECT_FALSE(EncodeJpeg(ppf_in, settings, nullptr, &compressed));
 }
 
+void TestEncodeRowsMatchesFrameEncode(const std::vector<uint8_t>& encoded,
+                                      const ColorHints& color_hints) {
+  PackedPixelFile ppf_in;
+  ASSERT_TRUE(DecodeBytes(Bytes(encoded), color_hints, &ppf_in));
+  PackedPixelFile ppf_rows;
+  std::unique_ptr<RowReader> rows;
+  ASSERT_TRUE(DecodeBytesRows(Bytes(encoded), color_hints, &ppf_rows, &rows));
+  EXPECT_TRUE(ppf_rows.frames.empty());
+  EXPECT_EQ(ppf_in.info.xsize, rows->xsize);
+  EXPECT_EQ(ppf_in.info.ysize, rows->ysize);
+
+  for (bool xyb : {false, true}) {
+    JpegSettings settings;
+    settings.xyb = xyb;
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> compressed;
+    ASSERT_TRUE(EncodeJpeg(ppf_in, settings, nullptr, &expected));
+    ASSERT_TRUE(EncodeJpeg(ppf_rows, rows.get(), settings, nullptr, nullptr,
+                           &compressed));
+    EXPECT_EQ(expected, compressed);
+  }
+}
+
+std::vector<uint8_t> HeaderBytes(const std::string& header) {
+  return std::vector<uint8_t>(header.begin(), header.end());
+}
+
+TEST(JpegliTest, JpegliEncodeRowsMatchesFrameEncode) {
+  std::string testimage = "jxl/flower/flower_small.rgb.depth8.ppm";
+  ColorHints color_hints;
+  color_hints.Add("color_space", "RGB_D65_SRG_Rel_SRG");
+  TestEncodeRowsMatchesFrameEncode(jpegli::test::ReadTestData(testimage),
+                                   color_hints);
+}
+
+TEST(JpegliTest, JpegliEncodeRowsMatchesFrameEncodePGX) {
+  const size_t xsize = 67;
+  const size_t ysize = 45;
+  ColorHints color_hints;
+  color_hints.Add("color_space", "Gra_D65_Rel_SRG");
+  for (size_t bits : {8, 16}) {
+    std::vector<uint8_t> pgx =
+        HeaderBytes("PG ML + " + std::to_string(bits) + " " +
+                    std::to_string(xsize) + " " + std::to_string(ysize) + "\n");
+    for (size_t y = 0; y < ysize; ++y) {
+      for (size_t x = 0; x < xsize; ++x) {
+        uint32_t val = ((x * 7 + y * 13) % 256) << (bits - 8);
+        if (bits > 8) pgx.push_back(val >> 8);
+        pgx.push_back(val & 0xff);
+      }
+    }
+    TestEncodeRowsMatchesFrameEncode(pgx, color_hints);
+  }
+}
+
+TEST(JpegliTest, JpegliEncodeRowsMatchesFrameEncodePFM) {
+  // PFM rows are stored bottom-up, so the row reader uses a negative stride.
+  const size_t xsize = 67;
+  const size_t ysize = 45;
+  std::vector<uint8_t> pfm = HeaderBytes("PF\n" + std::to_string(xsize) + " " +
+                                         std::to_string(ysize) + "\n-1.0\n");
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      for (size_t c = 0; c < 3; ++c) {
+        float val = ((x * 7 + y * 13 + c * 50) % 256) / 255.0f;
+        uint8_t bytes[4];
+        memcpy(bytes, &val, 4);
+        // The -1.0 scale factor means little endian samples.
+        if (!IsLittleEndian()) std::reverse(bytes, bytes + 4);
+        pfm.insert(pfm.end(), bytes, bytes + 4);
+      }
+    }
+  }
+  ColorHints color_hints;
+  color_hints.Add("color_space", "RGB_D65_SRG_Rel_Lin");
+  TestEncodeRowsMatchesFrameEncode(pfm, color_hints);
+}
+
 struct TestConfig {
   int num_colors;
   int passes;
@@ -414,7 +544,7 @@ TEST_P(JpegliColorQuantTestParam, JpegliColorQuantizeTest) {
   dparams2.two_pass_quant = (config.passes == 2);
   dparams2.num_colors = config.num_colors;
   dparams2.dither_mode = config.dither;
-  ASSERT_TRUE(DecodeJpeg(compressed, dparams2, nullptr, &ppf2));
+  ASSERT_TRUE(DecodeJpeg(Bytes(compressed), dparams2, nullptr, &ppf2));
 
   JPEGLI_TEST_ASSIGN_OR_DIE(double dist1,
                             Butteraugli3Norm(memory_manager, ppf0, ppf1));
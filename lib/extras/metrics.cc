@@ -6,6 +6,7 @@
 
 #include "lib/extras/metrics.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cmath>
 #include <cstdio>
@@ -39,9 +40,12 @@ namespace HWY_NAMESPACE {
 
 // These templates are not found via ADL.
 using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::Div;
 using hwy::HWY_NAMESPACE::GetLane;
 using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
 using hwy::HWY_NAMESPACE::Rebind;
+using hwy::HWY_NAMESPACE::Sub;
 
 StatusOr<double> ComputeDistanceP(const ImageF& distmap,
                                   const ButteraugliParams& params, double p) {
@@ -148,26 +152,25 @@ StatusOr<double> ComputeDistanceP(const ImageF& distmap,
   }
 }
 
-Status ComputeSumOfSquares(JpegliMemoryManager* memory_manager,
-                           const extras::PackedPixelFile& a,
-                           const extras::PackedPixelFile& b,
-                           const JpegliCmsInterface& cms,
-                           double sum_of_squares[3]) {
-  sum_of_squares[0] = sum_of_squares[1] = sum_of_squares[2] =
-      std::numeric_limits<double>::max();
+// Number of rows of each image that the row-band metrics hold in float at a
+// time.
+constexpr size_t kMetricsBandRows = 128;
+
+// Converts both images to sRGB in bands of rows and calls
+// process_band(band_a, band_b, y0) for each band in top-to-bottom order.
+template <typename ProcessBand>
+Status ForEachSRGBBand(JpegliMemoryManager* memory_manager,
+                       const extras::PackedPixelFile& a,
+                       const extras::PackedPixelFile& b,
+                       const JpegliCmsInterface& cms, ThreadPool* pool,
+                       const ProcessBand& process_band) {
   const size_t xsize = a.xsize();
   const size_t ysize = a.ysize();
+  if (xsize == 0 || ysize == 0) return true;
   const bool is_gray = a.info.num_color_channels == 1;
   // Convert to sRGB - closer to perception than linear.
   ColorEncoding c_desired = ColorEncoding::SRGB(is_gray);
 
-  JPEGLI_ASSIGN_OR_RETURN(Image3F srgb0,
-                          Image3F::Create(memory_manager, xsize, ysize));
-  JPEGLI_RETURN_IF_ERROR(ConvertPackedPixelFileToImage3F(a, &srgb0, nullptr));
-  JPEGLI_ASSIGN_OR_RETURN(Image3F srgb1,
-                          Image3F::Create(memory_manager, xsize, ysize));
-  JPEGLI_RETURN_IF_ERROR(ConvertPackedPixelFileToImage3F(b, &srgb1, nullptr));
-
   ColorEncoding c_enc_a;
   ColorEncoding c_enc_b;
   JPEGLI_RETURN_IF_ERROR(GetColorEncoding(a, &c_enc_a));
@@ -175,47 +178,235 @@ Status ComputeSumOfSquares(JpegliMemoryManager* memory_manager,
   float intensity_a = GetIntensityTarget(a, c_enc_a);
   float intensity_b = GetIntensityTarget(b, c_enc_b);
 
-  if (!c_enc_a.SameColorEncoding(c_desired)) {
-    JPEGLI_RETURN_IF_ERROR(ApplyColorTransform(c_enc_a, intensity_a, srgb0,
-                                               nullptr, Rect(srgb0), c_desired,
-                                               cms, nullptr, &srgb0));
-  }
-  if (!c_enc_b.SameColorEncoding(c_desired)) {
-    JPEGLI_RETURN_IF_ERROR(ApplyColorTransform(c_enc_b, intensity_b, srgb1,
-                                               nullptr, Rect(srgb1), c_desired,
-                                               cms, nullptr, &srgb1));
+  const size_t band_rows = std::min(kMetricsBandRows, ysize);
+  JPEGLI_ASSIGN_OR_RETURN(Image3F srgb0,
+                          Image3F::Create(memory_manager, xsize, band_rows));
+  JPEGLI_ASSIGN_OR_RETURN(Image3F srgb1,
+                          Image3F::Create(memory_manager, xsize, band_rows));
+  for (size_t y0 = 0; y0 < ysize; y0 += band_rows) {
+    const size_t num_rows = std::min(band_rows, ysize - y0);
+    JPEGLI_RETURN_IF_ERROR(srgb0.ShrinkTo(xsize, num_rows));
+    JPEGLI_RETURN_IF_ERROR(srgb1.ShrinkTo(xsize, num_rows));
+    JPEGLI_RETURN_IF_ERROR(
+        ConvertPackedPixelFileRowsToImage3F(a, y0, &srgb0, pool));
+    JPEGLI_RETURN_IF_ERROR(
+        ConvertPackedPixelFileRowsToImage3F(b, y0, &srgb1, pool));
+    if (!c_enc_a.SameColorEncoding(c_desired)) {
+      JPEGLI_RETURN_IF_ERROR(ApplyColorTransform(c_enc_a, intensity_a, srgb0,
+                                                 nullptr, Rect(srgb0),
+                                                 c_desired, cms, pool, &srgb0));
+    }
+    if (!c_enc_b.SameColorEncoding(c_desired)) {
+      JPEGLI_RETURN_IF_ERROR(ApplyColorTransform(c_enc_b, intensity_b, srgb1,
+                                                 nullptr, Rect(srgb1),
+                                                 c_desired, cms, pool, &srgb1));
+    }
+    JPEGLI_RETURN_IF_ERROR(process_band(srgb0, srgb1, y0));
   }
+  return true;
+}
 
+Status ComputeSumOfSquares(JpegliMemoryManager* memory_manager,
+                           const extras::PackedPixelFile& a,
+                           const extras::PackedPixelFile& b,
+                           const JpegliCmsInterface& cms, ThreadPool* pool,
+                           double sum_of_squares[3]) {
   sum_of_squares[0] = sum_of_squares[1] = sum_of_squares[2] = 0.0;
 
   // TODO(veluca): SIMD.
   float yuvmatrix[3][3] = {{0.299, 0.587, 0.114},
                            {-0.14713, -0.28886, 0.436},
                            {0.615, -0.51499, -0.10001}};
-  for (size_t y = 0; y < ysize; ++y) {
-    const float* JPEGLI_RESTRICT row0[3];
-    const float* JPEGLI_RESTRICT row1[3];
-    for (size_t j = 0; j < 3; j++) {
-      row0[j] = srgb0.ConstPlaneRow(j, y);
-      row1[j] = srgb1.ConstPlaneRow(j, y);
-    }
-    for (size_t x = 0; x < xsize; ++x) {
-      float cdiff[3] = {};
-      // YUV conversion is linear, so we can run it on the difference.
+  const auto process_band = [&](const Image3F& srgb0, const Image3F& srgb1,
+                                size_t /*y0*/) -> Status {
+    for (size_t y = 0; y < srgb0.ysize(); ++y) {
+      const float* JPEGLI_RESTRICT row0[3];
+      const float* JPEGLI_RESTRICT row1[3];
       for (size_t j = 0; j < 3; j++) {
-        cdiff[j] = row0[j][x] - row1[j][x];
+        row0[j] = srgb0.ConstPlaneRow(j, y);
+        row1[j] = srgb1.ConstPlaneRow(j, y);
       }
-      float yuvdiff[3] = {};
-      for (size_t j = 0; j < 3; j++) {
-        for (size_t k = 0; k < 3; k++) {
-          yuvdiff[j] += yuvmatrix[j][k] * cdiff[k];
+      for (size_t x = 0; x < srgb0.xsize(); ++x) {
+        float cdiff[3] = {};
+        // YUV conversion is linear, so we can run it on the difference.
+        for (size_t j = 0; j < 3; j++) {
+          cdiff[j] = row0[j][x] - row1[j][x];
+        }
+        float yuvdiff[3] = {};
+        for (size_t j = 0; j < 3; j++) {
+          for (size_t k = 0; k < 3; k++) {
+            yuvdiff[j] += yuvmatrix[j][k] * cdiff[k];
+          }
+        }
+        for (size_t j = 0; j < 3; j++) {
+          sum_of_squares[j] += static_cast<double>(yuvdiff[j]) * yuvdiff[j];
         }
-      }
-      for (size_t j = 0; j < 3; j++) {
-        sum_of_squares[j] += static_cast<double>(yuvdiff[j]) * yuvdiff[j];
       }
     }
+    return true;
+  };
+  Status status =
+      ForEachSRGBBand(memory_manager, a, b, cms, pool, process_band);
+  if (!status) {
+    sum_of_squares[0] = sum_of_squares[1] = sum_of_squares[2] =
+        std::numeric_limits<double>::max();
+  }
+  return status;
+}
+
+// Radius of the 11x11 Gaussian window of SSIM.
+constexpr size_t kSsimRadius = 5;
+constexpr size_t kSsimWindow = 2 * kSsimRadius + 1;
+// Window means of a, b, a^2, b^2 and a*b.
+constexpr size_t kSsimNumStats = 5;
+constexpr float kSsimC1 = 0.01f * 0.01f;
+constexpr float kSsimC2 = 0.03f * 0.03f;
+
+float SsimValue(float mu_a, float mu_b, float aa, float bb, float ab) {
+  const float mu_ab = mu_a * mu_b;
+  const float mu_aa = mu_a * mu_a;
+  const float mu_bb = mu_b * mu_b;
+  const float num = (2.0f * mu_ab + kSsimC1) * (2.0f * (ab - mu_ab) + kSsimC2);
+  const float den =
+      (mu_aa + mu_bb + kSsimC1) * ((aa - mu_aa) + (bb - mu_bb) + kSsimC2);
+  return num / den;
+}
+
+// Computes the sum of the SSIM map of the sRGB luma of the two images. The
+// horizontally blurred window statistics of the last kSsimWindow luma rows are
+// kept in a ring buffer, and each row of the SSIM map is produced as soon as
+// all rows of its window are available. Borders are handled by clamping.
+Status ComputeSsimSum(JpegliMemoryManager* memory_manager,
+                      const extras::PackedPixelFile& a,
+                      const extras::PackedPixelFile& b,
+                      const JpegliCmsInterface& cms, ThreadPool* pool,
+                      double* ssim_sum) {
+  *ssim_sum = 0.0;
+  const size_t xsize = a.xsize();
+  const size_t ysize = a.ysize();
+  if (xsize == 0 || ysize == 0) return true;
+
+  float weights[kSsimWindow];
+  float weight_sum = 0.0f;
+  for (size_t k = 0; k < kSsimWindow; ++k) {
+    const float dx = static_cast<float>(k) - kSsimRadius;
+    weights[k] = std::exp(-dx * dx / (2.0f * 1.5f * 1.5f));
+    weight_sum += weights[k];
   }
+  for (float& w : weights) w /= weight_sum;
+
+  JPEGLI_ASSIGN_OR_RETURN(
+      ImageF ring,
+      ImageF::Create(memory_manager, xsize, kSsimNumStats * kSsimWindow));
+  JPEGLI_ASSIGN_OR_RETURN(ImageF luma,
+                          ImageF::Create(memory_manager, xsize, 2));
+  JPEGLI_ASSIGN_OR_RETURN(ImageF ssim,
+                          ImageF::Create(memory_manager, xsize, 1));
+  const auto ring_row = [&](size_t stat, size_t y) {
+    return ring.Row(stat * kSsimWindow + y % kSsimWindow);
+  };
+
+  const auto add_row = [&](const Image3F& srgb0, const Image3F& srgb1,
+                           size_t band_y, size_t y) {
+    float* JPEGLI_RESTRICT luma0 = luma.Row(0);
+    float* JPEGLI_RESTRICT luma1 = luma.Row(1);
+    for (size_t x = 0; x < xsize; ++x) {
+      luma0[x] = 0.299f * srgb0.ConstPlaneRow(0, band_y)[x] +
+                 0.587f * srgb0.ConstPlaneRow(1, band_y)[x] +
+                 0.114f * srgb0.ConstPlaneRow(2, band_y)[x];
+      luma1[x] = 0.299f * srgb1.ConstPlaneRow(0, band_y)[x] +
+                 0.587f * srgb1.ConstPlaneRow(1, band_y)[x] +
+                 0.114f * srgb1.ConstPlaneRow(2, band_y)[x];
+    }
+    float* JPEGLI_RESTRICT out[kSsimNumStats];
+    for (size_t s = 0; s < kSsimNumStats; ++s) out[s] = ring_row(s, y);
+    for (size_t x = 0; x < xsize; ++x) {
+      float sums[kSsimNumStats] = {};
+      const bool interior = x >= kSsimRadius && x + kSsimRadius < xsize;
+      for (size_t k = 0; k < kSsimWindow; ++k) {
+        size_t xx = x + k;
+        if (interior) {
+          xx -= kSsimRadius;
+        } else {
+          xx = xx < kSsimRadius ? 0 : std::min(xx - kSsimRadius, xsize - 1);
+        }
+        const float va = luma0[xx];
+        const float vb = luma1[xx];
+        const float w = weights[k];
+        sums[0] += w * va;
+        sums[1] += w * vb;
+        sums[2] += w * va * va;
+        sums[3] += w * vb * vb;
+        sums[4] += w * va * vb;
+      }
+      for (size_t s = 0; s < kSsimNumStats; ++s) out[s][x] = sums[s];
+    }
+  };
+
+  const HWY_FULL(float) df;
+  const size_t N = Lanes(df);
+  const auto emit_row = [&](size_t y) {
+    const float* JPEGLI_RESTRICT rows[kSsimNumStats][kSsimWindow];
+    for (size_t k = 0; k < kSsimWindow; ++k) {
+      size_t yy = y + k;
+      yy = yy < kSsimRadius ? 0 : std::min(yy - kSsimRadius, ysize - 1);
+      for (size_t s = 0; s < kSsimNumStats; ++s) rows[s][k] = ring_row(s, yy);
+    }
+    float* JPEGLI_RESTRICT ssim_row = ssim.Row(0);
+    size_t x = 0;
+    for (; x + N <= xsize; x += N) {
+      auto mu_a = Zero(df);
+      auto mu_b = Zero(df);
+      auto aa = Zero(df);
+      auto bb = Zero(df);
+      auto ab = Zero(df);
+      for (size_t k = 0; k < kSsimWindow; ++k) {
+        const auto w = Set(df, weights[k]);
+        mu_a = MulAdd(w, Load(df, rows[0][k] + x), mu_a);
+        mu_b = MulAdd(w, Load(df, rows[1][k] + x), mu_b);
+        aa = MulAdd(w, Load(df, rows[2][k] + x), aa);
+        bb = MulAdd(w, Load(df, rows[3][k] + x), bb);
+        ab = MulAdd(w, Load(df, rows[4][k] + x), ab);
+      }
+      const auto mu_ab = Mul(mu_a, mu_b);
+      const auto mu_aa = Mul(mu_a, mu_a);
+      const auto mu_bb = Mul(mu_b, mu_b);
+      const auto two = Set(df, 2.0f);
+      const auto c1 = Set(df, kSsimC1);
+      const auto c2 = Set(df, kSsimC2);
+      const auto num = Mul(MulAdd(two, mu_ab, c1),
+                           MulAdd(two, Sub(ab, mu_ab), c2));
+      const auto den = Mul(Add(Add(mu_aa, mu_bb), c1),
+                           Add(Add(Sub(aa, mu_aa), Sub(bb, mu_bb)), c2));
+      Store(Div(num, den), df, ssim_row + x);
+    }
+    for (; x < xsize; ++x) {
+      float sums[kSsimNumStats] = {};
+      for (size_t k = 0; k < kSsimWindow; ++k) {
+        for (size_t s = 0; s < kSsimNumStats; ++s) {
+          sums[s] += weights[k] * rows[s][k][x];
+        }
+      }
+      ssim_row[x] = SsimValue(sums[0], sums[1], sums[2], sums[3], sums[4]);
+    }
+    double row_sum = 0.0;
+    for (x = 0; x < xsize; ++x) row_sum += ssim_row[x];
+    *ssim_sum += row_sum;
+  };
+
+  size_t next_row = 0;
+  const auto process_band = [&](const Image3F& srgb0, const Image3F& srgb1,
+                                size_t y0) -> Status {
+    for (size_t dy = 0; dy < srgb0.ysize(); ++dy) {
+      add_row(srgb0, srgb1, dy, y0 + dy);
+      // Rows [next_row - kSsimRadius, next_row + kSsimRadius] are ready.
+      while (next_row + kSsimRadius <= y0 + dy) emit_row(next_row++);
+    }
+    return true;
+  };
+  JPEGLI_RETURN_IF_ERROR(
+      ForEachSRGBBand(memory_manager, a, b, cms, pool, process_band));
+  while (next_row < ysize) emit_row(next_row++);
   return true;
 }
 
@@ -230,11 +421,12 @@ namespace jpegli {
 namespace {
 Status ComputeButteraugli(const Image3F& ref, const Image3F& actual,
                           const ButteraugliParams& params,
-                          const JpegliCmsInterface& cms, float& score,
-                          ImageF* distmap) {
+                          const JpegliCmsInterface& cms, ThreadPool* pool,
+                          float& score, ImageF* distmap) {
   JpegliMemoryManager* memory_manager = ref.memory_manager();
   std::unique_ptr<ButteraugliComparator> comparator;
-  JPEGLI_ASSIGN_OR_RETURN(comparator, ButteraugliComparator::Make(ref, params));
+  JPEGLI_ASSIGN_OR_RETURN(comparator,
+                          ButteraugliComparator::Make(ref, params, pool));
   JPEGLI_ASSIGN_OR_RETURN(
       ImageF temp_distmap,
       ImageF::Create(memory_manager, ref.xsize(), ref.ysize()));
@@ -290,7 +482,7 @@ Status ButteraugliDistance(JpegliMemoryManager* memory_manager,
   }
 
   JPEGLI_RETURN_IF_ERROR(
-      ComputeButteraugli(rgb0, rgb1, params, cms, score, distmap));
+      ComputeButteraugli(rgb0, rgb1, params, cms, pool, score, distmap));
   return true;
 }
 
@@ -325,10 +517,32 @@ StatusOr<double> Butteraugli3Norm(JpegliMemoryManager* memory_manager,
 }
 
 HWY_EXPORT(ComputeSumOfSquares);
+
+Status ComputeMSE(JpegliMemoryManager* memory_manager,
+                  const extras::PackedPixelFile& a,
+                  const extras::PackedPixelFile& b,
+                  const JpegliCmsInterface& cms, double mse[3],
+                  ThreadPool* pool) {
+  if (a.xsize() != b.xsize() || a.ysize() != b.ysize()) {
+    return JPEGLI_FAILURE("Images must have the same size for MSE.");
+  }
+  if (a.info.num_color_channels != b.info.num_color_channels) {
+    return JPEGLI_FAILURE("Grayscale vs RGB comparison not supported.");
+  }
+  double sum_of_squares[3] = {};
+  JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(ComputeSumOfSquares)(
+      memory_manager, a, b, cms, pool, sum_of_squares));
+  const size_t input_pixels = a.xsize() * a.ysize();
+  for (int i = 0; i < 3; ++i) {
+    mse[i] = input_pixels == 0 ? 0.0 : sum_of_squares[i] / input_pixels;
+  }
+  return true;
+}
+
 double ComputePSNR(JpegliMemoryManager* memory_manager,
                    const extras::PackedPixelFile& a,
                    const extras::PackedPixelFile& b,
-                   const JpegliCmsInterface& cms) {
+                   const JpegliCmsInterface& cms, ThreadPool* pool) {
   if (a.xsize() != b.xsize() || a.ysize() != b.ysize()) {
     fprintf(stderr, "Images must have the same size for PSNR.");
     return 0.0;
@@ -338,8 +552,8 @@ double ComputePSNR(JpegliMemoryManager* memory_manager,
     return 0.0;
   }
   double sum_of_squares[3] = {};
-  Status ok = HWY_DYNAMIC_DISPATCH(ComputeSumOfSquares)(memory_manager, a, b,
-                                                        cms, sum_of_squares);
+  Status ok = HWY_DYNAMIC_DISPATCH(ComputeSumOfSquares)(
+      memory_manager, a, b, cms, pool, sum_of_squares);
   if (!ok) {
     fprintf(stderr, "ComputeSumOfSquares failed.");
     return 0.0;
@@ -356,5 +570,24 @@ double ComputePSNR(JpegliMemoryManager* memory_manager,
   return avg_psnr;
 }
 
+HWY_EXPORT(ComputeSsimSum);
+StatusOr<double> ComputeSSIM(JpegliMemoryManager* memory_manager,
+                             const extras::PackedPixelFile& a,
+                             const extras::PackedPixelFile& b,
+                             const JpegliCmsInterface& cms, ThreadPool* pool) {
+  if (a.xsize() != b.xsize() || a.ysize() != b.ysize()) {
+    return JPEGLI_FAILURE("Images must have the same size for SSIM.");
+  }
+  if (a.info.num_color_channels != b.info.num_color_channels) {
+    return JPEGLI_FAILURE("Grayscale vs RGB comparison not supported.");
+  }
+  const size_t input_pixels = a.xsize() * a.ysize();
+  if (input_pixels == 0) return 1.0;
+  double ssim_sum = 0.0;
+  JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(ComputeSsimSum)(
+      memory_manager, a, b, cms, pool, &ssim_sum));
+  return ssim_sum / input_pixels;
+}
+
 }  // namespace jpegli
 #endif
@@ -35,10 +35,30 @@ StatusOr<double> Butteraugli3Norm(JpegliMemoryManager* memory_manager,
                                   const extras::PackedPixelFile& b,
                                   ThreadPool* pool = nullptr);
 
+// The metrics below read the pixels of the first frame of both images in bands
+// of rows, converting each band to sRGB floats, so that their memory use does
+// not grow with the image height.
+
+// Computes the weighted average PSNR of the Y, U and V channels.
 double ComputePSNR(JpegliMemoryManager* memory_manager,
                    const extras::PackedPixelFile& a,
                    const extras::PackedPixelFile& b,
-                   const JpegliCmsInterface& cms);
+                   const JpegliCmsInterface& cms, ThreadPool* pool = nullptr);
+
+// Computes the mean squared error of the Y, U and V channels.
+Status ComputeMSE(JpegliMemoryManager* memory_manager,
+                  const extras::PackedPixelFile& a,
+                  const extras::PackedPixelFile& b,
+                  const JpegliCmsInterface& cms, double mse[3],
+                  ThreadPool* pool = nullptr);
+
+// Computes the mean SSIM of the luma channel, using an 11x11 Gaussian window
+// with a standard deviation of 1.5 pixels.
+StatusOr<double> ComputeSSIM(JpegliMemoryManager* memory_manager,
+                             const extras::PackedPixelFile& a,
+                             const extras::PackedPixelFile& b,
+                             const JpegliCmsInterface& cms,
+                             ThreadPool* pool = nullptr);
 
 }  // namespace jpegli
 
@@ -0,0 +1,180 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/extras/metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lib/base/memory_manager.h"
+#include "lib/base/testing.h"
+#include "lib/cms/cms.h"
+#include "lib/extras/image.h"
+#include "lib/extras/test_image.h"
+#include "lib/extras/test_memory_manager.h"
+#include "lib/extras/test_utils.h"
+#include "lib/threads/test_utils.h"
+
+namespace jpegli {
+namespace {
+
+using ::jpegli::test::GetColorImage;
+using ::jpegli::test::TestImage;
+using ::jpegli::test::ThreadPoolForTests;
+
+// Taller than one band of rows so that band boundaries are exercised.
+constexpr size_t kXSize = 123;
+constexpr size_t kYSize = 301;
+
+void MakeImage(TestImage* img, uint16_t seed, bool distort) {
+  ASSERT_TRUE(img->SetDimensions(kXSize, kYSize));
+  JPEGLI_TEST_ASSIGN_OR_DIE(auto frame, img->AddFrame());
+  frame.RandomFill(seed);
+  if (!distort) return;
+  for (size_t y = 100; y < 200; ++y) {
+    for (size_t x = 20; x < 60; ++x) {
+      ASSERT_TRUE(frame.SetValue(y, x, 1, 0.25f));
+    }
+  }
+}
+
+TEST(MetricsTest, IdenticalImages) {
+  JpegliMemoryManager* memory_manager = jpegli::test::MemoryManager();
+  const JpegliCmsInterface& cms = *JpegliGetDefaultCms();
+  TestImage img;
+  MakeImage(&img, 777, false);
+  EXPECT_EQ(99.99, ComputePSNR(memory_manager, img.ppf(), img.ppf(), cms));
+  double mse[3];
+  ASSERT_TRUE(ComputeMSE(memory_manager, img.ppf(), img.ppf(), cms, mse));
+  for (double v : mse) EXPECT_EQ(0.0, v);
+  JPEGLI_TEST_ASSIGN_OR_DIE(
+      double ssim, ComputeSSIM(memory_manager, img.ppf(), img.ppf(), cms));
+  EXPECT_NEAR(1.0, ssim, 1e-6);
+}
+
+TEST(MetricsTest, MSEMatchesFullImage) {
+  JpegliMemoryManager* memory_manager = jpegli::test::MemoryManager();
+  const JpegliCmsInterface& cms = *JpegliGetDefaultCms();
+  TestImage img0;
+  TestImage img1;
+  MakeImage(&img0, 777, false);
+  MakeImage(&img1, 777, true);
+  double mse[3];
+  ASSERT_TRUE(ComputeMSE(memory_manager, img0.ppf(), img1.ppf(), cms, mse));
+  JPEGLI_TEST_ASSIGN_OR_DIE(Image3F rgb0, GetColorImage(img0.ppf()));
+  JPEGLI_TEST_ASSIGN_OR_DIE(Image3F rgb1, GetColorImage(img1.ppf()));
+  // Only the green channel differs, so the Y error is 0.587 times the green
+  // error.
+  double expected = 0.0;
+  for (size_t y = 0; y < kYSize; ++y) {
+    for (size_t x = 0; x < kXSize; ++x) {
+      const double diff = 0.587f * (rgb0.ConstPlaneRow(1, y)[x] -
+                                    rgb1.ConstPlaneRow(1, y)[x]);
+      expected += diff * diff;
+    }
+  }
+  expected /= kXSize * kYSize;
+  EXPECT_GT(mse[0], 0.0);
+  EXPECT_NEAR(expected, mse[0], 1e-6 * expected);
+}
+
+// SSIM of the sRGB luma computed on the full frame, with the same window and
+// border clamping as ComputeSSIM.
+double FullImageSSIM(const Image3F& rgb0, const Image3F& rgb1) {
+  constexpr int kRadius = 5;
+  const int xsize = rgb0.xsize();
+  const int ysize = rgb0.ysize();
+  double weights[2 * kRadius + 1];
+  double weight_sum = 0.0;
+  for (int k = -kRadius; k <= kRadius; ++k) {
+    weights[k + kRadius] = std::exp(-k * k / (2.0 * 1.5 * 1.5));
+    weight_sum += weights[k + kRadius];
+  }
+  for (double& w : weights) w /= weight_sum;
+  std::vector<double> luma0(xsize * ysize);
+  std::vector<double> luma1(xsize * ysize);
+  for (int y = 0; y < ysize; ++y) {
+    for (int x = 0; x < xsize; ++x) {
+      luma0[y * xsize + x] = 0.299 * rgb0.ConstPlaneRow(0, y)[x] +
+                             0.587 * rgb0.ConstPlaneRow(1, y)[x] +
+                             0.114 * rgb0.ConstPlaneRow(2, y)[x];
+      luma1[y * xsize + x] = 0.299 * rgb1.ConstPlaneRow(0, y)[x] +
+                             0.587 * rgb1.ConstPlaneRow(1, y)[x] +
+                             0.114 * rgb1.ConstPlaneRow(2, y)[x];
+    }
+  }
+  const double c1 = 0.01 * 0.01;
+  const double c2 = 0.03 * 0.03;
+  double ssim_sum = 0.0;
+  for (int y = 0; y < ysize; ++y) {
+    for (int x = 0; x < xsize; ++x) {
+      double mu_a = 0.0;
+      double mu_b = 0.0;
+      double aa = 0.0;
+      double bb = 0.0;
+      double ab = 0.0;
+      for (int dy = -kRadius; dy <= kRadius; ++dy) {
+        const int yy = std::min(std::max(y + dy, 0), ysize - 1);
+        for (int dx = -kRadius; dx <= kRadius; ++dx) {
+          const int xx = std::min(std::max(x + dx, 0), xsize - 1);
+          const double w = weights[dy + kRadius] * weights[dx + kRadius];
+          const double va = luma0[yy * xsize + xx];
+          const double vb = luma1[yy * xsize + xx];
+          mu_a += w * va;
+          mu_b += w * vb;
+          aa += w * va * va;
+          bb += w * vb * vb;
+          ab += w * va * vb;
+        }
+      }
+      const double num = (2 * mu_a * mu_b + c1) * (2 * (ab - mu_a * mu_b) + c2);
+      const double den = (mu_a * mu_a + mu_b * mu_b + c1) *
+                         ((aa - mu_a * mu_a) + (bb - mu_b * mu_b) + c2);
+      ssim_sum += num / den;
+    }
+  }
+  return ssim_sum / (xsize * ysize);
+}
+
+TEST(MetricsTest, SSIMMatchesFullImage) {
+  JpegliMemoryManager* memory_manager = jpegli::test::MemoryManager();
+  const JpegliCmsInterface& cms = *JpegliGetDefaultCms();
+  TestImage img0;
+  TestImage img1;
+  MakeImage(&img0, 777, false);
+  MakeImage(&img1, 777, true);
+  JPEGLI_TEST_ASSIGN_OR_DIE(
+      double ssim, ComputeSSIM(memory_manager, img0.ppf(), img1.ppf(), cms));
+  JPEGLI_TEST_ASSIGN_OR_DIE(Image3F rgb0, GetColorImage(img0.ppf()));
+  JPEGLI_TEST_ASSIGN_OR_DIE(Image3F rgb1, GetColorImage(img1.ppf()));
+  const double expected = FullImageSSIM(rgb0, rgb1);
+  EXPECT_LT(expected, 0.99);
+  EXPECT_NEAR(expected, ssim, 1e-5);
+}
+
+TEST(MetricsTest, SSIMThreadPoolGivesSameResult) {
+  JpegliMemoryManager* memory_manager = jpegli::test::MemoryManager();
+  const JpegliCmsInterface& cms = *JpegliGetDefaultCms();
+  TestImage img0;
+  TestImage img1;
+  MakeImage(&img0, 777, false);
+  MakeImage(&img1, 777, true);
+  JPEGLI_TEST_ASSIGN_OR_DIE(
+      double ssim, ComputeSSIM(memory_manager, img0.ppf(), img1.ppf(), cms));
+  EXPECT_LT(ssim, 0.99);
+  EXPECT_GT(ssim, 0.0);
+  ThreadPoolForTests pool(8);
+  JPEGLI_TEST_ASSIGN_OR_DIE(
+      double ssim_mt,
+      ComputeSSIM(memory_manager, img0.ppf(), img1.ppf(), cms, pool.get()));
+  EXPECT_EQ(ssim, ssim_mt);
+}
+
+}  // namespace
+}  // namespace jpegli
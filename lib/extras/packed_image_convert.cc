@@ -476,6 +476,33 @@ Status ConvertPackedPixelFileToImage3F(const extras::PackedPixelFile& ppf,
   return true;
 }
 
+Status ConvertPackedPixelFileRowsToImage3F(const extras::PackedPixelFile& ppf,
+                                           size_t y0, Image3F* color,
+                                           ThreadPool* pool) {
+  JPEGLI_RETURN_IF_ERROR(!ppf.frames.empty());
+  const extras::PackedImage& img = ppf.frames[0].color;
+  const size_t num_rows = color->ysize();
+  JPEGLI_ENSURE(color->xsize() == img.xsize);
+  JPEGLI_ENSURE(y0 + num_rows <= img.ysize);
+  if (num_rows == 0) return true;
+  size_t bits_per_sample =
+      ppf.input_bitdepth.type == JPEGLI_BIT_DEPTH_FROM_PIXEL_FORMAT
+          ? extras::PackedImage::BitsPerChannel(img.format.data_type)
+          : ppf.info.bits_per_sample;
+  const uint8_t* data =
+      reinterpret_cast<const uint8_t*>(img.pixels()) + y0 * img.stride;
+  for (size_t c = 0; c < ppf.info.num_color_channels; ++c) {
+    JPEGLI_RETURN_IF_ERROR(ConvertFromExternalNoSizeCheck(
+        data, img.xsize, num_rows, img.stride, bits_per_sample, img.format, c,
+        pool, &color->Plane(c)));
+  }
+  if (ppf.info.num_color_channels == 1) {
+    JPEGLI_RETURN_IF_ERROR(CopyImageTo(color->Plane(0), &color->Plane(1)));
+    JPEGLI_RETURN_IF_ERROR(CopyImageTo(color->Plane(0), &color->Plane(2)));
+  }
+  return true;
+}
+
 StatusOr<PackedPixelFile> ConvertImage3FToPackedPixelFile(
     const Image3F& image, const ColorEncoding& c_enc, JpegliPixelFormat format,
     ThreadPool* pool) {
@@ -29,6 +29,12 @@ Status ConvertPackedPixelFileToImage3F(const extras::PackedPixelFile& ppf,
                                        Image3F* color,
                                        ThreadPool* pool = nullptr);
 
+// Converts rows [y0, y0 + color->ysize()) of the first frame of 'ppf' to
+// float. 'color' must have the width of the image.
+Status ConvertPackedPixelFileRowsToImage3F(const extras::PackedPixelFile& ppf,
+                                           size_t y0, Image3F* color,
+                                           ThreadPool* pool = nullptr);
+
 StatusOr<PackedPixelFile> ConvertImage3FToPackedPixelFile(
     const Image3F& image, const ColorEncoding& c_enc, JpegliPixelFormat format,
     ThreadPool* pool);
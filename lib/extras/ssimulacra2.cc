@@ -0,0 +1,741 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+/*
+SSIMULACRA 2
+Structural SIMilarity Unveiling Local And Compression Related Artifacts
+
+Perceptual metric developed by Jon Sneyers (Cloudinary) in July 2022,
+updated in April 2023.
+Design:
+- XYB color space (rescaled to a 0..1 range and with B-Y)
+- SSIM map (with correction: no double gamma correction)
+- 'blockiness/ringing' map (distorted has edges where original is smooth)
+- 'smoothing' map (distorted is smooth where original has edges)
+- error maps are computed at 6 scales (1:1 to 1:32) for each component (X,Y,B)
+- downscaling is done in linear RGB
+- for all 6*3*3=54 maps, two norms are computed: 1-norm (mean) and 4-norm
+- a weighted sum of these 54*2=108 norms leads to the final score
+- weights were tuned based on a large set of subjective scores
+  (CID22, TID2013, Kadid10k, KonFiG-IQA).
+*/
+
+#include "lib/extras/ssimulacra2.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <hwy/aligned_allocator.h>
+#include <utility>
+#include <vector>
+
+#include "lib/base/common.h"
+#include "lib/base/compiler_specific.h"
+#include "lib/base/data_parallel.h"
+#include "lib/base/memory_manager.h"
+#include "lib/base/printf_macros.h"
+#include "lib/base/rect.h"
+#include "lib/base/status.h"
+#include "lib/cms/cms.h"
+#include "lib/cms/color_encoding_internal.h"
+#include "lib/extras/gauss_blur.h"
+#include "lib/extras/image.h"
+#include "lib/extras/image_color_transform.h"
+#include "lib/extras/image_ops.h"
+#include "lib/extras/packed_image_convert.h"
+#include "lib/extras/simd_util.h"
+#include "lib/extras/xyb_transform.h"
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/extras/ssimulacra2.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+HWY_BEFORE_NAMESPACE();
+namespace jpegli {
+namespace HWY_NAMESPACE {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Abs;
+using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::Div;
+using hwy::HWY_NAMESPACE::GetLane;
+using hwy::HWY_NAMESPACE::LoadInterleaved2;
+using hwy::HWY_NAMESPACE::Max;
+using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
+using hwy::HWY_NAMESPACE::Neg;
+using hwy::HWY_NAMESPACE::Sub;
+using hwy::HWY_NAMESPACE::SumOfLanes;
+using hwy::HWY_NAMESPACE::Vec;
+using hwy::HWY_NAMESPACE::Zero;
+
+using D = HWY_FULL(float);
+
+const float kC2 = 0.0009f;
+
+// Number of sums per channel and row in ComputeScaleStats: the 1-norm and
+// 4-norm sums of the SSIM, ringing and blurring error maps.
+constexpr size_t kNumSums = 6;
+
+/* Converts linear sRGB to XYB, then gets all components in more or less 0..1
+   range. Range of Rec2020 with these adjustments:
+    X: 0.017223..0.998838
+    Y: 0.010000..0.855303
+    B: 0.048759..0.989551
+   Range of sRGB:
+    X: 0.204594..0.813402
+    Y: 0.010000..0.855308
+    B: 0.272295..0.938012
+   The maximum pixel-wise difference has to be <= 1 for the ssim formula to make
+   sense.
+*/
+Status LinearToPositiveXYB(const float* premul_absorb, ThreadPool* pool,
+                           Image3F* image) {
+  const D d;
+  const size_t xsize = image->xsize();
+  const auto process_row = [&](const uint32_t task,
+                               size_t /*thread*/) -> Status {
+    const size_t y = static_cast<size_t>(task);
+    float* JPEGLI_RESTRICT row_x = image->PlaneRow(0, y);
+    float* JPEGLI_RESTRICT row_y = image->PlaneRow(1, y);
+    float* JPEGLI_RESTRICT row_b = image->PlaneRow(2, y);
+    LinearRGBRowToXYB(row_x, row_y, row_b, premul_absorb, xsize);
+    const auto mul_x = Set(d, 14.f);
+    const auto offset_x = Set(d, 0.42f);
+    const auto offset_y = Set(d, 0.01f);
+    const auto offset_b = Set(d, 0.55f);
+    for (size_t x = 0; x < xsize; x += Lanes(d)) {
+      const auto vx = Load(d, row_x + x);
+      const auto vy = Load(d, row_y + x);
+      const auto vb = Load(d, row_b + x);
+      Store(Add(Sub(vb, vy), offset_b), d, row_b + x);
+      Store(Add(Mul(vx, mul_x), offset_x), d, row_x + x);
+      Store(Add(vy, offset_y), d, row_y + x);
+    }
+    return true;
+  };
+  JPEGLI_RETURN_IF_ERROR(RunOnPool(pool, 0, image->ysize(), ThreadPool::NoInit,
+                                   process_row, "LinearToPositiveXYB"));
+  return true;
+}
+
+// 2x2 box downsampling, the last column and row are replicated for odd sizes.
+Status Downsample2x2(const Image3F& in, ThreadPool* pool, Image3F* out) {
+  const D d;
+  const size_t in_xsize = in.xsize();
+  const size_t in_ysize = in.ysize();
+  const size_t out_xsize = out->xsize();
+  const size_t out_ysize = out->ysize();
+  JPEGLI_ENSURE(out_xsize == DivCeil(in_xsize, 2));
+  JPEGLI_ENSURE(out_ysize == DivCeil(in_ysize, 2));
+  // Output pixels whose inputs are all inside the row.
+  const size_t interior_xsize = in_xsize / 2;
+  const auto process_row = [&](const uint32_t task,
+                               size_t /*thread*/) -> Status {
+    const size_t c = task / out_ysize;
+    const size_t oy = task % out_ysize;
+    const float* JPEGLI_RESTRICT row0 = in.ConstPlaneRow(c, 2 * oy);
+    const float* JPEGLI_RESTRICT row1 =
+        in.ConstPlaneRow(c, std::min(2 * oy + 1, in_ysize - 1));
+    float* JPEGLI_RESTRICT row_out = out->PlaneRow(c, oy);
+    const auto normalize = Set(d, 0.25f);
+    size_t ox = 0;
+    for (; ox + Lanes(d) <= interior_xsize; ox += Lanes(d)) {
+      Vec<D> even0;
+      Vec<D> odd0;
+      Vec<D> even1;
+      Vec<D> odd1;
+      LoadInterleaved2(d, row0 + 2 * ox, even0, odd0);
+      LoadInterleaved2(d, row1 + 2 * ox, even1, odd1);
+      const auto sum = Add(Add(Add(even0, odd0), even1), odd1);
+      Store(Mul(sum, normalize), d, row_out + ox);
+    }
+    for (; ox < out_xsize; ++ox) {
+      const size_t x0 = 2 * ox;
+      const size_t x1 = std::min(x0 + 1, in_xsize - 1);
+      float sum = row0[x0];
+      sum += row0[x1];
+      sum += row1[x0];
+      sum += row1[x1];
+      row_out[ox] = sum * 0.25f;
+    }
+    return true;
+  };
+  JPEGLI_RETURN_IF_ERROR(RunOnPool(pool, 0, 3 * out_ysize, ThreadPool::NoInit,
+                                   process_row, "Downsample2x2"));
+  return true;
+}
+
+// Blurs the product of a and b without storing it: each row of the product
+// goes to a per-thread buffer right before its horizontal pass.
+Status BlurProduct(const RecursiveGaussian& rg, const ImageF& a,
+                   const ImageF& b, ThreadPool* pool, ImageF* temp,
+                   ImageF* out) {
+  const D d;
+  const size_t xsize = a.xsize();
+  ImageF product_rows;
+  const auto init = [&](size_t num_threads) -> Status {
+    JPEGLI_ASSIGN_OR_RETURN(
+        product_rows, ImageF::Create(a.memory_manager(), xsize, num_threads));
+    return true;
+  };
+  const auto process_row = [&](const uint32_t task, size_t thread) -> Status {
+    const size_t y = static_cast<size_t>(task);
+    const float* JPEGLI_RESTRICT row_a = a.ConstRow(y);
+    const float* JPEGLI_RESTRICT row_b = b.ConstRow(y);
+    float* JPEGLI_RESTRICT row_product = product_rows.Row(thread);
+    for (size_t x = 0; x < xsize; x += Lanes(d)) {
+      Store(Mul(Load(d, row_a + x), Load(d, row_b + x)), d, row_product + x);
+    }
+    FastGaussian1D(rg, xsize, row_product, temp->Row(y));
+    return true;
+  };
+  JPEGLI_RETURN_IF_ERROR(
+      RunOnPool(pool, 0, a.ysize(), init, process_row, "BlurProduct"));
+  return FastGaussianVertical(rg, *temp, out, pool);
+}
+
+double quartic(double x) {
+  x *= x;
+  x *= x;
+  return x;
+}
+
+// Computes the SSIM and edge difference maps of one scale in one pass and
+// accumulates their norms per row, which are then summed in row order so that
+// the result does not depend on the number of threads.
+Status ComputeScaleStats(const Image3F& img1, const Image3F& m1,
+                         const Image3F& s11, const Image3F& img2,
+                         const Image3F& m2, const Image3F& s22,
+                         const Image3F& s12, ThreadPool* pool,
+                         MsssimScale* sscale) {
+  const D d;
+  const size_t xsize = img1.xsize();
+  const size_t ysize = img1.ysize();
+  std::vector<double> row_sums(3 * ysize * kNumSums);
+  const auto process_row = [&](const uint32_t task,
+                               size_t /*thread*/) -> Status {
+    const size_t c = task / ysize;
+    const size_t y = task % ysize;
+    const float* JPEGLI_RESTRICT row1 = img1.ConstPlaneRow(c, y);
+    const float* JPEGLI_RESTRICT row2 = img2.ConstPlaneRow(c, y);
+    const float* JPEGLI_RESTRICT row_m1 = m1.ConstPlaneRow(c, y);
+    const float* JPEGLI_RESTRICT row_m2 = m2.ConstPlaneRow(c, y);
+    const float* JPEGLI_RESTRICT row_s11 = s11.ConstPlaneRow(c, y);
+    const float* JPEGLI_RESTRICT row_s22 = s22.ConstPlaneRow(c, y);
+    const float* JPEGLI_RESTRICT row_s12 = s12.ConstPlaneRow(c, y);
+    double* sums = &row_sums[task * kNumSums];
+    const auto one = Set(d, 1.0f);
+    const auto two = Set(d, 2.0f);
+    const auto c2 = Set(d, kC2);
+    auto ssim1 = Zero(d);
+    auto ssim4 = Zero(d);
+    auto artifact1 = Zero(d);
+    auto artifact4 = Zero(d);
+    auto detail_lost1 = Zero(d);
+    auto detail_lost4 = Zero(d);
+    size_t x = 0;
+    for (; x + Lanes(d) <= xsize; x += Lanes(d)) {
+      const auto mu1 = Load(d, row_m1 + x);
+      const auto mu2 = Load(d, row_m2 + x);
+      // See the scalar loop below for the formulas.
+      const auto mu_diff = Sub(mu1, mu2);
+      const auto num_m = Sub(one, Mul(mu_diff, mu_diff));
+      const auto num_s =
+          Add(Mul(two, Sub(Load(d, row_s12 + x), Mul(mu1, mu2))), c2);
+      const auto denom_s = Add(Add(Sub(Load(d, row_s11 + x), Mul(mu1, mu1)),
+                                   Sub(Load(d, row_s22 + x), Mul(mu2, mu2))),
+                               c2);
+      const auto ssim = Max(Sub(one, Div(Mul(num_m, num_s), denom_s)), Zero(d));
+      const auto ssim_sq = Mul(ssim, ssim);
+      ssim1 = Add(ssim1, ssim);
+      ssim4 = MulAdd(ssim_sq, ssim_sq, ssim4);
+
+      const auto edge1 = Add(one, Abs(Sub(Load(d, row1 + x), mu1)));
+      const auto edge2 = Add(one, Abs(Sub(Load(d, row2 + x), mu2)));
+      const auto d1 = Sub(Div(edge2, edge1), one);
+      const auto artifact = Max(d1, Zero(d));
+      const auto artifact_sq = Mul(artifact, artifact);
+      artifact1 = Add(artifact1, artifact);
+      artifact4 = MulAdd(artifact_sq, artifact_sq, artifact4);
+      const auto detail_lost = Max(Neg(d1), Zero(d));
+      const auto detail_lost_sq = Mul(detail_lost, detail_lost);
+      detail_lost1 = Add(detail_lost1, detail_lost);
+      detail_lost4 = MulAdd(detail_lost_sq, detail_lost_sq, detail_lost4);
+    }
+    sums[0] = GetLane(SumOfLanes(d, ssim1));
+    sums[1] = GetLane(SumOfLanes(d, ssim4));
+    sums[2] = GetLane(SumOfLanes(d, artifact1));
+    sums[3] = GetLane(SumOfLanes(d, artifact4));
+    sums[4] = GetLane(SumOfLanes(d, detail_lost1));
+    sums[5] = GetLane(SumOfLanes(d, detail_lost4));
+    for (; x < xsize; ++x) {
+      float mu1 = row_m1[x];
+      float mu2 = row_m2[x];
+      float mu11 = mu1 * mu1;
+      float mu22 = mu2 * mu2;
+      float mu12 = mu1 * mu2;
+      /* Correction applied compared to the original SSIM formula, which has:
+
+           luma_err = 2 * mu1 * mu2 / (mu1^2 + mu2^2)
+                    = 1 - (mu1 - mu2)^2 / (mu1^2 + mu2^2)
+
+         The denominator causes error in the darks (low mu1 and mu2) to weigh
+         more than error in the brights (high mu1 and mu2). This would make
+         sense if values correspond to linear luma. However, the actual values
+         are either gamma-compressed luma (which supposedly is already
+         perceptually uniform) or chroma (where weighing green more than red
+         or blue more than yellow does not make any sense at all). So it is
+         better to simply drop this denominator.
+      */
+      float num_m = 1.0 - (mu1 - mu2) * (mu1 - mu2);
+      float num_s = 2 * (row_s12[x] - mu12) + kC2;
+      float denom_s = (row_s11[x] - mu11) + (row_s22[x] - mu22) + kC2;
+
+      // Use 1 - SSIM' so it becomes an error score instead of a quality
+      // index. This makes it make sense to compute an L_4 norm.
+      double ssim = 1.0 - (num_m * num_s / denom_s);
+      ssim = std::max(ssim, 0.0);
+      sums[0] += ssim;
+      sums[1] += quartic(ssim);
+
+      double d1 = (1.0 + std::abs(row2[x] - row_m2[x])) /
+                      (1.0 + std::abs(row1[x] - row_m1[x])) -
+                  1.0;
+
+      // d1 > 0: distorted has an edge where original is smooth
+      //         (indicating ringing, color banding, blockiness, etc)
+      double artifact = std::max(d1, 0.0);
+      sums[2] += artifact;
+      sums[3] += quartic(artifact);
+
+      // d1 < 0: original has an edge where distorted is smooth
+      //         (indicating smoothing, blurring, smearing, etc)
+      double detail_lost = std::max(-d1, 0.0);
+      sums[4] += detail_lost;
+      sums[5] += quartic(detail_lost);
+    }
+    return true;
+  };
+  JPEGLI_RETURN_IF_ERROR(RunOnPool(pool, 0, 3 * ysize, ThreadPool::NoInit,
+                                   process_row, "ComputeScaleStats"));
+  const double onePerPixels = 1.0 / (ysize * xsize);
+  for (size_t c = 0; c < 3; ++c) {
+    double sum[kNumSums] = {0.0};
+    for (size_t y = 0; y < ysize; ++y) {
+      const double* row = &row_sums[(c * ysize + y) * kNumSums];
+      for (size_t i = 0; i < kNumSums; ++i) {
+        sum[i] += row[i];
+      }
+    }
+    sscale->avg_ssim[c * 2] = onePerPixels * sum[0];
+    sscale->avg_ssim[c * 2 + 1] = sqrt(sqrt(onePerPixels * sum[1]));
+    sscale->avg_edgediff[c * 4] = onePerPixels * sum[2];
+    sscale->avg_edgediff[c * 4 + 1] = sqrt(sqrt(onePerPixels * sum[3]));
+    sscale->avg_edgediff[c * 4 + 2] = onePerPixels * sum[4];
+    sscale->avg_edgediff[c * 4 + 3] = sqrt(sqrt(onePerPixels * sum[5]));
+  }
+  return true;
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jpegli
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jpegli {
+
+HWY_EXPORT(LinearToPositiveXYB);
+HWY_EXPORT(Downsample2x2);
+HWY_EXPORT(BlurProduct);
+HWY_EXPORT(ComputeScaleStats);
+
+namespace {
+
+const int kNumScales = 6;
+
+Status ToXYB(const ColorEncoding& c_current, float intensity_target,
+             ThreadPool* pool, Image3F* JPEGLI_RESTRICT image,
+             const JpegliCmsInterface& cms) {
+  hwy::AlignedFreeUniquePtr<float[]> premul_absorb =
+      hwy::AllocateAligned<float>(MaxVectorSize() * 12);
+  ComputePremulAbsorb(intensity_target, premul_absorb.get());
+  const ColorEncoding& c_linear_srgb =
+      ColorEncoding::LinearSRGB(c_current.IsGray());
+  JPEGLI_ENSURE(ApplyColorTransform(c_current, intensity_target, *image,
+                                    nullptr, Rect(*image), c_linear_srgb, cms,
+                                    pool, image));
+  return HWY_DYNAMIC_DISPATCH(LinearToPositiveXYB)(premul_absorb.get(), pool,
+                                                   image);
+}
+
+// Decodes the pixels of ppf to linear sRGB and returns its intensity target.
+StatusOr<float> ToLinearSRGB(const extras::PackedPixelFile& ppf,
+                             ThreadPool* pool, Image3F* linear) {
+  JPEGLI_RETURN_IF_ERROR(
+      extras::ConvertPackedPixelFileToImage3F(ppf, linear, pool));
+  ColorEncoding c_enc;
+  JPEGLI_ENSURE(extras::GetColorEncoding(ppf, &c_enc));
+  float intensity_target = extras::GetIntensityTarget(ppf, c_enc);
+  const bool is_gray = ppf.info.num_color_channels == 1;
+  const ColorEncoding& c_desired = ColorEncoding::LinearSRGB(is_gray);
+  if (!c_enc.SameColorEncoding(c_desired)) {
+    JPEGLI_ENSURE(ApplyColorTransform(c_enc, intensity_target, *linear,
+                                      nullptr, Rect(*linear), c_desired,
+                                      *JpegliGetDefaultCms(), pool, linear));
+  }
+  return intensity_target;
+}
+
+// Returns the XYB image of the given scale. For all but the first scale, the
+// linear image of the previous scale is first downsampled in place.
+StatusOr<Image3F> ScaleToXYB(int scale, bool is_gray, float intensity_target,
+                             ThreadPool* pool, Image3F* linear) {
+  JpegliMemoryManager* memory_manager = linear->memory_manager();
+  if (scale > 0) {
+    JPEGLI_ASSIGN_OR_RETURN(
+        Image3F downsampled,
+        Image3F::Create(memory_manager, DivCeil(linear->xsize(), 2),
+                        DivCeil(linear->ysize(), 2)));
+    JPEGLI_RETURN_IF_ERROR(
+        HWY_DYNAMIC_DISPATCH(Downsample2x2)(*linear, pool, &downsampled));
+    *linear = std::move(downsampled);
+  }
+  JPEGLI_ASSIGN_OR_RETURN(
+      Image3F xyb,
+      Image3F::Create(memory_manager, linear->xsize(), linear->ysize()));
+  JPEGLI_RETURN_IF_ERROR(CopyImageTo(*linear, &xyb));
+  JPEGLI_RETURN_IF_ERROR(ToXYB(ColorEncoding::LinearSRGB(is_gray),
+                               intensity_target, pool, &xyb,
+                               *JpegliGetDefaultCms()));
+  return xyb;
+}
+
+// Temporary storage for Gaussian blur, reused for multiple images.
+class Blur {
+ public:
+  static StatusOr<Blur> Create(JpegliMemoryManager* memory_manager,
+                               const size_t xsize, const size_t ysize) {
+    Blur result;
+    JPEGLI_ASSIGN_OR_RETURN(result.temp_,
+                            ImageF::Create(memory_manager, xsize, ysize));
+    return result;
+  }
+
+  StatusOr<Image3F> operator()(const Image3F& in, ThreadPool* pool) {
+    JPEGLI_ASSIGN_OR_RETURN(
+        Image3F out,
+        Image3F::Create(in.memory_manager(), in.xsize(), in.ysize()));
+    for (size_t c = 0; c < 3; ++c) {
+      JPEGLI_RETURN_IF_ERROR(
+          FastGaussian(rg_, in.Plane(c), &temp_, &out.Plane(c), pool));
+    }
+    return out;
+  }
+
+  // Returns the blurred a * b.
+  StatusOr<Image3F> Product(const Image3F& a, const Image3F& b,
+                            ThreadPool* pool) {
+    JPEGLI_ASSIGN_OR_RETURN(
+        Image3F out, Image3F::Create(a.memory_manager(), a.xsize(), a.ysize()));
+    for (size_t c = 0; c < 3; ++c) {
+      JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(BlurProduct)(
+          rg_, a.Plane(c), b.Plane(c), pool, &temp_, &out.Plane(c)));
+    }
+    return out;
+  }
+
+  // Allows reusing across scales.
+  Status ShrinkTo(const size_t xsize, const size_t ysize) {
+    return temp_.ShrinkTo(xsize, ysize);
+  }
+
+ private:
+  Blur() : rg_(CreateRecursiveGaussian(1.5)) {}
+  RecursiveGaussian rg_;
+  ImageF temp_;
+};
+
+}  // namespace
+
+/*
+The final score is based on a weighted sum of 108 sub-scores:
+- for 6 scales (1:1 to 1:32, downsampled in linear RGB)
+- for 3 components (X, Y, B-Y, rescaled to 0..1 range)
+- using 2 norms (the 1-norm and the 4-norm)
+- over 3 error maps:
+    - SSIM' (SSIM without the spurious gamma correction term)
+    - "ringing" (distorted edges where there are no orig edges)
+    - "blurring" (orig edges where there are no distorted edges)
+
+The weights were obtained by running Nelder-Mead simplex search,
+optimizing to minimize MSE for the CID22 training set and to
+maximize Kendall rank correlation (and with a lower weight,
+also Pearson correlation) with the CID22 training set and the
+TID2013, Kadid10k and KonFiG-IQA datasets.
+Validation was done on the CID22 validation set.
+
+Final results after tuning (Kendall | Spearman | Pearson):
+   CID22:     0.6903 | 0.8805 | 0.8583
+   TID2013:   0.6590 | 0.8445 | 0.8471
+   KADID-10k: 0.6175 | 0.8133 | 0.8030
+   KonFiG(F): 0.7668 | 0.9194 | 0.9136
+*/
+double Msssim::Score() const {
+  double ssim = 0.0;
+  constexpr double weight[108] = {0.0,
+                                  0.0007376606707406586,
+                                  0.0,
+                                  0.0,
+                                  0.0007793481682867309,
+                                  0.0,
+                                  0.0,
+                                  0.0004371155730107379,
+                                  0.0,
+                                  1.1041726426657346,
+                                  0.00066284834129271,
+                                  0.00015231632783718752,
+                                  0.0,
+                                  0.0016406437456599754,
+                                  0.0,
+                                  1.8422455520539298,
+                                  11.441172603757666,
+                                  0.0,
+                                  0.0007989109436015163,
+                                  0.000176816438078653,
+                                  0.0,
+                                  1.8787594979546387,
+                                  10.94906990605142,
+                                  0.0,
+                                  0.0007289346991508072,
+                                  0.9677937080626833,
+                                  0.0,
+                                  0.00014003424285435884,
+                                  0.9981766977854967,
+                                  0.00031949755934435053,
+                                  0.0004550992113792063,
+                                  0.0,
+                                  0.0,
+                                  0.0013648766163243398,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  7.466890328078848,
+                                  0.0,
+                                  17.445833984131262,
+                                  0.0006235601634041466,
+                                  0.0,
+                                  0.0,
+                                  6.683678146179332,
+                                  0.00037724407979611296,
+                                  1.027889937768264,
+                                  225.20515300849274,
+                                  0.0,
+                                  0.0,
+                                  19.213238186143016,
+                                  0.0011401524586618361,
+                                  0.001237755635509985,
+                                  176.39317598450694,
+                                  0.0,
+                                  0.0,
+                                  24.43300999870476,
+                                  0.28520802612117757,
+                                  0.0004485436923833408,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  34.77906344483772,
+                                  44.835625328877896,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0008680556573291698,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0005313191874358747,
+                                  0.0,
+                                  0.00016533814161379112,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0004179171803251336,
+                                  0.0017290828234722833,
+                                  0.0,
+                                  0.0020827005846636437,
+                                  0.0,
+                                  0.0,
+                                  8.826982764996862,
+                                  23.19243343998926,
+                                  0.0,
+                                  95.1080498811086,
+                                  0.9863978034400682,
+                                  0.9834382792465353,
+                                  0.0012286405048278493,
+                                  171.2667255897307,
+                                  0.9807858872435379,
+                                  0.0,
+                                  0.0,
+                                  0.0,
+                                  0.0005130064588990679,
+                                  0.0,
+                                  0.00010854057858411537};
+
+  size_t i = 0;
+  char ch[] = "XYB";
+  const bool verbose = false;
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t scale = 0; scale < scales.size(); ++scale) {
+      for (size_t n = 0; n < 2; n++) {
+#ifdef SSIMULACRA2_OUTPUT_RAW_SCORES_FOR_WEIGHT_TUNING
+        printf("%.12f,%.12f,%.12f,", scales[scale].avg_ssim[c * 2 + n],
+               scales[scale].avg_edgediff[c * 4 + n],
+               scales[scale].avg_edgediff[c * 4 + 2 + n]);
+#endif
+        if (verbose) {
+          printf("%f from channel %c ssim, scale 1:%i, %" PRIuS
+                 "-norm (weight %f)\n",
+                 weight[i] * std::abs(scales[scale].avg_ssim[c * 2 + n]), ch[c],
+                 1 << scale, n * 3 + 1, weight[i]);
+        }
+        ssim += weight[i++] * std::abs(scales[scale].avg_ssim[c * 2 + n]);
+        if (verbose) {
+          printf("%f from channel %c ringing, scale 1:%i, %" PRIuS
+                 "-norm (weight %f)\n",
+                 weight[i] * std::abs(scales[scale].avg_edgediff[c * 4 + n]),
+                 ch[c], 1 << scale, n * 3 + 1, weight[i]);
+        }
+        ssim += weight[i++] * std::abs(scales[scale].avg_edgediff[c * 4 + n]);
+        if (verbose) {
+          printf(
+              "%f from channel %c blur, scale 1:%i, %" PRIuS
+              "-norm (weight %f)\n",
+              weight[i] * std::abs(scales[scale].avg_edgediff[c * 4 + n + 2]),
+              ch[c], 1 << scale, n * 3 + 1, weight[i]);
+        }
+        ssim +=
+            weight[i++] * std::abs(scales[scale].avg_edgediff[c * 4 + n + 2]);
+      }
+    }
+  }
+
+  ssim = ssim * 0.9562382616834844;
+  ssim = 2.326765642916932 * ssim - 0.020884521182843837 * ssim * ssim +
+         6.248496625763138e-05 * ssim * ssim * ssim;
+  if (ssim > 0) {
+    ssim = 100.0 - 10.0 * pow(ssim, 0.6276336467831387);
+  } else {
+    ssim = 100.0;
+  }
+  return ssim;
+}
+
+StatusOr<Ssimulacra2Reference> Ssimulacra2Reference::Create(
+    JpegliMemoryManager* memory_manager, const extras::PackedPixelFile& orig,
+    ThreadPool* pool) {
+  Ssimulacra2Reference ref;
+  ref.xsize_ = orig.xsize();
+  ref.ysize_ = orig.ysize();
+  ref.num_color_channels_ = orig.info.num_color_channels;
+  const bool is_gray = ref.num_color_channels_ == 1;
+  JPEGLI_ASSIGN_OR_RETURN(
+      Image3F linear, Image3F::Create(memory_manager, ref.xsize_, ref.ysize_));
+  JPEGLI_ASSIGN_OR_RETURN(ref.intensity_target_,
+                          ToLinearSRGB(orig, pool, &linear));
+  JPEGLI_ASSIGN_OR_RETURN(
+      Blur blur, Blur::Create(memory_manager, ref.xsize_, ref.ysize_));
+  for (int scale = 0; scale < kNumScales; scale++) {
+    if (linear.xsize() < 8 || linear.ysize() < 8) {
+      break;
+    }
+    Scale s;
+    JPEGLI_ASSIGN_OR_RETURN(
+        s.xyb,
+        ScaleToXYB(scale, is_gray, ref.intensity_target_, pool, &linear));
+    JPEGLI_RETURN_IF_ERROR(blur.ShrinkTo(s.xyb.xsize(), s.xyb.ysize()));
+    JPEGLI_ASSIGN_OR_RETURN(s.mu, blur(s.xyb, pool));
+    JPEGLI_ASSIGN_OR_RETURN(s.sigma_sq, blur.Product(s.xyb, s.xyb, pool));
+    ref.scales_.emplace_back(std::move(s));
+  }
+  return ref;
+}
+
+StatusOr<Msssim> ComputeSSIMULACRA2(JpegliMemoryManager* memory_manager,
+                                    const Ssimulacra2Reference& orig,
+                                    const extras::PackedPixelFile& distorted,
+                                    ThreadPool* pool) {
+  if (orig.xsize() != distorted.xsize() || orig.ysize() != distorted.ysize()) {
+    return JPEGLI_FAILURE("Images must have the same size for SSIMULACRA2.");
+  }
+  if (orig.num_color_channels() != distorted.info.num_color_channels) {
+    return JPEGLI_FAILURE("Grayscale vs RGB comparison not supported.");
+  }
+  const bool is_gray = orig.num_color_channels() == 1;
+  JPEGLI_ASSIGN_OR_RETURN(
+      Image3F linear,
+      Image3F::Create(memory_manager, orig.xsize(), orig.ysize()));
+  JPEGLI_ASSIGN_OR_RETURN(float intensity_dist,
+                          ToLinearSRGB(distorted, pool, &linear));
+  JPEGLI_ASSIGN_OR_RETURN(
+      Blur blur, Blur::Create(memory_manager, orig.xsize(), orig.ysize()));
+
+  Msssim msssim;
+  for (size_t scale = 0; scale < orig.scales().size(); scale++) {
+    const Ssimulacra2Reference::Scale& ref = orig.scales()[scale];
+    // The downsampled scales of both images use the intensity target of the
+    // original.
+    const float intensity_target =
+        scale == 0 ? intensity_dist : orig.intensity_target();
+    JPEGLI_ASSIGN_OR_RETURN(
+        Image3F img2,
+        ScaleToXYB(scale, is_gray, intensity_target, pool, &linear));
+    JPEGLI_RETURN_IF_ERROR(blur.ShrinkTo(img2.xsize(), img2.ysize()));
+    JPEGLI_ASSIGN_OR_RETURN(Image3F mu2, blur(img2, pool));
+    JPEGLI_ASSIGN_OR_RETURN(Image3F sigma2_sq, blur.Product(img2, img2, pool));
+    JPEGLI_ASSIGN_OR_RETURN(Image3F sigma12, blur.Product(ref.xyb, img2, pool));
+
+    MsssimScale sscale;
+    JPEGLI_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(ComputeScaleStats)(
+        ref.xyb, ref.mu, ref.sigma_sq, img2, mu2, sigma2_sq, sigma12, pool,
+        &sscale));
+    msssim.scales.push_back(sscale);
+  }
+  return msssim;
+}
+
+StatusOr<Msssim> ComputeSSIMULACRA2(JpegliMemoryManager* memory_manager,
+                                    const extras::PackedPixelFile& orig,
+                                    const extras::PackedPixelFile& distorted,
+                                    ThreadPool* pool) {
+  if (orig.xsize() != distorted.xsize() || orig.ysize() != distorted.ysize()) {
+    return JPEGLI_FAILURE("Images must have the same size for SSIMULACRA2.");
+  }
+  if (orig.info.num_color_channels != distorted.info.num_color_channels) {
+    return JPEGLI_FAILURE("Grayscale vs RGB comparison not supported.");
+  }
+  JPEGLI_ASSIGN_OR_RETURN(
+      Ssimulacra2Reference ref,
+      Ssimulacra2Reference::Create(memory_manager, orig, pool));
+  return ComputeSSIMULACRA2(memory_manager, ref, distorted, pool);
+}
+
+}  // namespace jpegli
+#endif  // HWY_ONCE
@@ -0,0 +1,79 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#ifndef JPEGLI_LIB_EXTRAS_SSIMULACRA2_H_
+#define JPEGLI_LIB_EXTRAS_SSIMULACRA2_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "lib/base/data_parallel.h"
+#include "lib/base/memory_manager.h"
+#include "lib/base/status.h"
+#include "lib/extras/image.h"
+#include "lib/extras/packed_image.h"
+
+namespace jpegli {
+
+struct MsssimScale {
+  double avg_ssim[3 * 2];
+  double avg_edgediff[3 * 4];
+};
+
+struct Msssim {
+  std::vector<MsssimScale> scales;
+
+  double Score() const;
+};
+
+// The scales of a reference image, computed once so that it can be compared
+// against any number of distorted images.
+class Ssimulacra2Reference {
+ public:
+  struct Scale {
+    // The image in the (positive) XYB space used by the metric.
+    Image3F xyb;
+    // Gaussian blurred xyb and xyb^2.
+    Image3F mu;
+    Image3F sigma_sq;
+  };
+
+  static StatusOr<Ssimulacra2Reference> Create(
+      JpegliMemoryManager* memory_manager, const extras::PackedPixelFile& orig,
+      ThreadPool* pool = nullptr);
+
+  size_t xsize() const { return xsize_; }
+  size_t ysize() const { return ysize_; }
+  size_t num_color_channels() const { return num_color_channels_; }
+  float intensity_target() const { return intensity_target_; }
+  const std::vector<Scale>& scales() const { return scales_; }
+
+ private:
+  Ssimulacra2Reference() = default;
+
+  size_t xsize_ = 0;
+  size_t ysize_ = 0;
+  size_t num_color_channels_ = 0;
+  float intensity_target_ = 0.0f;
+  std::vector<Scale> scales_;
+};
+
+// Computes the SSIMULACRA 2 score between reference image 'orig' and
+// distorted image 'distorted'.
+StatusOr<Msssim> ComputeSSIMULACRA2(JpegliMemoryManager* memory_manager,
+                                    const extras::PackedPixelFile& orig,
+                                    const extras::PackedPixelFile& distorted,
+                                    ThreadPool* pool = nullptr);
+
+// Same as above, with the scales of the reference image precomputed.
+StatusOr<Msssim> ComputeSSIMULACRA2(JpegliMemoryManager* memory_manager,
+                                    const Ssimulacra2Reference& orig,
+                                    const extras::PackedPixelFile& distorted,
+                                    ThreadPool* pool = nullptr);
+
+}  // namespace jpegli
+
+#endif  // JPEGLI_LIB_EXTRAS_SSIMULACRA2_H_
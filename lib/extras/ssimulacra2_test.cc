@@ -0,0 +1,104 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/extras/ssimulacra2.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include "lib/base/memory_manager.h"
+#include "lib/base/testing.h"
+#include "lib/extras/test_image.h"
+#include "lib/extras/test_memory_manager.h"
+#include "lib/extras/test_utils.h"
+#include "lib/threads/test_utils.h"
+
+namespace jpegli {
+namespace {
+
+using ::jpegli::test::TestImage;
+using ::jpegli::test::ThreadPoolForTests;
+
+constexpr size_t kXSize = 217;
+constexpr size_t kYSize = 131;
+
+void MakeImage(TestImage* img, uint16_t seed, bool distort) {
+  ASSERT_TRUE(img->SetDimensions(kXSize, kYSize));
+  JPEGLI_TEST_ASSIGN_OR_DIE(auto frame, img->AddFrame());
+  frame.RandomFill(seed);
+  if (!distort) return;
+  for (size_t y = kYSize / 3; y < kYSize / 2; ++y) {
+    for (size_t x = kXSize / 4; x < kXSize / 2; ++x) {
+      for (size_t c = 0; c < 3; ++c) {
+        ASSERT_TRUE(frame.SetValue(y, x, c, 0.5f));
+      }
+    }
+  }
+}
+
+TEST(Ssimulacra2Test, IdenticalImages) {
+  JpegliMemoryManager* memory_manager = jpegli::test::MemoryManager();
+  TestImage img;
+  MakeImage(&img, 777, false);
+  JPEGLI_TEST_ASSIGN_OR_DIE(
+      Msssim msssim, ComputeSSIMULACRA2(memory_manager, img.ppf(), img.ppf()));
+  EXPECT_NEAR(msssim.Score(), 100.0, 1e-6);
+}
+
+TEST(Ssimulacra2Test, DistortionLowersScore) {
+  JpegliMemoryManager* memory_manager = jpegli::test::MemoryManager();
+  TestImage img0;
+  TestImage img1;
+  MakeImage(&img0, 777, false);
+  MakeImage(&img1, 777, true);
+  JPEGLI_TEST_ASSIGN_OR_DIE(
+      Msssim msssim,
+      ComputeSSIMULACRA2(memory_manager, img0.ppf(), img1.ppf()));
+  EXPECT_LT(msssim.Score(), 95.0);
+}
+
+TEST(Ssimulacra2Test, ReferenceGivesSameResult) {
+  JpegliMemoryManager* memory_manager = jpegli::test::MemoryManager();
+  TestImage img0;
+  TestImage img1;
+  TestImage img2;
+  MakeImage(&img0, 777, false);
+  MakeImage(&img1, 777, true);
+  MakeImage(&img2, 778, false);
+  JPEGLI_TEST_ASSIGN_OR_DIE(
+      Ssimulacra2Reference ref,
+      Ssimulacra2Reference::Create(memory_manager, img0.ppf()));
+  EXPECT_EQ(kXSize, ref.xsize());
+  EXPECT_EQ(kYSize, ref.ysize());
+  for (TestImage* distorted : {&img1, &img2}) {
+    JPEGLI_TEST_ASSIGN_OR_DIE(
+        Msssim direct,
+        ComputeSSIMULACRA2(memory_manager, img0.ppf(), distorted->ppf()));
+    JPEGLI_TEST_ASSIGN_OR_DIE(
+        Msssim cached,
+        ComputeSSIMULACRA2(memory_manager, ref, distorted->ppf()));
+    EXPECT_EQ(direct.Score(), cached.Score());
+  }
+}
+
+TEST(Ssimulacra2Test, ThreadPoolGivesSameResult) {
+  JpegliMemoryManager* memory_manager = jpegli::test::MemoryManager();
+  TestImage img0;
+  TestImage img1;
+  MakeImage(&img0, 777, false);
+  MakeImage(&img1, 777, true);
+  JPEGLI_TEST_ASSIGN_OR_DIE(
+      Msssim msssim,
+      ComputeSSIMULACRA2(memory_manager, img0.ppf(), img1.ppf()));
+  ThreadPoolForTests pool(8);
+  JPEGLI_TEST_ASSIGN_OR_DIE(
+      Msssim msssim_mt, ComputeSSIMULACRA2(memory_manager, img0.ppf(),
+                                           img1.ppf(), pool.get()));
+  EXPECT_EQ(msssim.Score(), msssim_mt.Score());
+}
+
+}  // namespace
+}  // namespace jpegli
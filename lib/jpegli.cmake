@@ -100,6 +100,46 @@ foreach (TESTFILE IN LISTS JPEGLI_INTERNAL_JPEGLI_TESTS)
   # 240 seconds because some build types (e.g. coverage) can be quite slow.
   gtest_discover_tests(${TESTNAME} DISCOVERY_TIMEOUT 240)
 endforeach ()
+
+# The stats are compiled out of the default build, so the GetStats test is also
+# run against a copy of the library that collects them.
+if (NOT JPEGLI_ENABLE_STATS)
+add_library(jpegli_stats-static STATIC EXCLUDE_FROM_ALL
+  "${JPEGLI_INTERNAL_JPEGLI_SOURCES}")
+target_compile_options(jpegli_stats-static PRIVATE "${JPEGLI_INTERNAL_FLAGS}")
+target_compile_definitions(jpegli_stats-static PUBLIC -DJPEGLI_ENABLE_STATS=1)
+target_include_directories(jpegli_stats-static PRIVATE
+  "$<BUILD_INTERFACE:${PROJECT_SOURCE_DIR}>"
+  "${JPEGLI_HWY_INCLUDE_DIRS}"
+)
+target_include_directories(jpegli_stats-static PUBLIC
+  "$<BUILD_INTERFACE:${CMAKE_CURRENT_BINARY_DIR}/include/jpegli>"
+)
+target_link_libraries(jpegli_stats-static PUBLIC ${JPEGLI_INTERNAL_LIBS})
+
+add_executable(encode_api_stats_test jpegli/encode_api_test.cc
+  $<TARGET_OBJECTS:jpegli_libjpeg_util-obj>
+  ${JPEGLI_INTERNAL_JPEGLI_TESTLIB_FILES}
+)
+target_compile_options(encode_api_stats_test PRIVATE ${JPEGLI_INTERNAL_FLAGS})
+target_compile_definitions(encode_api_stats_test PRIVATE
+  -DTEST_DATA_PATH="${JPEGLI_TEST_DATA_PATH}")
+target_include_directories(encode_api_stats_test PRIVATE
+  "${PROJECT_SOURCE_DIR}"
+  "${CMAKE_CURRENT_SOURCE_DIR}/include"
+  "${CMAKE_CURRENT_BINARY_DIR}/include"
+)
+target_link_libraries(encode_api_stats_test
+  hwy
+  jpegli_stats-static
+  gtest
+  gtest_main
+  ${JPEG_LIBRARIES}
+)
+set_target_properties(encode_api_stats_test PROPERTIES PREFIX "tests/")
+add_test(NAME EncodeAPITest.GetStatsEnabled
+  COMMAND encode_api_stats_test --gtest_filter=EncodeAPITest.GetStats)
+endif()
 endif()
 
 #
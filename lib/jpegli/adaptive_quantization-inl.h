@@ -0,0 +1,166 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <cstddef>
+
+#include "lib/jpegli/common_internal.h"
+
+#if defined(JPEGLI_LIB_JPEGLI_ADAPTIVE_QUANTIZATION_INL_H_) == \
+    defined(HWY_TARGET_TOGGLE)
+#ifdef JPEGLI_LIB_JPEGLI_ADAPTIVE_QUANTIZATION_INL_H_
+#undef JPEGLI_LIB_JPEGLI_ADAPTIVE_QUANTIZATION_INL_H_
+#else
+#define JPEGLI_LIB_JPEGLI_ADAPTIVE_QUANTIZATION_INL_H_
+#endif
+
+#include <hwy/highway.h>
+
+#include "lib/base/compiler_specific.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jpegli {
+namespace HWY_NAMESPACE {
+namespace {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::AllTrue;
+using hwy::HWY_NAMESPACE::And;
+using hwy::HWY_NAMESPACE::Div;
+using hwy::HWY_NAMESPACE::Eq;
+using hwy::HWY_NAMESPACE::Min;
+using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
+using hwy::HWY_NAMESPACE::Sqrt;
+using hwy::HWY_NAMESPACE::Sub;
+using hwy::HWY_NAMESPACE::Vec;
+using hwy::HWY_NAMESPACE::ZeroIfNegative;
+
+constexpr float kInputScaling = 1.0f / 255.0f;
+
+// mul and mul2 represent a scaling difference between jpegli and butteraugli.
+const float kSGmul = 226.0480446705883f;
+const float kSGmul2 = 1.0f / 73.377132366608819f;
+
+// Multiplier for conversion of log2(x) result to ln(x).
+// print(1.0 / math.log2(math.e))
+constexpr float kInvLog2e = 0.6931471805599453;
+
+// Includes correction factor for std::log -> log2.
+const float kSGRetMul = kSGmul2 * 18.6580932135f * kInvLog2e;
+const float kSGVOffset = 7.14672470003f;
+
+template <bool invert, typename D, typename V>
+V RatioOfDerivativesOfCubicRootToSimpleGamma(const D d, V v) {
+  // The opsin space in jpegli is the cubic root of photons, i.e., v * v * v
+  // is related to the number of photons.
+  //
+  // SimpleGamma(v * v * v) is the psychovisual space in butteraugli.
+  // This ratio allows quantization to move from jxl's opsin space to
+  // butteraugli's log-gamma space.
+  static const float kEpsilon = 1e-2;
+  static const float kNumOffset = kEpsilon / kInputScaling / kInputScaling;
+  static const float kNumMul = kSGRetMul * 3 * kSGmul;
+  static const float kVOffset =
+      (kSGVOffset * kInvLog2e + kEpsilon) / kInputScaling;
+  static const float kDenMul =
+      kInvLog2e * kSGmul * kInputScaling * kInputScaling;
+
+  v = ZeroIfNegative(v);
+  const auto num_mul = Set(d, kNumMul);
+  const auto num_offset = Set(d, kNumOffset);
+  const auto den_offset = Set(d, kVOffset);
+  const auto den_mul = Set(d, kDenMul);
+
+  const auto v2 = Mul(v, v);
+
+  const auto num = MulAdd(num_mul, v2, num_offset);
+  const auto den = MulAdd(Mul(den_mul, v), v2, den_offset);
+  return invert ? Div(num, den) : Div(den, num);
+}
+
+template <typename D, typename V>
+V MaskingSqrt(const D d, V v) {
+  static const float kLogOffset = 28;
+  static const float kMul = 211.50759899638012f;
+  const auto mul_v = Set(d, kMul * 1e8);
+  const auto offset_v = Set(d, kLogOffset);
+  return Mul(Set(d, 0.25f), Sqrt(MulAdd(v, Sqrt(mul_v), offset_v)));
+}
+
+// Returns the masking value of the pixels [x, x + Lanes(d)) of row_in, which is
+// based on their difference from the average of their 4 neighbours.
+template <class D, class V = Vec<D>>
+JPEGLI_INLINE V PixelMaskingValue(const D d, const float* row_t,
+                                  const float* row_in, const float* row_b,
+                                  const size_t x, const V flat_diff) {
+  // The XYB gamma is 3.0 to be able to decode faster with two muls.
+  // Butteraugli's gamma is matching the gamma of human eye, around 2.6.
+  // We approximate the gamma difference by adding one cubic root into
+  // the adaptive quantization. This gives us a total gamma of 2.6666
+  // for quantization uses.
+  static const float match_gamma_offset = 0.019 / kInputScaling;
+  static const float limit = 0.2f;
+  const auto in = LoadU(d, row_in + x);
+  const auto in_r = LoadU(d, row_in + x + 1);
+  const auto in_l = LoadU(d, row_in + x - 1);
+  const auto in_t = LoadU(d, row_t + x);
+  const auto in_b = LoadU(d, row_b + x);
+  // In flat regions the pixel is equal to the base below, so the gamma
+  // correction and the masking can be skipped.
+  if (AllTrue(d, And(And(Eq(in_r, in), Eq(in_l, in)),
+                     And(Eq(in_t, in), Eq(in_b, in))))) {
+    return flat_diff;
+  }
+  const auto base = Mul(Set(d, 0.25f), Add(Add(in_r, in_l), Add(in_t, in_b)));
+  const auto gammacv =
+      RatioOfDerivativesOfCubicRootToSimpleGamma</*invert=*/false>(
+          d, Add(in, Set(d, match_gamma_offset)));
+  auto diff = Mul(gammacv, Sub(in, base));
+  diff = Mul(diff, diff);
+  diff = Min(diff, Set(d, limit));
+  return MaskingSqrt(d, diff);
+}
+
+// Computes the pixel columns [x0, x1) of the masking values of the input rows
+// [y, y + 4), averaged over 4x4 pixels, into row_out[x0 / 4, x1 / 4). The input
+// must have a border of one pixel, and x0 and x1 must be multiples of 8. The
+// four rows are summed in registers, so this needs no full-resolution buffer
+// and gives the same result as summing them row by row.
+JPEGLI_INLINE void ComputePreErosionRow(const RowBuffer<float>& input,
+                                        const size_t x0, const size_t x1,
+                                        const size_t y,
+                                        float* JPEGLI_RESTRICT row_out) {
+  const HWY_CAPPED(float, 8) df;
+  // The value of diff for a pixel that is equal to all of its neighbours.
+  const auto flat_diff = MaskingSqrt(df, Zero(df));
+  const float* rows[6];
+  for (size_t i = 0; i < 6; ++i) {
+    rows[i] = input.Row(static_cast<ptrdiff_t>(y + i) - 1);
+  }
+  HWY_ALIGN float sums[8];
+  for (size_t x = x0; x < x1; x += 8) {
+    for (size_t dx = 0; dx < 8; dx += Lanes(df)) {
+      auto sum =
+          PixelMaskingValue(df, rows[0], rows[1], rows[2], x + dx, flat_diff);
+      for (size_t iy = 1; iy < 4; ++iy) {
+        const auto diff = PixelMaskingValue(df, rows[iy], rows[iy + 1],
+                                            rows[iy + 2], x + dx, flat_diff);
+        sum = Add(diff, sum);
+      }
+      Store(sum, df, sums + dx);
+    }
+    row_out[x / 4] = (sums[0] + sums[1] + sums[2] + sums[3]) * 0.25f;
+    row_out[x / 4 + 1] = (sums[4] + sums[5] + sums[6] + sums[7]) * 0.25f;
+  }
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace
+}  // namespace HWY_NAMESPACE
+}  // namespace jpegli
+HWY_AFTER_NAMESPACE();
+#endif  // JPEGLI_LIB_JPEGLI_ADAPTIVE_QUANTIZATION_INL_H_
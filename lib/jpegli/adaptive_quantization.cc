@@ -11,9 +11,12 @@
 #include <cstdint>
 #include <cstdlib>
 
+#include "lib/base/data_parallel.h"
+#include "lib/base/status.h"
 #include "lib/base/types.h"
 #include "lib/jpegli/common.h"
 #include "lib/jpegli/common_internal.h"
+#include "lib/jpegli/error.h"
 
 #undef HWY_TARGET_INCLUDE
 #define HWY_TARGET_INCLUDE "lib/jpegli/adaptive_quantization.cc"
@@ -22,6 +25,7 @@
 
 #include "lib/base/compiler_specific.h"
 #include "lib/base/types.h"
+#include "lib/jpegli/adaptive_quantization-inl.h"
 #include "lib/jpegli/encode_internal.h"
 HWY_BEFORE_NAMESPACE();
 namespace jpegli {
@@ -44,12 +48,9 @@ using hwy::HWY_NAMESPACE::NegMulAdd;
 using hwy::HWY_NAMESPACE::Rebind;
 using hwy::HWY_NAMESPACE::ShiftLeft;
 using hwy::HWY_NAMESPACE::ShiftRight;
-using hwy::HWY_NAMESPACE::Sqrt;
 using hwy::HWY_NAMESPACE::Sub;
 using hwy::HWY_NAMESPACE::ZeroIfNegative;
 
-constexpr float kInputScaling = 1.0f / 255.0f;
-
 // Primary template: default to actual division.
 template <typename T, class V>
 struct FastDivision {
@@ -159,13 +160,8 @@ V FastPow2f(const DF df, V x) {
   return Div(num, den);
 }
 
-inline float FastPow2f(float f) {
-  HWY_CAPPED(float, 1) D;
-  return GetLane(FastPow2f(D, Set(D, f)));
-}
-
 // The following functions modulate an exponent (out_val) and return the updated
-// value. Their descriptor is limited to 8 lanes for 8x8 blocks.
+// value. Each lane holds the value of one block.
 
 template <class D, class V>
 V ComputeMask(const D d, const V out_val) {
@@ -192,47 +188,6 @@ V ComputeMask(const D d, const V out_val) {
   return Add(kBase, MulAdd(kMul4, v4, MulAdd(kMul2, v2, Mul(kMul3, v3))));
 }
 
-// mul and mul2 represent a scaling difference between jpegli and butteraugli.
-const float kSGmul = 226.0480446705883f;
-const float kSGmul2 = 1.0f / 73.377132366608819f;
-
-// Multiplier for conversion of log2(x) result to ln(x).
-// print(1.0 / math.log2(math.e))
-constexpr float kInvLog2e = 0.6931471805599453;
-
-// Includes correction factor for std::log -> log2.
-const float kSGRetMul = kSGmul2 * 18.6580932135f * kInvLog2e;
-const float kSGVOffset = 7.14672470003f;
-
-template <bool invert, typename D, typename V>
-V RatioOfDerivativesOfCubicRootToSimpleGamma(const D d, V v) {
-  // The opsin space in jpegli is the cubic root of photons, i.e., v * v * v
-  // is related to the number of photons.
-  //
-  // SimpleGamma(v * v * v) is the psychovisual space in butteraugli.
-  // This ratio allows quantization to move from jxl's opsin space to
-  // butteraugli's log-gamma space.
-  static const float kEpsilon = 1e-2;
-  static const float kNumOffset = kEpsilon / kInputScaling / kInputScaling;
-  static const float kNumMul = kSGRetMul * 3 * kSGmul;
-  static const float kVOffset =
-      (kSGVOffset * kInvLog2e + kEpsilon) / kInputScaling;
-  static const float kDenMul =
-      kInvLog2e * kSGmul * kInputScaling * kInputScaling;
-
-  v = ZeroIfNegative(v);
-  const auto num_mul = Set(d, kNumMul);
-  const auto num_offset = Set(d, kNumOffset);
-  const auto den_offset = Set(d, kVOffset);
-  const auto den_mul = Set(d, kDenMul);
-
-  const auto v2 = Mul(v, v);
-
-  const auto num = MulAdd(num_mul, v2, num_offset);
-  const auto den = MulAdd(Mul(den_mul, v), v2, den_offset);
-  return invert ? Div(num, den) : Div(den, num);
-}
-
 template <bool invert = false>
 float RatioOfDerivativesOfCubicRootToSimpleGamma(float v) {
   using DScalar = HWY_CAPPED(float, 1);
@@ -264,14 +219,14 @@ V SimpleGamma(const D d, V v) {
 }
 */
 
-template <class D, class V>
-V GammaModulation(const D d, const size_t x, const size_t y,
-                  const RowBuffer<float>& input, const V out_val) {
+// Returns the sum over the 8x8 block at (x, y) of the ratio of derivatives
+// used by GammaModulation.
+template <class D>
+float BlockGammaRatioSum(const D d, const size_t x, const size_t y,
+                         const RowBuffer<float>& input) {
   static const float kBias = 0.16f / kInputScaling;
-  static const float kScale = kInputScaling / 64.0f;
   auto overall_ratio = Zero(d);
   const auto bias = Set(d, kBias);
-  const auto scale = Set(d, kScale);
   const float* const JPEGLI_RESTRICT block_start = input.Row(y) + x;
   for (size_t dy = 0; dy < 8; ++dy) {
     const float* const JPEGLI_RESTRICT row_in =
@@ -283,7 +238,13 @@ V GammaModulation(const D d, const size_t x, const size_t y,
       overall_ratio = Add(overall_ratio, ratio_g);
     }
   }
-  overall_ratio = Mul(SumOfLanes(d, overall_ratio), scale);
+  return GetLane(SumOfLanes(d, overall_ratio));
+}
+
+template <class D, class V>
+V GammaModulation(const D d, const V ratio_sum, const V out_val) {
+  static const float kScale = kInputScaling / 64.0f;
+  const auto overall_ratio = Mul(ratio_sum, Set(d, kScale));
   // ideally -1.0, but likely optimal correction adds some entropy, so slightly
   // less than that.
   // ln(2) constant folded in because we want std::log but have FastLog2f.
@@ -291,18 +252,17 @@ V GammaModulation(const D d, const size_t x, const size_t y,
   return MulAdd(kGamma, FastLog2f(d, overall_ratio), out_val);
 }
 
-// Change precision in 8x8 blocks that have high frequency content.
-template <class D, class V>
-V HfModulation(const D d, const size_t x, const size_t y,
-               const RowBuffer<float>& input, const V out_val) {
+// Returns the sum of absolute differences with right and below neighbours
+// within the 8x8 block at (x, y), used by HfModulation.
+template <class D>
+float BlockHfSum(const D d, const size_t x, const size_t y,
+                 const RowBuffer<float>& input) {
   // Zero out the invalid differences for the rightmost value per row.
   const Rebind<uint32_t, D> du;
   HWY_ALIGN constexpr uint32_t kMaskRight[8] = {~0u, ~0u, ~0u, ~0u,
                                                 ~0u, ~0u, ~0u, 0};
 
   auto sum = Zero(d);  // sum of absolute differences with right and below
-  static const float kSumCoeff = -2.0052193233688884f * kInputScaling / 112.0;
-  auto sumcoeff = Set(d, kSumCoeff);
 
   const float* const JPEGLI_RESTRICT block_start = input.Row(y) + x;
   for (size_t dy = 0; dy < 8; ++dy) {
@@ -320,12 +280,24 @@ V HfModulation(const D d, const size_t x, const size_t y,
     }
   }
 
-  sum = SumOfLanes(d, sum);
-  return MulAdd(sum, sumcoeff, out_val);
+  return GetLane(SumOfLanes(d, sum));
 }
 
+// Change precision in 8x8 blocks that have high frequency content.
+template <class D, class V>
+V HfModulation(const D d, const V hf_sum, const V out_val) {
+  static const float kSumCoeff = -2.0052193233688884f * kInputScaling / 112.0;
+  return MulAdd(hf_sum, Set(d, kSumCoeff), out_val);
+}
+
+// Turns the eroded masking values of the blocks [bx0, bx1) of the block rows
+// [yb0, yb0 + yblen) of aq_map into the final quantization field. The per-block
+// sums over the input pixels are computed first into the two rows of
+// block_sums, after which the remaining per-block computations are done for a
+// full vector of blocks at a time.
 void PerBlockModulations(const float y_quant_01, const RowBuffer<float>& input,
-                         const size_t yb0, const size_t yblen,
+                         const size_t bx0, const size_t bx1, const size_t yb0,
+                         const size_t yblen, RowBuffer<float>* block_sums,
                          RowBuffer<float>* aq_map) {
   static const float kAcQuant = 0.841f;
   float base_level = 0.48f * kAcQuant;
@@ -341,33 +313,38 @@ void PerBlockModulations(const float y_quant_01, const RowBuffer<float>& input,
   }
   const float mul = kAcQuant * dampen;
   const float add = (1.0f - dampen) * base_level;
+  const HWY_CAPPED(float, 8) df8;
+  const HWY_FULL(float) df;
+  const auto mul_v = Set(df, mul);
+  const auto add_v = Set(df, add);
+  const auto log2e = Set(df, 1.442695041f);
+  const auto one = Set(df, 1.0f);
+  const auto kMaskedMul = Set(df, 0.6f);
+  float* JPEGLI_RESTRICT hf_sums = block_sums->Row(0);
+  float* JPEGLI_RESTRICT ratio_sums = block_sums->Row(1);
   for (size_t iy = 0; iy < yblen; iy++) {
     const size_t yb = yb0 + iy;
     const size_t y = yb * 8;
     float* const JPEGLI_RESTRICT row_out = aq_map->Row(yb);
-    const HWY_CAPPED(float, 8) df;
-    for (size_t ix = 0; ix < aq_map->xsize(); ix++) {
+    for (size_t ix = bx0; ix < bx1; ix++) {
       size_t x = ix * 8;
-      auto out_val = Set(df, row_out[ix]);
+      hf_sums[ix] = BlockHfSum(df8, x, y, input);
+      ratio_sums[ix] = BlockGammaRatioSum(df8, x, y, input);
+    }
+    for (size_t ix = bx0; ix < bx1; ix += Lanes(df)) {
+      auto out_val = Load(df, row_out + ix);
       out_val = ComputeMask(df, out_val);
-      out_val = HfModulation(df, x, y, input, out_val);
-      out_val = GammaModulation(df, x, y, input, out_val);
+      out_val = HfModulation(df, Load(df, hf_sums + ix), out_val);
+      out_val = GammaModulation(df, Load(df, ratio_sums + ix), out_val);
       // We want multiplicative quantization field, so everything
       // until this point has been modulating the exponent.
-      row_out[ix] = FastPow2f(GetLane(out_val) * 1.442695041f) * mul + add;
+      out_val = Add(Mul(FastPow2f(df, Mul(out_val, log2e)), mul_v), add_v);
+      out_val = ZeroIfNegative(Sub(Div(kMaskedMul, out_val), one));
+      Store(out_val, df, row_out + ix);
     }
   }
 }
 
-template <typename D, typename V>
-V MaskingSqrt(const D d, V v) {
-  static const float kLogOffset = 28;
-  static const float kMul = 211.50759899638012f;
-  const auto mul_v = Set(d, kMul * 1e8);
-  const auto offset_v = Set(d, kLogOffset);
-  return Mul(Set(d, 0.25f), Sqrt(MulAdd(v, Sqrt(mul_v), offset_v)));
-}
-
 template <typename V>
 void Sort4(V& min0, V& min1, V& min2, V& min3) {
   const auto tmp0 = Min(min0, min1);
@@ -394,12 +371,12 @@ void UpdateMin4(const V v, V& min0, V& min1, V& min2, V& min3) {
 }
 
 // Computes a linear combination of the 4 lowest values of the 3x3 neighborhood
-// of each pixel. Output is downsampled 2x.
-void FuzzyErosion(const RowBuffer<float>& pre_erosion, const size_t yb0,
-                  const size_t yblen, RowBuffer<float>* tmp,
-                  RowBuffer<float>* aq_map) {
-  int xsize_blocks = aq_map->xsize();
-  int xsize = pre_erosion.xsize();
+// of each pixel, for the blocks [bx0, bx1). Output is downsampled 2x.
+void FuzzyErosion(const RowBuffer<float>& pre_erosion, const size_t bx0,
+                  const size_t bx1, const size_t yb0, const size_t yblen,
+                  RowBuffer<float>* tmp, RowBuffer<float>* aq_map) {
+  const int x0 = 2 * bx0;
+  const int x1 = 2 * bx1;
   HWY_FULL(float) d;
   const auto mul0 = Set(d, 0.125f);
   const auto mul1 = Set(d, 0.075f);
@@ -411,7 +388,7 @@ void FuzzyErosion(const RowBuffer<float>& pre_erosion, const size_t yb0,
     const float* JPEGLI_RESTRICT rowm = pre_erosion.Row(y);
     const float* JPEGLI_RESTRICT rowb = pre_erosion.Row(y + 1);
     float* row_out = tmp->Row(y);
-    for (int x = 0; x < xsize; x += Lanes(d)) {
+    for (int x = x0; x < x1; x += Lanes(d)) {
       int xm1 = x - 1;
       int xp1 = x + 1;
       auto min0 = LoadU(d, rowm + x);
@@ -431,7 +408,7 @@ void FuzzyErosion(const RowBuffer<float>& pre_erosion, const size_t yb0,
     if (iy % 2 == 1) {
       const float* JPEGLI_RESTRICT row_out0 = tmp->Row(y - 1);
       float* JPEGLI_RESTRICT aq_out = aq_map->Row(yb0 + iy / 2);
-      for (int bx = 0, x = 0; bx < xsize_blocks; ++bx, x += 2) {
+      for (int bx = bx0, x = x0; bx < static_cast<int>(bx1); ++bx, x += 2) {
         aq_out[bx] =
             (row_out[x] + row_out[x + 1] + row_out0[x] + row_out0[x + 1]);
       }
@@ -439,61 +416,13 @@ void FuzzyErosion(const RowBuffer<float>& pre_erosion, const size_t yb0,
   }
 }
 
-void ComputePreErosion(const RowBuffer<float>& input, const size_t xsize,
-                       const size_t y0, const size_t ylen, int border,
-                       float* diff_buffer, RowBuffer<float>* pre_erosion) {
-  const size_t xsize_out = xsize / 4;
-  const size_t y0_out = y0 / 4;
-
-  // The XYB gamma is 3.0 to be able to decode faster with two muls.
-  // Butteraugli's gamma is matching the gamma of human eye, around 2.6.
-  // We approximate the gamma difference by adding one cubic root into
-  // the adaptive quantization. This gives us a total gamma of 2.6666
-  // for quantization uses.
-  static const float match_gamma_offset = 0.019 / kInputScaling;
-
-  const HWY_CAPPED(float, 8) df;
-
-  static const float limit = 0.2f;
-  // Computes image (padded to multiple of 8x8) of local pixel differences.
-  // Subsample both directions by 4.
-  for (size_t iy = 0; iy < ylen; ++iy) {
-    size_t y = y0 + iy;
-    const float* row_in = input.Row(y);
-    const float* row_in1 = input.Row(y + 1);
-    const float* row_in2 = input.Row(y - 1);
-    float* JPEGLI_RESTRICT row_out = diff_buffer;
-    const auto match_gamma_offset_v = Set(df, match_gamma_offset);
-    const auto quarter = Set(df, 0.25f);
-    for (size_t x = 0; x < xsize; x += Lanes(df)) {
-      const auto in = LoadU(df, row_in + x);
-      const auto in_r = LoadU(df, row_in + x + 1);
-      const auto in_l = LoadU(df, row_in + x - 1);
-      const auto in_t = LoadU(df, row_in2 + x);
-      const auto in_b = LoadU(df, row_in1 + x);
-      const auto base = Mul(quarter, Add(Add(in_r, in_l), Add(in_t, in_b)));
-      const auto gammacv =
-          RatioOfDerivativesOfCubicRootToSimpleGamma</*invert=*/false>(
-              df, Add(in, match_gamma_offset_v));
-      auto diff = Mul(gammacv, Sub(in, base));
-      diff = Mul(diff, diff);
-      diff = Min(diff, Set(df, limit));
-      diff = MaskingSqrt(df, diff);
-      if ((iy & 3) != 0) {
-        diff = Add(diff, LoadU(df, row_out + x));
-      }
-      StoreU(diff, df, row_out + x);
-    }
-    if (iy % 4 == 3) {
-      size_t y_out = y0_out + iy / 4;
-      float* row_d_out = pre_erosion->Row(y_out);
-      for (size_t x = 0; x < xsize_out; x++) {
-        row_d_out[x] = (row_out[x * 4] + row_out[x * 4 + 1] +
-                        row_out[x * 4 + 2] + row_out[x * 4 + 3]) *
-                       0.25f;
-      }
-      pre_erosion->PadRow(y_out, xsize_out, border);
-    }
+// Computes the pixel columns [x0, x1) of the rows [y0 / 4, (y0 + ylen) / 4) of
+// the 4x4 subsampled masking field; y0 and ylen must be multiples of 4.
+void ComputePreErosion(const RowBuffer<float>& input, const size_t x0,
+                       const size_t x1, const size_t y0, const size_t ylen,
+                       RowBuffer<float>* pre_erosion) {
+  for (size_t y = y0; y < y0 + ylen; y += 4) {
+    ComputePreErosionRow(input, x0, x1, y, pre_erosion->Row(y / 4));
   }
 }
 
@@ -514,6 +443,11 @@ namespace {
 
 constexpr int kPreErosionBorder = 1;
 
+// The quantization field of an iMCU row is computed in strips of this many
+// block columns, which can be processed in parallel. Their boundaries are
+// aligned to full vectors in all buffers.
+constexpr size_t kStripBlocks = 64;
+
 }  // namespace
 
 void ComputeAdaptiveQuantField(j_compress_ptr cinfo) {
@@ -533,7 +467,6 @@ void ComputeAdaptiveQuantField(j_compress_ptr cinfo) {
   }
   const RowBuffer<float>& input = m->input_buffer[y_channel];
   const size_t xsize_blocks = y_comp->width_in_blocks;
-  const size_t xsize = xsize_blocks * DCTSIZE;
   const size_t yb0 = m->next_iMCU_row * cinfo->max_v_samp_factor;
   const size_t yblen = cinfo->max_v_samp_factor;
   size_t y0 = yb0 * DCTSIZE;
@@ -546,8 +479,25 @@ void ComputeAdaptiveQuantField(j_compress_ptr cinfo) {
   if (m->next_iMCU_row + 1 == cinfo->total_iMCU_rows) {
     ylen -= 4;
   }
-  HWY_DYNAMIC_DISPATCH(ComputePreErosion)
-  (input, xsize, y0, ylen, kPreErosionBorder, m->diff_buffer, &m->pre_erosion);
+  // The strips only write their own columns of the shared buffers, so the
+  // result does not depend on the runner.
+  ThreadPool pool(m->runner, m->runner_opaque);
+  const uint32_t num_strips = DivCeil(xsize_blocks, kStripBlocks);
+  const auto pre_erosion = [&](const uint32_t strip,
+                               size_t /* thread */) -> Status {
+    const size_t bx0 = strip * kStripBlocks;
+    const size_t bx1 = std::min(bx0 + kStripBlocks, xsize_blocks);
+    HWY_DYNAMIC_DISPATCH(ComputePreErosion)
+    (input, bx0 * DCTSIZE, bx1 * DCTSIZE, y0, ylen, &m->pre_erosion);
+    return true;
+  };
+  if (!RunOnPool(&pool, 0, num_strips, ThreadPool::NoInit, pre_erosion,
+                 "ComputePreErosion")) {
+    JPEGLI_ERROR("Failed to compute the masking field.");
+  }
+  for (size_t y = y0; y < y0 + ylen; y += 4) {
+    m->pre_erosion.PadRow(y / 4, 2 * xsize_blocks, kPreErosionBorder);
+  }
   if (y0 == 0) {
     m->pre_erosion.CopyRow(-1, 0, kPreErosionBorder);
   }
@@ -555,15 +505,21 @@ void ComputeAdaptiveQuantField(j_compress_ptr cinfo) {
     size_t last_row = m->ysize_blocks * 2 - 1;
     m->pre_erosion.CopyRow(last_row + 1, last_row, kPreErosionBorder);
   }
-  HWY_DYNAMIC_DISPATCH(FuzzyErosion)
-  (m->pre_erosion, yb0, yblen, &m->fuzzy_erosion_tmp, &m->quant_field);
-  HWY_DYNAMIC_DISPATCH(PerBlockModulations)
-  (y_quant_01, input, yb0, yblen, &m->quant_field);
-  for (int y = 0; y < cinfo->max_v_samp_factor; ++y) {
-    float* row = m->quant_field.Row(yb0 + y);
-    for (size_t x = 0; x < xsize_blocks; ++x) {
-      row[x] = std::max(0.0f, (0.6f / row[x]) - 1.0f);
-    }
+  const auto modulations = [&](const uint32_t strip,
+                               size_t /* thread */) -> Status {
+    const size_t bx0 = strip * kStripBlocks;
+    const size_t bx1 = std::min(bx0 + kStripBlocks, xsize_blocks);
+    HWY_DYNAMIC_DISPATCH(FuzzyErosion)
+    (m->pre_erosion, bx0, bx1, yb0, yblen, &m->fuzzy_erosion_tmp,
+     &m->quant_field);
+    HWY_DYNAMIC_DISPATCH(PerBlockModulations)
+    (y_quant_01, input, bx0, bx1, yb0, yblen, &m->aq_block_sums,
+     &m->quant_field);
+    return true;
+  };
+  if (!RunOnPool(&pool, 0, num_strips, ThreadPool::NoInit, modulations,
+                 "PerBlockModulations")) {
+    JPEGLI_ERROR("Failed to compute the quantization field.");
   }
 }
 
@@ -0,0 +1,115 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <cstddef>
+#include <vector>
+
+#include "lib/base/random.h"
+#include "lib/jpegli/common.h"
+#include "lib/jpegli/common_internal.h"
+#include "lib/jpegli/encode.h"
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jpegli/adaptive_quantization_test.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+#include <hwy/tests/hwy_gtest.h>
+
+#include "lib/jpegli/adaptive_quantization-inl.h"
+#include "lib/jpegli/testing.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jpegli {
+namespace HWY_NAMESPACE {
+namespace {
+
+// The computation that ComputePreErosionRow() replaces: the masking values of
+// each input row are stored in a full resolution row and added to the ones of
+// the previous rows, then the sums are averaged over 4 columns.
+void ReferencePreErosionRow(const RowBuffer<float>& input, const size_t xsize,
+                            const size_t y, float* diff_buffer,
+                            float* row_out) {
+  const HWY_CAPPED(float, 8) df;
+  const auto flat_diff = MaskingSqrt(df, Zero(df));
+  for (size_t iy = 0; iy < 4; ++iy) {
+    const ptrdiff_t yy = y + iy;
+    const float* row_t = input.Row(yy - 1);
+    const float* row_in = input.Row(yy);
+    const float* row_b = input.Row(yy + 1);
+    for (size_t x = 0; x < xsize; x += Lanes(df)) {
+      auto diff = PixelMaskingValue(df, row_t, row_in, row_b, x, flat_diff);
+      if (iy != 0) {
+        diff = Add(diff, LoadU(df, diff_buffer + x));
+      }
+      StoreU(diff, df, diff_buffer + x);
+    }
+  }
+  for (size_t x = 0; x < xsize / 4; x++) {
+    row_out[x] = (diff_buffer[x * 4] + diff_buffer[x * 4 + 1] +
+                  diff_buffer[x * 4 + 2] + diff_buffer[x * 4 + 3]) *
+                 0.25f;
+  }
+}
+
+HWY_NOINLINE void TestFusedPreErosion() {
+  constexpr size_t kXSize = 37 * 8;
+  constexpr size_t kYSize = 16;
+  constexpr size_t kSplit = 128;
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr jerr;
+  cinfo.err = jpegli_std_error(&jerr);
+  jpegli_create_compress(&cinfo);
+  RowBuffer<float> input;
+  input.Allocate(&cinfo, kYSize + 2, kXSize + 1);
+  Rng rng(1);
+  for (size_t y = 0; y < kYSize + 2; ++y) {
+    float* row = input.Row(y);
+    // Flat, smooth and noisy regions, so that both the flat region shortcut
+    // and the full masking computation are used.
+    for (ptrdiff_t x = -1; x <= static_cast<ptrdiff_t>(kXSize); ++x) {
+      if (x < 64) {
+        row[x] = 100.0f;
+      } else if (x < 160) {
+        row[x] = 0.5f * x + y;
+      } else {
+        row[x] = rng.UniformF(0.0f, 255.0f);
+      }
+    }
+  }
+  std::vector<float> diff_buffer(kXSize + 8);
+  std::vector<float> expected(kXSize / 4);
+  std::vector<float> actual(kXSize / 4);
+  std::vector<float> actual_split(kXSize / 4);
+  for (size_t y = 1; y + 4 <= kYSize + 1; y += 4) {
+    ReferencePreErosionRow(input, kXSize, y, diff_buffer.data(),
+                           expected.data());
+    ComputePreErosionRow(input, 0, kXSize, y, actual.data());
+    ComputePreErosionRow(input, 0, kSplit, y, actual_split.data());
+    ComputePreErosionRow(input, kSplit, kXSize, y, actual_split.data());
+    for (size_t x = 0; x < kXSize / 4; ++x) {
+      EXPECT_EQ(expected[x], actual[x]) << "y = " << y << " x = " << x;
+      EXPECT_EQ(expected[x], actual_split[x]) << "y = " << y << " x = " << x;
+    }
+  }
+  jpegli_destroy_compress(&cinfo);
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace
+}  // namespace HWY_NAMESPACE
+}  // namespace jpegli
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jpegli {
+
+class AdaptiveQuantizationTargetTest : public hwy::TestWithParamTarget {};
+HWY_TARGET_INSTANTIATE_TEST_SUITE_P(AdaptiveQuantizationTargetTest);
+
+HWY_EXPORT_AND_TEST_P(AdaptiveQuantizationTargetTest, TestFusedPreErosion);
+
+}  // namespace jpegli
+#endif  // HWY_ONCE
@@ -10,10 +10,12 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <vector>
 
 #include "lib/jpegli/common.h"
 #include "lib/jpegli/encode_internal.h"
 #include "lib/jpegli/memory_manager.h"
+#include "lib/jpegli/stats.h"
 
 namespace jpegli {
 
@@ -29,9 +31,29 @@ void JpegBitWriterInit(j_compress_ptr cinfo) {
   bw->put_buffer = 0;
   bw->free_bits = 64;
   bw->healthy = true;
+  bw->output = nullptr;
+}
+
+void JpegBitWriterInit(JpegBitWriter* bw, uint8_t* data, size_t len,
+                       std::vector<uint8_t>* output) {
+  bw->cinfo = nullptr;
+  bw->data = data;
+  bw->len = len;
+  bw->pos = 0;
+  bw->output_pos = 0;
+  bw->put_buffer = 0;
+  bw->free_bits = 64;
+  bw->healthy = true;
+  bw->output = output;
 }
 
 bool EmptyBitWriterBuffer(JpegBitWriter* bw) {
+  if (bw->output) {
+    bw->output->insert(bw->output->end(), bw->data + bw->output_pos,
+                       bw->data + bw->pos);
+    bw->output_pos = bw->pos = 0;
+    return true;
+  }
   while (bw->output_pos < bw->pos) {
     j_compress_ptr cinfo = bw->cinfo;
     if (cinfo->dest->free_in_buffer == 0 &&
@@ -41,6 +63,7 @@ bool EmptyBitWriterBuffer(JpegBitWriter* bw) {
     size_t buflen = bw->pos - bw->output_pos;
     size_t copylen = std::min<size_t>(cinfo->dest->free_in_buffer, buflen);
     memcpy(cinfo->dest->next_output_byte, bw->data + bw->output_pos, copylen);
+    JPEGLI_STATS_ADD(cinfo->master, output_bytes, copylen);
     bw->output_pos += copylen;
     cinfo->dest->free_in_buffer -= copylen;
     cinfo->dest->next_output_byte += copylen;
@@ -7,8 +7,10 @@
 #ifndef JPEGLI_LIB_JPEGLI_BIT_WRITER_H_
 #define JPEGLI_LIB_JPEGLI_BIT_WRITER_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <vector>
 
 #include "lib/base/byte_order.h"
 #include "lib/base/compiler_specific.h"
@@ -26,10 +28,19 @@ struct JpegBitWriter {
   uint64_t put_buffer;
   int free_bits;
   bool healthy;
+  // If not null, the output is appended here instead of being written to the
+  // destination manager.
+  std::vector<uint8_t>* output;
 };
 
 void JpegBitWriterInit(j_compress_ptr cinfo);
 
+// Initializes *bw to pack bits into the len bytes long buffer at data and to
+// append the output to *output. Unlike the bit writer of cinfo, this can be
+// used on any thread.
+void JpegBitWriterInit(JpegBitWriter* bw, uint8_t* data, size_t len,
+                       std::vector<uint8_t>* output);
+
 bool EmptyBitWriterBuffer(JpegBitWriter* bw);
 
 void JumpToByteBoundary(JpegBitWriter* bw);
@@ -14,11 +14,14 @@
 #include <vector>
 
 #include "lib/base/compiler_specific.h"
+#include "lib/base/data_parallel.h"
+#include "lib/base/status.h"
 #include "lib/jpegli/bit_writer.h"
 #include "lib/jpegli/common.h"
 #include "lib/jpegli/common_internal.h"
 #include "lib/jpegli/encode_internal.h"
 #include "lib/jpegli/error.h"
+#include "lib/jpegli/stats.h"
 
 namespace jpegli {
 
@@ -31,6 +34,7 @@ void WriteOutput(j_compress_ptr cinfo, const uint8_t* buf, size_t bufsize) {
     }
     size_t len = std::min<size_t>(cinfo->dest->free_in_buffer, bufsize - pos);
     memcpy(cinfo->dest->next_output_byte, buf + pos, len);
+    JPEGLI_STATS_ADD(cinfo->master, output_bytes, len);
     pos += len;
     cinfo->dest->free_in_buffer -= len;
     cinfo->dest->next_output_byte += len;
@@ -436,11 +440,9 @@ void WriteDCRefinementBits(j_compress_ptr cinfo, int scan_index,
   }
 }
 
-}  // namespace
-
-void WriteScanData(j_compress_ptr cinfo, int scan_index) {
+// Writes the entropy coded data of the scan to *bw, padded to a byte boundary.
+void WriteScanBits(j_compress_ptr cinfo, int scan_index, JpegBitWriter* bw) {
   const jpeg_scan_info* scan_info = &cinfo->scan_info[scan_index];
-  JpegBitWriter* bw = &cinfo->master->bw;
   if (scan_info->Ah == 0) {
     WriteTokens(cinfo, scan_index, bw);
   } else if (scan_info->Ss > 0) {
@@ -448,13 +450,56 @@ void WriteScanData(j_compress_ptr cinfo, int scan_index) {
   } else {
     WriteDCRefinementBits(cinfo, scan_index, bw);
   }
+  JumpToByteBoundary(bw);
+}
+
+}  // namespace
+
+void WriteScanData(j_compress_ptr cinfo, int scan_index) {
+  JpegBitWriter* bw = &cinfo->master->bw;
+  WriteScanBits(cinfo, scan_index, bw);
   if (!bw->healthy) {
     JPEGLI_ERROR("Unknown Huffman coded symbol found in scan %d", scan_index);
   }
-  JumpToByteBoundary(bw);
   if (!EmptyBitWriterBuffer(bw)) {
     JPEGLI_ERROR("Output suspension is not supported in finish_compress");
   }
 }
 
+void WriteScans(j_compress_ptr cinfo, ThreadPool* pool) {
+  jpeg_comp_master* m = cinfo->master;
+  const int num_scans = cinfo->num_scans;
+  std::vector<std::vector<uint8_t>> scan_data(num_scans);
+  std::vector<uint8_t> healthy(num_scans);
+  std::vector<std::vector<uint8_t>> buffers;
+  const auto init_buffers = [&](size_t num_threads) -> Status {
+    buffers.resize(num_threads);
+    for (auto& buffer : buffers) {
+      buffer.resize(m->bw.len);
+    }
+    return true;
+  };
+  const auto write_scan = [&](const uint32_t scan_index,
+                              const size_t thread) -> Status {
+    JpegBitWriter bw;
+    JpegBitWriterInit(&bw, buffers[thread].data(), buffers[thread].size(),
+                      &scan_data[scan_index]);
+    WriteScanBits(cinfo, scan_index, &bw);
+    EmptyBitWriterBuffer(&bw);
+    healthy[scan_index] = bw.healthy;
+    return true;
+  };
+  if (!RunOnPool(pool, 0, num_scans, init_buffers, write_scan,
+                 "WriteScans")) {
+    JPEGLI_ERROR("Failed to write scans.");
+  }
+  for (int i = 0; i < num_scans; ++i) {
+    WriteScanHeader(cinfo, i);
+    if (!healthy[i]) {
+      JPEGLI_ERROR("Unknown Huffman coded symbol found in scan %d", i);
+    }
+    WriteOutput(cinfo, scan_data[i]);
+  }
+}
+
 }  // namespace jpegli
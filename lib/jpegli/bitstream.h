@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "lib/base/compiler_specific.h"
+#include "lib/base/data_parallel.h"
 #include "lib/jpegli/bit_writer.h"
 #include "lib/jpegli/common.h"
 #include "lib/jpegli/encode_internal.h"
@@ -44,6 +45,11 @@ void WriteBlock(const int32_t* JPEGLI_RESTRICT symbols,
                 JpegBitWriter* JPEGLI_RESTRICT bw);
 void WriteScanData(j_compress_ptr cinfo, int scan_index);
 
+// Writes the headers and entropy coded data of all scans. The scans are entropy
+// coded into memory concurrently on the thread pool and are written to the
+// output in order.
+void WriteScans(j_compress_ptr cinfo, ThreadPool* pool);
+
 }  // namespace jpegli
 
 #endif  // JPEGLI_LIB_JPEGLI_BITSTREAM_H_
@@ -8,6 +8,7 @@
 
 #include "lib/jpegli/common_internal.h"
 #include "lib/jpegli/decode_internal.h"
+#include "lib/jpegli/encode_internal.h"
 #include "lib/jpegli/memory_manager.h"
 #include "lib/jpegli/types.h"
 
@@ -49,6 +50,19 @@ JHUFF_TBL* jpegli_alloc_huff_table(j_common_ptr cinfo) {
   return table;
 }
 
+boolean jpegli_get_stats(j_common_ptr cinfo, JpegliStats* stats) {
+  memset(stats, 0, sizeof(*stats));
+#if JPEGLI_ENABLE_STATS
+  if (cinfo->is_decompressor) {
+    *stats = reinterpret_cast<j_decompress_ptr>(cinfo)->master->stats;
+  } else {
+    *stats = reinterpret_cast<j_compress_ptr>(cinfo)->master->stats;
+  }
+#endif
+  stats->peak_memory_usage = jpegli::GetPeakMemoryUsage(cinfo);
+  return JPEGLI_ENABLE_STATS ? TRUE : FALSE;
+}
+
 int jpegli_bytes_per_sample(JpegliDataType data_type) {
   switch (data_type) {
     case JPEGLI_TYPE_UINT8:
@@ -22,6 +22,7 @@
 #define JPEGLI_LIB_JPEGLI_COMMON_H_
 
 #include "lib/base/include_jpeglib.h"  // IWYU pragma: export
+#include "lib/jpegli/types.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -37,6 +38,12 @@ JQUANT_TBL* jpegli_alloc_quant_table(j_common_ptr cinfo);
 
 JHUFF_TBL* jpegli_alloc_huff_table(j_common_ptr cinfo);
 
+// Fills in the per-stage timing and counters of the current or last image
+// processed by the compressor or decompressor. The stage timings and counters
+// are only collected if the library was built with JPEGLI_ENABLE_STATS, if it
+// was not, only the peak memory usage is filled in and FALSE is returned.
+boolean jpegli_get_stats(j_common_ptr cinfo, JpegliStats* stats);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
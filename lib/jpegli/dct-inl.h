@@ -9,6 +9,7 @@
 #include <cstdint>
 
 #include "lib/jpegli/common.h"
+#include "lib/jpegli/encode_internal.h"
 
 #if defined(JPEGLI_LIB_JPEGLI_DCT_INL_H_) == defined(HWY_TARGET_TOGGLE)
 #ifdef JPEGLI_LIB_JPEGLI_DCT_INL_H_
@@ -30,7 +31,9 @@ namespace {
 // These templates are not found via ADL.
 using hwy::HWY_NAMESPACE::Abs;
 using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::AllTrue;
 using hwy::HWY_NAMESPACE::DemoteTo;
+using hwy::HWY_NAMESPACE::Eq;
 using hwy::HWY_NAMESPACE::Ge;
 using hwy::HWY_NAMESPACE::Half;
 using hwy::HWY_NAMESPACE::IfThenElseZero;
@@ -41,57 +44,59 @@ using hwy::HWY_NAMESPACE::Round;
 using hwy::HWY_NAMESPACE::Sub;
 using hwy::HWY_NAMESPACE::Vec;
 
-template <size_t N>
+// The 1D DCTs below transform strips of 8 rows and at most kLanes columns,
+// which are stored with a row stride of kLanes in the temporary buffers.
+template <size_t N, size_t kLanes>
 void AddReverse(const float* JPEGLI_RESTRICT a_in1,
                 const float* JPEGLI_RESTRICT a_in2,
                 float* JPEGLI_RESTRICT a_out) {
-  HWY_CAPPED(float, 8) d8;
+  HWY_CAPPED(float, kLanes) d;
   for (size_t i = 0; i < N; i++) {
-    auto in1 = Load(d8, a_in1 + i * 8);
-    auto in2 = Load(d8, a_in2 + (N - i - 1) * 8);
-    Store(Add(in1, in2), d8, a_out + i * 8);
+    auto in1 = Load(d, a_in1 + i * kLanes);
+    auto in2 = Load(d, a_in2 + (N - i - 1) * kLanes);
+    Store(Add(in1, in2), d, a_out + i * kLanes);
   }
 }
 
-template <size_t N>
+template <size_t N, size_t kLanes>
 void SubReverse(const float* JPEGLI_RESTRICT a_in1,
                 const float* JPEGLI_RESTRICT a_in2,
                 float* JPEGLI_RESTRICT a_out) {
-  HWY_CAPPED(float, 8) d8;
+  HWY_CAPPED(float, kLanes) d;
   for (size_t i = 0; i < N; i++) {
-    auto in1 = Load(d8, a_in1 + i * 8);
-    auto in2 = Load(d8, a_in2 + (N - i - 1) * 8);
-    Store(Sub(in1, in2), d8, a_out + i * 8);
+    auto in1 = Load(d, a_in1 + i * kLanes);
+    auto in2 = Load(d, a_in2 + (N - i - 1) * kLanes);
+    Store(Sub(in1, in2), d, a_out + i * kLanes);
   }
 }
 
-template <size_t N>
+template <size_t N, size_t kLanes>
 void B(float* JPEGLI_RESTRICT coeff) {
-  HWY_CAPPED(float, 8) d8;
+  HWY_CAPPED(float, kLanes) d;
   constexpr float kSqrt2 = 1.41421356237f;
-  auto sqrt2 = Set(d8, kSqrt2);
-  auto in1_0 = Load(d8, coeff);
-  auto in2_0 = Load(d8, coeff + 8);
-  Store(MulAdd(in1_0, sqrt2, in2_0), d8, coeff);
+  auto sqrt2 = Set(d, kSqrt2);
+  auto in1_0 = Load(d, coeff);
+  auto in2_0 = Load(d, coeff + kLanes);
+  Store(MulAdd(in1_0, sqrt2, in2_0), d, coeff);
   for (size_t i = 1; i + 1 < N; i++) {
-    auto in1 = Load(d8, coeff + i * 8);
-    auto in2 = Load(d8, coeff + (i + 1) * 8);
-    Store(Add(in1, in2), d8, coeff + i * 8);
+    auto in1 = Load(d, coeff + i * kLanes);
+    auto in2 = Load(d, coeff + (i + 1) * kLanes);
+    Store(Add(in1, in2), d, coeff + i * kLanes);
   }
 }
 
 // Ideally optimized away by compiler (except the multiply).
-template <size_t N>
+template <size_t N, size_t kLanes>
 void InverseEvenOdd(const float* JPEGLI_RESTRICT a_in,
                     float* JPEGLI_RESTRICT a_out) {
-  HWY_CAPPED(float, 8) d8;
+  HWY_CAPPED(float, kLanes) d;
   for (size_t i = 0; i < N / 2; i++) {
-    auto in1 = Load(d8, a_in + i * 8);
-    Store(in1, d8, a_out + 2 * i * 8);
+    auto in1 = Load(d, a_in + i * kLanes);
+    Store(in1, d, a_out + 2 * i * kLanes);
   }
   for (size_t i = N / 2; i < N; i++) {
-    auto in1 = Load(d8, a_in + i * 8);
-    Store(in1, d8, a_out + (2 * (i - N / 2) + 1) * 8);
+    auto in1 = Load(d, a_in + i * kLanes);
+    Store(in1, d, a_out + (2 * (i - N / 2) + 1) * kLanes);
   }
 }
 
@@ -125,89 +130,117 @@ constexpr float WcMultipliers<8>::kMultipliers[];
 #endif
 
 // Invoked on full vector.
-template <size_t N>
+template <size_t N, size_t kLanes>
 void Multiply(float* JPEGLI_RESTRICT coeff) {
-  HWY_CAPPED(float, 8) d8;
+  HWY_CAPPED(float, kLanes) d;
   for (size_t i = 0; i < N / 2; i++) {
-    auto in1 = Load(d8, coeff + (N / 2 + i) * 8);
-    auto mul = Set(d8, WcMultipliers<N>::kMultipliers[i]);
-    Store(Mul(in1, mul), d8, coeff + (N / 2 + i) * 8);
+    auto in1 = Load(d, coeff + (N / 2 + i) * kLanes);
+    auto mul = Set(d, WcMultipliers<N>::kMultipliers[i]);
+    Store(Mul(in1, mul), d, coeff + (N / 2 + i) * kLanes);
   }
 }
 
+template <size_t kLanes>
 void LoadFromBlock(const float* JPEGLI_RESTRICT pixels, size_t pixels_stride,
                    size_t off, float* JPEGLI_RESTRICT coeff) {
-  HWY_CAPPED(float, 8) d8;
+  HWY_CAPPED(float, kLanes) d;
   for (size_t i = 0; i < 8; i++) {
-    Store(LoadU(d8, pixels + i * pixels_stride + off), d8, coeff + i * 8);
+    Store(LoadU(d, pixels + i * pixels_stride + off), d, coeff + i * kLanes);
   }
 }
 
+template <size_t kLanes>
 void StoreToBlockAndScale(const float* JPEGLI_RESTRICT coeff, float* output,
-                          size_t off) {
-  HWY_CAPPED(float, 8) d8;
-  auto mul = Set(d8, 1.0f / 8);
+                          size_t output_stride, size_t off) {
+  HWY_CAPPED(float, kLanes) d;
+  auto mul = Set(d, 1.0f / 8);
   for (size_t i = 0; i < 8; i++) {
-    StoreU(Mul(mul, Load(d8, coeff + i * 8)), d8, output + i * 8 + off);
+    StoreU(Mul(mul, Load(d, coeff + i * kLanes)), d,
+           output + i * output_stride + off);
   }
 }
 
-template <size_t N>
+template <size_t N, size_t kLanes>
 struct DCT1DImpl;
 
-template <>
-struct DCT1DImpl<1> {
+template <size_t kLanes>
+struct DCT1DImpl<1, kLanes> {
   JPEGLI_INLINE void operator()(float* JPEGLI_RESTRICT mem) {}
 };
 
-template <>
-struct DCT1DImpl<2> {
+template <size_t kLanes>
+struct DCT1DImpl<2, kLanes> {
   JPEGLI_INLINE void operator()(float* JPEGLI_RESTRICT mem) {
-    HWY_CAPPED(float, 8) d8;
-    auto in1 = Load(d8, mem);
-    auto in2 = Load(d8, mem + 8);
-    Store(Add(in1, in2), d8, mem);
-    Store(Sub(in1, in2), d8, mem + 8);
+    HWY_CAPPED(float, kLanes) d;
+    auto in1 = Load(d, mem);
+    auto in2 = Load(d, mem + kLanes);
+    Store(Add(in1, in2), d, mem);
+    Store(Sub(in1, in2), d, mem + kLanes);
   }
 };
 
-template <size_t N>
+template <size_t N, size_t kLanes>
 struct DCT1DImpl {
   void operator()(float* JPEGLI_RESTRICT mem) {
-    HWY_ALIGN float tmp[N * 8];
-    AddReverse<N / 2>(mem, mem + N * 4, tmp);
-    DCT1DImpl<N / 2>()(tmp);
-    SubReverse<N / 2>(mem, mem + N * 4, tmp + N * 4);
-    Multiply<N>(tmp);
-    DCT1DImpl<N / 2>()(tmp + N * 4);
-    B<N / 2>(tmp + N * 4);
-    InverseEvenOdd<N>(tmp, mem);
+    HWY_ALIGN float tmp[N * kLanes];
+    AddReverse<N / 2, kLanes>(mem, mem + N / 2 * kLanes, tmp);
+    DCT1DImpl<N / 2, kLanes>()(tmp);
+    SubReverse<N / 2, kLanes>(mem, mem + N / 2 * kLanes, tmp + N / 2 * kLanes);
+    Multiply<N, kLanes>(tmp);
+    DCT1DImpl<N / 2, kLanes>()(tmp + N / 2 * kLanes);
+    B<N / 2, kLanes>(tmp + N / 2 * kLanes);
+    InverseEvenOdd<N, kLanes>(tmp, mem);
   }
 };
 
+// Transforms the xsize columns of the 8 rows at pixels, xsize must be a
+// multiple of the vector size.
+template <size_t kLanes>
 void DCT1D(const float* JPEGLI_RESTRICT pixels, size_t pixels_stride,
-           float* JPEGLI_RESTRICT output) {
-  HWY_CAPPED(float, 8) d8;
-  HWY_ALIGN float tmp[64];
-  for (size_t i = 0; i < 8; i += Lanes(d8)) {
+           size_t xsize, float* JPEGLI_RESTRICT output, size_t output_stride) {
+  HWY_CAPPED(float, kLanes) d;
+  HWY_ALIGN float tmp[8 * kLanes];
+  for (size_t i = 0; i < xsize; i += Lanes(d)) {
     // TODO(veluca): consider removing the temporary memory here (as is done in
     // IDCT), if it turns out that some compilers don't optimize away the loads
     // and this is performance-critical.
-    LoadFromBlock(pixels, pixels_stride, i, tmp);
-    DCT1DImpl<8>()(tmp);
-    StoreToBlockAndScale(tmp, output, i);
+    LoadFromBlock<kLanes>(pixels, pixels_stride, i, tmp);
+    DCT1DImpl<8, kLanes>()(tmp);
+    StoreToBlockAndScale<kLanes>(tmp, output, output_stride, i);
   }
 }
 
 JPEGLI_INLINE JPEGLI_MAYBE_UNUSED void TransformFromPixels(
     const float* JPEGLI_RESTRICT pixels, size_t pixels_stride,
     float* JPEGLI_RESTRICT coefficients, float* JPEGLI_RESTRICT scratch_space) {
-  DCT1D(pixels, pixels_stride, scratch_space);
+  DCT1D<8>(pixels, pixels_stride, 8, scratch_space, 8);
   Transpose8x8Block(scratch_space, coefficients);
-  DCT1D(coefficients, 8, scratch_space);
+  DCT1D<8>(coefficients, 8, 8, scratch_space, 8);
   Transpose8x8Block(scratch_space, coefficients);
 }
 
+// Same as TransformFromPixels for kDCTBatchSize horizontally adjacent blocks,
+// whose coefficients are stored one after the other. The 1D DCTs are done on
+// rows spanning all blocks of the batch, so vectors wider than a block row are
+// fully used. The scratch space must hold 2 * kDCTBatchSize * DCTSIZE2 floats.
+JPEGLI_INLINE JPEGLI_MAYBE_UNUSED void TransformBatchFromPixels(
+    const float* JPEGLI_RESTRICT pixels, size_t pixels_stride,
+    float* JPEGLI_RESTRICT coefficients, float* JPEGLI_RESTRICT scratch_space) {
+  constexpr size_t kWidth = kDCTBatchSize * DCTSIZE;
+  float* JPEGLI_RESTRICT rows0 = scratch_space;
+  float* JPEGLI_RESTRICT rows1 = scratch_space + kDCTBatchSize * DCTSIZE2;
+  DCT1D<16>(pixels, pixels_stride, kWidth, rows0, kWidth);
+  for (size_t b = 0; b < kDCTBatchSize; ++b) {
+    Transpose8x8Block(rows0 + b * DCTSIZE, kWidth, rows1 + b * DCTSIZE,
+                      kWidth);
+  }
+  DCT1D<16>(rows1, kWidth, kWidth, rows0, kWidth);
+  for (size_t b = 0; b < kDCTBatchSize; ++b) {
+    Transpose8x8Block(rows0 + b * DCTSIZE, kWidth, coefficients + b * DCTSIZE2,
+                      DCTSIZE);
+  }
+}
+
 JPEGLI_INLINE JPEGLI_MAYBE_UNUSED void StoreQuantizedValue(
     const Vec<HWY_FULL(int32_t)>& ival, int16_t* out) {
   Half<HWY_FULL(int16_t)> di16;
@@ -241,26 +274,76 @@ void QuantizeBlock(const float* dct, const float* qmc, float aq_strength,
   }
 }
 
+// Returns true if all pixels of the 8 rows and xsize columns starting at
+// pixels have the same value. xsize must be a multiple of 8.
+JPEGLI_INLINE JPEGLI_MAYBE_UNUSED bool IsFlatRegion(
+    const float* JPEGLI_RESTRICT pixels, size_t stride, size_t xsize) {
+  const HWY_CAPPED(float, 8) d;
+  const auto first = Set(d, pixels[0]);
+  for (size_t y = 0; y < DCTSIZE; ++y) {
+    const float* JPEGLI_RESTRICT row = pixels + y * stride;
+    for (size_t x = 0; x < xsize; x += Lanes(d)) {
+      if (!AllTrue(d, Eq(Load(d, row + x), first))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Quantizes the DC coefficient, or reuses the previous one if they are close
+// enough.
+JPEGLI_INLINE JPEGLI_MAYBE_UNUSED int QuantizeDC(float dct_dc, float qmc_dc,
+                                                 int16_t last_dc_coeff,
+                                                 float aq_strength,
+                                                 const float* zero_bias_offset,
+                                                 const float* zero_bias_mul) {
+  // Center DC values around zero.
+  static constexpr float kDCBias = 128.0f;
+  const float dc = (dct_dc - kDCBias) * qmc_dc;
+  float dc_threshold = zero_bias_offset[0] + aq_strength * zero_bias_mul[0];
+  if (std::abs(dc - last_dc_coeff) < dc_threshold) {
+    return last_dc_coeff;
+  }
+  return std::round(dc);
+}
+
 template <typename T>
 void ComputeCoefficientBlock(const float* JPEGLI_RESTRICT pixels, size_t stride,
+                             const float* JPEGLI_RESTRICT batch_dct,
                              const float* JPEGLI_RESTRICT qmc,
                              int16_t last_dc_coeff, float aq_strength,
                              const float* zero_bias_offset,
                              const float* zero_bias_mul,
                              float* JPEGLI_RESTRICT tmp, T* block) {
-  float* JPEGLI_RESTRICT dct = tmp;
-  float* JPEGLI_RESTRICT scratch_space = tmp + DCTSIZE2;
-  TransformFromPixels(pixels, stride, dct, scratch_space);
+  // The DCT of the block is already known if it was transformed as part of a
+  // batch of blocks.
+  const float* JPEGLI_RESTRICT dct = batch_dct;
+  if (dct == nullptr) {
+    float* JPEGLI_RESTRICT block_dct = tmp;
+    float* JPEGLI_RESTRICT scratch_space = tmp + DCTSIZE2;
+    TransformFromPixels(pixels, stride, block_dct, scratch_space);
+    dct = block_dct;
+  }
   QuantizeBlock(dct, qmc, aq_strength, zero_bias_offset, zero_bias_mul, block);
-  // Center DC values around zero.
-  static constexpr float kDCBias = 128.0f;
-  const float dc = (dct[0] - kDCBias) * qmc[0];
-  float dc_threshold = zero_bias_offset[0] + aq_strength * zero_bias_mul[0];
-  if (std::abs(dc - last_dc_coeff) < dc_threshold) {
-    block[0] = last_dc_coeff;
-  } else {
-    block[0] = std::round(dc);
+  block[0] = QuantizeDC(dct[0], qmc[0], last_dc_coeff, aq_strength,
+                        zero_bias_offset, zero_bias_mul);
+}
+
+// Same as ComputeCoefficientBlock for a block whose pixels all have the given
+// value. The DCT of such a block has only a DC coefficient, which is equal to
+// the pixel value, so the transform and the AC quantization are skipped.
+template <typename T>
+void ComputeFlatCoefficientBlock(float value, const float* JPEGLI_RESTRICT qmc,
+                                 int16_t last_dc_coeff, float aq_strength,
+                                 const float* zero_bias_offset,
+                                 const float* zero_bias_mul, T* block) {
+  const HWY_FULL(int32_t) di;
+  for (size_t k = 0; k < DCTSIZE2; k += Lanes(di)) {
+    StoreQuantizedValue(Zero(di), block + k);
   }
+  block[0] = QuantizeDC(value, qmc[0], last_dc_coeff, aq_strength,
+                        zero_bias_offset, zero_bias_mul);
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -0,0 +1,68 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <cstddef>
+
+#include "lib/base/random.h"
+#include "lib/jpegli/common.h"
+#include "lib/jpegli/encode_internal.h"
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jpegli/dct_test.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+#include <hwy/tests/hwy_gtest.h>
+
+#include "lib/jpegli/dct-inl.h"
+#include "lib/jpegli/testing.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jpegli {
+namespace HWY_NAMESPACE {
+namespace {
+
+HWY_NOINLINE void TestBatchedTransform() {
+  constexpr size_t kBatchWidth = kDCTBatchSize * DCTSIZE;
+  // Wider than the batch, so that the rows of the batch are not contiguous.
+  constexpr size_t kStride = kBatchWidth + 16;
+  HWY_ALIGN float pixels[DCTSIZE * kStride];
+  HWY_ALIGN float expected[kDCTBatchSize * DCTSIZE2];
+  HWY_ALIGN float actual[kDCTBatchSize * DCTSIZE2];
+  HWY_ALIGN float scratch_space[2 * kDCTBatchSize * DCTSIZE2];
+  Rng rng(1);
+  for (size_t iter = 0; iter < 20; ++iter) {
+    for (float& v : pixels) {
+      v = rng.UniformF(-128.0f, 128.0f);
+    }
+    for (size_t b = 0; b < kDCTBatchSize; ++b) {
+      TransformFromPixels(pixels + b * DCTSIZE, kStride,
+                          expected + b * DCTSIZE2, scratch_space);
+    }
+    TransformBatchFromPixels(pixels, kStride, actual, scratch_space);
+    for (size_t i = 0; i < kDCTBatchSize * DCTSIZE2; ++i) {
+      ASSERT_EQ(expected[i], actual[i])
+          << "iter = " << iter << " block = " << i / DCTSIZE2
+          << " k = " << i % DCTSIZE2;
+    }
+  }
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace
+}  // namespace HWY_NAMESPACE
+}  // namespace jpegli
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jpegli {
+
+class DCTTargetTest : public hwy::TestWithParamTarget {};
+HWY_TARGET_INSTANTIATE_TEST_SUITE_P(DCTTargetTest);
+
+HWY_EXPORT_AND_TEST_P(DCTTargetTest, TestBatchedTransform);
+
+}  // namespace jpegli
+#endif  // HWY_ONCE
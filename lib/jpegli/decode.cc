@@ -26,6 +26,7 @@
 #include "lib/jpegli/huffman.h"
 #include "lib/jpegli/memory_manager.h"
 #include "lib/jpegli/render.h"
+#include "lib/jpegli/stats.h"
 #include "lib/jpegli/types.h"
 
 namespace jpegli {
@@ -56,6 +57,7 @@ void InitializeImage(j_decompress_ptr cinfo) {
   memset(cinfo->arith_ac_K, 0, sizeof(cinfo->arith_ac_K));
   // Initialize the private fields.
   jpeg_decomp_master* m = cinfo->master;
+  JPEGLI_STATS_RESET(m);
   m->input_buffer_.clear();
   m->input_buffer_pos_ = 0;
   m->codestream_bits_ahead_ = 0;
@@ -88,6 +90,9 @@ void InitializeImage(j_decompress_ptr cinfo) {
   }
   m->output_passes_done_ = 0;
   m->xoffset_ = 0;
+  m->fixed_point_idct = false;
+  m->has_integer_planes_ = false;
+  m->integer_output = nullptr;
   m->dequant_ = nullptr;
 }
 
@@ -319,10 +324,12 @@ int ConsumeInput(j_decompress_ptr cinfo) {
     }
     size_t pos = 0;
     if (cinfo->global_state == kDecProcessScan) {
+      JPEGLI_STAGE_TIMER(m, JPEGLI_STAGE_PROCESS_SCAN);
       status = ProcessScan(cinfo, data, len, &pos, &m->codestream_bits_ahead_);
     } else {
       status = ProcessMarkers(cinfo, data, len, &pos);
     }
+    JPEGLI_STATS_ADD(m, input_bytes, pos);
     if (m->input_buffer_.empty()) {
       cinfo->src->next_input_byte += pos;
       cinfo->src->bytes_in_buffer -= pos;
@@ -509,6 +516,11 @@ void AllocateOutputBuffers(j_decompress_ptr cinfo) {
       static_cast<size_t>(cinfo->max_h_samp_factor) * m->min_scaled_dct_size;
   size_t output_stride = m->iMCU_cols_ * iMCU_width;
   m->need_context_rows_ = false;
+  // The fixed-point render path can only be used with 8-bit output and
+  // without color quantization, see ChooseIntegerOutput().
+  m->has_integer_planes_ = (cinfo->dct_method == JDCT_IFAST &&
+                            m->output_data_type_ == JPEGLI_TYPE_UINT8 &&
+                            !cinfo->quantize_colors && !cinfo->raw_data_out);
   for (int c = 0; c < cinfo->num_components; ++c) {
     if (cinfo->do_fancy_upsampling && m->v_factor[c] == 2) {
       m->need_context_rows_ = true;
@@ -525,18 +537,30 @@ void AllocateOutputBuffers(j_decompress_ptr cinfo) {
       cheight *= 3;
     }
     m->raw_output_[c].Allocate(cinfo, cheight, downsampled_width);
+    if (m->has_integer_planes_) {
+      m->raw_output_i16_[c].Allocate(cinfo, cheight, downsampled_width);
+    }
   }
   int num_all_components =
       std::max(cinfo->out_color_components, cinfo->num_components);
   for (int c = 0; c < num_all_components; ++c) {
     m->render_output_[c].Allocate(cinfo, cinfo->max_v_samp_factor,
                                   output_stride);
+    if (m->has_integer_planes_) {
+      m->render_output_i16_[c].Allocate(cinfo, cinfo->max_v_samp_factor,
+                                        output_stride);
+    }
   }
-  m->idct_scratch_ = Allocate<float>(cinfo, 5 * DCTSIZE2, JPOOL_IMAGE_ALIGNED);
+  m->idct_scratch_ = Allocate<float>(cinfo, 3 * kIDCTBatchSize * DCTSIZE2,
+                                     JPOOL_IMAGE_ALIGNED);
   // Padding for horizontal chroma upsampling.
   constexpr size_t kUpsamplePadding = 2 * HWY_ALIGNMENT / sizeof(float);
   m->upsample_scratch_ = Allocate<float>(
       cinfo, output_stride + kUpsamplePadding, JPOOL_IMAGE_ALIGNED);
+  if (m->has_integer_planes_) {
+    m->upsample_scratch_i16_ = Allocate<int16_t>(
+        cinfo, output_stride + 2 * kUpsamplePadding, JPOOL_IMAGE_ALIGNED);
+  }
   size_t bytes_per_sample = jpegli_bytes_per_sample(m->output_data_type_);
   size_t bytes_per_pixel = cinfo->out_color_components * bytes_per_sample;
   size_t scratch_stride = RoundUpTo(output_stride, HWY_ALIGNMENT);
@@ -942,7 +966,6 @@ void jpegli_crop_scanline(j_decompress_ptr cinfo, JDIMENSION* xoffset,
       *xoffset + *width > cinfo->output_width) {
     JPEGLI_ERROR("jpegli_crop_scanline: Invalid arguments");
   }
-  // TODO(szabadka) Skip the IDCT for skipped over blocks.
   size_t xend = *xoffset + *width;
   size_t iMCU_width =
       static_cast<size_t>(m->min_scaled_dct_size) * cinfo->max_h_samp_factor;
@@ -950,6 +973,7 @@ void jpegli_crop_scanline(j_decompress_ptr cinfo, JDIMENSION* xoffset,
   *width = xend - *xoffset;
   cinfo->master->xoffset_ = *xoffset;
   cinfo->output_width = *width;
+  jpegli::UpdateRenderedColumns(cinfo);
 }
 
 JDIMENSION jpegli_read_raw_data(j_decompress_ptr cinfo, JSAMPIMAGE data,
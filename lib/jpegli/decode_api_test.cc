@@ -599,6 +599,86 @@ TEST(DecodeAPITest, AbbreviatedStreams) {
   if (data_stream) free(data_stream);
 }
 
+// Decodes the compressed image, cropped with jpegli_crop_scanline to the
+// columns [*xoffset, *xoffset + *width) if *width is not zero, and updates the
+// crop window to the one chosen by the decoder.
+void DecodeCropped(const std::vector<uint8_t>& compressed,
+                   J_DCT_METHOD dct_method, JDIMENSION* xoffset,
+                   JDIMENSION* width, TestImage* output) {
+  jpeg_decompress_struct cinfo;
+  const auto try_catch_block = [&]() -> bool {
+    ERROR_HANDLER_SETUP(jpegli);
+    jpegli_create_decompress(&cinfo);
+    jpegli_mem_src(&cinfo, compressed.data(), compressed.size());
+    jpegli_read_header(&cinfo, TRUE);
+    cinfo.dct_method = dct_method;
+    jpegli_start_decompress(&cinfo);
+    if (*width == 0) {
+      *xoffset = 0;
+      *width = cinfo.output_width;
+    } else {
+      jpegli_crop_scanline(&cinfo, xoffset, width);
+    }
+    output->xsize = *width;
+    output->ysize = cinfo.output_height;
+    output->components = cinfo.out_color_components;
+    const size_t stride = output->xsize * output->components;
+    output->pixels.resize(output->ysize * stride);
+    while (cinfo.output_scanline < cinfo.output_height) {
+      JSAMPROW row = &output->pixels[cinfo.output_scanline * stride];
+      jpegli_read_scanlines(&cinfo, &row, 1);
+    }
+    jpegli_finish_decompress(&cinfo);
+    return true;
+  };
+  ASSERT_TRUE(try_catch_block());
+  jpegli_destroy_decompress(&cinfo);
+}
+
+TEST(DecodeAPITest, CropScanlineMatchesFullDecode) {
+  TestImage input;
+  input.xsize = 1531;
+  input.ysize = 67;
+  GeneratePixels(&input);
+  CompressParams jparams;
+  jparams.h_sampling = {2, 1, 1};
+  jparams.v_sampling = {2, 1, 1};
+  std::vector<uint8_t> compressed;
+  ASSERT_TRUE(EncodeWithJpegli(input, jparams, &compressed));
+  // Crop windows that start inside an iMCU column, including windows at both
+  // edges of the image, and ones where the vector aligned start of the
+  // rendered columns is left of the iMCU column of the crop.
+  const JDIMENSION kCrops[][2] = {
+      {1, 1}, {17, 40}, {333, 517}, {1000, 531}, {1490, 41}, {1530, 1},
+  };
+  for (J_DCT_METHOD dct_method : {JDCT_ISLOW, JDCT_IFAST}) {
+    JDIMENSION full_xoffset = 0;
+    JDIMENSION full_width = 0;
+    TestImage full;
+    DecodeCropped(compressed, dct_method, &full_xoffset, &full_width, &full);
+    ASSERT_EQ(input.xsize, full.xsize);
+    for (const auto& crop : kCrops) {
+      JDIMENSION xoffset = crop[0];
+      JDIMENSION width = crop[1];
+      TestImage cropped;
+      DecodeCropped(compressed, dct_method, &xoffset, &width, &cropped);
+      ASSERT_LE(xoffset, crop[0]);
+      ASSERT_GE(xoffset + width, crop[0] + crop[1]);
+      ASSERT_LE(xoffset + width, full.xsize);
+      ASSERT_EQ(full.ysize, cropped.ysize);
+      const size_t components = full.components;
+      for (size_t y = 0; y < full.ysize; ++y) {
+        const uint8_t* full_row =
+            &full.pixels[(y * full.xsize + xoffset) * components];
+        const uint8_t* cropped_row = &cropped.pixels[y * width * components];
+        ASSERT_EQ(0, memcmp(full_row, cropped_row, width * components))
+            << "dct_method = " << dct_method << " xoffset = " << crop[0]
+            << " width = " << crop[1] << " y = " << y;
+      }
+    }
+  }
+}
+
 class DecodeAPITestParam : public ::testing::TestWithParam<TestConfig> {};
 
 TEST_P(DecodeAPITestParam, TestAPI) {
@@ -758,6 +838,59 @@ std::vector<TestConfig> GenerateTests(bool buffered) {
     }
   }
 
+  // Tests for the fixed-point IDCT, compared against the JDCT_IFAST output of
+  // libjpeg. The constants of the libjpeg IDCT have only 8 fractional bits, so
+  // the two outputs differ by a few levels at most.
+  for (int h_samp : {1, 2}) {
+    for (int v_samp : {1, 2}) {
+      for (int progr : {0, 2}) {
+        for (bool fancy : {true, false}) {
+          if (!fancy && (h_samp == 1 && v_samp == 1)) continue;
+          if (progr != 0 && h_samp != v_samp) continue;
+          TestConfig config;
+          config.jparams.h_sampling = {h_samp, 1, 1};
+          config.jparams.v_sampling = {v_samp, 1, 1};
+          config.jparams.progressive_mode = progr;
+          config.dparams.do_fancy_upsampling = fancy;
+          config.dparams.dct_method = JDCT_IFAST;
+          config.max_rms_dist = 1.5f;
+          config.max_diff = 8.0f;
+          all_tests.push_back(config);
+        }
+      }
+    }
+  }
+  for (J_COLOR_SPACE out_color_space :
+       {JCS_GRAYSCALE, JCS_EXT_BGR, JCS_EXT_RGBA, JCS_EXT_ARGB}) {
+    TestConfig config;
+    config.jparams.h_sampling = {2, 1, 1};
+    config.jparams.v_sampling = {2, 1, 1};
+    config.dparams.set_out_color_space = true;
+    config.dparams.out_color_space = out_color_space;
+    config.dparams.dct_method = JDCT_IFAST;
+    config.max_rms_dist = 1.5f;
+    config.max_diff = 8.0f;
+    all_tests.push_back(config);
+  }
+  {
+    TestConfig config;
+    config.input.color_space = JCS_GRAYSCALE;
+    config.dparams.dct_method = JDCT_IFAST;
+    config.max_rms_dist = 1.0f;
+    config.max_diff = 4.0f;
+    all_tests.push_back(config);
+  }
+  {
+    TestConfig config;
+    config.jparams.h_sampling = {2, 1, 1};
+    config.jparams.v_sampling = {2, 1, 1};
+    config.dparams.crop_output = true;
+    config.dparams.dct_method = JDCT_IFAST;
+    config.max_rms_dist = 1.5f;
+    config.max_diff = 8.0f;
+    all_tests.push_back(config);
+  }
+
   // Tests for partial input.
   for (float size_factor : {0.1f, 0.33f, 0.5f, 0.75f}) {
     for (int progr : {0, 1, 3}) {
@@ -1292,6 +1425,9 @@ std::ostream& operator<<(std::ostream& os, const DecompressParams& dparams) {
   if (!dparams.do_fancy_upsampling) {
     os << "NoFancyUpsampling";
   }
+  if (dparams.dct_method == JDCT_IFAST) {
+    os << "IFastDCT";
+  }
   if (dparams.scale_num != 1 || dparams.scale_denom != 1) {
     os << "Scale" << dparams.scale_num << "_" << dparams.scale_denom;
   }
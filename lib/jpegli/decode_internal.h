@@ -15,6 +15,7 @@
 #include "lib/base/compiler_specific.h"
 #include "lib/jpegli/common_internal.h"
 #include "lib/jpegli/huffman.h"
+#include "lib/jpegli/stats.h"
 #include "lib/jpegli/types.h"
 
 namespace jpegli {
@@ -27,6 +28,31 @@ static constexpr size_t kAllHuffLutSize = NUM_HUFF_TBLS * kJpegHuffmanLutSize;
 
 typedef int16_t coeff_t;
 
+// Writes one output row of len pixels, starting at column xoffset of the
+// rendered planes, to output. The scratch buffer holds at least one vector of
+// output pixels.
+typedef void (*FusedOutputFunc)(float* rows[kMaxComponents], size_t xoffset,
+                                size_t len, uint8_t* scratch, uint8_t* output);
+
+// Same as above, for the 16-bit integer planes of the fixed-point render path.
+// The samples of the planes are centered 8-bit samples.
+typedef void (*IntegerOutputFunc)(int16_t* rows[kMaxComponents],
+                                  size_t xoffset, size_t len, uint8_t* scratch,
+                                  uint8_t* output);
+
+// Number of horizontally adjacent blocks that are transformed together by the
+// 8x8 inverse transform of a block row.
+static constexpr size_t kIDCTBatchSize = 4;
+
+// Inverse transform of num_blocks horizontally adjacent blocks of a component
+// to consecutive columns of the output rows.
+typedef void (*InverseTransformRowFunc)(const int16_t* qblocks,
+                                        size_t num_blocks,
+                                        const float* dequant,
+                                        const float* biases,
+                                        float* scratch_space, float* output,
+                                        size_t output_stride, size_t dctsize);
+
 // State of the decoder that has to be saved before decoding one MCU in case
 // we run out of the bitstream.
 struct MCUCodingState {
@@ -103,10 +129,20 @@ struct jpeg_decomp_master {
   int output_passes_done_;
   JpegliDataType output_data_type_ = JPEGLI_TYPE_UINT8;
   size_t xoffset_;
+  // Range of iMCU columns that are decoded and rendered: the ones that
+  // intersect the cropped output and their context for fancy upsampling.
+  size_t imcu_col_begin_;
+  size_t imcu_col_end_;
   bool swap_endianness_ = false;
   bool need_context_rows_;
   bool regenerate_inverse_colormap_;
   bool apply_smoothing;
+  // Set if the blocks are transformed with the fixed-point IDCT selected by
+  // JDCT_IFAST, in which case no dequantization biases are applied.
+  bool fixed_point_idct;
+  // Set if the 16-bit integer planes below were allocated, which is done if
+  // JDCT_IFAST was selected when the decompression started.
+  bool has_integer_planes_;
 
   int min_scaled_dct_size;
   int scaled_dct_size[jpegli::kMaxComponents];
@@ -114,17 +150,31 @@ struct jpeg_decomp_master {
   size_t raw_height_[jpegli::kMaxComponents];
   jpegli::RowBuffer<float> raw_output_[jpegli::kMaxComponents];
   jpegli::RowBuffer<float> render_output_[jpegli::kMaxComponents];
+  // Same as the above two for the fixed-point render path.
+  jpegli::RowBuffer<int16_t> raw_output_i16_[jpegli::kMaxComponents];
+  jpegli::RowBuffer<int16_t> render_output_i16_[jpegli::kMaxComponents];
 
   void (*inverse_transform[jpegli::kMaxComponents])(
       const int16_t* JPEGLI_RESTRICT qblock,
       const float* JPEGLI_RESTRICT dequant, const float* JPEGLI_RESTRICT biases,
       float* JPEGLI_RESTRICT scratch_space, float* JPEGLI_RESTRICT output,
       size_t output_stride, size_t dctsize);
+  // Same as above for the blocks of a block row, used when the coefficients
+  // are not smoothed before the transform.
+  jpegli::InverseTransformRowFunc inverse_transform_row[jpegli::kMaxComponents];
 
   void (*color_transform)(float* row[jpegli::kMaxComponents], size_t len);
+  // Color transform, decentering and sample conversion of an output row in a
+  // single pass, or nullptr if the separate steps above are used.
+  jpegli::FusedOutputFunc fused_output;
+  // Upsampling, color transform and sample conversion on 16-bit integers of
+  // the output of the fixed-point IDCT, or nullptr if the float planes are
+  // used. See ChooseIntegerOutput().
+  jpegli::IntegerOutputFunc integer_output;
 
   float* idct_scratch_;
   float* upsample_scratch_;
+  int16_t* upsample_scratch_i16_;
   uint8_t* output_scratch_;
   int16_t* smoothing_scratch_;
   float* dequant_;
@@ -153,6 +203,10 @@ struct jpeg_decomp_master {
   // i.e. the bottom half when rendering incomplete scans.
   int (*coef_bits_latch)[SAVED_COEFS];
   int (*prev_coef_bits_latch)[SAVED_COEFS];
+
+#if JPEGLI_ENABLE_STATS
+  JpegliStats stats;
+#endif
 };
 
 #endif  // JPEGLI_LIB_JPEGLI_DECODE_INTERNAL_H_
@@ -17,6 +17,7 @@
 #include "lib/jpegli/decode_internal.h"
 #include "lib/jpegli/error.h"
 #include "lib/jpegli/memory_manager.h"
+#include "lib/jpegli/stats.h"
 
 namespace jpegli {
 namespace {
@@ -332,6 +333,7 @@ void ProcessDHT(j_decompress_ptr cinfo, const uint8_t* data, size_t len) {
     for (int i = total_count; i < kJpegHuffmanAlphabetSize; ++i) {
       (*table)->huffval[i] = 0;
     }
+    JPEGLI_STATS_ADD(cinfo->master, num_huffman_tables, 1);
   }
   JPEG_VERIFY_MARKER_END();
 }
@@ -6,10 +6,14 @@
 
 #include "lib/jpegli/downsample.h"
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 
 #include "lib/base/compiler_specific.h"
+#include "lib/base/data_parallel.h"
+#include "lib/base/status.h"
 #include "lib/jpegli/common.h"
 
 #undef HWY_TARGET_INCLUDE
@@ -27,6 +31,7 @@ namespace HWY_NAMESPACE {
 // These templates are not found via ADL.
 using hwy::HWY_NAMESPACE::Add;
 using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
 using hwy::HWY_NAMESPACE::Vec;
 
 using D = HWY_CAPPED(float, 8);
@@ -203,6 +208,31 @@ void Downsample4x4(float* rows_in[MAX_SAMP_FACTOR], size_t len,
   Downsample1x4(rows_in, len / 4, row_out);
 }
 
+// Computes the sum of each pixel of the row and its left and right neighbours.
+void HorizontalSum3(const float* row_in, size_t len, float* row_out) {
+  for (size_t x = 0; x < len; x += Lanes(d)) {
+    const auto left = LoadU(d, row_in + x - 1);
+    const auto right = LoadU(d, row_in + x + 1);
+    Store(Add(Add(left, Load(d, row_in + x)), right), d, row_out + x);
+  }
+}
+
+// Applies the 3x3 smoothing filter to row_in, given the horizontal sums of 3
+// of the row above, the row itself and the row below.
+void SmoothRow(const float* row_in, const float* sum_t, const float* sum_m,
+               const float* sum_b, float w0, float w1, size_t len,
+               float* row_out) {
+  // The center pixel is included in the 3x3 sum with weight w1.
+  const auto center_mul = Set(d, w0 - w1);
+  const auto sum_mul = Set(d, w1);
+  for (size_t x = 0; x < len; x += Lanes(d)) {
+    const auto sum = Add(Add(Load(d, sum_t + x), Load(d, sum_m + x)),
+                         Load(d, sum_b + x));
+    const auto center = Load(d, row_in + x);
+    Store(MulAdd(center, center_mul, Mul(sum, sum_mul)), d, row_out + x);
+  }
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jpegli
@@ -226,6 +256,16 @@ HWY_EXPORT(Downsample4x1);
 HWY_EXPORT(Downsample4x2);
 HWY_EXPORT(Downsample4x3);
 HWY_EXPORT(Downsample4x4);
+HWY_EXPORT(HorizontalSum3);
+HWY_EXPORT(SmoothRow);
+
+namespace {
+
+// Number of columns of the input smoothing tasks, a multiple of the vector
+// size.
+constexpr size_t kSmoothingStripSize = 512;
+
+}  // namespace
 
 void NullDownsample(float* rows_in[MAX_SAMP_FACTOR], size_t len,
                     float* row_out) {}
@@ -325,10 +365,9 @@ void ApplyInputSmoothing(j_compress_ptr cinfo) {
   const size_t iMCU_height = DCTSIZE * cinfo->max_v_samp_factor;
   const ptrdiff_t y0 = m->next_iMCU_row * iMCU_height;
   const ptrdiff_t y1 = y0 + iMCU_height;
-  const ptrdiff_t xsize_padded = m->xsize_blocks * DCTSIZE;
+  const size_t xsize_padded = m->xsize_blocks * DCTSIZE;
   for (int c = 0; c < cinfo->num_components; c++) {
     auto& input = m->input_buffer[c];
-    auto& output = *m->smooth_input[c];
     if (m->next_iMCU_row == 0) {
       input.CopyRow(-1, 0, 1);
     }
@@ -336,27 +375,37 @@ void ApplyInputSmoothing(j_compress_ptr cinfo) {
       size_t last_row = m->ysize_blocks * DCTSIZE - 1;
       input.CopyRow(last_row + 1, last_row, 1);
     }
-    // TODO(szabadka) SIMDify this.
+  }
+  // Each task smooths a strip of columns of one component. The horizontal
+  // sums of 3 of the rows are kept in a rolling window of 3 rows, so that each
+  // of them is computed once per iMCU row. The tasks use disjoint columns of
+  // the windows, so the result does not depend on the runner.
+  const size_t num_strips = DivCeil(xsize_padded, kSmoothingStripSize);
+  const auto smooth_strip = [&](const uint32_t task,
+                                size_t /* thread */) -> Status {
+    const int c = task / num_strips;
+    const size_t x0 = (task % num_strips) * kSmoothingStripSize;
+    const size_t len = std::min(kSmoothingStripSize, xsize_padded - x0);
+    const auto& input = m->input_buffer[c];
+    auto& output = *m->smooth_input[c];
+    auto& sums = m->input_smoothing_sums[c];
+    for (ptrdiff_t y = y0 - 1; y < y0 + 1; ++y) {
+      HWY_DYNAMIC_DISPATCH(HorizontalSum3)
+      (input.Row(y) + x0, len, sums.Row(y) + x0);
+    }
     for (ptrdiff_t y = y0; y < y1; ++y) {
-      const float* row_t = input.Row(y - 1);
-      const float* row_m = input.Row(y);
-      const float* row_b = input.Row(y + 1);
-      float* row_out = output.Row(y);
-      for (ptrdiff_t x = 0; x < xsize_padded; ++x) {
-        float val_tl = row_t[x - 1];
-        float val_tm = row_t[x];
-        float val_tr = row_t[x + 1];
-        float val_ml = row_m[x - 1];
-        float val_mm = row_m[x];
-        float val_mr = row_m[x + 1];
-        float val_bl = row_b[x - 1];
-        float val_bm = row_b[x];
-        float val_br = row_b[x + 1];
-        float val1 = (val_tl + val_tm + val_tr + val_ml + val_mr + val_bl +
-                      val_bm + val_br);
-        row_out[x] = val_mm * kW0 + val1 * kW1;
-      }
+      HWY_DYNAMIC_DISPATCH(HorizontalSum3)
+      (input.Row(y + 1) + x0, len, sums.Row(y + 1) + x0);
+      HWY_DYNAMIC_DISPATCH(SmoothRow)
+      (input.Row(y) + x0, sums.Row(y - 1) + x0, sums.Row(y) + x0,
+       sums.Row(y + 1) + x0, kW0, kW1, len, output.Row(y) + x0);
     }
+    return true;
+  };
+  ThreadPool pool(m->runner, m->runner_opaque);
+  if (!RunOnPool(&pool, 0, cinfo->num_components * num_strips,
+                 ThreadPool::NoInit, smooth_strip, "ApplyInputSmoothing")) {
+    JPEGLI_ERROR("Failed to smooth the input.");
   }
 }
 
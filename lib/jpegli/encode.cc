@@ -7,11 +7,14 @@
 #include "lib/jpegli/encode.h"
 
 #include <algorithm>
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <map>
 #include <vector>
 
+#include "lib/base/data_parallel.h"
 #include "lib/base/types.h"
 #include "lib/jpegli/adaptive_quantization.h"
 #include "lib/jpegli/bit_writer.h"
@@ -30,6 +33,7 @@
 #include "lib/jpegli/memory_manager.h"
 #include "lib/jpegli/quant.h"
 #include "lib/jpegli/simd.h"
+#include "lib/jpegli/stats.h"
 #include "lib/jpegli/types.h"
 
 namespace jpegli {
@@ -83,6 +87,8 @@ void InitializeCompressParams(j_compress_ptr cinfo) {
 #endif
   cinfo->master->psnr_target = 0.0f;
   cinfo->master->psnr_tolerance = 0.01f;
+  cinfo->master->block_error_target = 0.0f;
+  cinfo->master->block_error_tolerance = 0.02f;
   cinfo->master->min_distance = 0.1f;
   cinfo->master->max_distance = 25.0f;
 }
@@ -240,6 +246,62 @@ void ValidateScanScript(j_compress_ptr cinfo) {
   }
 }
 
+// Sets up the per-scan state of the encoder for the scan script.
+void ProcessScanScript(j_compress_ptr cinfo) {
+  jpeg_comp_master* m = cinfo->master;
+  cinfo->progressive_mode = TO_JPEGLI_BOOL(
+      cinfo->scan_info->Ss != 0 || cinfo->scan_info->Se != DCTSIZE2 - 1);
+  ValidateScanScript(cinfo);
+  m->scan_token_info =
+      Allocate<ScanTokenInfo>(cinfo, cinfo->num_scans, JPOOL_IMAGE);
+  memset(m->scan_token_info, 0, cinfo->num_scans * sizeof(ScanTokenInfo));
+  m->ac_ctx_offset = Allocate<uint8_t>(cinfo, cinfo->num_scans, JPOOL_IMAGE);
+  size_t num_ac_contexts = 0;
+  for (int i = 0; i < cinfo->num_scans; ++i) {
+    const jpeg_scan_info* scan_info = &cinfo->scan_info[i];
+    m->ac_ctx_offset[i] = 4 + num_ac_contexts;
+    if (scan_info->Se > 0) {
+      num_ac_contexts += scan_info->comps_in_scan;
+    }
+    if (num_ac_contexts > 252) {
+      JPEGLI_ERROR("Too many AC scans in image");
+    }
+    ScanTokenInfo* sti = &m->scan_token_info[i];
+    if (scan_info->comps_in_scan == 1) {
+      int comp_idx = scan_info->component_index[0];
+      jpeg_component_info* comp = &cinfo->comp_info[comp_idx];
+      sti->MCUs_per_row = comp->width_in_blocks;
+      sti->MCU_rows_in_scan = comp->height_in_blocks;
+      sti->blocks_in_MCU = 1;
+    } else {
+      sti->MCUs_per_row =
+          DivCeil(cinfo->image_width, DCTSIZE * cinfo->max_h_samp_factor);
+      sti->MCU_rows_in_scan =
+          DivCeil(cinfo->image_height, DCTSIZE * cinfo->max_v_samp_factor);
+      sti->blocks_in_MCU = 0;
+      for (int j = 0; j < scan_info->comps_in_scan; ++j) {
+        int comp_idx = scan_info->component_index[j];
+        jpeg_component_info* comp = &cinfo->comp_info[comp_idx];
+        sti->blocks_in_MCU +=
+            static_cast<size_t>(comp->h_samp_factor) * comp->v_samp_factor;
+      }
+    }
+    size_t num_MCUs = sti->MCU_rows_in_scan * sti->MCUs_per_row;
+    sti->num_blocks = num_MCUs * sti->blocks_in_MCU;
+    if (cinfo->restart_in_rows <= 0) {
+      sti->restart_interval = cinfo->restart_interval;
+    } else {
+      sti->restart_interval =
+          std::min<size_t>(sti->MCUs_per_row * cinfo->restart_in_rows, 65535u);
+    }
+    sti->num_restarts = sti->restart_interval > 0
+                            ? DivCeil(num_MCUs, sti->restart_interval)
+                            : 1;
+    sti->restarts = Allocate<size_t>(cinfo, sti->num_restarts, JPOOL_IMAGE);
+  }
+  m->num_contexts = 4 + num_ac_contexts;
+}
+
 void ProcessCompressionParams(j_compress_ptr cinfo) {
   if (cinfo->dest == nullptr) {
     JPEGLI_ERROR("Missing destination.");
@@ -331,60 +393,13 @@ void ProcessCompressionParams(j_compress_ptr cinfo) {
       y_comp->v_samp_factor != cinfo->max_v_samp_factor) {
     m->use_adaptive_quantization = false;
   }
+  m->search_scan_script = false;
   if (cinfo->scan_info == nullptr) {
     SetDefaultScanScript(cinfo);
+    m->search_scan_script =
+        m->scan_search_ms > 0 && m->progressive_level > 0;
   }
-  cinfo->progressive_mode = TO_JPEGLI_BOOL(
-      cinfo->scan_info->Ss != 0 || cinfo->scan_info->Se != DCTSIZE2 - 1);
-  ValidateScanScript(cinfo);
-  m->scan_token_info =
-      Allocate<ScanTokenInfo>(cinfo, cinfo->num_scans, JPOOL_IMAGE);
-  memset(m->scan_token_info, 0, cinfo->num_scans * sizeof(ScanTokenInfo));
-  m->ac_ctx_offset = Allocate<uint8_t>(cinfo, cinfo->num_scans, JPOOL_IMAGE);
-  size_t num_ac_contexts = 0;
-  for (int i = 0; i < cinfo->num_scans; ++i) {
-    const jpeg_scan_info* scan_info = &cinfo->scan_info[i];
-    m->ac_ctx_offset[i] = 4 + num_ac_contexts;
-    if (scan_info->Se > 0) {
-      num_ac_contexts += scan_info->comps_in_scan;
-    }
-    if (num_ac_contexts > 252) {
-      JPEGLI_ERROR("Too many AC scans in image");
-    }
-    ScanTokenInfo* sti = &m->scan_token_info[i];
-    if (scan_info->comps_in_scan == 1) {
-      int comp_idx = scan_info->component_index[0];
-      jpeg_component_info* comp = &cinfo->comp_info[comp_idx];
-      sti->MCUs_per_row = comp->width_in_blocks;
-      sti->MCU_rows_in_scan = comp->height_in_blocks;
-      sti->blocks_in_MCU = 1;
-    } else {
-      sti->MCUs_per_row =
-          DivCeil(cinfo->image_width, DCTSIZE * cinfo->max_h_samp_factor);
-      sti->MCU_rows_in_scan =
-          DivCeil(cinfo->image_height, DCTSIZE * cinfo->max_v_samp_factor);
-      sti->blocks_in_MCU = 0;
-      for (int j = 0; j < scan_info->comps_in_scan; ++j) {
-        int comp_idx = scan_info->component_index[j];
-        jpeg_component_info* comp = &cinfo->comp_info[comp_idx];
-        sti->blocks_in_MCU +=
-            static_cast<size_t>(comp->h_samp_factor) * comp->v_samp_factor;
-      }
-    }
-    size_t num_MCUs = sti->MCU_rows_in_scan * sti->MCUs_per_row;
-    sti->num_blocks = num_MCUs * sti->blocks_in_MCU;
-    if (cinfo->restart_in_rows <= 0) {
-      sti->restart_interval = cinfo->restart_interval;
-    } else {
-      sti->restart_interval =
-          std::min<size_t>(sti->MCUs_per_row * cinfo->restart_in_rows, 65535u);
-    }
-    sti->num_restarts = sti->restart_interval > 0
-                            ? DivCeil(num_MCUs, sti->restart_interval)
-                            : 1;
-    sti->restarts = Allocate<size_t>(cinfo, sti->num_restarts, JPOOL_IMAGE);
-  }
-  m->num_contexts = 4 + num_ac_contexts;
+  ProcessScanScript(cinfo);
 }
 
 bool IsStreamingSupported(j_compress_ptr cinfo) {
@@ -398,23 +413,30 @@ bool IsStreamingSupported(j_compress_ptr cinfo) {
   if (cinfo->num_scans > 1) {
     return false;
   }
-  if (cinfo->master->psnr_target > 0) {
+  if (cinfo->master->psnr_target > 0 ||
+      cinfo->master->block_error_target > 0) {
     return false;
   }
   return true;
 }
 
+void AllocateTokenArrays(j_compress_ptr cinfo) {
+  jpeg_comp_master* m = cinfo->master;
+  int ysize_blocks = DivCeil(cinfo->image_height, DCTSIZE);
+  int num_arrays = cinfo->num_scans * ysize_blocks;
+  m->token_arrays = Allocate<TokenArray>(cinfo, num_arrays, JPOOL_IMAGE);
+  m->cur_token_array = 0;
+  memset(m->token_arrays, 0, num_arrays * sizeof(TokenArray));
+  m->next_token = nullptr;
+  m->num_tokens = 0;
+  m->total_num_tokens = 0;
+}
+
 void AllocateBuffers(j_compress_ptr cinfo) {
   jpeg_comp_master* m = cinfo->master;
   memset(m->last_dc_coeff, 0, sizeof(m->last_dc_coeff));
   if (!IsStreamingSupported(cinfo) || cinfo->optimize_coding) {
-    int ysize_blocks = DivCeil(cinfo->image_height, DCTSIZE);
-    int num_arrays = cinfo->num_scans * ysize_blocks;
-    m->token_arrays = Allocate<TokenArray>(cinfo, num_arrays, JPOOL_IMAGE);
-    m->cur_token_array = 0;
-    memset(m->token_arrays, 0, num_arrays * sizeof(TokenArray));
-    m->num_tokens = 0;
-    m->total_num_tokens = 0;
+    AllocateTokenArrays(cinfo);
   }
   if (cinfo->global_state == kEncWriteCoeffs) {
     return;
@@ -430,6 +452,11 @@ void AllocateBuffers(j_compress_ptr cinfo) {
     for (int c = 0; c < num_all_components; ++c) {
       m->input_buffer[c].Allocate(cinfo, ysize_full, xsize_full);
     }
+    if (cinfo->smoothing_factor) {
+      for (int c = 0; c < cinfo->num_components; ++c) {
+        m->input_smoothing_sums[c].Allocate(cinfo, 3, xsize_full);
+      }
+    }
   }
   for (int c = 0; c < cinfo->num_components; ++c) {
     jpeg_component_info* comp = &cinfo->comp_info[c];
@@ -450,7 +477,11 @@ void AllocateBuffers(j_compress_ptr cinfo) {
     }
     m->quant_mul[c] = Allocate<float>(cinfo, DCTSIZE2, JPOOL_IMAGE_ALIGNED);
   }
-  m->dct_buffer = Allocate<float>(cinfo, 2 * DCTSIZE2, JPOOL_IMAGE_ALIGNED);
+  m->dct_buffer = Allocate<float>(cinfo, 2 * kDCTBatchSize * DCTSIZE2,
+                                  JPOOL_IMAGE_ALIGNED);
+  m->dct_batch = Allocate<float>(
+      cinfo, cinfo->num_components * MAX_SAMP_FACTOR * kDCTBatchSize * DCTSIZE2,
+      JPOOL_IMAGE_ALIGNED);
   m->block_tmp = Allocate<int32_t>(cinfo, DCTSIZE2 * 4, JPOOL_IMAGE_ALIGNED);
   if (!IsStreamingSupported(cinfo)) {
     m->coeff_buffers =
@@ -470,15 +501,14 @@ void AllocateBuffers(j_compress_ptr cinfo) {
     const size_t xsize_blocks = y_comp->width_in_blocks;
     const size_t vecsize = VectorSize();
     const size_t xsize_padded = DivCeil(2 * xsize_blocks, vecsize) * vecsize;
-    m->diff_buffer =
-        Allocate<float>(cinfo, xsize_blocks * DCTSIZE + 8, JPOOL_IMAGE_ALIGNED);
     m->fuzzy_erosion_tmp.Allocate(cinfo, 2, xsize_padded);
     m->pre_erosion.Allocate(cinfo, 6 * cinfo->max_v_samp_factor, xsize_padded);
     size_t qf_height = cinfo->max_v_samp_factor;
-    if (m->psnr_target > 0) {
+    if (m->psnr_target > 0 || m->block_error_target > 0) {
       qf_height *= cinfo->total_iMCU_rows;
     }
     m->quant_field.Allocate(cinfo, qf_height, xsize_blocks);
+    m->aq_block_sums.Allocate(cinfo, 2, xsize_blocks);
   } else {
     m->quant_field.Allocate(cinfo, 1, m->xsize_blocks);
     m->quant_field.FillRow(0, 0, m->xsize_blocks);
@@ -492,6 +522,174 @@ void AllocateBuffers(j_compress_ptr cinfo) {
   }
 }
 
+// Coding of the AC coefficients of one component in a searched scan script:
+// coefficients 1 .. split are sent in one scan (if split > 0), coefficients
+// split + 1 .. 63 are sent with point transform shift and then refined in
+// shift successive approximation scans.
+struct ACScanPlan {
+  int split;
+  int shift;
+};
+
+constexpr ACScanPlan kACScanPlans[] = {
+    {0, 0}, {0, 1}, {0, 2}, {2, 0}, {2, 1}, {2, 2}, {5, 0}, {5, 1},
+    {5, 2}, {0, 3}, {2, 3}, {5, 3}, {8, 0}, {8, 1}, {8, 2}, {8, 3},
+};
+constexpr int kMaxACScanShift = 3;
+
+// Approximate size of the SOS marker of a single-component scan.
+constexpr float kScanHeaderBits = 80.0f;
+
+// Calls add_scan(c, Ss, Se, Ah, Al) for the AC scans of the given per-component
+// plans, in the order in which they appear in the scan script.
+template <typename F>
+void ForEachACScan(const std::vector<ACScanPlan>& plans, const F& add_scan) {
+  const int num_comps = plans.size();
+  for (int c = 0; c < num_comps; ++c) {
+    if (plans[c].split > 0) {
+      add_scan(c, 1, plans[c].split, 0, 0);
+    }
+  }
+  for (int c = 0; c < num_comps; ++c) {
+    add_scan(c, plans[c].split + 1, 63, 0, plans[c].shift);
+  }
+  for (int al = kMaxACScanShift - 1; al >= 0; --al) {
+    for (int c = 0; c < num_comps; ++c) {
+      if (plans[c].shift > al) {
+        add_scan(c, plans[c].split + 1, 63, al + 1, al);
+      }
+    }
+  }
+}
+
+// Number of work units of the scan script search that take about one
+// millisecond. A work unit is one coefficient visited while tokenizing a scan
+// or one histogram symbol visited while clustering the Huffman tables.
+constexpr float kScanSearchWorkPerMs = 200000.0f;
+
+// Replaces the default scan script with the one that has the smallest
+// estimated size among the per-component AC scan plans that could be
+// evaluated within the work budget. The plans are improved one component at a
+// time, and each candidate is estimated as a whole script, since the AC scans
+// of all components share the four Huffman table slots. The histograms of the
+// scans are cached per band and point transform, so candidates sharing scans
+// reuse them, and only the Huffman table clustering is redone.
+// The time budget is converted to a number of work units rather than measured,
+// so that the chosen script does not depend on the speed of the machine.
+void OptimizeScanScript(j_compress_ptr cinfo) {
+  jpeg_comp_master* m = cinfo->master;
+  const float max_work = m->scan_search_ms * kScanSearchWorkPerMs;
+  float work = 0.0f;
+  struct ScanEstimate {
+    Histogram histo;
+    size_t extra_bits;
+  };
+  std::map<std::array<int, 5>, ScanEstimate> scan_estimates;
+  std::map<std::array<int, 3>, size_t> band_nonzeros;
+  ScanEstimateBuffers buffers;
+  const auto get_scan_estimate = [&](int c, int Ss, int Se, int Ah,
+                                     int Al) -> const ScanEstimate& {
+    const std::array<int, 5> key = {c, Ss, Se, Ah, Al};
+    auto it = scan_estimates.find(key);
+    if (it != scan_estimates.end()) return it->second;
+    ScanEstimate& est = scan_estimates[key];
+    const jpeg_component_info* comp = &cinfo->comp_info[c];
+    work += static_cast<float>(comp->width_in_blocks) *
+            comp->height_in_blocks * (Se - Ss + 1);
+    if (Ah == 0) {
+      size_t num_nonzeros;
+      est.extra_bits = EstimateACFirstScan(cinfo, c, Ss, Se, Al, &buffers,
+                                           &est.histo, &num_nonzeros);
+      band_nonzeros[{c, Ss, Se}] = num_nonzeros;
+    } else {
+      // The first scan of the band always precedes its refinements in
+      // ForEachACScan(), so it has already been estimated.
+      size_t num_nonzeros = band_nonzeros[{c, Ss, Se}];
+      est.extra_bits = EstimateACRefinementScan(cinfo, c, Ss, Se, Al,
+                                                num_nonzeros, &buffers,
+                                                &est.histo);
+    }
+    return est;
+  };
+  std::vector<Histogram> histograms;
+  const auto get_script_bits = [&](const std::vector<ACScanPlan>& plans) {
+    histograms.clear();
+    float bits = 0.0f;
+    ForEachACScan(plans, [&](int c, int Ss, int Se, int Ah, int Al) {
+      const ScanEstimate& est = get_scan_estimate(c, Ss, Se, Ah, Al);
+      histograms.push_back(est.histo);
+      bits += kScanHeaderBits + est.extra_bits;
+    });
+    work += static_cast<float>(histograms.size()) * kJpegHuffmanAlphabetSize;
+    return bits +
+           EstimateACHuffmanBits(cinfo, histograms.data(), histograms.size());
+  };
+
+  const ACScanPlan default_plan =
+      m->progressive_level == 1 ? ACScanPlan{0, 1} : ACScanPlan{2, 2};
+  const int num_comps = cinfo->num_components;
+  std::vector<ACScanPlan> best_plans(num_comps, default_plan);
+  const float default_bits = get_script_bits(best_plans);
+  float best_bits = default_bits;
+  bool out_of_budget = false;
+  for (const ACScanPlan& plan : kACScanPlans) {
+    for (int c = 0; c < num_comps && !out_of_budget; ++c) {
+      if (plan.split == best_plans[c].split &&
+          plan.shift == best_plans[c].shift) {
+        continue;
+      }
+      if (work > max_work) {
+        out_of_budget = true;
+        break;
+      }
+      std::vector<ACScanPlan> plans = best_plans;
+      plans[c] = plan;
+      float bits = get_script_bits(plans);
+      if (bits < best_bits) {
+        best_bits = bits;
+        best_plans = plans;
+      }
+    }
+    if (out_of_budget) break;
+  }
+  // The estimate does not include the byte stuffing of the entropy coded
+  // data, which is about one byte in 256, so smaller gains are not reliable
+  // and the default script is kept.
+  if (best_bits + best_bits / 256 >= default_bits) return;
+
+  std::vector<jpeg_scan_info> scans;
+  const auto add_scan = [&](int c, int Ss, int Se, int Ah, int Al) {
+    jpeg_scan_info scan = {};
+    scan.comps_in_scan = 1;
+    scan.component_index[0] = c;
+    scan.Ss = Ss;
+    scan.Se = Se;
+    scan.Ah = Ah;
+    scan.Al = Al;
+    scans.push_back(scan);
+  };
+  bool interleave_dc =
+      (cinfo->max_h_samp_factor == 1 && cinfo->max_v_samp_factor == 1);
+  int dc_comps = interleave_dc ? MAX_COMPS_IN_SCAN : 1;
+  for (int c = 0; c < num_comps; c += dc_comps) {
+    add_scan(c, 0, 0, 0, 0);
+    scans.back().comps_in_scan = std::min(dc_comps, num_comps - c);
+    for (int j = 0; j < scans.back().comps_in_scan; ++j) {
+      scans.back().component_index[j] = c + j;
+    }
+  }
+  ForEachACScan(best_plans, add_scan);
+
+  cinfo->script_space_size = scans.size();
+  cinfo->script_space =
+      Allocate<jpeg_scan_info>(cinfo, cinfo->script_space_size);
+  std::copy(scans.begin(), scans.end(), cinfo->script_space);
+  cinfo->scan_info = cinfo->script_space;
+  cinfo->num_scans = cinfo->script_space_size;
+  ProcessScanScript(cinfo);
+  AllocateTokenArrays(cinfo);
+}
+
 void InitProgressMonitor(j_compress_ptr cinfo) {
   if (cinfo->progress == nullptr) {
     return;
@@ -511,6 +709,7 @@ void InitProgressMonitor(j_compress_ptr cinfo) {
 void InitCompress(j_compress_ptr cinfo, boolean write_all_tables) {
   jpeg_comp_master* m = cinfo->master;
   (*cinfo->err->reset_error_mgr)(reinterpret_cast<j_common_ptr>(cinfo));
+  JPEGLI_STATS_RESET(m);
   ProcessCompressionParams(cinfo);
   InitProgressMonitor(cinfo);
   AllocateBuffers(cinfo);
@@ -520,8 +719,9 @@ void InitCompress(j_compress_ptr cinfo, boolean write_all_tables) {
       ChooseColorTransform(cinfo);
       ChooseDownsampleMethods(cinfo);
     }
-    QuantPass pass = m->psnr_target > 0 ? QuantPass::SEARCH_FIRST_PASS
-                                        : QuantPass::NO_SEARCH;
+    QuantPass pass = (m->psnr_target > 0 || m->block_error_target > 0)
+                         ? QuantPass::SEARCH_FIRST_PASS
+                         : QuantPass::NO_SEARCH;
     InitQuantizer(cinfo, pass);
   }
   if (write_all_tables) {
@@ -600,9 +800,14 @@ void ProcessiMCURow(j_compress_ptr cinfo) {
   JPEGLI_CHECK(cinfo->master->next_iMCU_row < cinfo->total_iMCU_rows);
   if (!cinfo->raw_data_in) {
     ApplyInputSmoothing(cinfo);
+    JPEGLI_STAGE_TIMER(cinfo->master, JPEGLI_STAGE_DOWNSAMPLE);
     DownsampleInputBuffer(cinfo);
   }
-  ComputeAdaptiveQuantField(cinfo);
+  {
+    JPEGLI_STAGE_TIMER(cinfo->master, JPEGLI_STAGE_ADAPTIVE_QUANTIZATION);
+    ComputeAdaptiveQuantField(cinfo);
+  }
+  JPEGLI_STAGE_TIMER(cinfo->master, JPEGLI_STAGE_DCT);
   if (IsStreamingSupported(cinfo)) {
     if (cinfo->optimize_coding) {
       ComputeTokensForiMCURow(cinfo);
@@ -687,6 +892,7 @@ void jpegli_CreateCompress(j_compress_ptr cinfo, int version,
   memset(cinfo->arith_ac_K, 0, sizeof(cinfo->arith_ac_K));
   cinfo->write_Adobe_marker = FALSE;
   cinfo->master = jpegli::Allocate<jpeg_comp_master>(cinfo, 1);
+  JPEGLI_STATS_RESET(cinfo->master);
   jpegli::InitializeCompressParams(cinfo);
   cinfo->master->force_baseline = true;
   cinfo->master->xyb_mode = false;
@@ -694,6 +900,9 @@ void jpegli_CreateCompress(j_compress_ptr cinfo, int version,
   cinfo->master->use_std_tables = false;
   cinfo->master->use_adaptive_quantization = true;
   cinfo->master->progressive_level = jpegli::kDefaultProgressiveLevel;
+  cinfo->master->runner = nullptr;
+  cinfo->master->runner_opaque = nullptr;
+  cinfo->master->scan_search_ms = 0.0f;
   cinfo->master->data_type = JPEGLI_TYPE_UINT8;
   cinfo->master->endianness = JPEGLI_NATIVE_ENDIAN;
   cinfo->master->coeff_buffers = nullptr;
@@ -862,6 +1071,17 @@ void jpegli_set_psnr(j_compress_ptr cinfo, float psnr, float tolerance,
   cinfo->master->max_distance = max_distance;
 }
 
+void jpegli_set_max_block_error_target(j_compress_ptr cinfo, float target,
+                                       float tolerance) {
+  CheckState(cinfo, jpegli::kEncStart);
+  if (target < 0.0f || tolerance < 0.0f) {
+    JPEGLI_ERROR("Invalid block error target %f tolerance %f", target,
+                 tolerance);
+  }
+  cinfo->master->block_error_target = target;
+  cinfo->master->block_error_tolerance = tolerance;
+}
+
 void jpegli_set_quality(j_compress_ptr cinfo, int quality,
                         boolean force_baseline) {
   CheckState(cinfo, jpegli::kEncStart);
@@ -928,6 +1148,22 @@ void jpegli_enable_adaptive_quantization(j_compress_ptr cinfo, boolean value) {
   cinfo->master->use_adaptive_quantization = FROM_JPEGLI_BOOL(value);
 }
 
+void jpegli_set_parallel_runner(j_compress_ptr cinfo,
+                                JpegliParallelRunner runner,
+                                void* runner_opaque) {
+  CheckState(cinfo, jpegli::kEncStart);
+  cinfo->master->runner = runner;
+  cinfo->master->runner_opaque = runner_opaque;
+}
+
+void jpegli_set_scan_optimization(j_compress_ptr cinfo, float max_ms) {
+  CheckState(cinfo, jpegli::kEncStart);
+  if (max_ms < 0) {
+    JPEGLI_ERROR("Invalid scan optimization time budget %f", max_ms);
+  }
+  cinfo->master->scan_search_ms = max_ms;
+}
+
 void jpegli_simple_progression(j_compress_ptr cinfo) {
   CheckState(cinfo, jpegli::kEncStart);
   jpegli_set_progressive_level(cinfo, 2);
@@ -1152,7 +1388,14 @@ JDIMENSION jpegli_write_scanlines(j_compress_ptr cinfo, JSAMPARRAY scanlines,
   float* rows[jpegli::kMaxComponents];
   for (size_t i = input_lag; i < num_lines; ++i) {
     jpegli::ReadInputRow(cinfo, scanlines[i], rows);
-    (*m->color_transform)(rows, cinfo->image_width);
+    JPEGLI_STATS_ADD(m, input_bytes,
+                     static_cast<size_t>(cinfo->image_width) *
+                         cinfo->input_components *
+                         jpegli_bytes_per_sample(m->data_type));
+    {
+      JPEGLI_STAGE_TIMER(m, JPEGLI_STAGE_COLOR_TRANSFORM);
+      (*m->color_transform)(rows, cinfo->image_width);
+    }
     jpegli::PadInputBuffer(cinfo, rows);
     jpegli::ProcessiMCURows(cinfo);
     if (!jpegli::EmptyBitWriterBuffer(&m->bw)) {
@@ -1207,6 +1450,7 @@ JDIMENSION jpegli_write_raw_data(j_compress_ptr cinfo, JSAMPIMAGE data,
         memset(rows[0], 0, xsize * sizeof(rows[0][0]));
       } else {
         (*m->input_method)(plane[i], xsize, rows);
+        JPEGLI_STATS_ADD(m, input_bytes, xsize);
       }
       // We need a border of 1 repeated pixel for adaptive quant field.
       buffer.PadRow(y0 + i, xsize, /*border=*/1);
@@ -1241,26 +1485,55 @@ void jpegli_finish_compress(j_compress_ptr cinfo) {
 
   if (m->psnr_target > 0) {
     jpegli::QuantizetoPSNR(cinfo);
+  } else if (m->block_error_target > 0) {
+    jpegli::QuantizeToBlockError(cinfo);
   }
 
   const bool tokens_done = jpegli::IsStreamingSupported(cinfo);
   const bool bitstream_done =
       tokens_done && !FROM_JPEGLI_BOOL(cinfo->optimize_coding);
 
+  // The scans of multi-scan images are independent of each other once all the
+  // coefficients are known, therefore with a runner they are tokenized and
+  // entropy coded in parallel.
+  const bool parallel = m->runner != nullptr && cinfo->num_scans > 1;
+  jpegli::ThreadPool pool(m->runner, m->runner_opaque);
+  std::vector<std::vector<jpegli::Token>> scan_tokens;
+
   if (!tokens_done) {
-    jpegli::TokenizeJpeg(cinfo);
+    JPEGLI_STAGE_TIMER(m, JPEGLI_STAGE_TOKENIZE);
+    if (m->search_scan_script) {
+      jpegli::OptimizeScanScript(cinfo);
+    }
+    if (parallel) {
+      jpegli::TokenizeJpeg(cinfo, &pool, &scan_tokens);
+    } else {
+      jpegli::TokenizeJpeg(cinfo);
+    }
   }
+#if JPEGLI_ENABLE_STATS
+  for (int i = 0; i < cinfo->num_scans; ++i) {
+    m->stats.num_tokens += m->scan_token_info[i].num_tokens;
+  }
+#endif
 
   if (cinfo->optimize_coding || cinfo->progressive_mode) {
+    JPEGLI_STAGE_TIMER(m, JPEGLI_STAGE_OPTIMIZE_HUFFMAN);
     jpegli::OptimizeHuffmanCodes(cinfo);
     jpegli::InitEntropyCoder(cinfo);
   }
+  JPEGLI_STATS_ADD(m, num_huffman_tables, m->num_huffman_tables);
 
   if (!bitstream_done) {
     jpegli::WriteFrameHeader(cinfo);
-    for (int i = 0; i < cinfo->num_scans; ++i) {
-      jpegli::WriteScanHeader(cinfo, i);
-      jpegli::WriteScanData(cinfo, i);
+    JPEGLI_STAGE_TIMER(m, JPEGLI_STAGE_WRITE_SCANS);
+    if (parallel) {
+      jpegli::WriteScans(cinfo, &pool);
+    } else {
+      for (int i = 0; i < cinfo->num_scans; ++i) {
+        jpegli::WriteScanHeader(cinfo, i);
+        jpegli::WriteScanData(cinfo, i);
+      }
     }
   } else {
     JumpToByteBoundary(&m->bw);
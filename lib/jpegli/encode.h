@@ -24,6 +24,7 @@
 #include <cstddef>
 #include <cstdio>
 
+#include "lib/base/parallel_runner.h"
 #include "lib/jpegli/common.h"
 #include "lib/jpegli/types.h"
 
@@ -126,6 +127,18 @@ float jpegli_quality_to_distance(int quality);
 void jpegli_set_psnr(j_compress_ptr cinfo, float psnr, float tolerance,
                      float min_distance, float max_distance);
 
+// Enables distance parameter search to meet the given target for the
+// quantization error of the blocks. The error of each coefficient is measured
+// in units of its quantization step at distance 1.0, so the error of an image
+// quantized at distance d is about d. It is computed without decoding the
+// image and is not a butteraugli distance. The search stops when the high-norm
+// of the block errors is within target * tolerance, and blocks whose error is
+// still above the target get a weaker adaptive quantization. The search range
+// is the one set by jpegli_set_psnr(), and a PSNR target takes precedence over
+// this one.
+void jpegli_set_max_block_error_target(j_compress_ptr cinfo, float target,
+                                       float tolerance);
+
 // Changes the default behaviour of the encoder in the selection of quantization
 // matrices and chroma subsampling. Must be called before jpegli_set_defaults()
 // because some default setting depend on the XYB mode.
@@ -145,6 +158,25 @@ void jpegli_set_input_format(j_compress_ptr cinfo, JpegliDataType data_type,
 // Enabled by default.
 void jpegli_enable_adaptive_quantization(j_compress_ptr cinfo, boolean value);
 
+// Sets the runner that the encoder uses to smooth the input and to compute the
+// adaptive quantization field of wide images, and that jpegli_finish_compress()
+// uses to tokenize and entropy code the scans of multi-scan (e.g. progressive)
+// images in parallel. The output does not depend on the runner. A NULL runner
+// (the default) does all the work on the calling thread.
+void jpegli_set_parallel_runner(j_compress_ptr cinfo,
+                                JpegliParallelRunner runner,
+                                void* runner_opaque);
+
+// Enables a search for a smaller progressive scan script than the default one
+// of the progressive level. For each component the encoder tries different
+// spectral splits and successive approximation shifts of the AC coefficients,
+// estimates the size of each candidate from the Huffman cost of its tokens,
+// and keeps the best script found within about max_ms milliseconds. The time
+// limit is converted to a fixed amount of work, so the output does not depend
+// on the speed of the machine. Has no effect in sequential mode or with a
+// custom scan script. 0 (the default) disables the search.
+void jpegli_set_scan_optimization(j_compress_ptr cinfo, float max_ms);
+
 // Sets the default progression parameters, where level 0 is sequential, and
 // greater level value means more progression steps. Default is 2.
 void jpegli_set_progressive_level(j_compress_ptr cinfo, int level);
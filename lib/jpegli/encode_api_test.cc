@@ -5,6 +5,7 @@
 // https://developers.google.com/open-source/licenses/bsd
 
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
@@ -13,11 +14,14 @@
 #include <ostream>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "lib/base/parallel_runner.h"
 #include "lib/jpegli/common.h"
 #include "lib/jpegli/encode.h"
 #include "lib/jpegli/libjpeg_test_util.h"
+#include "lib/jpegli/stats.h"
 #include "lib/jpegli/test_params.h"
 #include "lib/jpegli/test_utils.h"
 #include "lib/jpegli/testing.h"
@@ -102,6 +106,236 @@ TEST(EncodeAPITest, ReuseCinfoSameImageTwice) {
             memcmp(compressed0.data(), compressed1.data(), compressed0.size()));
 }
 
+TEST(EncodeAPITest, GetStats) {
+  TestImage input;
+  input.xsize = 129;
+  input.ysize = 73;
+  CompressParams jparams;
+  jparams.optimize_coding = 1;
+  GenerateInput(PIXELS, jparams, &input);
+  uint8_t* buffer = nullptr;
+  unsigned long buffer_size = 0;  // NOLINT
+  jpeg_compress_struct cinfo;
+  JpegliStats stats;
+  boolean have_stats = FALSE;
+  const auto try_catch_block = [&]() -> bool {
+    ERROR_HANDLER_SETUP(jpegli);
+    jpegli_create_compress(&cinfo);
+    jpegli_mem_dest(&cinfo, &buffer, &buffer_size);
+    EncodeWithJpegli(input, jparams, &cinfo);
+    have_stats = jpegli_get_stats(reinterpret_cast<j_common_ptr>(&cinfo),
+                                  &stats);
+    return true;
+  };
+  EXPECT_TRUE(try_catch_block());
+  jpegli_destroy_compress(&cinfo);
+  if (buffer) free(buffer);
+  EXPECT_GT(stats.peak_memory_usage, 0u);
+  ASSERT_EQ(JPEGLI_ENABLE_STATS ? TRUE : FALSE, have_stats);
+  if (!have_stats) {
+    EXPECT_EQ(0u, stats.output_bytes);
+    return;
+  }
+  EXPECT_EQ(buffer_size, stats.output_bytes);
+  EXPECT_EQ(input.xsize * input.ysize * 3, stats.input_bytes);
+  EXPECT_GT(stats.num_tokens, 0u);
+  EXPECT_GT(stats.num_huffman_tables, 0u);
+  EXPECT_EQ(input.ysize, stats.stage_calls[JPEGLI_STAGE_COLOR_TRANSFORM]);
+  EXPECT_GT(stats.stage_calls[JPEGLI_STAGE_DCT], 0u);
+  EXPECT_EQ(1u, stats.stage_calls[JPEGLI_STAGE_OPTIMIZE_HUFFMAN]);
+}
+
+TEST(EncodeAPITest, FlatRegions) {
+  for (int progr : {0, 2}) {
+    for (int optimize : {0, 1}) {
+      TestImage input;
+      input.xsize = 259;
+      input.ysize = 141;
+      GeneratePixels(&input);
+      // Overwrite the top left part of the image with a constant color, so
+      // that it has flat blocks, flat batches of blocks and blocks that are
+      // only partially flat.
+      const size_t stride = input.xsize * input.components;
+      for (size_t y = 0; y < 77; ++y) {
+        for (size_t x = 0; x < 197; ++x) {
+          for (size_t c = 0; c < input.components; ++c) {
+            input.pixels[y * stride + x * input.components + c] = 64 + 50 * c;
+          }
+        }
+      }
+      CompressParams jparams;
+      // Without chroma subsampling, so that the sharp color edge at the border
+      // of the flat part does not dominate the distance.
+      jparams.h_sampling = {1, 1, 1};
+      jparams.v_sampling = {1, 1, 1};
+      jparams.progressive_mode = progr;
+      jparams.optimize_coding = optimize;
+      std::vector<uint8_t> compressed;
+      ASSERT_TRUE(EncodeWithJpegli(input, jparams, &compressed));
+      DecompressParams dparams;
+      TestImage output;
+      DecodeWithLibjpeg(jparams, dparams, compressed, &output);
+      VerifyOutputImage(input, output, 2.4f);
+    }
+  }
+}
+
+// Runs the tasks on *runner_opaque new threads.
+JpegliParallelRetCode TestParallelRunner(void* runner_opaque,
+                                         void* jpegli_opaque,
+                                         JpegliParallelRunInit init,
+                                         JpegliParallelRunFunction func,
+                                         uint32_t start_range,
+                                         uint32_t end_range) {
+  const size_t num_threads = *static_cast<size_t*>(runner_opaque);
+  if (init(jpegli_opaque, num_threads) != JPEGLI_PARALLEL_RET_SUCCESS) {
+    return JPEGLI_PARALLEL_RET_RUNNER_ERROR;
+  }
+  std::atomic<uint32_t> next_task{start_range};
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (uint32_t task = next_task++; task < end_range; task = next_task++) {
+        func(jpegli_opaque, task, t);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  return JPEGLI_PARALLEL_RET_SUCCESS;
+}
+
+// Returns the output of the encoder, with TestParallelRunner on *num_threads
+// threads if num_threads is not null.
+std::vector<uint8_t> EncodeWithRunner(const TestImage& input,
+                                      const CompressParams& jparams,
+                                      size_t* num_threads) {
+  std::vector<uint8_t> compressed;
+  uint8_t* buffer = nullptr;
+  unsigned long buffer_size = 0;  // NOLINT
+  jpeg_compress_struct cinfo;
+  const auto try_catch_block = [&]() -> bool {
+    ERROR_HANDLER_SETUP(jpegli);
+    jpegli_create_compress(&cinfo);
+    if (num_threads) {
+      jpegli_set_parallel_runner(&cinfo, TestParallelRunner, num_threads);
+    }
+    jpegli_mem_dest(&cinfo, &buffer, &buffer_size);
+    EncodeWithJpegli(input, jparams, &cinfo);
+    compressed.assign(buffer, buffer + buffer_size);
+    return true;
+  };
+  EXPECT_TRUE(try_catch_block());
+  jpegli_destroy_compress(&cinfo);
+  if (buffer) free(buffer);
+  return compressed;
+}
+
+TEST(EncodeAPITest, ParallelRunnerSameOutput) {
+  size_t num_threads = 3;
+  for (int progr : {1, 2, 3, 4, 5}) {
+    for (unsigned int restart_interval : {0, 5}) {
+      TestImage input;
+      input.xsize = 237;
+      input.ysize = 131;
+      CompressParams jparams;
+      jparams.h_sampling = {2, 1, 1};
+      jparams.v_sampling = {2, 1, 1};
+      jparams.progressive_mode = progr;
+      jparams.restart_interval = restart_interval;
+      GenerateInput(PIXELS, jparams, &input);
+      std::vector<uint8_t> serial = EncodeWithRunner(input, jparams, nullptr);
+      std::vector<uint8_t> parallel =
+          EncodeWithRunner(input, jparams, &num_threads);
+      ASSERT_FALSE(serial.empty());
+      EXPECT_EQ(serial, parallel);
+    }
+  }
+}
+
+TEST(EncodeAPITest, ParallelAdaptiveQuantizationSameOutput) {
+  size_t num_threads = 3;
+  // Wide enough for several strips of the quantization field computation,
+  // with a partial last strip.
+  for (size_t xsize : {1031, 1100}) {
+    for (int samp : {1, 2}) {
+      TestImage input;
+      input.xsize = xsize;
+      input.ysize = 75;
+      CompressParams jparams;
+      jparams.h_sampling = {samp, 1, 1};
+      jparams.v_sampling = {samp, 1, 1};
+      GenerateInput(PIXELS, jparams, &input);
+      std::vector<uint8_t> serial = EncodeWithRunner(input, jparams, nullptr);
+      std::vector<uint8_t> parallel =
+          EncodeWithRunner(input, jparams, &num_threads);
+      ASSERT_FALSE(serial.empty());
+      EXPECT_EQ(serial, parallel);
+    }
+  }
+}
+
+TEST(EncodeAPITest, ParallelInputSmoothingSameOutput) {
+  size_t num_threads = 3;
+  for (int samp : {1, 2}) {
+    TestImage input;
+    input.xsize = 1100;
+    input.ysize = 75;
+    CompressParams jparams;
+    jparams.h_sampling = {samp, 1, 1};
+    jparams.v_sampling = {samp, 1, 1};
+    jparams.smoothing_factor = 50;
+    GenerateInput(PIXELS, jparams, &input);
+    std::vector<uint8_t> serial = EncodeWithRunner(input, jparams, nullptr);
+    std::vector<uint8_t> parallel =
+        EncodeWithRunner(input, jparams, &num_threads);
+    ASSERT_FALSE(serial.empty());
+    EXPECT_EQ(serial, parallel);
+  }
+}
+
+TEST(EncodeAPITest, ScanSearchNotLarger) {
+  size_t num_smaller = 0;
+  for (int samp : {1, 2}) {
+    for (int progr : {1, 2}) {
+      TestImage input;
+      input.xsize = 257 + samp * 37;
+      input.ysize = 265;
+      CompressParams jparams;
+      jparams.h_sampling = {samp, 1, 1};
+      jparams.v_sampling = {samp, 1, 1};
+      jparams.progressive_mode = progr;
+      GenerateInput(PIXELS, jparams, &input);
+      std::vector<uint8_t> unsearched =
+          EncodeWithRunner(input, jparams, nullptr);
+      jparams.scan_search_ms = 10000.0f;
+      std::vector<uint8_t> searched = EncodeWithRunner(input, jparams, nullptr);
+      ASSERT_FALSE(unsearched.empty());
+      ASSERT_FALSE(searched.empty());
+      EXPECT_LE(searched.size(), unsearched.size())
+          << "samp = " << samp << " progr = " << progr;
+      // The default script is kept unless a smaller one is found, so a
+      // smaller output means that a different script was chosen.
+      if (searched.size() < unsearched.size()) ++num_smaller;
+    }
+  }
+  EXPECT_GT(num_smaller, 0);
+}
+
+TEST(EncodeAPITest, ScanSearchDeterministic) {
+  TestImage input;
+  input.xsize = 331;
+  input.ysize = 265;
+  CompressParams jparams;
+  jparams.progressive_mode = 2;
+  // Small enough to stop the search before all candidates are evaluated.
+  jparams.scan_search_ms = 5.0f;
+  GenerateInput(PIXELS, jparams, &input);
+  std::vector<uint8_t> first = EncodeWithRunner(input, jparams, nullptr);
+  std::vector<uint8_t> second = EncodeWithRunner(input, jparams, nullptr);
+  ASSERT_FALSE(first.empty());
+  EXPECT_EQ(first, second);
+}
+
 std::vector<TestConfig> GenerateBasicConfigs() {
   std::vector<TestConfig> all_configs;
   for (int samp : {1, 2}) {
@@ -415,6 +649,19 @@ std::vector<TestConfig> GenerateTests() {
       }
     }
   }
+  for (int samp : {1, 2}) {
+    for (int progr : {1, 2}) {
+      TestConfig config;
+      config.jparams.h_sampling = {samp, 1, 1};
+      config.jparams.v_sampling = {samp, 1, 1};
+      config.jparams.progressive_mode = progr;
+      // Large enough to try all the candidate scan scripts.
+      config.jparams.scan_search_ms = 10000.0f;
+      config.max_bpp = samp == 1 ? 1.5f : 1.28f;
+      config.max_dist = samp == 1 ? 1.95f : 2.0f;
+      all_tests.push_back(config);
+    }
+  }
   for (int h0_samp : {1, 2, 4}) {
     for (int v0_samp : {1, 2, 4}) {
       for (int h2_samp : {1, 2, 4}) {
@@ -517,6 +764,28 @@ std::vector<TestConfig> GenerateTests() {
     config.max_dist = 3.5;
     all_tests.push_back(config);
   }
+  for (float target : {1.0f, 3.0f}) {
+    for (bool aq : {false, true}) {
+      TestConfig config;
+      config.jparams.block_error_target = target;
+      config.jparams.use_adaptive_quantization = aq;
+      config.jparams.h_sampling = {1, 1, 1};
+      config.jparams.v_sampling = {1, 1, 1};
+      config.max_bpp = target < 2.0f ? 2.4 : 1.3;
+      config.max_dist = target < 2.0f ? 2.6 : 4.5;
+      all_tests.push_back(config);
+    }
+  }
+  {
+    // The chroma blocks share their quant field entries with luma blocks.
+    TestConfig config;
+    config.jparams.block_error_target = 2.0f;
+    config.jparams.h_sampling = {2, 1, 1};
+    config.jparams.v_sampling = {2, 1, 1};
+    config.max_bpp = 1.5;
+    config.max_dist = 3.6;
+    all_tests.push_back(config);
+  }
   {
     TestConfig config;
     config.jparams.libjpeg_mode = true;
@@ -11,9 +11,12 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <limits>
+#include <vector>
 
 #include "lib/jpegli/common.h"
+#include "lib/jpegli/common_internal.h"
 #include "lib/jpegli/encode_internal.h"
 #include "lib/jpegli/memory_manager.h"
 #include "lib/jpegli/quant.h"
@@ -117,6 +120,126 @@ float ComputePSNR(j_compress_ptr cinfo, int sampling) {
   return 4.3429448f * log(num / (error / 255. / 255.));
 }
 
+// Returns the squared error of the requantized block, with the error of each
+// coefficient measured in units of its quantization step at distance 1.0. The
+// base quantization matrices follow the contrast sensitivity of butteraugli, so
+// this is a cheap per-block (i.e. 8x downsampled) estimate of the frequency
+// weighted error of the IDCT'd block.
+float BlockWeightedError(const int16_t* block, const float* qmc,
+                         const float* iqmc, const float* ref_qmc,
+                         const float aq_strength, const float* zero_bias_offset,
+                         const float* zero_bias_mul) {
+  D d;
+  DI di;
+  DI16 di16;
+  auto err = Zero(d);
+  const auto aq_mul = Set(d, aq_strength);
+  for (size_t k = 0; k < DCTSIZE2; k += Lanes(d)) {
+    const auto in = Load(di16, block + k);
+    const auto val = ConvertTo(d, PromoteTo(di, in));
+    const auto q = Load(d, qmc + k);
+    const auto qval = Mul(val, q);
+    const auto zb_offset = Load(d, zero_bias_offset + k);
+    const auto zb_mul = Load(d, zero_bias_mul + k);
+    const auto threshold = Add(zb_offset, Mul(zb_mul, aq_mul));
+    const auto nzero_mask = Ge(Abs(qval), threshold);
+    const auto iqval = IfThenElseZero(nzero_mask, Round(qval));
+    const auto invq = Load(d, iqmc + k);
+    const auto rval = Mul(iqval, invq);
+    const auto diff = Mul(Sub(val, rval), Load(d, ref_qmc + k));
+    err = Add(err, Mul(diff, diff));
+  }
+  return GetLane(SumOfLanes(d, err));
+}
+
+// Uniform quantization with step size s has an RMS error of s / sqrt(12), so
+// with this scaling a block quantized at distance d has an estimate of about d.
+float BlockErrorEstimate(float weighted_error) {
+  return std::sqrt(weighted_error * (12.0f / DCTSIZE2));
+}
+
+// Returns the quantization error of the requantized image, computed from every
+// sampling-th block row and column. This is not a butteraugli distance: it has
+// no masking and no cross-block effects, it only weights the errors like the
+// distance 1.0 quantization matrices do. The block errors are combined with a
+// high p-norm, which is close to their maximum but less sensitive to outliers.
+float EstimateBlockError(j_compress_ptr cinfo, const float* ref_qmc,
+                         int sampling) {
+  constexpr double kPNorm = 16.0;
+  jpeg_comp_master* m = cinfo->master;
+  InitQuantizer(cinfo, QuantPass::SEARCH_SECOND_PASS);
+  double sum = 0.0;
+  size_t num = 0;
+  for (int c = 0; c < cinfo->num_components; ++c) {
+    jpeg_component_info* comp = &cinfo->comp_info[c];
+    const float* qmc = m->quant_mul[c];
+    const float* ref_qmc_c = ref_qmc + c * DCTSIZE2;
+    const size_t h_factor = m->h_factor[c];
+    const size_t v_factor = m->v_factor[c];
+    const float* zero_bias_offset = m->zero_bias_offset[c];
+    const float* zero_bias_mul = m->zero_bias_mul[c];
+    HWY_ALIGN float iqmc[64];
+    ComputeInverseWeights(qmc, iqmc);
+    for (JDIMENSION by = 0; by < comp->height_in_blocks; by += sampling) {
+      JBLOCKARRAY blocks = GetBlockRow(cinfo, c, by);
+      const float* qf = m->quant_field.Row(by * v_factor);
+      for (JDIMENSION bx = 0; bx < comp->width_in_blocks; bx += sampling) {
+        float err = BlockWeightedError(&blocks[0][bx][0], qmc, iqmc, ref_qmc_c,
+                                       qf[bx * h_factor], zero_bias_offset,
+                                       zero_bias_mul);
+        sum += std::pow(BlockErrorEstimate(err), kPNorm);
+        ++num;
+      }
+    }
+  }
+  return std::pow(sum / num, 1.0 / kPNorm);
+}
+
+// Lowers the adaptive quantization strength of the blocks whose error is above
+// max_error, which shrinks their zero-bias dead zone. With
+// chroma subsampling a quant field entry is shared by blocks of several
+// components, so the strength is reduced once, as much as the worst of these
+// blocks needs.
+void LimitBlockErrors(j_compress_ptr cinfo, const float* ref_qmc,
+                      float max_error) {
+  jpeg_comp_master* m = cinfo->master;
+  InitQuantizer(cinfo, QuantPass::SEARCH_SECOND_PASS);
+  const size_t qf_xsize = m->quant_field.xsize();
+  std::vector<float> ratios(m->quant_field.ysize() * qf_xsize, 1.0f);
+  for (int c = 0; c < cinfo->num_components; ++c) {
+    jpeg_component_info* comp = &cinfo->comp_info[c];
+    const float* qmc = m->quant_mul[c];
+    const float* ref_qmc_c = ref_qmc + c * DCTSIZE2;
+    const size_t h_factor = m->h_factor[c];
+    const size_t v_factor = m->v_factor[c];
+    const float* zero_bias_offset = m->zero_bias_offset[c];
+    const float* zero_bias_mul = m->zero_bias_mul[c];
+    HWY_ALIGN float iqmc[64];
+    ComputeInverseWeights(qmc, iqmc);
+    for (JDIMENSION by = 0; by < comp->height_in_blocks; ++by) {
+      JBLOCKARRAY blocks = GetBlockRow(cinfo, c, by);
+      const float* qf = m->quant_field.Row(by * v_factor);
+      float* ratio_row = &ratios[by * v_factor * qf_xsize];
+      for (JDIMENSION bx = 0; bx < comp->width_in_blocks; ++bx) {
+        const size_t x = bx * h_factor;
+        float err = BlockWeightedError(&blocks[0][bx][0], qmc, iqmc, ref_qmc_c,
+                                       qf[x], zero_bias_offset, zero_bias_mul);
+        float error = BlockErrorEstimate(err);
+        if (error > max_error) {
+          ratio_row[x] = std::min(ratio_row[x], max_error / error);
+        }
+      }
+    }
+  }
+  for (size_t y = 0; y < m->quant_field.ysize(); ++y) {
+    float* qf = m->quant_field.Row(y);
+    const float* ratio_row = &ratios[y * qf_xsize];
+    for (size_t x = 0; x < qf_xsize; ++x) {
+      qf[x] *= ratio_row[x] * ratio_row[x];
+    }
+  }
+}
+
 void ReQuantizeCoeffs(j_compress_ptr cinfo) {
   jpeg_comp_master* m = cinfo->master;
   InitQuantizer(cinfo, QuantPass::SEARCH_SECOND_PASS);
@@ -148,6 +271,8 @@ namespace jpegli {
 namespace {
 HWY_EXPORT(ComputePSNR);
 HWY_EXPORT(ReQuantizeCoeffs);
+HWY_EXPORT(EstimateBlockError);
+HWY_EXPORT(LimitBlockErrors);
 
 void ReQuantizeCoeffs(j_compress_ptr cinfo) {
   HWY_DYNAMIC_DISPATCH(ReQuantizeCoeffs)(cinfo);
@@ -157,6 +282,16 @@ float ComputePSNR(j_compress_ptr cinfo, int sampling) {
   return HWY_DYNAMIC_DISPATCH(ComputePSNR)(cinfo, sampling);
 }
 
+float EstimateBlockError(j_compress_ptr cinfo, const float* ref_qmc,
+                         int sampling) {
+  return HWY_DYNAMIC_DISPATCH(EstimateBlockError)(cinfo, ref_qmc, sampling);
+}
+
+void LimitBlockErrors(j_compress_ptr cinfo, const float* ref_qmc,
+                      float max_error) {
+  HWY_DYNAMIC_DISPATCH(LimitBlockErrors)(cinfo, ref_qmc, max_error);
+}
+
 void UpdateDistance(j_compress_ptr cinfo, float distance) {
   float distances[NUM_QUANT_TBLS] = {distance, distance, distance};
   SetQuantMatrices(cinfo, distances, /*add_two_chroma_tables=*/true);
@@ -226,6 +361,77 @@ float FindDistanceForPSNR(j_compress_ptr cinfo) {
   return d;
 }
 
+// Fills in ref_qmc with the quantization multipliers of distance 1.0, these
+// are the units in which EstimateBlockError() measures the errors.
+void ComputeReferenceQuantMul(j_compress_ptr cinfo, float* ref_qmc) {
+  jpeg_comp_master* m = cinfo->master;
+  UpdateDistance(cinfo, 1.0f);
+  InitQuantizer(cinfo, QuantPass::SEARCH_SECOND_PASS);
+  for (int c = 0; c < cinfo->num_components; ++c) {
+    memcpy(ref_qmc + c * DCTSIZE2, m->quant_mul[c], DCTSIZE2 * sizeof(float));
+  }
+}
+
+float FindDistanceForBlockError(j_compress_ptr cinfo, const float* ref_qmc) {
+  constexpr int kMaxIters = 20;
+  const float target = cinfo->master->block_error_target;
+  const float tolerance = cinfo->master->block_error_tolerance;
+  const float min_dist = cinfo->master->min_distance;
+  const float max_dist = cinfo->master->max_distance;
+  float d = Clamp(target, min_dist, max_dist);
+  for (int sampling : {4, 1}) {
+    float best_diff = std::numeric_limits<float>::max();
+    float best_distance = 0.0f;
+    float best_estimate = 0.0;
+    float dmin = min_dist;
+    float dmax = max_dist;
+    bool found_lower_bound = false;
+    bool found_upper_bound = false;
+    for (int i = 0; i < kMaxIters; ++i) {
+      UpdateDistance(cinfo, d);
+      float estimate = EstimateBlockError(cinfo, ref_qmc, sampling);
+      if (estimate < target) {
+        dmin = d;
+        found_lower_bound = true;
+      } else {
+        dmax = d;
+        found_upper_bound = true;
+      }
+#if (PSNR_SEARCH_DBG > 1)
+      printf("sampling %d iter %2d d %7.4f estimate %.4f", sampling, i, d,
+             estimate);
+      if (found_upper_bound && found_lower_bound) {
+        printf("    d-interval: [ %7.4f .. %7.4f ]", dmin, dmax);
+      }
+      printf("\n");
+#endif
+      float diff = std::abs(estimate - target);
+      if (diff < best_diff) {
+        best_diff = diff;
+        best_distance = d;
+        best_estimate = estimate;
+      }
+      if (diff < tolerance * target || dmin == dmax) {
+        break;
+      }
+      if (!found_lower_bound || !found_upper_bound) {
+        // The estimate grows roughly linearly with the distance.
+        d *= estimate > 0.0f ? target / estimate : 2.0f;
+      } else {
+        d = 0.5f * (dmin + dmax);
+      }
+      d = Clamp(d, min_dist, max_dist);
+    }
+    d = best_distance;
+    if (sampling == 1 && PSNR_SEARCH_DBG) {
+      printf("Final estimate %.4f at distance %.4f\n", best_estimate, d);
+    } else {
+      (void)best_estimate;
+    }
+  }
+  return d;
+}
+
 }  // namespace
 
 void QuantizetoPSNR(j_compress_ptr cinfo) {
@@ -234,5 +440,20 @@ void QuantizetoPSNR(j_compress_ptr cinfo) {
   ReQuantizeCoeffs(cinfo);
 }
 
+void QuantizeToBlockError(j_compress_ptr cinfo) {
+  jpeg_comp_master* m = cinfo->master;
+  HWY_ALIGN float ref_qmc[kMaxComponents * DCTSIZE2];
+  ComputeReferenceQuantMul(cinfo, ref_qmc);
+  float distance = FindDistanceForBlockError(cinfo, ref_qmc);
+  UpdateDistance(cinfo, distance);
+  if (m->use_adaptive_quantization) {
+    // Without adaptive quantization all blocks share one quant field entry.
+    float max_error =
+        m->block_error_target * (1.0f + m->block_error_tolerance);
+    LimitBlockErrors(cinfo, ref_qmc, max_error);
+  }
+  ReQuantizeCoeffs(cinfo);
+}
+
 }  // namespace jpegli
 #endif  // HWY_ONCE
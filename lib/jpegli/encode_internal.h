@@ -10,9 +10,11 @@
 #include <cstddef>
 #include <cstdint>
 
+#include "lib/base/parallel_runner.h"
 #include "lib/jpegli/bit_writer.h"
 #include "lib/jpegli/common.h"
 #include "lib/jpegli/common_internal.h"
+#include "lib/jpegli/stats.h"
 #include "lib/jpegli/types.h"
 
 namespace jpegli {
@@ -23,6 +25,10 @@ constexpr int kICCMarker = JPEG_APP0 + 2;
 
 constexpr int kDefaultProgressiveLevel = 0;
 
+// Number of horizontally adjacent blocks of a component that are transformed
+// together by the streaming encoder.
+constexpr size_t kDCTBatchSize = 4;
+
 typedef int16_t coeff_t;
 
 struct HuffmanCodeTable {
@@ -34,6 +40,7 @@ struct Token {
   uint8_t context;
   uint8_t symbol;
   uint16_t bits;
+  Token() = default;
   Token(int c, int s, int b) : context(c), symbol(s), bits(b) {}
 };
 
@@ -69,6 +76,9 @@ struct ScanTokenInfo {
 struct jpeg_comp_master {
   jpegli::RowBuffer<float> input_buffer[jpegli::kMaxComponents];
   jpegli::RowBuffer<float>* smooth_input[jpegli::kMaxComponents];
+  // Horizontal sums of 3 of the last 3 input rows of each component, used by
+  // the input smoothing.
+  jpegli::RowBuffer<float> input_smoothing_sums[jpegli::kMaxComponents];
   jpegli::RowBuffer<float>* raw_data[jpegli::kMaxComponents];
   bool force_baseline;
   bool xyb_mode;
@@ -76,6 +86,10 @@ struct jpeg_comp_master {
   bool use_std_tables;
   bool use_adaptive_quantization;
   int progressive_level;
+  JpegliParallelRunner runner;
+  void* runner_opaque;
+  float scan_search_ms;
+  bool search_scan_script;
   size_t xsize_blocks;
   size_t ysize_blocks;
   size_t blocks_per_iMCU_row;
@@ -114,9 +128,11 @@ struct jpeg_comp_master {
   uint8_t* ac_ctx_offset;
   // Array of num_huffman tables derived coding tables.
   jpegli::HuffmanCodeTable* coding_tables;
-  float* diff_buffer;
   jpegli::RowBuffer<float> fuzzy_erosion_tmp;
   jpegli::RowBuffer<float> pre_erosion;
+  // Per-block sums of the high frequency and gamma modulations of one block
+  // row of the quantization field.
+  jpegli::RowBuffer<float> aq_block_sums;
   jpegli::RowBuffer<float> quant_field;
   jvirt_barray_ptr* coeff_buffers;
   size_t next_input_row;
@@ -126,6 +142,9 @@ struct jpeg_comp_master {
   JCOEF last_dc_coeff[MAX_COMPS_IN_SCAN];
   jpegli::JpegBitWriter bw;
   float* dct_buffer;
+  // The DCT of the current batch of blocks of each component and block row
+  // within the iMCU row.
+  float* dct_batch;
   int32_t* block_tmp;
   jpegli::TokenArray* token_arrays;
   size_t cur_token_array;
@@ -136,8 +155,13 @@ struct jpeg_comp_master {
   uint8_t* next_refinement_bit;
   float psnr_target;
   float psnr_tolerance;
+  float block_error_target;
+  float block_error_tolerance;
   float min_distance;
   float max_distance;
+#if JPEGLI_ENABLE_STATS
+  JpegliStats stats;
+#endif
 };
 
 #endif  // JPEGLI_LIB_JPEGLI_ENCODE_INTERNAL_H_
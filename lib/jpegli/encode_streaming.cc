@@ -119,7 +119,8 @@ void ProcessiMCURow(j_compress_ptr cinfo) {
   int32_t* symbols = m->block_tmp + DCTSIZE2;
   int32_t* nonzero_idx = m->block_tmp + 3 * DCTSIZE2;
   coeff_t* JPEGLI_RESTRICT last_dc_coeff = m->last_dc_coeff;
-  bool adaptive_quant = m->use_adaptive_quantization && m->psnr_target == 0;
+  bool adaptive_quant = m->use_adaptive_quantization &&
+                        m->psnr_target == 0 && m->block_error_target == 0;
   JBLOCKARRAY blocks[kMaxComponents];
   if (kMode == kStreamingModeCoefficients) {
     for (int c = 0; c < cinfo->num_components; ++c) {
@@ -191,9 +192,29 @@ void ProcessiMCURow(j_compress_ptr cinfo) {
             aq_strength = qf[iy * qf_stride + bx * h_factor];
           }
           const float* pixels = imcu_start[c] + (iy * stride + bx) * DCTSIZE;
-          ComputeCoefficientBlock(pixels, stride, qmc, last_dc_coeff[c],
-                                  aq_strength, zero_bias_offset, zero_bias_mul,
-                                  m->dct_buffer, block);
+          const size_t bx0 = bx - bx % kDCTBatchSize;
+          const bool batched = bx0 + kDCTBatchSize <= comp->width_in_blocks;
+          float* batch = m->dct_batch +
+                         (c * MAX_SAMP_FACTOR + iy) * kDCTBatchSize * DCTSIZE2;
+          // The first block of a batch transforms the whole batch, the other
+          // blocks are reached in the following MCUs. A batch that is flat as
+          // a whole is not transformed, since all of its blocks are flat.
+          if (batched && bx == bx0 &&
+              !IsFlatRegion(pixels, stride, kDCTBatchSize * DCTSIZE)) {
+            TransformBatchFromPixels(pixels, stride, batch, m->dct_buffer);
+          }
+          const bool flat = IsFlatRegion(pixels, stride, DCTSIZE);
+          if (flat) {
+            ComputeFlatCoefficientBlock(pixels[0], qmc, last_dc_coeff[c],
+                                        aq_strength, zero_bias_offset,
+                                        zero_bias_mul, block);
+          } else {
+            const float* dct =
+                batched ? batch + (bx - bx0) * DCTSIZE2 : nullptr;
+            ComputeCoefficientBlock(pixels, stride, dct, qmc, last_dc_coeff[c],
+                                    aq_strength, zero_bias_offset,
+                                    zero_bias_mul, m->dct_buffer, block);
+          }
           if (kMode == kStreamingModeCoefficients) {
             JCOEF* cblock = &blocks[c][iy][bx][0];
             for (int k = 0; k < DCTSIZE2; ++k) {
@@ -206,8 +227,15 @@ void ProcessiMCURow(j_compress_ptr cinfo) {
             ComputeTokensForBlock<int32_t, false>(block, 0, c, c + 4,
                                                   &m->next_token);
           } else if (kMode == kStreamingModeBits) {
-            ZigZagShuffle(block);
-            const int num_nonzeros = CompactBlock(block, nonzero_idx);
+            int num_nonzeros = 1;
+            if (flat) {
+              // Only the DC coefficient can be nonzero, there is nothing to
+              // reorder or compact.
+              nonzero_idx[0] = 0;
+            } else {
+              ZigZagShuffle(block);
+              num_nonzeros = CompactBlock(block, nonzero_idx);
+            }
             const bool emit_eob = nonzero_idx[num_nonzeros - 1] < 1008;
             ComputeSymbols(num_nonzeros, nonzero_idx, block, symbols);
             WriteBlock(symbols, block, num_nonzeros, emit_eob, dc_code, ac_code,
@@ -14,6 +14,7 @@
 #include <vector>
 
 #include "lib/base/bits.h"
+#include "lib/base/data_parallel.h"
 #include "lib/base/status.h"
 #include "lib/base/types.h"
 #include "lib/jpegli/common.h"
@@ -75,6 +76,74 @@ size_t EstimateNumTokens(j_compress_ptr cinfo, size_t mcu_y, size_t ysize_mcus,
 namespace {
 HWY_EXPORT(ComputeTokensSequential);
 
+// Destination of the tokens of the scans with Ah == 0. By default the tokens
+// are appended to the token arrays of the encoder. Scans that are tokenized on
+// a worker thread, where the memory manager can not be used, write to their
+// own vector instead, and the token positions are relative to its start.
+class TokenWriter {
+ public:
+  explicit TokenWriter(j_compress_ptr cinfo)
+      : next_token(cinfo->master->next_token), cinfo_(cinfo) {}
+  TokenWriter(j_compress_ptr cinfo, std::vector<Token>* tokens)
+      : next_token(tokens->data()), cinfo_(cinfo), tokens_(tokens) {}
+
+  // Where the next token goes, there is room for the number of tokens passed
+  // to the last Reserve() call.
+  Token* next_token;
+
+  // Makes room for max_tokens more tokens, which is the maximum number of
+  // tokens in one of the num_rows rows of the scan, and row is the current
+  // row. Must be called after Flush().
+  void Reserve(size_t max_tokens, size_t row, size_t num_rows) {
+    if (tokens_) {
+      if (num_tokens_ + max_tokens > tokens_->size()) {
+        tokens_->resize(num_tokens_ + EstimateNumTokens(cinfo_, row, num_rows,
+                                                        num_tokens_,
+                                                        max_tokens));
+        next_token = tokens_->data() + num_tokens_;
+      }
+      return;
+    }
+    jpeg_comp_master* m = cinfo_->master;
+    TokenArray* ta = &m->token_arrays[m->cur_token_array];
+    if (ta->num_tokens + max_tokens > m->num_tokens) {
+      if (ta->tokens) {
+        m->total_num_tokens += ta->num_tokens;
+        ++m->cur_token_array;
+        ta = &m->token_arrays[m->cur_token_array];
+      }
+      m->num_tokens = EstimateNumTokens(cinfo_, row, num_rows,
+                                        m->total_num_tokens, max_tokens);
+      ta->tokens = Allocate<Token>(cinfo_, m->num_tokens, JPOOL_IMAGE);
+      next_token = ta->tokens;
+    }
+  }
+
+  // Records the tokens written since the last call.
+  void Flush() {
+    if (tokens_) {
+      num_tokens_ = next_token - tokens_->data();
+      return;
+    }
+    jpeg_comp_master* m = cinfo_->master;
+    TokenArray* ta = &m->token_arrays[m->cur_token_array];
+    ta->num_tokens = next_token - ta->tokens;
+    m->next_token = next_token;
+  }
+
+  // Position of the next token, as of the last Flush().
+  size_t position() const {
+    if (tokens_) return num_tokens_;
+    jpeg_comp_master* m = cinfo_->master;
+    return m->total_num_tokens + m->token_arrays[m->cur_token_array].num_tokens;
+  }
+
+ private:
+  j_compress_ptr cinfo_;
+  std::vector<Token>* tokens_ = nullptr;
+  size_t num_tokens_ = 0;
+};
+
 void TokenizeProgressiveDC(const coeff_t* coeffs, int context, int Al,
                            coeff_t* last_dc_coeff, Token** next_token) {
   coeff_t temp2;
@@ -92,10 +161,10 @@ void TokenizeProgressiveDC(const coeff_t* coeffs, int context, int Al,
   *(*next_token)++ = Token(context, nbits, bits);
 }
 
-void TokenizeACProgressiveScan(j_compress_ptr cinfo, int scan_index,
-                               int context, ScanTokenInfo* sti) {
+void TokenizeACProgressiveScan(j_compress_ptr cinfo,
+                               const jpeg_scan_info* scan_info, int context,
+                               ScanTokenInfo* sti, TokenWriter* w) {
   jpeg_comp_master* m = cinfo->master;
-  const jpeg_scan_info* scan_info = &cinfo->scan_info[scan_index];
   const int comp_idx = scan_info->component_index[0];
   const jpeg_component_info* comp = &cinfo->comp_info[comp_idx];
   const int Al = scan_info->Al;
@@ -103,19 +172,13 @@ void TokenizeACProgressiveScan(j_compress_ptr cinfo, int scan_index,
   const int Se = scan_info->Se;
   const size_t restart_interval = sti->restart_interval;
   int restarts_to_go = restart_interval;
-  size_t num_blocks =
-      static_cast<size_t>(comp->height_in_blocks) * comp->width_in_blocks;
-  size_t num_restarts =
-      restart_interval > 0 ? DivCeil(num_blocks, restart_interval) : 1;
   size_t restart_idx = 0;
   int eob_run = 0;
-  TokenArray* ta = &m->token_arrays[m->cur_token_array];
-  sti->token_offset = m->total_num_tokens + ta->num_tokens;
-  sti->restarts = Allocate<size_t>(cinfo, num_restarts, JPOOL_IMAGE);
+  sti->token_offset = w->position();
   const auto emit_eob_run = [&]() {
     int nbits = jpegli::FloorLog2Nonzero<uint32_t>(eob_run);
     int symbol = nbits << 4u;
-    *m->next_token++ = Token(context, symbol, eob_run & ((1 << nbits) - 1));
+    *w->next_token++ = Token(context, symbol, eob_run & ((1 << nbits) - 1));
     eob_run = 0;
   };
   for (JDIMENSION by = 0; by < comp->height_in_blocks; ++by) {
@@ -126,23 +189,12 @@ void TokenizeACProgressiveScan(j_compress_ptr cinfo, int scan_index,
     // one extra EOBrun token that was rolled over from the previous block-row
     // and has to be flushed at the end.
     int max_tokens_per_row = 1 + comp->width_in_blocks * (Se - Ss + 1);
-    if (ta->num_tokens + max_tokens_per_row > m->num_tokens) {
-      if (ta->tokens) {
-        m->total_num_tokens += ta->num_tokens;
-        ++m->cur_token_array;
-        ta = &m->token_arrays[m->cur_token_array];
-      }
-      m->num_tokens =
-          EstimateNumTokens(cinfo, by, comp->height_in_blocks,
-                            m->total_num_tokens, max_tokens_per_row);
-      ta->tokens = Allocate<Token>(cinfo, m->num_tokens, JPOOL_IMAGE);
-      m->next_token = ta->tokens;
-    }
+    w->Reserve(max_tokens_per_row, by, comp->height_in_blocks);
     for (JDIMENSION bx = 0; bx < comp->width_in_blocks; ++bx) {
       if (restart_interval > 0 && restarts_to_go == 0) {
         if (eob_run > 0) emit_eob_run();
-        ta->num_tokens = m->next_token - ta->tokens;
-        sti->restarts[restart_idx++] = m->total_num_tokens + ta->num_tokens;
+        w->Flush();
+        sti->restarts[restart_idx++] = w->position();
         restarts_to_go = restart_interval;
       }
       const coeff_t* block = &blocks[0][bx][0];
@@ -172,12 +224,12 @@ void TokenizeACProgressiveScan(j_compress_ptr cinfo, int scan_index,
         }
         if (eob_run > 0) emit_eob_run();
         while (r > 15) {
-          *m->next_token++ = Token(context, 0xf0, 0);
+          *w->next_token++ = Token(context, 0xf0, 0);
           r -= 16;
         }
         int nbits = jpegli::FloorLog2Nonzero<uint32_t>(temp) + 1;
         int symbol = (r << 4u) + nbits;
-        *m->next_token++ = Token(context, symbol, temp2 & ((1 << nbits) - 1));
+        *w->next_token++ = Token(context, symbol, temp2 & ((1 << nbits) - 1));
         ++num_nzeros;
         r = 0;
       }
@@ -189,20 +241,22 @@ void TokenizeACProgressiveScan(j_compress_ptr cinfo, int scan_index,
       sti->num_future_nonzeros += num_future_nzeros;
       --restarts_to_go;
     }
-    ta->num_tokens = m->next_token - ta->tokens;
+    w->Flush();
   }
   if (eob_run > 0) {
     emit_eob_run();
-    ++ta->num_tokens;
+    w->Flush();
   }
-  sti->num_tokens = m->total_num_tokens + ta->num_tokens - sti->token_offset;
-  sti->restarts[restart_idx++] = m->total_num_tokens + ta->num_tokens;
+  sti->num_tokens = w->position() - sti->token_offset;
+  sti->restarts[restart_idx++] = w->position();
 }
 
-void TokenizeACRefinementScan(j_compress_ptr cinfo, int scan_index,
-                              ScanTokenInfo* sti) {
+// The tokens, refinement bits and EOB runs are written to the buffers of *sti,
+// which are allocated by the caller. Returns the number of refinement bits.
+size_t TokenizeACRefinementScan(j_compress_ptr cinfo,
+                                const jpeg_scan_info* scan_info,
+                                ScanTokenInfo* sti) {
   jpeg_comp_master* m = cinfo->master;
-  const jpeg_scan_info* scan_info = &cinfo->scan_info[scan_index];
   const int comp_idx = scan_info->component_index[0];
   const jpeg_component_info* comp = &cinfo->comp_info[comp_idx];
   const int Al = scan_info->Al;
@@ -213,14 +267,6 @@ void TokenizeACRefinementScan(j_compress_ptr cinfo, int scan_index,
   RefToken token;
   int eob_run = 0;
   int eob_refbits = 0;
-  size_t num_blocks =
-      static_cast<size_t>(comp->height_in_blocks) * comp->width_in_blocks;
-  size_t num_restarts =
-      restart_interval > 0 ? DivCeil(num_blocks, restart_interval) : 1;
-  sti->tokens = m->next_refinement_token;
-  sti->refbits = m->next_refinement_bit;
-  sti->eobruns = Allocate<uint16_t>(cinfo, num_blocks / 2, JPOOL_IMAGE);
-  sti->restarts = Allocate<size_t>(cinfo, num_restarts, JPOOL_IMAGE);
   RefToken* next_token = sti->tokens;
   RefToken* next_eob_token = next_token;
   uint8_t* next_ref_bit = sti->refbits;
@@ -313,19 +359,17 @@ void TokenizeACRefinementScan(j_compress_ptr cinfo, int scan_index,
   }
   sti->num_tokens = next_token - sti->tokens;
   sti->restarts[restart_idx++] = sti->num_tokens;
-  m->next_refinement_token = next_token;
-  m->next_refinement_bit = next_ref_bit;
+  return next_ref_bit - sti->refbits;
 }
 
+// Tokenizes a DC, AC first or sequential scan. The refinement bits of DC
+// refinement scans are written to sti->refbits, which is allocated by the
+// caller.
 void TokenizeScan(j_compress_ptr cinfo, size_t scan_index, int ac_ctx_offset,
-                  ScanTokenInfo* sti) {
+                  ScanTokenInfo* sti, TokenWriter* w) {
   const jpeg_scan_info* scan_info = &cinfo->scan_info[scan_index];
   if (scan_info->Ss > 0) {
-    if (scan_info->Ah == 0) {
-      TokenizeACProgressiveScan(cinfo, scan_index, ac_ctx_offset, sti);
-    } else {
-      TokenizeACRefinementScan(cinfo, scan_index, sti);
-    }
+    TokenizeACProgressiveScan(cinfo, scan_info, ac_ctx_offset, sti, w);
     return;
   }
 
@@ -343,22 +387,10 @@ void TokenizeScan(j_compress_ptr cinfo, size_t scan_index, int ac_ctx_offset,
   HWY_ALIGN constexpr coeff_t kSinkBlock[DCTSIZE2] = {0};
 
   size_t restart_idx = 0;
-  TokenArray* ta = &m->token_arrays[m->cur_token_array];
-  sti->token_offset = Ah > 0 ? 0 : m->total_num_tokens + ta->num_tokens;
+  sti->token_offset = Ah > 0 ? 0 : w->position();
 
-  if (Ah > 0) {
-    sti->refbits = Allocate<uint8_t>(cinfo, sti->num_blocks, JPOOL_IMAGE);
-  } else if (cinfo->progressive_mode) {
-    if (ta->num_tokens + sti->num_blocks > m->num_tokens) {
-      if (ta->tokens) {
-        m->total_num_tokens += ta->num_tokens;
-        ++m->cur_token_array;
-        ta = &m->token_arrays[m->cur_token_array];
-      }
-      m->num_tokens = sti->num_blocks;
-      ta->tokens = Allocate<Token>(cinfo, m->num_tokens, JPOOL_IMAGE);
-      m->next_token = ta->tokens;
-    }
+  if (Ah == 0 && cinfo->progressive_mode) {
+    w->Reserve(sti->num_blocks, 0, 1);
   }
 
   JBLOCKARRAY blocks[MAX_COMPS_IN_SCAN];
@@ -377,27 +409,19 @@ void TokenizeScan(j_compress_ptr cinfo, size_t scan_index, int ac_ctx_offset,
     }
     if (!cinfo->progressive_mode) {
       int max_tokens_per_mcu_row = MaxNumTokensPerMCURow(cinfo);
-      if (ta->num_tokens + max_tokens_per_mcu_row > m->num_tokens) {
-        if (ta->tokens) {
-          m->total_num_tokens += ta->num_tokens;
-          ++m->cur_token_array;
-          ta = &m->token_arrays[m->cur_token_array];
-        }
-        m->num_tokens =
-            EstimateNumTokens(cinfo, mcu_y, sti->MCU_rows_in_scan,
-                              m->total_num_tokens, max_tokens_per_mcu_row);
-        ta->tokens = Allocate<Token>(cinfo, m->num_tokens, JPOOL_IMAGE);
-        m->next_token = ta->tokens;
-      }
+      w->Reserve(max_tokens_per_mcu_row, mcu_y, sti->MCU_rows_in_scan);
     }
     for (size_t mcu_x = 0; mcu_x < sti->MCUs_per_row; ++mcu_x) {
       // Possibly emit a restart marker.
       if (restart_interval > 0 && restarts_to_go == 0) {
         restarts_to_go = restart_interval;
         memset(last_dc_coeff, 0, sizeof(last_dc_coeff));
-        ta->num_tokens = m->next_token - ta->tokens;
-        sti->restarts[restart_idx++] =
-            Ah > 0 ? block_idx : m->total_num_tokens + ta->num_tokens;
+        if (Ah > 0) {
+          sti->restarts[restart_idx++] = block_idx;
+        } else {
+          w->Flush();
+          sti->restarts[restart_idx++] = w->position();
+        }
       }
       // Encode one MCU
       for (int i = 0; i < scan_info->comps_in_scan; ++i) {
@@ -419,12 +443,12 @@ void TokenizeScan(j_compress_ptr cinfo, size_t scan_index, int ac_ctx_offset,
             if (!is_progressive) {
               HWY_DYNAMIC_DISPATCH(ComputeTokensSequential)
               (block, last_dc_coeff[i], comp_idx, ac_ctx_offset + i,
-               &m->next_token);
+               &w->next_token);
               last_dc_coeff[i] = block[0];
             } else {
               if (Ah == 0) {
                 TokenizeProgressiveDC(block, comp_idx, Al, last_dc_coeff + i,
-                                      &m->next_token);
+                                      &w->next_token);
               } else {
                 sti->refbits[block_idx] = (block[0] >> Al) & 1;
               }
@@ -435,19 +459,51 @@ void TokenizeScan(j_compress_ptr cinfo, size_t scan_index, int ac_ctx_offset,
       }
       --restarts_to_go;
     }
-    ta->num_tokens = m->next_token - ta->tokens;
+    if (Ah == 0) w->Flush();
   }
   JPEGLI_DASSERT(block_idx == sti->num_blocks);
-  sti->num_tokens =
-      Ah > 0 ? sti->num_blocks
-             : m->total_num_tokens + ta->num_tokens - sti->token_offset;
-  sti->restarts[restart_idx++] =
-      Ah > 0 ? sti->num_blocks : m->total_num_tokens + ta->num_tokens;
+  if (Ah > 0) {
+    sti->num_tokens = sti->num_blocks;
+    sti->restarts[restart_idx++] = sti->num_blocks;
+  } else {
+    sti->num_tokens = w->position() - sti->token_offset;
+    sti->restarts[restart_idx++] = w->position();
+  }
   if (Ah == 0 && cinfo->progressive_mode) {
     JPEGLI_DASSERT(sti->num_blocks == sti->num_tokens);
   }
 }
 
+bool IsACRefinementScan(const jpeg_scan_info* si) {
+  return si->Ss > 0 && si->Ah > 0;
+}
+
+void AllocateDCRefinementBits(j_compress_ptr cinfo, int scan_index) {
+  const jpeg_scan_info* si = &cinfo->scan_info[scan_index];
+  ScanTokenInfo* sti = &cinfo->master->scan_token_info[scan_index];
+  if (si->Ss == 0 && si->Ah > 0) {
+    sti->refbits = Allocate<uint8_t>(cinfo, sti->num_blocks, JPOOL_IMAGE);
+  }
+}
+
+uint16_t* AllocateEOBRuns(j_compress_ptr cinfo, int scan_index) {
+  const ScanTokenInfo* sti = &cinfo->master->scan_token_info[scan_index];
+  return Allocate<uint16_t>(cinfo, sti->num_blocks / 2, JPOOL_IMAGE);
+}
+
+// Tokenizes an AC refinement scan into the next free part of the shared
+// refinement token and bit buffers.
+void TokenizeACRefinementScanShared(j_compress_ptr cinfo, int scan_index) {
+  jpeg_comp_master* m = cinfo->master;
+  ScanTokenInfo* sti = &m->scan_token_info[scan_index];
+  sti->tokens = m->next_refinement_token;
+  sti->refbits = m->next_refinement_bit;
+  sti->eobruns = AllocateEOBRuns(cinfo, scan_index);
+  m->next_refinement_bit +=
+      TokenizeACRefinementScan(cinfo, &cinfo->scan_info[scan_index], sti);
+  m->next_refinement_token += sti->num_tokens;
+}
+
 }  // namespace
 
 void TokenizeJpeg(j_compress_ptr cinfo) {
@@ -457,13 +513,14 @@ void TokenizeJpeg(j_compress_ptr cinfo) {
   size_t num_refinement_bits = 0;
   int num_refinement_scans[kMaxComponents][DCTSIZE2] = {};
   int max_num_refinement_scans = 0;
+  TokenWriter writer(cinfo);
   for (int i = 0; i < cinfo->num_scans; ++i) {
     const jpeg_scan_info* si = &cinfo->scan_info[i];
     ScanTokenInfo* sti = &m->scan_token_info[i];
     if (si->Ss > 0 && si->Ah == 0 && si->Al > 0) {
       int offset = m->ac_ctx_offset[i];
       int comp_idx = si->component_index[0];
-      TokenizeScan(cinfo, i, offset, sti);
+      TokenizeScan(cinfo, i, offset, sti, &writer);
       processed[i] = 1;
       max_refinement_tokens += sti->num_future_nonzeros;
       for (int k = si->Ss; k <= si->Se; ++k) {
@@ -472,12 +529,8 @@ void TokenizeJpeg(j_compress_ptr cinfo) {
       max_num_refinement_scans = std::max(max_num_refinement_scans, si->Al);
       num_refinement_bits += sti->num_nonzeros;
     }
-    if (si->Ss > 0 && si->Ah > 0) {
-      int comp_idx = si->component_index[0];
-      const jpeg_component_info* comp = &cinfo->comp_info[comp_idx];
-      size_t num_blocks =
-          static_cast<size_t>(comp->width_in_blocks) * comp->height_in_blocks;
-      max_refinement_tokens += (1 + (si->Se - si->Ss) / 16) * num_blocks;
+    if (IsACRefinementScan(si)) {
+      max_refinement_tokens += (1 + (si->Se - si->Ss) / 16) * sti->num_blocks;
     }
   }
   if (max_refinement_tokens > 0) {
@@ -493,10 +546,9 @@ void TokenizeJpeg(j_compress_ptr cinfo) {
       const jpeg_scan_info* si = &cinfo->scan_info[i];
       int comp_idx = si->component_index[0];
       ScanTokenInfo* sti = &m->scan_token_info[i];
-      if (si->Ss > 0 && si->Ah > 0 &&
+      if (IsACRefinementScan(si) &&
           si->Ah == num_refinement_scans[comp_idx][si->Ss] - j) {
-        int offset = m->ac_ctx_offset[i];
-        TokenizeScan(cinfo, i, offset, sti);
+        TokenizeACRefinementScanShared(cinfo, i);
         processed[i] = 1;
         new_refinement_bits += sti->num_nonzeros;
       }
@@ -509,18 +561,104 @@ void TokenizeJpeg(j_compress_ptr cinfo) {
     if (processed[i]) {
       continue;
     }
-    int offset = m->ac_ctx_offset[i];
-    TokenizeScan(cinfo, i, offset, &m->scan_token_info[i]);
     processed[i] = 1;
+    if (IsACRefinementScan(&cinfo->scan_info[i])) {
+      TokenizeACRefinementScanShared(cinfo, i);
+      continue;
+    }
+    int offset = m->ac_ctx_offset[i];
+    AllocateDCRefinementBits(cinfo, i);
+    TokenizeScan(cinfo, i, offset, &m->scan_token_info[i], &writer);
   }
 }
 
-namespace {
+void TokenizeJpeg(j_compress_ptr cinfo, ThreadPool* pool,
+                  std::vector<std::vector<Token>>* scan_tokens) {
+  jpeg_comp_master* m = cinfo->master;
+  const int num_scans = cinfo->num_scans;
+  scan_tokens->resize(num_scans);
+  std::vector<uint32_t> first_pass;
+  std::vector<uint32_t> refinement_pass;
+  for (int i = 0; i < num_scans; ++i) {
+    if (IsACRefinementScan(&cinfo->scan_info[i])) {
+      refinement_pass.push_back(i);
+    } else {
+      AllocateDCRefinementBits(cinfo, i);
+      first_pass.push_back(i);
+    }
+  }
+  const auto tokenize_scan = [&](const uint32_t task,
+                                 size_t /* thread */) -> Status {
+    const int i = first_pass[task];
+    TokenWriter writer(cinfo, &(*scan_tokens)[i]);
+    TokenizeScan(cinfo, i, m->ac_ctx_offset[i], &m->scan_token_info[i],
+                 &writer);
+    return true;
+  };
+  if (!RunOnPool(pool, 0, first_pass.size(), ThreadPool::NoInit,
+                 tokenize_scan, "TokenizeScan")) {
+    JPEGLI_ERROR("Failed to tokenize scans.");
+  }
 
-struct Histogram {
-  int count[kJpegHuffmanAlphabetSize];
-  Histogram() { memset(count, 0, sizeof(count)); }
-};
+  // Each AC refinement scan gets its own buffers, so that the scans can be
+  // tokenized independently. The number of new non-zero coefficients and of
+  // refinement bits is bounded by the statistics of the first scans of the
+  // same component and spectral band.
+  for (uint32_t i : refinement_pass) {
+    const jpeg_scan_info* si = &cinfo->scan_info[i];
+    ScanTokenInfo* sti = &m->scan_token_info[i];
+    size_t max_tokens = (1 + (si->Se - si->Ss) / 16) * sti->num_blocks;
+    size_t max_refbits = 0;
+    for (uint32_t k : first_pass) {
+      const jpeg_scan_info* fsi = &cinfo->scan_info[k];
+      const ScanTokenInfo* fsti = &m->scan_token_info[k];
+      if (fsi->Ss > 0 && fsi->Al > 0 &&
+          fsi->component_index[0] == si->component_index[0] &&
+          fsi->Ss <= si->Se && si->Ss <= fsi->Se) {
+        max_tokens += fsti->num_future_nonzeros;
+        max_refbits += fsti->num_nonzeros + fsti->num_future_nonzeros;
+      }
+    }
+    sti->tokens = Allocate<RefToken>(cinfo, max_tokens, JPOOL_IMAGE);
+    sti->refbits = Allocate<uint8_t>(cinfo, max_refbits, JPOOL_IMAGE);
+    sti->eobruns = AllocateEOBRuns(cinfo, i);
+  }
+  const auto tokenize_refinement_scan = [&](const uint32_t task,
+                                            size_t /* thread */) -> Status {
+    const int i = refinement_pass[task];
+    TokenizeACRefinementScan(cinfo, &cinfo->scan_info[i],
+                             &m->scan_token_info[i]);
+    return true;
+  };
+  if (!RunOnPool(pool, 0, refinement_pass.size(), ThreadPool::NoInit,
+                 tokenize_refinement_scan, "TokenizeACRefinementScan")) {
+    JPEGLI_ERROR("Failed to tokenize scans.");
+  }
+
+  // Turn the scan token vectors into the token arrays of the encoder, and
+  // the token positions into global ones.
+  size_t num_arrays = 0;
+  size_t total_num_tokens = 0;
+  for (uint32_t i : first_pass) {
+    ScanTokenInfo* sti = &m->scan_token_info[i];
+    if (cinfo->scan_info[i].Ah > 0) continue;
+    sti->token_offset += total_num_tokens;
+    for (size_t r = 0; r < sti->num_restarts; ++r) {
+      sti->restarts[r] += total_num_tokens;
+    }
+    if (sti->num_tokens > 0) {
+      TokenArray* ta = &m->token_arrays[num_arrays++];
+      ta->tokens = (*scan_tokens)[i].data();
+      ta->num_tokens = sti->num_tokens;
+    }
+    total_num_tokens += sti->num_tokens;
+  }
+  m->cur_token_array = num_arrays > 0 ? num_arrays - 1 : 0;
+  m->total_num_tokens =
+      total_num_tokens - m->token_arrays[m->cur_token_array].num_tokens;
+}
+
+namespace {
 
 void BuildHistograms(j_compress_ptr cinfo, Histogram* histograms) {
   jpeg_comp_master* m = cinfo->master;
@@ -553,14 +691,17 @@ struct JpegClusteredHistograms {
 };
 
 float HistogramCost(const Histogram& histo) {
-  std::vector<uint32_t> counts(kJpegHuffmanAlphabetSize + 1);
-  std::vector<uint8_t> depths(kJpegHuffmanAlphabetSize + 1);
+  // This is called many times during clustering, so we avoid heap
+  // allocations here.
+  uint32_t counts[kJpegHuffmanAlphabetSize + 1];
+  // CreateHuffmanTree() only sets the depths of the non-zero counts.
+  uint8_t depths[kJpegHuffmanAlphabetSize + 1] = {};
   for (size_t i = 0; i < kJpegHuffmanAlphabetSize; ++i) {
     counts[i] = histo.count[i];
   }
   counts[kJpegHuffmanAlphabetSize] = 1;
-  CreateHuffmanTree(counts.data(), counts.size(), kJpegHuffmanMaxBitLength,
-                    depths.data());
+  CreateHuffmanTree(counts, kJpegHuffmanAlphabetSize + 1,
+                    kJpegHuffmanMaxBitLength, depths);
   size_t header_bits = (1 + kJpegHuffmanMaxBitLength) * 8;
   size_t data_bits = 0;
   for (size_t i = 0; i < kJpegHuffmanAlphabetSize; ++i) {
@@ -578,6 +719,12 @@ void AddHistograms(const Histogram& a, const Histogram& b, Histogram* c) {
   }
 }
 
+void SubtractHistograms(const Histogram& a, const Histogram& b, Histogram* c) {
+  for (size_t i = 0; i < kJpegHuffmanAlphabetSize; ++i) {
+    c->count[i] = a.count[i] - b.count[i];
+  }
+}
+
 bool IsEmptyHistogram(const Histogram& histo) {
   for (int count : histo.count) {
     if (count) return false;
@@ -585,11 +732,119 @@ bool IsEmptyHistogram(const Histogram& histo) {
   return true;
 }
 
+// Number of non-empty histograms after the current one that are considered
+// when choosing the slot to reuse for a new cluster. The slots are likely
+// reassigned again after a few more histograms, and this keeps the clustering
+// linear in the number of histograms.
+constexpr size_t kMaxFutureMerges = 8;
+
+// Returns the number of bits that merging the next kMaxFutureMerges non-empty
+// histograms after position i into the histogram of the given slot would save,
+// if each of them was merged separately. This is used to decide which slot to
+// reuse for a new cluster.
+float FutureMergeGain(const Histogram* histograms, const float* costs,
+                      size_t num, size_t i, const Histogram& slot_histo,
+                      float slot_cost) {
+  float gain = 0.0f;
+  size_t num_merges = 0;
+  for (size_t k = i + 1; k < num && num_merges < kMaxFutureMerges; ++k) {
+    if (IsEmptyHistogram(histograms[k])) continue;
+    ++num_merges;
+    Histogram combined;
+    AddHistograms(slot_histo, histograms[k], &combined);
+    float merge_cost = HistogramCost(combined) - slot_cost;
+    gain += std::max(0.0f, costs[k] - merge_cost);
+  }
+  return gain;
+}
+
+// Moves single histograms between clusters as long as this reduces the total
+// cost. A histogram can only be moved to a cluster whose Huffman table is in
+// its slot at the position of the histogram, and the first histogram of a
+// cluster that is emitted between scans is never moved, since that defines
+// where its table is written.
+void RefineJpegHistogramClusters(const Histogram* histograms, size_t num,
+                                 JpegClusteredHistograms* clusters) {
+  constexpr size_t kMaxIterations = 4;
+  const size_t num_clusters = clusters->histograms.size();
+  if (num_clusters < 2) return;
+  // Position of the first histogram of each cluster.
+  std::vector<size_t> first(num_clusters, num);
+  std::vector<size_t> num_members(num_clusters);
+  for (size_t i = 0; i < num; ++i) {
+    if (IsEmptyHistogram(histograms[i])) continue;
+    uint32_t k = clusters->histogram_indexes[i];
+    first[k] = std::min(first[k], i);
+    ++num_members[k];
+  }
+  // The first four clusters are emitted before the first scan, the others
+  // right before the scan of their first histogram, where they replace the
+  // previous cluster of the same slot.
+  std::vector<size_t> live_begin(num_clusters);
+  std::vector<size_t> live_end(num_clusters, num);
+  for (size_t k = 0; k < num_clusters; ++k) {
+    live_begin[k] = k < 4 ? 0 : first[k];
+    for (size_t l = k + 1; l < num_clusters; ++l) {
+      if (clusters->slot_ids[l] == clusters->slot_ids[k]) {
+        live_end[k] = first[l];
+        break;
+      }
+    }
+  }
+  std::vector<float> cluster_costs(num_clusters);
+  for (size_t k = 0; k < num_clusters; ++k) {
+    cluster_costs[k] = HistogramCost(clusters->histograms[k]);
+  }
+  for (size_t iter = 0; iter < kMaxIterations; ++iter) {
+    bool changed = false;
+    for (size_t i = 0; i < num; ++i) {
+      const Histogram& cur = histograms[i];
+      if (IsEmptyHistogram(cur)) continue;
+      uint32_t a = clusters->histogram_indexes[i];
+      if (num_members[a] == 1 || (a >= 4 && first[a] == i)) continue;
+      Histogram reduced;
+      SubtractHistograms(clusters->histograms[a], cur, &reduced);
+      float reduced_cost = HistogramCost(reduced);
+      float removal_gain = cluster_costs[a] - reduced_cost;
+      uint32_t best_cluster = a;
+      float best_delta = 0.0f;
+      float best_cost = 0.0f;
+      for (uint32_t b = 0; b < num_clusters; ++b) {
+        if (b == a || i < live_begin[b] || i >= live_end[b]) continue;
+        Histogram combined;
+        AddHistograms(clusters->histograms[b], cur, &combined);
+        float combined_cost = HistogramCost(combined);
+        float delta = combined_cost - cluster_costs[b] - removal_gain;
+        if (delta < best_delta) {
+          best_delta = delta;
+          best_cluster = b;
+          best_cost = combined_cost;
+        }
+      }
+      if (best_cluster == a) continue;
+      uint32_t b = best_cluster;
+      clusters->histograms[a] = reduced;
+      cluster_costs[a] = reduced_cost;
+      AddHistograms(clusters->histograms[b], cur, &clusters->histograms[b]);
+      cluster_costs[b] = best_cost;
+      clusters->histogram_indexes[i] = b;
+      --num_members[a];
+      ++num_members[b];
+      changed = true;
+    }
+    if (!changed) break;
+  }
+}
+
 void ClusterJpegHistograms(j_compress_ptr cinfo, const Histogram* histograms,
                            size_t num, JpegClusteredHistograms* clusters) {
   clusters->histogram_indexes.resize(num);
   std::vector<uint32_t> slot_histograms;
   std::vector<float> slot_costs;
+  std::vector<float> costs(num);
+  for (size_t i = 0; i < num; ++i) {
+    costs[i] = HistogramCost(histograms[i]);
+  }
   // Since not all jpeg decoders support the extended sequential mode, i.e. the
   // 0xff 0xc1 SOF marker, we will limit the number of clusters to 2 in
   // sequential mode, unless the quantization tables already require the
@@ -605,7 +860,7 @@ void ClusterJpegHistograms(j_compress_ptr cinfo, const Histogram* histograms,
     size_t best_slot = slot_histograms.size();
     float best_cost = force_baseline && best_slot > 1
                           ? std::numeric_limits<float>::max()
-                          : HistogramCost(cur);
+                          : costs[i];
     for (size_t j = 0; j < slot_histograms.size(); ++j) {
       size_t prev_idx = slot_histograms[j];
       const Histogram& prev = clusters->histograms[prev_idx];
@@ -628,8 +883,18 @@ void ClusterJpegHistograms(j_compress_ptr cinfo, const Histogram* histograms,
         slot_histograms.push_back(histogram_index);
         slot_costs.push_back(best_cost);
       } else {
-        // TODO(szabadka) Find the best histogram to replace.
-        best_slot = (clusters->slot_ids.back() + 1) % 4;
+        // Replace the histogram that would be the least useful for the
+        // remaining histograms.
+        float min_gain = std::numeric_limits<float>::max();
+        for (size_t j = 0; j < slot_histograms.size(); ++j) {
+          float gain = FutureMergeGain(
+              histograms, costs.data(), num, i,
+              clusters->histograms[slot_histograms[j]], slot_costs[j]);
+          if (gain < min_gain) {
+            min_gain = gain;
+            best_slot = j;
+          }
+        }
       }
       slot_histograms[best_slot] = histogram_index;
       slot_costs[best_slot] = best_cost;
@@ -644,6 +909,7 @@ void ClusterJpegHistograms(j_compress_ptr cinfo, const Histogram* histograms,
       slot_costs[best_slot] += best_cost;
     }
   }
+  RefineJpegHistogramClusters(histograms, num, clusters);
 }
 
 void CopyHuffmanTable(j_compress_ptr cinfo, int index, bool is_dc,
@@ -846,5 +1112,80 @@ void InitEntropyCoder(j_compress_ptr cinfo) {
   }
 }
 
+namespace {
+
+size_t NumExtraBits(const Histogram& histo) {
+  size_t bits = 0;
+  for (size_t i = 0; i < kJpegHuffmanAlphabetSize; ++i) {
+    bits += static_cast<size_t>(histo.count[i]) * kNumExtraBits[i];
+  }
+  return bits;
+}
+
+}  // namespace
+
+size_t EstimateACFirstScan(j_compress_ptr cinfo, int comp_idx, int Ss, int Se,
+                           int Al, ScanEstimateBuffers* buffers,
+                           Histogram* histo, size_t* num_nonzeros) {
+  const jpeg_scan_info scan_info = {1, {comp_idx}, Ss, Se, 0, Al};
+  ScanTokenInfo sti = {};
+  size_t end_of_scan;
+  sti.restarts = &end_of_scan;
+  TokenWriter writer(cinfo, &buffers->tokens);
+  TokenizeACProgressiveScan(cinfo, &scan_info, 0, &sti, &writer);
+  const Token* tokens = buffers->tokens.data();
+  *histo = Histogram();
+  for (size_t i = 0; i < sti.num_tokens; ++i) {
+    ++histo->count[tokens[i].symbol];
+  }
+  *num_nonzeros = sti.num_nonzeros + sti.num_future_nonzeros;
+  return NumExtraBits(*histo);
+}
+
+size_t EstimateACRefinementScan(j_compress_ptr cinfo, int comp_idx, int Ss,
+                                int Se, int Al, size_t num_nonzeros,
+                                ScanEstimateBuffers* buffers,
+                                Histogram* histo) {
+  const jpeg_component_info* comp = &cinfo->comp_info[comp_idx];
+  const size_t num_blocks =
+      static_cast<size_t>(comp->width_in_blocks) * comp->height_in_blocks;
+  const jpeg_scan_info scan_info = {1, {comp_idx}, Ss, Se, Al + 1, Al};
+  // Same bounds as in TokenizeJpeg(), the number of new non-zeros and of
+  // refinement bits are both at most the number of non-zeros in the band.
+  const size_t max_tokens = num_nonzeros + (1 + (Se - Ss) / 16) * num_blocks;
+  if (buffers->ref_tokens.size() < max_tokens) {
+    buffers->ref_tokens.resize(max_tokens);
+  }
+  if (buffers->refbits.size() < num_nonzeros) {
+    buffers->refbits.resize(num_nonzeros);
+  }
+  if (buffers->eobruns.size() < num_blocks / 2) {
+    buffers->eobruns.resize(num_blocks / 2);
+  }
+  ScanTokenInfo sti = {};
+  size_t end_of_scan;
+  sti.restarts = &end_of_scan;
+  sti.tokens = buffers->ref_tokens.data();
+  sti.refbits = buffers->refbits.data();
+  sti.eobruns = buffers->eobruns.data();
+  size_t num_refbits = TokenizeACRefinementScan(cinfo, &scan_info, &sti);
+  *histo = Histogram();
+  for (size_t i = 0; i < sti.num_tokens; ++i) {
+    ++histo->count[sti.tokens[i].symbol & 253];
+  }
+  return NumExtraBits(*histo) + num_refbits;
+}
+
+float EstimateACHuffmanBits(j_compress_ptr cinfo, const Histogram* histograms,
+                            size_t num) {
+  JpegClusteredHistograms clusters;
+  ClusterJpegHistograms(cinfo, histograms, num, &clusters);
+  float bits = 0.0f;
+  for (const Histogram& histo : clusters.histograms) {
+    bits += HistogramCost(histo);
+  }
+  return bits;
+}
+
 }  // namespace jpegli
 #endif  // HWY_ONCE
@@ -8,8 +8,14 @@
 #define JPEGLI_LIB_JPEGLI_ENTROPY_CODING_H_
 
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
 
+#include "lib/base/data_parallel.h"
 #include "lib/jpegli/common.h"
+#include "lib/jpegli/common_internal.h"
+#include "lib/jpegli/encode_internal.h"
 
 namespace jpegli {
 
@@ -20,6 +26,50 @@ size_t EstimateNumTokens(j_compress_ptr cinfo, size_t mcu_y, size_t ysize_mcus,
 
 void TokenizeJpeg(j_compress_ptr cinfo);
 
+// Same as above, but the scans are tokenized concurrently on the thread pool.
+// The tokens of the scans with Ah == 0 are stored in (*scan_tokens)[scan_index]
+// instead of memory from the memory manager, therefore *scan_tokens must be
+// kept until the scans are written.
+void TokenizeJpeg(j_compress_ptr cinfo, ThreadPool* pool,
+                  std::vector<std::vector<Token>>* scan_tokens);
+
+struct Histogram {
+  int count[kJpegHuffmanAlphabetSize];
+  Histogram() { memset(count, 0, sizeof(count)); }
+};
+
+// Token buffers of the scan estimates below. They can be reused across calls,
+// so that they are only reallocated when a scan needs more tokens.
+struct ScanEstimateBuffers {
+  std::vector<Token> tokens;
+  std::vector<RefToken> ref_tokens;
+  std::vector<uint8_t> refbits;
+  std::vector<uint16_t> eobruns;
+};
+
+// Computes the histogram of the Huffman coded symbols of a progressive AC first
+// scan (Ss > 0, Ah = 0) of one component and returns the number of extra bits
+// of the symbols. Sets *num_nonzeros to the number of non-zero coefficients in
+// the band.
+size_t EstimateACFirstScan(j_compress_ptr cinfo, int comp_idx, int Ss, int Se,
+                           int Al, ScanEstimateBuffers* buffers,
+                           Histogram* histo, size_t* num_nonzeros);
+
+// Same as above for the refinement scan with Ah = Al + 1, where num_nonzeros
+// is the value returned by one of the first scans of the band. The returned
+// value includes the refinement bits.
+size_t EstimateACRefinementScan(j_compress_ptr cinfo, int comp_idx, int Ss,
+                                int Se, int Al, size_t num_nonzeros,
+                                ScanEstimateBuffers* buffers,
+                                Histogram* histo);
+
+// Returns the size in bits of the Huffman codes and coded symbols of the AC
+// scans with the given histograms, in scan order. The histograms are clustered
+// into Huffman tables as in OptimizeHuffmanCodes(), so a table that is shared
+// by several scans is only counted once.
+float EstimateACHuffmanBits(j_compress_ptr cinfo, const Histogram* histograms,
+                            size_t num);
+
 void CopyHuffmanTables(j_compress_ptr cinfo);
 
 void OptimizeHuffmanCodes(j_compress_ptr cinfo);
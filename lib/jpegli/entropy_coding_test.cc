@@ -0,0 +1,119 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/jpegli/entropy_coding.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lib/jpegli/common.h"
+#include "lib/jpegli/encode.h"
+#include "lib/jpegli/libjpeg_test_util.h"
+#include "lib/jpegli/test_params.h"
+#include "lib/jpegli/test_utils.h"
+#include "lib/jpegli/testing.h"
+
+namespace jpegli {
+namespace {
+
+float HistogramBits(j_compress_ptr cinfo, const Histogram& histo) {
+  return EstimateACHuffmanBits(cinfo, &histo, 1);
+}
+
+// The clustering that was used before the slot to reuse was chosen by looking
+// ahead: the histograms are merged greedily into one of the four slots, and
+// when a new cluster is needed the slots are reused in round robin order.
+float RoundRobinClusteredBits(j_compress_ptr cinfo,
+                              const std::vector<Histogram>& histograms) {
+  std::vector<Histogram> clusters;
+  std::vector<size_t> slot_clusters;
+  std::vector<float> slot_costs;
+  size_t last_slot = 0;
+  for (const Histogram& cur : histograms) {
+    size_t best_slot = slot_clusters.size();
+    float best_cost = HistogramBits(cinfo, cur);
+    for (size_t j = 0; j < slot_clusters.size(); ++j) {
+      Histogram combined = clusters[slot_clusters[j]];
+      for (size_t i = 0; i < kJpegHuffmanAlphabetSize; ++i) {
+        combined.count[i] += cur.count[i];
+      }
+      float cost = HistogramBits(cinfo, combined) - slot_costs[j];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_slot = j;
+      }
+    }
+    if (best_slot == slot_clusters.size()) {
+      if (best_slot < 4) {
+        slot_clusters.push_back(0);
+        slot_costs.push_back(0.0f);
+      } else {
+        best_slot = (last_slot + 1) % 4;
+      }
+      slot_clusters[best_slot] = clusters.size();
+      slot_costs[best_slot] = best_cost;
+      clusters.push_back(cur);
+      last_slot = best_slot;
+    } else {
+      Histogram* cluster = &clusters[slot_clusters[best_slot]];
+      for (size_t i = 0; i < kJpegHuffmanAlphabetSize; ++i) {
+        cluster->count[i] += cur.count[i];
+      }
+      slot_costs[best_slot] += best_cost;
+    }
+  }
+  float bits = 0.0f;
+  for (const Histogram& cluster : clusters) {
+    bits += HistogramBits(cinfo, cluster);
+  }
+  return bits;
+}
+
+TEST(EntropyCodingTest, ClusteringNotWorseThanRoundRobin) {
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr jerr;
+  cinfo.err = jpegli_std_error(&jerr);
+  jpegli_create_compress(&cinfo);
+  cinfo.progressive_mode = TRUE;
+  // Five histograms with disjoint symbols, so that each needs its own Huffman
+  // table, and the first one is used again after the fifth one took a slot.
+  const int kPattern[] = {0, 1, 2, 3, 4, 0, 0, 1, 2, 3, 0, 4, 0, 1, 2, 3};
+  std::vector<Histogram> histograms;
+  for (int k : kPattern) {
+    Histogram histo;
+    histo.count[0] = 500;
+    for (int s = 0; s < 12; ++s) {
+      histo.count[k * 16 + s + 1] = 100 + 37 * s;
+    }
+    histograms.push_back(histo);
+  }
+  float bits =
+      EstimateACHuffmanBits(&cinfo, histograms.data(), histograms.size());
+  EXPECT_LT(bits, RoundRobinClusteredBits(&cinfo, histograms));
+  jpegli_destroy_compress(&cinfo);
+}
+
+TEST(EntropyCodingTest, ManyACHistogramsRoundtrip) {
+  // Test scripts with more than four AC scans of different statistics.
+  for (int progr : {11, 12, 13}) {
+    TestImage input;
+    input.xsize = 259;
+    input.ysize = 141;
+    GeneratePixels(&input);
+    CompressParams jparams;
+    jparams.progressive_mode = progr;
+    std::vector<uint8_t> compressed;
+    ASSERT_TRUE(EncodeWithJpegli(input, jparams, &compressed));
+    DecompressParams dparams;
+    TestImage output;
+    DecodeWithLibjpeg(jparams, dparams, compressed, &output);
+    VerifyOutputImage(input, output, 2.4f);
+  }
+}
+
+}  // namespace
+}  // namespace jpegli
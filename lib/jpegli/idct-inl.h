@@ -0,0 +1,324 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <cstddef>
+#include <cstdint>
+
+#include "lib/jpegli/common.h"
+#include "lib/jpegli/decode_internal.h"
+
+#if defined(JPEGLI_LIB_JPEGLI_IDCT_INL_H_) == defined(HWY_TARGET_TOGGLE)
+#ifdef JPEGLI_LIB_JPEGLI_IDCT_INL_H_
+#undef JPEGLI_LIB_JPEGLI_IDCT_INL_H_
+#else
+#define JPEGLI_LIB_JPEGLI_IDCT_INL_H_
+#endif
+
+#include <hwy/highway.h>
+
+#include "lib/base/compiler_specific.h"
+#include "lib/base/status.h"
+#include "lib/jpegli/transpose-inl.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jpegli {
+namespace HWY_NAMESPACE {
+namespace {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Abs;
+using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::Eq;
+using hwy::HWY_NAMESPACE::Gt;
+using hwy::HWY_NAMESPACE::IfThenElseZero;
+using hwy::HWY_NAMESPACE::IfThenZeroElse;
+using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
+using hwy::HWY_NAMESPACE::NegMulAdd;
+using hwy::HWY_NAMESPACE::Or;
+using hwy::HWY_NAMESPACE::Rebind;
+using hwy::HWY_NAMESPACE::Sub;
+using hwy::HWY_NAMESPACE::Vec;
+using hwy::HWY_NAMESPACE::Xor;
+
+using D = HWY_FULL(float);
+using DI = HWY_FULL(int32_t);
+constexpr D d;
+constexpr DI di;
+
+using D8 = HWY_CAPPED(float, 8);
+constexpr D8 d8;
+
+void DequantBlock(const int16_t* JPEGLI_RESTRICT qblock,
+                  const float* JPEGLI_RESTRICT dequant,
+                  const float* JPEGLI_RESTRICT biases,
+                  float* JPEGLI_RESTRICT block) {
+  for (size_t k = 0; k < 64; k += Lanes(d)) {
+    const auto mul = Load(d, dequant + k);
+    const auto bias = Load(d, biases + k);
+    const Rebind<int16_t, DI> di16;
+    const Vec<DI> quant_i = PromoteTo(di, Load(di16, qblock + k));
+    const Rebind<float, DI> df;
+    const auto quant = ConvertTo(df, quant_i);
+    const auto abs_quant = Abs(quant);
+    const auto not_0 = Gt(abs_quant, Zero(df));
+    const auto sign_quant = Xor(quant, abs_quant);
+    const auto biased_quant = Sub(quant, Xor(bias, sign_quant));
+    const auto deq = IfThenElseZero(not_0, Mul(biased_quant, mul));
+    Store(deq, d, block + k);
+  }
+}
+
+// The 1D IDCTs below transform strips of at most kLanes columns, which are
+// stored with a row stride of kLanes in the temporary buffers.
+template <size_t N, size_t kLanes>
+void ForwardEvenOdd(const float* JPEGLI_RESTRICT a_in, size_t a_in_stride,
+                    float* JPEGLI_RESTRICT a_out) {
+  const HWY_CAPPED(float, kLanes) dl;
+  for (size_t i = 0; i < N / 2; i++) {
+    auto in1 = LoadU(dl, a_in + 2 * i * a_in_stride);
+    Store(in1, dl, a_out + i * kLanes);
+  }
+  for (size_t i = N / 2; i < N; i++) {
+    auto in1 = LoadU(dl, a_in + (2 * (i - N / 2) + 1) * a_in_stride);
+    Store(in1, dl, a_out + i * kLanes);
+  }
+}
+
+template <size_t N, size_t kLanes>
+void BTranspose(float* JPEGLI_RESTRICT coeff) {
+  const HWY_CAPPED(float, kLanes) dl;
+  for (size_t i = N - 1; i > 0; i--) {
+    auto in1 = Load(dl, coeff + i * kLanes);
+    auto in2 = Load(dl, coeff + (i - 1) * kLanes);
+    Store(Add(in1, in2), dl, coeff + i * kLanes);
+  }
+  constexpr float kSqrt2 = 1.41421356237f;
+  auto sqrt2 = Set(dl, kSqrt2);
+  auto in1 = Load(dl, coeff);
+  Store(Mul(in1, sqrt2), dl, coeff);
+}
+
+// Constants for DCT implementation. Generated by the following snippet:
+// for i in range(N // 2):
+//    print(1.0 / (2 * math.cos((i + 0.5) * math.pi / N)), end=", ")
+template <size_t N>
+struct WcMultipliers;
+
+template <>
+struct WcMultipliers<4> {
+  static constexpr float kMultipliers[] = {
+      0.541196100146197,
+      1.3065629648763764,
+  };
+};
+
+template <>
+struct WcMultipliers<8> {
+  static constexpr float kMultipliers[] = {
+      0.5097955791041592,
+      0.6013448869350453,
+      0.8999762231364156,
+      2.5629154477415055,
+  };
+};
+
+#if JPEGLI_CXX_LANG < JPEGLI_CXX_17
+constexpr float WcMultipliers<4>::kMultipliers[];
+constexpr float WcMultipliers<8>::kMultipliers[];
+#endif
+
+template <size_t N, size_t kLanes>
+void MultiplyAndAdd(const float* JPEGLI_RESTRICT coeff,
+                    float* JPEGLI_RESTRICT out, size_t out_stride) {
+  const HWY_CAPPED(float, kLanes) dl;
+  for (size_t i = 0; i < N / 2; i++) {
+    auto mul = Set(dl, WcMultipliers<N>::kMultipliers[i]);
+    auto in1 = Load(dl, coeff + i * kLanes);
+    auto in2 = Load(dl, coeff + (N / 2 + i) * kLanes);
+    auto out1 = MulAdd(mul, in2, in1);
+    auto out2 = NegMulAdd(mul, in2, in1);
+    StoreU(out1, dl, out + i * out_stride);
+    StoreU(out2, dl, out + (N - i - 1) * out_stride);
+  }
+}
+
+template <size_t N, size_t kLanes>
+struct IDCT1DImpl;
+
+template <size_t kLanes>
+struct IDCT1DImpl<1, kLanes> {
+  JPEGLI_INLINE void operator()(const float* from, size_t from_stride,
+                                float* to, size_t to_stride) {
+    const HWY_CAPPED(float, kLanes) dl;
+    StoreU(LoadU(dl, from), dl, to);
+  }
+};
+
+template <size_t kLanes>
+struct IDCT1DImpl<2, kLanes> {
+  JPEGLI_INLINE void operator()(const float* from, size_t from_stride,
+                                float* to, size_t to_stride) {
+    JPEGLI_DASSERT(from_stride >= 8);
+    JPEGLI_DASSERT(to_stride >= 8);
+    const HWY_CAPPED(float, kLanes) dl;
+    auto in1 = LoadU(dl, from);
+    auto in2 = LoadU(dl, from + from_stride);
+    StoreU(Add(in1, in2), dl, to);
+    StoreU(Sub(in1, in2), dl, to + to_stride);
+  }
+};
+
+template <size_t N, size_t kLanes>
+struct IDCT1DImpl {
+  void operator()(const float* from, size_t from_stride, float* to,
+                  size_t to_stride) {
+    JPEGLI_DASSERT(from_stride >= 8);
+    JPEGLI_DASSERT(to_stride >= 8);
+    HWY_ALIGN float tmp[8 * kLanes];
+    ForwardEvenOdd<N, kLanes>(from, from_stride, tmp);
+    IDCT1DImpl<N / 2, kLanes>()(tmp, kLanes, tmp, kLanes);
+    BTranspose<N / 2, kLanes>(tmp + N / 2 * kLanes);
+    IDCT1DImpl<N / 2, kLanes>()(tmp + N / 2 * kLanes, kLanes,
+                                tmp + N / 2 * kLanes, kLanes);
+    MultiplyAndAdd<N, kLanes>(tmp, to, to_stride);
+  }
+};
+
+// Transforms the xsize columns of the N rows at from, xsize must be a multiple
+// of the vector size.
+template <size_t N, size_t kLanes>
+void IDCT1D(const float* JPEGLI_RESTRICT from, size_t from_stride,
+            size_t xsize, float* JPEGLI_RESTRICT output, size_t output_stride) {
+  const HWY_CAPPED(float, kLanes) dl;
+  for (size_t i = 0; i < xsize; i += Lanes(dl)) {
+    IDCT1DImpl<N, kLanes>()(from + i, from_stride, output + i, output_stride);
+  }
+}
+
+void ComputeScaledIDCT(float* JPEGLI_RESTRICT block0,
+                       float* JPEGLI_RESTRICT block1,
+                       float* JPEGLI_RESTRICT output, size_t output_stride) {
+  Transpose8x8Block(block0, block1);
+  IDCT1D<8, 8>(block1, 8, 8, block0, 8);
+  Transpose8x8Block(block0, block1);
+  IDCT1D<8, 8>(block1, 8, 8, output, output_stride);
+}
+
+void InverseTransformBlock8x8(const int16_t* JPEGLI_RESTRICT qblock,
+                              const float* JPEGLI_RESTRICT dequant,
+                              const float* JPEGLI_RESTRICT biases,
+                              float* JPEGLI_RESTRICT scratch_space,
+                              float* JPEGLI_RESTRICT output,
+                              size_t output_stride, size_t dctsize) {
+  float* JPEGLI_RESTRICT block0 = scratch_space;
+  float* JPEGLI_RESTRICT block1 = scratch_space + DCTSIZE2;
+  DequantBlock(qblock, dequant, biases, block0);
+  ComputeScaledIDCT(block0, block1, output, output_stride);
+}
+
+// Same as InverseTransformBlock8x8 for kIDCTBatchSize horizontally adjacent
+// blocks. The 1D IDCTs are done on rows spanning all blocks of the batch, so
+// vectors wider than a block row are fully used.
+void InverseTransformBatch8x8(const int16_t* JPEGLI_RESTRICT qblocks,
+                              const float* JPEGLI_RESTRICT dequant,
+                              const float* JPEGLI_RESTRICT biases,
+                              float* JPEGLI_RESTRICT scratch_space,
+                              float* JPEGLI_RESTRICT output,
+                              size_t output_stride) {
+  constexpr size_t kWidth = kIDCTBatchSize * DCTSIZE;
+  float* JPEGLI_RESTRICT blocks = scratch_space;
+  float* JPEGLI_RESTRICT rows0 = scratch_space + kIDCTBatchSize * DCTSIZE2;
+  float* JPEGLI_RESTRICT rows1 = scratch_space + 2 * kIDCTBatchSize * DCTSIZE2;
+  for (size_t b = 0; b < kIDCTBatchSize; ++b) {
+    float* JPEGLI_RESTRICT block = blocks + b * DCTSIZE2;
+    DequantBlock(qblocks + b * DCTSIZE2, dequant, biases, block);
+    Transpose8x8Block(block, DCTSIZE, rows0 + b * DCTSIZE, kWidth);
+  }
+  IDCT1D<8, 16>(rows0, kWidth, kWidth, rows1, kWidth);
+  for (size_t b = 0; b < kIDCTBatchSize; ++b) {
+    Transpose8x8Block(rows1 + b * DCTSIZE, kWidth, rows0 + b * DCTSIZE, kWidth);
+  }
+  IDCT1D<8, 16>(rows0, kWidth, kWidth, output, output_stride);
+}
+
+// Returns true if none of the num_blocks blocks has nonzero AC coefficients.
+bool HasOnlyDC(const int16_t* JPEGLI_RESTRICT qblocks, size_t num_blocks) {
+  const HWY_CAPPED(int16_t, DCTSIZE2) d16;
+  const auto dc_mask = FirstN(d16, 1);
+  auto ac = Zero(d16);
+  for (size_t b = 0; b < num_blocks; ++b) {
+    const int16_t* JPEGLI_RESTRICT qblock = qblocks + b * DCTSIZE2;
+    ac = Or(ac, IfThenZeroElse(dc_mask, LoadU(d16, qblock)));
+    for (size_t k = Lanes(d16); k < DCTSIZE2; k += Lanes(d16)) {
+      ac = Or(ac, LoadU(d16, qblock + k));
+    }
+  }
+  return AllTrue(d16, Eq(ac, Zero(d16)));
+}
+
+// Fills the output of a block with only a DC coefficient, which is what the
+// IDCT of such a block gives.
+void FillDCBlock(const int16_t* JPEGLI_RESTRICT qblock,
+                 const float* JPEGLI_RESTRICT dequant,
+                 const float* JPEGLI_RESTRICT biases,
+                 float* JPEGLI_RESTRICT output, size_t output_stride) {
+  const float quant = qblock[0];
+  float dc = 0.0f;
+  if (quant != 0.0f) {
+    // Same as the dequantization of DequantBlock.
+    dc = (quant - (quant > 0.0f ? biases[0] : -biases[0])) * dequant[0];
+  }
+  const auto value = Set(d8, dc);
+  for (size_t y = 0; y < DCTSIZE; ++y) {
+    for (size_t x = 0; x < DCTSIZE; x += Lanes(d8)) {
+      StoreU(value, d8, output + y * output_stride + x);
+    }
+  }
+}
+
+// Row variant of InverseTransformBlock8x8. The blocks are transformed in
+// batches, and batches without AC coefficients, common in smooth regions, are
+// filled with their DC values without any transform.
+void InverseTransformBlockRow8x8(const int16_t* JPEGLI_RESTRICT qblocks,
+                                 size_t num_blocks,
+                                 const float* JPEGLI_RESTRICT dequant,
+                                 const float* JPEGLI_RESTRICT biases,
+                                 float* JPEGLI_RESTRICT scratch_space,
+                                 float* JPEGLI_RESTRICT output,
+                                 size_t output_stride, size_t dctsize) {
+  size_t bx = 0;
+  for (; bx + kIDCTBatchSize <= num_blocks; bx += kIDCTBatchSize) {
+    const int16_t* JPEGLI_RESTRICT batch = qblocks + bx * DCTSIZE2;
+    float* JPEGLI_RESTRICT batch_out = output + bx * DCTSIZE;
+    if (HasOnlyDC(batch, kIDCTBatchSize)) {
+      for (size_t b = 0; b < kIDCTBatchSize; ++b) {
+        FillDCBlock(batch + b * DCTSIZE2, dequant, biases,
+                    batch_out + b * DCTSIZE, output_stride);
+      }
+    } else {
+      InverseTransformBatch8x8(batch, dequant, biases, scratch_space, batch_out,
+                               output_stride);
+    }
+  }
+  for (; bx < num_blocks; ++bx) {
+    const int16_t* JPEGLI_RESTRICT qblock = qblocks + bx * DCTSIZE2;
+    float* JPEGLI_RESTRICT block_out = output + bx * DCTSIZE;
+    if (HasOnlyDC(qblock, 1)) {
+      FillDCBlock(qblock, dequant, biases, block_out, output_stride);
+    } else {
+      InverseTransformBlock8x8(qblock, dequant, biases, scratch_space,
+                               block_out, output_stride, dctsize);
+    }
+  }
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace
+}  // namespace HWY_NAMESPACE
+}  // namespace jpegli
+HWY_AFTER_NAMESPACE();
+#endif  // JPEGLI_LIB_JPEGLI_IDCT_INL_H_
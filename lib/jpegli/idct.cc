@@ -7,6 +7,7 @@
 #include "lib/jpegli/idct.h"
 
 #include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 
@@ -20,188 +21,257 @@
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
 
-#include "lib/jpegli/transpose-inl.h"
+#include "lib/jpegli/idct-inl.h"
 
 HWY_BEFORE_NAMESPACE();
 namespace jpegli {
 namespace HWY_NAMESPACE {
 
 // These templates are not found via ADL.
-using hwy::HWY_NAMESPACE::Abs;
 using hwy::HWY_NAMESPACE::Add;
-using hwy::HWY_NAMESPACE::Gt;
-using hwy::HWY_NAMESPACE::IfThenElseZero;
+using hwy::HWY_NAMESPACE::Clamp;
 using hwy::HWY_NAMESPACE::Mul;
-using hwy::HWY_NAMESPACE::MulAdd;
-using hwy::HWY_NAMESPACE::NegMulAdd;
+using hwy::HWY_NAMESPACE::MulHigh;
 using hwy::HWY_NAMESPACE::Rebind;
+using hwy::HWY_NAMESPACE::ShiftLeft;
+using hwy::HWY_NAMESPACE::ShiftRight;
 using hwy::HWY_NAMESPACE::Sub;
 using hwy::HWY_NAMESPACE::Vec;
-using hwy::HWY_NAMESPACE::Xor;
 
-using D = HWY_FULL(float);
-using DI = HWY_FULL(int32_t);
-constexpr D d;
-constexpr DI di;
-
-using D8 = HWY_CAPPED(float, 8);
-constexpr D8 d8;
-
-void DequantBlock(const int16_t* JPEGLI_RESTRICT qblock,
-                  const float* JPEGLI_RESTRICT dequant,
-                  const float* JPEGLI_RESTRICT biases,
-                  float* JPEGLI_RESTRICT block) {
-  for (size_t k = 0; k < 64; k += Lanes(d)) {
-    const auto mul = Load(d, dequant + k);
-    const auto bias = Load(d, biases + k);
-    const Rebind<int16_t, DI> di16;
-    const Vec<DI> quant_i = PromoteTo(di, Load(di16, qblock + k));
-    const Rebind<float, DI> df;
-    const auto quant = ConvertTo(df, quant_i);
-    const auto abs_quant = Abs(quant);
-    const auto not_0 = Gt(abs_quant, Zero(df));
-    const auto sign_quant = Xor(quant, abs_quant);
-    const auto biased_quant = Sub(quant, Xor(bias, sign_quant));
-    const auto deq = IfThenElseZero(not_0, Mul(biased_quant, mul));
-    Store(deq, d, block + k);
-  }
+#if HWY_TARGET != HWY_SCALAR
+// Fixed-point multiplication by a constant given with 14 fractional bits, as
+// in the fixed-point forward DCT of the encoder.
+template <class V>
+JPEGLI_INLINE V MulFixed(V v, V c) {
+  return MulHigh(ShiftLeft<2>(v), c);
 }
 
-template <size_t N>
-void ForwardEvenOdd(const float* JPEGLI_RESTRICT a_in, size_t a_in_stride,
-                    float* JPEGLI_RESTRICT a_out) {
-  for (size_t i = 0; i < N / 2; i++) {
-    auto in1 = LoadU(d8, a_in + 2 * i * a_in_stride);
-    Store(in1, d8, a_out + i * 8);
-  }
-  for (size_t i = N / 2; i < N; i++) {
-    auto in1 = LoadU(d8, a_in + (2 * (i - N / 2) + 1) * a_in_stride);
-    Store(in1, d8, a_out + i * 8);
-  }
+// One pass of the scaled AAN IDCT of libjpeg's jidctfst.c, applied to every
+// lane of the eight rows. Input k is expected to be scaled by kAANScale[k].
+template <class DI16, class V = Vec<DI16>>
+JPEGLI_INLINE void FixedPointIDCT1D(DI16 d, V& v0, V& v1, V& v2, V& v3, V& v4,
+                                    V& v5, V& v6, V& v7) {
+  const V c1_082 = Set(d, 17734);    // 1.082392200
+  const V c1_414 = Set(d, 23170);    // 1.414213562
+  const V c1_847 = Set(d, 30274);    // 1.847759065
+  const V cm1_613 = Set(d, -26429);  // 1 - 2.613125930
+  // Even part.
+  const V tmp10 = Add(v0, v4);
+  const V tmp11 = Sub(v0, v4);
+  const V tmp13 = Add(v2, v6);
+  const V tmp12 = Sub(MulFixed(Sub(v2, v6), c1_414), tmp13);
+  const V even0 = Add(tmp10, tmp13);
+  const V even3 = Sub(tmp10, tmp13);
+  const V even1 = Add(tmp11, tmp12);
+  const V even2 = Sub(tmp11, tmp12);
+  // Odd part.
+  const V z13 = Add(v5, v3);
+  const V z10 = Sub(v5, v3);
+  const V z11 = Add(v1, v7);
+  const V z12 = Sub(v1, v7);
+  const V odd7 = Add(z11, z13);
+  const V odd11 = MulFixed(Sub(z11, z13), c1_414);
+  const V z5 = MulFixed(Add(z10, z12), c1_847);
+  const V odd10 = Sub(MulFixed(z12, c1_082), z5);
+  const V odd12 = Sub(Add(MulFixed(z10, cm1_613), z5), z10);
+  const V odd6 = Sub(odd12, odd7);
+  const V odd5 = Sub(odd11, odd6);
+  const V odd4 = Add(odd10, odd5);
+  v0 = Add(even0, odd7);
+  v7 = Sub(even0, odd7);
+  v1 = Add(even1, odd6);
+  v6 = Sub(even1, odd6);
+  v2 = Add(even2, odd5);
+  v5 = Sub(even2, odd5);
+  v4 = Add(even3, odd4);
+  v3 = Sub(even3, odd4);
 }
 
-template <size_t N>
-void BTranspose(float* JPEGLI_RESTRICT coeff) {
-  for (size_t i = N - 1; i > 0; i--) {
-    auto in1 = Load(d8, coeff + i * 8);
-    auto in2 = Load(d8, coeff + (i - 1) * 8);
-    Store(Add(in1, in2), d8, coeff + i * 8);
-  }
-  constexpr float kSqrt2 = 1.41421356237f;
-  auto sqrt2 = Set(d8, kSqrt2);
-  auto in1 = Load(d8, coeff);
-  Store(Mul(in1, sqrt2), d8, coeff);
+// Descales the output of the two passes by the 3 bits of the 2D transform and
+// the 2 extra bits of precision, and range-limits it to centered 8-bit samples.
+template <class DI16, class V = Vec<DI16>>
+JPEGLI_INLINE V FixedPointDescale(DI16 d, V v) {
+  return Clamp(ShiftRight<5>(SaturatedAdd(v, Set(d, 16))), Set(d, -128),
+               Set(d, 127));
 }
 
-// Constants for DCT implementation. Generated by the following snippet:
-// for i in range(N // 2):
-//    print(1.0 / (2 * math.cos((i + 0.5) * math.pi / N)), end=", ")
-template <size_t N>
-struct WcMultipliers;
-
-template <>
-struct WcMultipliers<4> {
-  static constexpr float kMultipliers[] = {
-      0.541196100146197,
-      1.3065629648763764,
-  };
+// kAANScale[k] = sqrt(2) * cos(k * pi / 16) for k > 0.
+constexpr float kAANScale[DCTSIZE] = {
+    1.0f,        1.38703985f, 1.30656296f, 1.17587560f,
+    1.0f,        0.78569496f, 0.54119610f, 0.27589938f,
 };
 
-template <>
-struct WcMultipliers<8> {
-  static constexpr float kMultipliers[] = {
-      0.5097955791041592,
-      0.6013448869350453,
-      0.8999762231364156,
-      2.5629154477415055,
-  };
-};
-
-#if JPEGLI_CXX_LANG < JPEGLI_CXX_17
-constexpr float WcMultipliers<4>::kMultipliers[];
-constexpr float WcMultipliers<8>::kMultipliers[];
+// The dequantization factors are relative to the [-0.5, 0.5] float sample
+// range, the fixed-point IDCT works with 8-bit block and 2 extra bits of
+// precision in the first pass, as jidctfst.c does.
+constexpr float kFixedPointScale = 8 * 255 * 4;
 #endif
 
-template <size_t N>
-void MultiplyAndAdd(const float* JPEGLI_RESTRICT coeff,
-                    float* JPEGLI_RESTRICT out, size_t out_stride) {
-  for (size_t i = 0; i < N / 2; i++) {
-    auto mul = Set(d8, WcMultipliers<N>::kMultipliers[i]);
-    auto in1 = Load(d8, coeff + i * 8);
-    auto in2 = Load(d8, coeff + (N / 2 + i) * 8);
-    auto out1 = MulAdd(mul, in2, in1);
-    auto out2 = NegMulAdd(mul, in2, in1);
-    StoreU(out1, d8, out + i * out_stride);
-    StoreU(out2, d8, out + (N - i - 1) * out_stride);
-  }
+#if HWY_TARGET != HWY_SCALAR
+// The fixed-point IDCT needs vectors of at least eight 16-bit lanes.
+HWY_INLINE bool HasFixedPointLanes() {
+  const HWY_CAPPED(int16_t, 8) d16;
+  return Lanes(d16) >= DCTSIZE;
 }
 
-template <size_t N>
-struct IDCT1DImpl;
-
-template <>
-struct IDCT1DImpl<1> {
-  JPEGLI_INLINE void operator()(const float* from, size_t from_stride,
-                                float* to, size_t to_stride) {
-    StoreU(LoadU(d8, from), d8, to);
-  }
-};
-
-template <>
-struct IDCT1DImpl<2> {
-  JPEGLI_INLINE void operator()(const float* from, size_t from_stride,
-                                float* to, size_t to_stride) {
-    JPEGLI_DASSERT(from_stride >= 8);
-    JPEGLI_DASSERT(to_stride >= 8);
-    auto in1 = LoadU(d8, from);
-    auto in2 = LoadU(d8, from + from_stride);
-    StoreU(Add(in1, in2), d8, to);
-    StoreU(Sub(in1, in2), d8, to + to_stride);
+// Transforms the block with the fast integer IDCT of libjpeg, after
+// dequantizing it to 16-bit integers, and stores the rounded and range-limited
+// samples to output as centered 8-bit samples. The dequantization biases are
+// not applied.
+void FixedPointTransform(const int16_t* JPEGLI_RESTRICT qblock,
+                         const float* JPEGLI_RESTRICT dequant,
+                         int16_t* JPEGLI_RESTRICT output,
+                         size_t output_stride) {
+  const HWY_CAPPED(int16_t, 8) d16;
+  const Rebind<int32_t, D8> di32;
+  const Rebind<int16_t, D8> dh;
+  HWY_ALIGN int16_t block[DCTSIZE2];
+  const auto min_coeff = Set(d8, -32768.0f);
+  const auto max_coeff = Set(d8, 32767.0f);
+  for (size_t y = 0; y < DCTSIZE; ++y) {
+    const auto row_scale = Set(d8, kAANScale[y] * kFixedPointScale);
+    for (size_t x = 0; x < DCTSIZE; x += Lanes(d8)) {
+      const size_t k = y * DCTSIZE + x;
+      const auto quant_i = PromoteTo(di32, Load(dh, qblock + k));
+      const auto quant = ConvertTo(d8, quant_i);
+      const auto scale = Mul(LoadU(d8, kAANScale + x), row_scale);
+      const auto deq = Mul(quant, Mul(Load(d8, dequant + k), scale));
+      const auto ideq = NearestInt(Clamp(deq, min_coeff, max_coeff));
+      Store(DemoteTo(dh, ideq), dh, block + k);
+    }
   }
-};
+  auto v0 = Load(d16, block + 0 * DCTSIZE);
+  auto v1 = Load(d16, block + 1 * DCTSIZE);
+  auto v2 = Load(d16, block + 2 * DCTSIZE);
+  auto v3 = Load(d16, block + 3 * DCTSIZE);
+  auto v4 = Load(d16, block + 4 * DCTSIZE);
+  auto v5 = Load(d16, block + 5 * DCTSIZE);
+  auto v6 = Load(d16, block + 6 * DCTSIZE);
+  auto v7 = Load(d16, block + 7 * DCTSIZE);
+  FixedPointIDCT1D(d16, v0, v1, v2, v3, v4, v5, v6, v7);
+  Transpose8x8I16(d16, v0, v1, v2, v3, v4, v5, v6, v7);
+  FixedPointIDCT1D(d16, v0, v1, v2, v3, v4, v5, v6, v7);
+  Transpose8x8I16(d16, v0, v1, v2, v3, v4, v5, v6, v7);
+  StoreU(FixedPointDescale(d16, v0), d16, output + 0 * output_stride);
+  StoreU(FixedPointDescale(d16, v1), d16, output + 1 * output_stride);
+  StoreU(FixedPointDescale(d16, v2), d16, output + 2 * output_stride);
+  StoreU(FixedPointDescale(d16, v3), d16, output + 3 * output_stride);
+  StoreU(FixedPointDescale(d16, v4), d16, output + 4 * output_stride);
+  StoreU(FixedPointDescale(d16, v5), d16, output + 5 * output_stride);
+  StoreU(FixedPointDescale(d16, v6), d16, output + 6 * output_stride);
+  StoreU(FixedPointDescale(d16, v7), d16, output + 7 * output_stride);
+}
 
-template <size_t N>
-struct IDCT1DImpl {
-  void operator()(const float* from, size_t from_stride, float* to,
-                  size_t to_stride) {
-    JPEGLI_DASSERT(from_stride >= 8);
-    JPEGLI_DASSERT(to_stride >= 8);
-    HWY_ALIGN float tmp[64];
-    ForwardEvenOdd<N>(from, from_stride, tmp);
-    IDCT1DImpl<N / 2>()(tmp, 8, tmp, 8);
-    BTranspose<N / 2>(tmp + N * 4);
-    IDCT1DImpl<N / 2>()(tmp + N * 4, 8, tmp + N * 4, 8);
-    MultiplyAndAdd<N>(tmp, to, to_stride);
-  }
-};
+// Returns the sample that FixedPointTransform gives for every pixel of a block
+// with only a DC coefficient, since both passes of the transform leave the DC
+// value in every sample.
+int16_t FixedPointDCSample(const int16_t* JPEGLI_RESTRICT qblock,
+                           const float* JPEGLI_RESTRICT dequant) {
+  const HWY_CAPPED(int16_t, 8) d16;
+  const Rebind<int16_t, D8> dh;
+  // Same as the dequantization of FixedPointTransform, where kAANScale[0] is 1.
+  const auto scale = Set(d8, kFixedPointScale);
+  const auto deq = Mul(Set(d8, qblock[0]), Mul(Set(d8, dequant[0]), scale));
+  const auto ideq =
+      NearestInt(Clamp(deq, Set(d8, -32768.0f), Set(d8, 32767.0f)));
+  const int16_t dc = GetLane(DemoteTo(dh, ideq));
+  return GetLane(FixedPointDescale(d16, Set(d16, dc)));
+}
+#endif
 
-template <size_t N>
-void IDCT1D(float* JPEGLI_RESTRICT from, float* JPEGLI_RESTRICT output,
-            size_t output_stride) {
-  for (size_t i = 0; i < 8; i += Lanes(d8)) {
-    IDCT1DImpl<N>()(from + i, 8, output + i, output_stride);
+// Fixed-point variant of InverseTransformBlock8x8 for JDCT_IFAST. The samples
+// of FixedPointTransform are stored with the same scaling as that of
+// InverseTransformBlock8x8.
+void InverseTransformBlockFixedPoint(const int16_t* JPEGLI_RESTRICT qblock,
+                                     const float* JPEGLI_RESTRICT dequant,
+                                     const float* JPEGLI_RESTRICT biases,
+                                     float* JPEGLI_RESTRICT scratch_space,
+                                     float* JPEGLI_RESTRICT output,
+                                     size_t output_stride, size_t dctsize) {
+#if HWY_TARGET != HWY_SCALAR
+  if (HasFixedPointLanes()) {
+    const Rebind<int32_t, D8> di32;
+    const Rebind<int16_t, D8> dh;
+    HWY_ALIGN int16_t block[DCTSIZE2];
+    FixedPointTransform(qblock, dequant, block, DCTSIZE);
+    const auto mul = Set(d8, 1.0f / 255);
+    for (size_t y = 0; y < DCTSIZE; ++y) {
+      for (size_t x = 0; x < DCTSIZE; x += Lanes(d8)) {
+        const auto iv = PromoteTo(di32, Load(dh, block + y * DCTSIZE + x));
+        const auto sample = Mul(ConvertTo(d8, iv), mul);
+        StoreU(sample, d8, output + y * output_stride + x);
+      }
+    }
+    return;
   }
+#endif
+  // The biases are all zero when this transform is used.
+  InverseTransformBlock8x8(qblock, dequant, biases, scratch_space, output,
+                           output_stride, dctsize);
 }
 
-void ComputeScaledIDCT(float* JPEGLI_RESTRICT block0,
-                       float* JPEGLI_RESTRICT block1,
-                       float* JPEGLI_RESTRICT output, size_t output_stride) {
-  Transpose8x8Block(block0, block1);
-  IDCT1D<8>(block1, block0, 8);
-  Transpose8x8Block(block0, block1);
-  IDCT1D<8>(block1, output, output_stride);
+// Fixed-point variant of FillDCBlock, the output is the same as that of
+// InverseTransformBlockFixedPoint for a block with only a DC coefficient.
+void FillDCBlockFixedPoint(const int16_t* JPEGLI_RESTRICT qblock,
+                           const float* JPEGLI_RESTRICT dequant,
+                           const float* JPEGLI_RESTRICT biases,
+                           float* JPEGLI_RESTRICT output,
+                           size_t output_stride) {
+#if HWY_TARGET != HWY_SCALAR
+  if (HasFixedPointLanes()) {
+    const float sample = FixedPointDCSample(qblock, dequant);
+    const auto value = Mul(Set(d8, sample), Set(d8, 1.0f / 255));
+    for (size_t y = 0; y < DCTSIZE; ++y) {
+      for (size_t x = 0; x < DCTSIZE; x += Lanes(d8)) {
+        StoreU(value, d8, output + y * output_stride + x);
+      }
+    }
+    return;
+  }
+#endif
+  // Same fallback as that of InverseTransformBlockFixedPoint.
+  FillDCBlock(qblock, dequant, biases, output, output_stride);
 }
 
-void InverseTransformBlock8x8(const int16_t* JPEGLI_RESTRICT qblock,
-                              const float* JPEGLI_RESTRICT dequant,
-                              const float* JPEGLI_RESTRICT biases,
-                              float* JPEGLI_RESTRICT scratch_space,
-                              float* JPEGLI_RESTRICT output,
-                              size_t output_stride, size_t dctsize) {
-  float* JPEGLI_RESTRICT block0 = scratch_space;
-  float* JPEGLI_RESTRICT block1 = scratch_space + DCTSIZE2;
-  DequantBlock(qblock, dequant, biases, block0);
-  ComputeScaledIDCT(block0, block1, output, output_stride);
+// Same as InverseTransformBlockRowFixedPoint, but the centered 8-bit samples
+// are stored as 16-bit integers, for the fixed-point render path.
+void InverseTransformBlockRowFixedPointI16(
+    const int16_t* JPEGLI_RESTRICT qblocks, size_t num_blocks,
+    const float* JPEGLI_RESTRICT dequant, const float* JPEGLI_RESTRICT biases,
+    float* JPEGLI_RESTRICT scratch_space, int16_t* JPEGLI_RESTRICT output,
+    size_t output_stride) {
+#if HWY_TARGET != HWY_SCALAR
+  if (HasFixedPointLanes()) {
+    const HWY_CAPPED(int16_t, 8) d16;
+    for (size_t bx = 0; bx < num_blocks; ++bx) {
+      const int16_t* JPEGLI_RESTRICT qblock = qblocks + bx * DCTSIZE2;
+      int16_t* JPEGLI_RESTRICT block_out = output + bx * DCTSIZE;
+      if (HasOnlyDC(qblock, 1)) {
+        const auto value = Set(d16, FixedPointDCSample(qblock, dequant));
+        for (size_t y = 0; y < DCTSIZE; ++y) {
+          StoreU(value, d16, block_out + y * output_stride);
+        }
+      } else {
+        FixedPointTransform(qblock, dequant, block_out, output_stride);
+      }
+    }
+    return;
+  }
+#endif
+  // Without the fixed-point transform, the samples of the float transform are
+  // rounded to 8 bits.
+  float* JPEGLI_RESTRICT block = scratch_space + 2 * DCTSIZE2;
+  for (size_t bx = 0; bx < num_blocks; ++bx) {
+    InverseTransformBlock8x8(qblocks + bx * DCTSIZE2, dequant, biases,
+                             scratch_space, block, DCTSIZE, DCTSIZE);
+    for (size_t y = 0; y < DCTSIZE; ++y) {
+      int16_t* JPEGLI_RESTRICT row = output + y * output_stride + bx * DCTSIZE;
+      for (size_t x = 0; x < DCTSIZE; ++x) {
+        const float v = std::round(block[y * DCTSIZE + x] * 255.0f);
+        row[x] = static_cast<int16_t>(std::min(127.0f, std::max(-128.0f, v)));
+      }
+    }
+  }
 }
 
 // Computes the N-point IDCT of in[], and stores the result in out[]. The in[]
@@ -677,6 +747,51 @@ void InverseTransformBlockGeneric(const int16_t* JPEGLI_RESTRICT qblock,
   }
 }
 
+// Row variant of the single-block transforms that have no batched version.
+template <void (*Transform)(const int16_t*, const float*, const float*, float*,
+                            float*, size_t, size_t)>
+void InverseTransformBlocks(const int16_t* JPEGLI_RESTRICT qblocks,
+                            size_t num_blocks,
+                            const float* JPEGLI_RESTRICT dequant,
+                            const float* JPEGLI_RESTRICT biases,
+                            float* JPEGLI_RESTRICT scratch_space,
+                            float* JPEGLI_RESTRICT output,
+                            size_t output_stride, size_t dctsize) {
+  for (size_t bx = 0; bx < num_blocks; ++bx) {
+    Transform(qblocks + bx * DCTSIZE2, dequant, biases, scratch_space,
+              output + bx * dctsize, output_stride, dctsize);
+  }
+}
+
+// Row variant of InverseTransformBlockFixedPoint. As in the IDCT of libjpeg,
+// blocks without AC coefficients skip the transform.
+void InverseTransformBlockRowFixedPoint(
+    const int16_t* JPEGLI_RESTRICT qblocks, size_t num_blocks,
+    const float* JPEGLI_RESTRICT dequant, const float* JPEGLI_RESTRICT biases,
+    float* JPEGLI_RESTRICT scratch_space, float* JPEGLI_RESTRICT output,
+    size_t output_stride, size_t dctsize) {
+  for (size_t bx = 0; bx < num_blocks; ++bx) {
+    const int16_t* JPEGLI_RESTRICT qblock = qblocks + bx * DCTSIZE2;
+    float* JPEGLI_RESTRICT block_out = output + bx * DCTSIZE;
+    if (HasOnlyDC(qblock, 1)) {
+      FillDCBlockFixedPoint(qblock, dequant, biases, block_out, output_stride);
+    } else {
+      InverseTransformBlockFixedPoint(qblock, dequant, biases, scratch_space,
+                                      block_out, output_stride, dctsize);
+    }
+  }
+}
+
+void InverseTransformBlockRowGeneric(
+    const int16_t* JPEGLI_RESTRICT qblocks, size_t num_blocks,
+    const float* JPEGLI_RESTRICT dequant, const float* JPEGLI_RESTRICT biases,
+    float* JPEGLI_RESTRICT scratch_space, float* JPEGLI_RESTRICT output,
+    size_t output_stride, size_t dctsize) {
+  InverseTransformBlocks<InverseTransformBlockGeneric>(
+      qblocks, num_blocks, dequant, biases, scratch_space, output,
+      output_stride, dctsize);
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jpegli
@@ -686,20 +801,53 @@ HWY_AFTER_NAMESPACE();
 namespace jpegli {
 
 HWY_EXPORT(InverseTransformBlock8x8);
+HWY_EXPORT(InverseTransformBlockFixedPoint);
 HWY_EXPORT(InverseTransformBlockGeneric);
+HWY_EXPORT(InverseTransformBlockRow8x8);
+HWY_EXPORT(InverseTransformBlockRowFixedPoint);
+HWY_EXPORT(InverseTransformBlockRowFixedPointI16);
+HWY_EXPORT(InverseTransformBlockRowGeneric);
+
+void InverseTransformBlockRowFixedPointI16(
+    const int16_t* JPEGLI_RESTRICT qblocks, size_t num_blocks,
+    const float* JPEGLI_RESTRICT dequant, const float* JPEGLI_RESTRICT biases,
+    float* JPEGLI_RESTRICT scratch_space, int16_t* JPEGLI_RESTRICT output,
+    size_t output_stride) {
+  HWY_DYNAMIC_DISPATCH(InverseTransformBlockRowFixedPointI16)
+  (qblocks, num_blocks, dequant, biases, scratch_space, output, output_stride);
+}
 
 jpegli::Status ChooseInverseTransform(j_decompress_ptr cinfo) {
   jpeg_decomp_master* m = cinfo->master;
+  // The fixed-point IDCT rounds the samples to 8 bits, so it is used only for
+  // 8-bit output and unscaled blocks, and not together with block smoothing.
+  m->fixed_point_idct = (cinfo->dct_method == JDCT_IFAST &&
+                         m->output_data_type_ == JPEGLI_TYPE_UINT8 &&
+                         !m->apply_smoothing);
+  for (int c = 0; c < cinfo->num_components; ++c) {
+    if (m->scaled_dct_size[c] != DCTSIZE) {
+      m->fixed_point_idct = false;
+    }
+  }
   for (int c = 0; c < cinfo->num_components; ++c) {
     int dct_size = m->scaled_dct_size[c];
     if (dct_size < 1 || dct_size > 16) {
       return JPEGLI_FAILURE("Compute1dIDCT does not support N=%d", dct_size);
     }
-    if (dct_size == DCTSIZE) {
+    if (m->fixed_point_idct) {
+      m->inverse_transform[c] =
+          HWY_DYNAMIC_DISPATCH(InverseTransformBlockFixedPoint);
+      m->inverse_transform_row[c] =
+          HWY_DYNAMIC_DISPATCH(InverseTransformBlockRowFixedPoint);
+    } else if (dct_size == DCTSIZE) {
       m->inverse_transform[c] = HWY_DYNAMIC_DISPATCH(InverseTransformBlock8x8);
+      m->inverse_transform_row[c] =
+          HWY_DYNAMIC_DISPATCH(InverseTransformBlockRow8x8);
     } else {
       m->inverse_transform[c] =
           HWY_DYNAMIC_DISPATCH(InverseTransformBlockGeneric);
+      m->inverse_transform_row[c] =
+          HWY_DYNAMIC_DISPATCH(InverseTransformBlockRowGeneric);
     }
   }
   return true;
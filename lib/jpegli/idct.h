@@ -7,6 +7,10 @@
 #ifndef JPEGLI_LIB_JPEGLI_IDCT_H_
 #define JPEGLI_LIB_JPEGLI_IDCT_H_
 
+#include <cstddef>
+#include <cstdint>
+
+#include "lib/base/compiler_specific.h"
 #include "lib/base/status.h"
 #include "lib/jpegli/common.h"
 
@@ -14,6 +18,15 @@ namespace jpegli {
 
 jpegli::Status ChooseInverseTransform(j_decompress_ptr cinfo);
 
+// Transforms num_blocks horizontally adjacent blocks with the fixed-point IDCT
+// of JDCT_IFAST, and stores the centered 8-bit samples as 16-bit integers, for
+// the fixed-point render path.
+void InverseTransformBlockRowFixedPointI16(
+    const int16_t* JPEGLI_RESTRICT qblocks, size_t num_blocks,
+    const float* JPEGLI_RESTRICT dequant, const float* JPEGLI_RESTRICT biases,
+    float* JPEGLI_RESTRICT scratch_space, int16_t* JPEGLI_RESTRICT output,
+    size_t output_stride);
+
 }  // namespace jpegli
 
 #endif  // JPEGLI_LIB_JPEGLI_IDCT_H_
@@ -0,0 +1,171 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <cstddef>
+#include <cstdint>
+
+#include "lib/base/random.h"
+#include "lib/jpegli/common.h"
+#include "lib/jpegli/decode_internal.h"
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jpegli/idct_test.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+#include <hwy/tests/hwy_gtest.h>
+
+#include "lib/jpegli/idct-inl.h"
+#include "lib/jpegli/testing.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jpegli {
+namespace HWY_NAMESPACE {
+namespace {
+
+// Enough blocks for two full batches and a partial last batch.
+constexpr size_t kNumBlocks = 2 * kIDCTBatchSize + 3;
+// Wider than the row of blocks, so that the output rows are not contiguous.
+constexpr size_t kStride = kNumBlocks * DCTSIZE + 16;
+
+// Fills the quantization tables with the ranges of a typical decoder setup.
+void GenerateTables(Rng* rng, float* dequant, float* biases) {
+  for (size_t k = 0; k < DCTSIZE2; ++k) {
+    dequant[k] = rng->UniformF(0.5f, 40.0f) / (8 * 255);
+    biases[k] = k == 0 ? 0.0f : rng->UniformF(0.0f, 0.5f);
+  }
+}
+
+// Fills a block with random coefficients, of which only the DC is nonzero if
+// dc_only is true.
+void GenerateBlock(Rng* rng, bool dc_only, int16_t* qblock) {
+  qblock[0] = rng->UniformI(-1024, 1024);
+  for (size_t k = 1; k < DCTSIZE2; ++k) {
+    qblock[k] = (dc_only || rng->Bernoulli(0.7f)) ? 0 : rng->UniformI(-64, 64);
+  }
+}
+
+// Transforms the blocks one by one with InverseTransformBlock8x8.
+void ReferenceBlockRow(const int16_t* qblocks, size_t num_blocks,
+                       const float* dequant, const float* biases,
+                       float* scratch_space, float* output) {
+  for (size_t bx = 0; bx < num_blocks; ++bx) {
+    InverseTransformBlock8x8(qblocks + bx * DCTSIZE2, dequant, biases,
+                             scratch_space, output + bx * DCTSIZE, kStride,
+                             DCTSIZE);
+  }
+}
+
+void ExpectSameOutput(const float* expected, const float* actual,
+                      size_t num_blocks, size_t iter) {
+  for (size_t y = 0; y < DCTSIZE; ++y) {
+    for (size_t x = 0; x < num_blocks * DCTSIZE; ++x) {
+      const size_t i = y * kStride + x;
+      ASSERT_EQ(expected[i], actual[i])
+          << "iter = " << iter << " block = " << x / DCTSIZE << " y = " << y
+          << " x = " << x % DCTSIZE;
+    }
+  }
+}
+
+HWY_NOINLINE void TestBatchedInverseTransform() {
+  HWY_ALIGN int16_t qblocks[kIDCTBatchSize * DCTSIZE2];
+  HWY_ALIGN float dequant[DCTSIZE2];
+  HWY_ALIGN float biases[DCTSIZE2];
+  HWY_ALIGN float expected[DCTSIZE * kStride];
+  HWY_ALIGN float actual[DCTSIZE * kStride];
+  HWY_ALIGN float scratch_space[3 * kIDCTBatchSize * DCTSIZE2];
+  Rng rng(1);
+  for (size_t iter = 0; iter < 20; ++iter) {
+    GenerateTables(&rng, dequant, biases);
+    for (size_t b = 0; b < kIDCTBatchSize; ++b) {
+      GenerateBlock(&rng, /*dc_only=*/false, qblocks + b * DCTSIZE2);
+    }
+    ReferenceBlockRow(qblocks, kIDCTBatchSize, dequant, biases, scratch_space,
+                      expected);
+    InverseTransformBatch8x8(qblocks, dequant, biases, scratch_space, actual,
+                             kStride);
+    ExpectSameOutput(expected, actual, kIDCTBatchSize, iter);
+  }
+}
+
+HWY_NOINLINE void TestHasOnlyDC() {
+  HWY_ALIGN int16_t qblocks[kIDCTBatchSize * DCTSIZE2];
+  Rng rng(1);
+  for (size_t b = 0; b < kIDCTBatchSize; ++b) {
+    GenerateBlock(&rng, /*dc_only=*/true, qblocks + b * DCTSIZE2);
+  }
+  EXPECT_TRUE(HasOnlyDC(qblocks, kIDCTBatchSize));
+  // A single nonzero AC coefficient anywhere in the batch is found.
+  for (size_t b = 0; b < kIDCTBatchSize; ++b) {
+    for (size_t k = 1; k < DCTSIZE2; ++k) {
+      int16_t* coeff = qblocks + b * DCTSIZE2 + k;
+      *coeff = (k % 2) ? 1 : -1;
+      EXPECT_FALSE(HasOnlyDC(qblocks, kIDCTBatchSize))
+          << "block = " << b << " k = " << k;
+      if (b == 0) {
+        EXPECT_FALSE(HasOnlyDC(qblocks, 1)) << "k = " << k;
+      } else {
+        EXPECT_TRUE(HasOnlyDC(qblocks, 1)) << "block = " << b << " k = " << k;
+      }
+      *coeff = 0;
+    }
+  }
+}
+
+HWY_NOINLINE void TestInverseTransformBlockRow() {
+  HWY_ALIGN int16_t qblocks[kNumBlocks * DCTSIZE2];
+  HWY_ALIGN float dequant[DCTSIZE2];
+  HWY_ALIGN float biases[DCTSIZE2];
+  HWY_ALIGN float expected[DCTSIZE * kStride];
+  HWY_ALIGN float actual[DCTSIZE * kStride];
+  HWY_ALIGN float scratch_space[3 * kIDCTBatchSize * DCTSIZE2];
+  Rng rng(1);
+  for (size_t iter = 0; iter < 40; ++iter) {
+    GenerateTables(&rng, dequant, biases);
+    // The first batch has only DC blocks, the second one has DC-only and
+    // other blocks mixed, and each of the blocks of the partial last batch is
+    // DC-only or not at random.
+    for (size_t bx = 0; bx < kNumBlocks; ++bx) {
+      bool dc_only;
+      if (bx < kIDCTBatchSize) {
+        dc_only = true;
+      } else if (bx < 2 * kIDCTBatchSize) {
+        dc_only = (bx % 2 == 1);
+      } else {
+        dc_only = rng.Bernoulli(0.5f);
+      }
+      GenerateBlock(&rng, dc_only, qblocks + bx * DCTSIZE2);
+    }
+    // All the row lengths, so that every position of the partial batch is
+    // covered.
+    for (size_t num_blocks = 1; num_blocks <= kNumBlocks; ++num_blocks) {
+      ReferenceBlockRow(qblocks, num_blocks, dequant, biases, scratch_space,
+                        expected);
+      InverseTransformBlockRow8x8(qblocks, num_blocks, dequant, biases,
+                                  scratch_space, actual, kStride, DCTSIZE);
+      ExpectSameOutput(expected, actual, num_blocks, iter);
+    }
+  }
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace
+}  // namespace HWY_NAMESPACE
+}  // namespace jpegli
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jpegli {
+
+class IDCTTargetTest : public hwy::TestWithParamTarget {};
+HWY_TARGET_INSTANTIATE_TEST_SUITE_P(IDCTTargetTest);
+
+HWY_EXPORT_AND_TEST_P(IDCTTargetTest, TestBatchedInverseTransform);
+HWY_EXPORT_AND_TEST_P(IDCTTargetTest, TestHasOnlyDC);
+HWY_EXPORT_AND_TEST_P(IDCTTargetTest, TestInverseTransformBlockRow);
+
+}  // namespace jpegli
+#endif  // HWY_ONCE
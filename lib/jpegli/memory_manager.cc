@@ -187,4 +187,10 @@ void InitMemoryManager(j_common_ptr cinfo) {
   cinfo->mem = reinterpret_cast<struct jpeg_memory_mgr*>(mem);
 }
 
+size_t GetPeakMemoryUsage(j_common_ptr cinfo) {
+  if (cinfo->mem == nullptr) return 0;
+  MemoryManager* mem = reinterpret_cast<MemoryManager*>(cinfo->mem);
+  return mem->peak_memory_usage;
+}
+
 }  // namespace jpegli
@@ -18,6 +18,9 @@ namespace jpegli {
 
 void InitMemoryManager(j_common_ptr cinfo);
 
+// Returns the peak number of bytes allocated since InitMemoryManager().
+size_t GetPeakMemoryUsage(j_common_ptr cinfo);
+
 template <typename T>
 T* Allocate(j_common_ptr cinfo, size_t len, int pool_id = JPOOL_PERMANENT) {
   const size_t size = len * sizeof(T);  // NOLINT
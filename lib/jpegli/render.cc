@@ -24,6 +24,7 @@
 #include "lib/jpegli/decode_internal.h"
 #include "lib/jpegli/error.h"
 #include "lib/jpegli/idct.h"
+#include "lib/jpegli/stats.h"
 #include "lib/jpegli/types.h"
 #include "lib/jpegli/upsample.h"
 
@@ -59,6 +60,8 @@ using hwy::HWY_NAMESPACE::Clamp;
 using hwy::HWY_NAMESPACE::Gt;
 using hwy::HWY_NAMESPACE::IfThenElseZero;
 using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
+using hwy::HWY_NAMESPACE::MulFixedPoint15;
 using hwy::HWY_NAMESPACE::NearestInt;
 using hwy::HWY_NAMESPACE::Or;
 using hwy::HWY_NAMESPACE::Rebind;
@@ -281,6 +284,329 @@ void WriteToOutput(j_decompress_ptr cinfo, float* JPEGLI_RESTRICT rows[],
   }
 }
 
+// Converts decentered samples to the output sample type.
+template <typename T>
+struct OutputSample {
+  static constexpr float kMultiplier = sizeof(T) == 1 ? 255.0f : 65535.0f;
+  template <class DF>
+  static HWY_INLINE Vec<Rebind<T, DF>> Convert(DF df, Vec<DF> v, Vec<DF> mul) {
+    const Rebind<T, DF> du;
+    return DemoteTo(du, NearestInt(Clamp(Zero(df), Mul(v, mul), mul)));
+  }
+};
+
+template <>
+struct OutputSample<float> {
+  static constexpr float kMultiplier = 1.0f;
+  template <class DF>
+  static HWY_INLINE Vec<DF> Convert(DF /* df */, Vec<DF> v,
+                                   Vec<DF> /* mul */) {
+    return v;
+  }
+};
+
+// Source of an output channel: the index of a (color converted) plane, or
+// kFusedAlpha for an opaque alpha channel.
+constexpr int kFusedAlpha = -1;
+
+template <int kSource, class V>
+HWY_INLINE V SelectChannel(V v0, V v1, V v2, V v3, V alpha) {
+  if (kSource == 0) return v0;
+  if (kSource == 1) return v1;
+  if (kSource == 2) return v2;
+  if (kSource == 3) return v3;
+  return alpha;
+}
+
+// Does the work of color_transform, DecenterRow and WriteToOutput for one
+// output row in a single pass over the planes, writing the interleaved samples
+// directly to output. Only the last partial vector goes through scratch.
+template <typename T, bool kYCbCr, size_t kNumChannels, int kC0, int kC1,
+          int kC2, int kC3>
+void WriteFusedRow(float* rows[kMaxComponents], size_t x0, size_t len,
+                   uint8_t* JPEGLI_RESTRICT scratch,
+                   uint8_t* JPEGLI_RESTRICT output) {
+  const HWY_CAPPED(float, 8) df;
+  const Rebind<T, decltype(df)> du;
+  const size_t N = Lanes(df);
+  constexpr bool kUsesPlane3 = kC0 == 3 || kC1 == 3 || kC2 == 3 || kC3 == 3;
+  const float* JPEGLI_RESTRICT row0 = rows[0] + x0;
+  const float* JPEGLI_RESTRICT row1 = rows[kNumChannels >= 3 ? 1 : 0] + x0;
+  const float* JPEGLI_RESTRICT row2 = rows[kNumChannels >= 3 ? 2 : 0] + x0;
+  const float* JPEGLI_RESTRICT row3 = rows[kUsesPlane3 ? 3 : 0] + x0;
+  T* JPEGLI_RESTRICT out = reinterpret_cast<T*>(output);
+  T* JPEGLI_RESTRICT tail = reinterpret_cast<T*>(scratch);
+#if JPEGLI_MEMORY_SANITIZER
+  const size_t padding = hwy::RoundUpTo(len, N) - len;
+  __msan_unpoison(row0 + len, sizeof(row0[0]) * padding);
+  __msan_unpoison(row1 + len, sizeof(row1[0]) * padding);
+  __msan_unpoison(row2 + len, sizeof(row2[0]) * padding);
+  __msan_unpoison(row3 + len, sizeof(row3[0]) * padding);
+#endif
+  // Same constants as in YCbCrToExtRGB, so that the output is identical to
+  // that of the non-fused path.
+  const auto crcr = Set(df, 1.402f);
+  const auto cgcb = Set(df, -0.114f * 1.772f / 0.587f);
+  const auto cgcr = Set(df, -0.299f * 1.402f / 0.587f);
+  const auto cbcb = Set(df, 1.772f);
+  const auto c128 = Set(df, 128.0f / 255);
+  const auto alpha = Add(Set(df, 127.0f / 255.0f), c128);
+  const auto mul = Set(df, OutputSample<T>::kMultiplier);
+  for (size_t x = 0; x < len; x += N) {
+    auto v0 = LoadU(df, row0 + x);
+    auto v1 = LoadU(df, row1 + x);
+    auto v2 = LoadU(df, row2 + x);
+    if (kYCbCr) {
+      const auto r = MulAdd(crcr, v2, v0);
+      const auto g = MulAdd(cgcr, v2, MulAdd(cgcb, v1, v0));
+      const auto b = MulAdd(cbcb, v1, v0);
+      v0 = r;
+      v1 = g;
+      v2 = b;
+    }
+    v0 = Add(v0, c128);
+    v1 = Add(v1, c128);
+    v2 = Add(v2, c128);
+    const auto v3 = Add(LoadU(df, row3 + x), c128);
+    const auto o0 = OutputSample<T>::Convert(
+        df, SelectChannel<kC0>(v0, v1, v2, v3, alpha), mul);
+    const auto o1 = OutputSample<T>::Convert(
+        df, SelectChannel<kC1>(v0, v1, v2, v3, alpha), mul);
+    const auto o2 = OutputSample<T>::Convert(
+        df, SelectChannel<kC2>(v0, v1, v2, v3, alpha), mul);
+    const auto o3 = OutputSample<T>::Convert(
+        df, SelectChannel<kC3>(v0, v1, v2, v3, alpha), mul);
+    const bool full = x + N <= len;
+    T* JPEGLI_RESTRICT dst = full ? out + kNumChannels * x : tail;
+    if (kNumChannels == 1) {
+      StoreU(o0, du, dst);
+    } else if (kNumChannels == 3) {
+      StoreInterleaved3(o0, o1, o2, du, dst);
+    } else {
+      StoreInterleaved4(o0, o1, o2, o3, du, dst);
+    }
+    if (!full) {
+      memcpy(out + kNumChannels * x, tail,
+             (len - x) * kNumChannels * sizeof(T));
+    }
+  }
+}
+
+template <typename T, bool kYCbCr>
+FusedOutputFunc ChooseFusedRGBOutput(J_COLOR_SPACE out_color_space) {
+  switch (out_color_space) {
+    case JCS_RGB:
+#ifdef JCS_EXTENSIONS
+    case JCS_EXT_RGB:
+#endif
+      return WriteFusedRow<T, kYCbCr, 3, 0, 1, 2, 0>;
+#ifdef JCS_EXTENSIONS
+    case JCS_EXT_BGR:
+      return WriteFusedRow<T, kYCbCr, 3, 2, 1, 0, 0>;
+    case JCS_EXT_RGBX:
+#ifdef JCS_ALPHA_EXTENSIONS
+    case JCS_EXT_RGBA:
+#endif
+      return WriteFusedRow<T, kYCbCr, 4, 0, 1, 2, kFusedAlpha>;
+    case JCS_EXT_BGRX:
+#ifdef JCS_ALPHA_EXTENSIONS
+    case JCS_EXT_BGRA:
+#endif
+      return WriteFusedRow<T, kYCbCr, 4, 2, 1, 0, kFusedAlpha>;
+    case JCS_EXT_XRGB:
+#ifdef JCS_ALPHA_EXTENSIONS
+    case JCS_EXT_ARGB:
+#endif
+      return WriteFusedRow<T, kYCbCr, 4, kFusedAlpha, 0, 1, 2>;
+    case JCS_EXT_XBGR:
+#ifdef JCS_ALPHA_EXTENSIONS
+    case JCS_EXT_ABGR:
+#endif
+      return WriteFusedRow<T, kYCbCr, 4, kFusedAlpha, 2, 1, 0>;
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+template <typename T>
+FusedOutputFunc ChooseFusedOutputForType(j_decompress_ptr cinfo) {
+  const J_COLOR_SPACE in_color_space = cinfo->jpeg_color_space;
+  const J_COLOR_SPACE out_color_space = cinfo->out_color_space;
+  if (in_color_space == out_color_space ||
+      (in_color_space == JCS_YCbCr && out_color_space == JCS_GRAYSCALE)) {
+    switch (cinfo->out_color_components) {
+      case 1:
+        return WriteFusedRow<T, false, 1, 0, 0, 0, 0>;
+      case 3:
+        return WriteFusedRow<T, false, 3, 0, 1, 2, 0>;
+      case 4:
+        return WriteFusedRow<T, false, 4, 0, 1, 2, 3>;
+      default:
+        return nullptr;
+    }
+  } else if (in_color_space == JCS_YCbCr) {
+    return ChooseFusedRGBOutput<T, true>(out_color_space);
+  } else if (in_color_space == JCS_RGB && out_color_space != JCS_GRAYSCALE) {
+    return ChooseFusedRGBOutput<T, false>(out_color_space);
+  }
+  return nullptr;
+}
+
+// Returns the fused output kernel for the current output settings, or nullptr
+// if they need the general path (color quantization, byte swapping, or color
+// transforms that have no fused version).
+FusedOutputFunc ChooseFusedOutput(j_decompress_ptr cinfo) {
+  jpeg_decomp_master* m = cinfo->master;
+  if (cinfo->quantize_colors || m->swap_endianness_) {
+    return nullptr;
+  }
+  switch (m->output_data_type_) {
+    case JPEGLI_TYPE_UINT8:
+      return ChooseFusedOutputForType<uint8_t>(cinfo);
+    case JPEGLI_TYPE_UINT16:
+      return ChooseFusedOutputForType<uint16_t>(cinfo);
+    case JPEGLI_TYPE_FLOAT:
+      return ChooseFusedOutputForType<float>(cinfo);
+    default:
+      return nullptr;
+  }
+}
+
+// Integer variant of WriteFusedRow for the centered 8-bit samples of the
+// fixed-point render path. The color transform uses the constants of
+// YCbCrToExtRGB with 15 fractional bits, and the samples saturate to 8 bits.
+template <bool kYCbCr, size_t kNumChannels, int kC0, int kC1, int kC2, int kC3>
+void WriteIntegerRow(int16_t* rows[kMaxComponents], size_t x0, size_t len,
+                     uint8_t* JPEGLI_RESTRICT scratch,
+                     uint8_t* JPEGLI_RESTRICT output) {
+  const HWY_CAPPED(int16_t, 16) di16;
+  const Rebind<uint8_t, decltype(di16)> du;
+  const size_t N = Lanes(di16);
+  constexpr bool kUsesPlane3 = kC0 == 3 || kC1 == 3 || kC2 == 3 || kC3 == 3;
+  const int16_t* JPEGLI_RESTRICT row0 = rows[0] + x0;
+  const int16_t* JPEGLI_RESTRICT row1 = rows[kNumChannels >= 3 ? 1 : 0] + x0;
+  const int16_t* JPEGLI_RESTRICT row2 = rows[kNumChannels >= 3 ? 2 : 0] + x0;
+  const int16_t* JPEGLI_RESTRICT row3 = rows[kUsesPlane3 ? 3 : 0] + x0;
+#if JPEGLI_MEMORY_SANITIZER
+  const size_t padding = hwy::RoundUpTo(len, N) - len;
+  __msan_unpoison(row0 + len, sizeof(row0[0]) * padding);
+  __msan_unpoison(row1 + len, sizeof(row1[0]) * padding);
+  __msan_unpoison(row2 + len, sizeof(row2[0]) * padding);
+  __msan_unpoison(row3 + len, sizeof(row3[0]) * padding);
+#endif
+  // The multipliers above 1 are split into 1 and a fraction.
+  const auto crcr = Set(di16, 13173);   // 1.402 - 1
+  const auto cgcb = Set(di16, -11277);  // -0.114 * 1.772 / 0.587
+  const auto cgcr = Set(di16, -23401);  // -0.299 * 1.402 / 0.587
+  const auto cbcb = Set(di16, 25297);   // 1.772 - 1
+  const auto c128 = Set(di16, 128);
+  const auto alpha = Set(di16, 255);
+  for (size_t x = 0; x < len; x += N) {
+    auto v0 = LoadU(di16, row0 + x);
+    auto v1 = LoadU(di16, row1 + x);
+    auto v2 = LoadU(di16, row2 + x);
+    if (kYCbCr) {
+      const auto r = Add(v0, Add(v2, MulFixedPoint15(v2, crcr)));
+      const auto g = Add(v0, Add(MulFixedPoint15(v1, cgcb),
+                                 MulFixedPoint15(v2, cgcr)));
+      const auto b = Add(v0, Add(v1, MulFixedPoint15(v1, cbcb)));
+      v0 = r;
+      v1 = g;
+      v2 = b;
+    }
+    v0 = Add(v0, c128);
+    v1 = Add(v1, c128);
+    v2 = Add(v2, c128);
+    const auto v3 = Add(LoadU(di16, row3 + x), c128);
+    const auto o0 = DemoteTo(du, SelectChannel<kC0>(v0, v1, v2, v3, alpha));
+    const auto o1 = DemoteTo(du, SelectChannel<kC1>(v0, v1, v2, v3, alpha));
+    const auto o2 = DemoteTo(du, SelectChannel<kC2>(v0, v1, v2, v3, alpha));
+    const auto o3 = DemoteTo(du, SelectChannel<kC3>(v0, v1, v2, v3, alpha));
+    const bool full = x + N <= len;
+    uint8_t* JPEGLI_RESTRICT dst = full ? output + kNumChannels * x : scratch;
+    if (kNumChannels == 1) {
+      StoreU(o0, du, dst);
+    } else if (kNumChannels == 3) {
+      StoreInterleaved3(o0, o1, o2, du, dst);
+    } else {
+      StoreInterleaved4(o0, o1, o2, o3, du, dst);
+    }
+    if (!full) {
+      memcpy(output + kNumChannels * x, scratch, (len - x) * kNumChannels);
+    }
+  }
+}
+
+template <bool kYCbCr>
+IntegerOutputFunc ChooseIntegerRGBOutput(J_COLOR_SPACE out_color_space) {
+  switch (out_color_space) {
+    case JCS_RGB:
+#ifdef JCS_EXTENSIONS
+    case JCS_EXT_RGB:
+#endif
+      return WriteIntegerRow<kYCbCr, 3, 0, 1, 2, 0>;
+#ifdef JCS_EXTENSIONS
+    case JCS_EXT_BGR:
+      return WriteIntegerRow<kYCbCr, 3, 2, 1, 0, 0>;
+    case JCS_EXT_RGBX:
+#ifdef JCS_ALPHA_EXTENSIONS
+    case JCS_EXT_RGBA:
+#endif
+      return WriteIntegerRow<kYCbCr, 4, 0, 1, 2, kFusedAlpha>;
+    case JCS_EXT_BGRX:
+#ifdef JCS_ALPHA_EXTENSIONS
+    case JCS_EXT_BGRA:
+#endif
+      return WriteIntegerRow<kYCbCr, 4, 2, 1, 0, kFusedAlpha>;
+    case JCS_EXT_XRGB:
+#ifdef JCS_ALPHA_EXTENSIONS
+    case JCS_EXT_ARGB:
+#endif
+      return WriteIntegerRow<kYCbCr, 4, kFusedAlpha, 0, 1, 2>;
+    case JCS_EXT_XBGR:
+#ifdef JCS_ALPHA_EXTENSIONS
+    case JCS_EXT_ABGR:
+#endif
+      return WriteIntegerRow<kYCbCr, 4, kFusedAlpha, 2, 1, 0>;
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+// Returns the output kernel of the fixed-point render path, or nullptr if the
+// current settings need the float planes. The path is used for the same color
+// transforms as the fused float output, and only with the fixed-point IDCT,
+// which excludes dequantization biases, block smoothing and scaled output.
+IntegerOutputFunc ChooseIntegerOutput(j_decompress_ptr cinfo) {
+  jpeg_decomp_master* m = cinfo->master;
+  if (!m->fixed_point_idct || !m->has_integer_planes_ ||
+      cinfo->quantize_colors || cinfo->raw_data_out) {
+    return nullptr;
+  }
+  const J_COLOR_SPACE in_color_space = cinfo->jpeg_color_space;
+  const J_COLOR_SPACE out_color_space = cinfo->out_color_space;
+  if (in_color_space == out_color_space ||
+      (in_color_space == JCS_YCbCr && out_color_space == JCS_GRAYSCALE)) {
+    switch (cinfo->out_color_components) {
+      case 1:
+        return WriteIntegerRow<false, 1, 0, 0, 0, 0>;
+      case 3:
+        return WriteIntegerRow<false, 3, 0, 1, 2, 0>;
+      case 4:
+        return WriteIntegerRow<false, 4, 0, 1, 2, 3>;
+      default:
+        return nullptr;
+    }
+  } else if (in_color_space == JCS_YCbCr) {
+    return ChooseIntegerRGBOutput<true>(out_color_space);
+  } else if (in_color_space == JCS_RGB && out_color_space != JCS_GRAYSCALE) {
+    return ChooseIntegerRGBOutput<false>(out_color_space);
+  }
+  return nullptr;
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jpegli
@@ -293,6 +619,8 @@ namespace jpegli {
 HWY_EXPORT(GatherBlockStats);
 HWY_EXPORT(WriteToOutput);
 HWY_EXPORT(DecenterRow);
+HWY_EXPORT(ChooseFusedOutput);
+HWY_EXPORT(ChooseIntegerOutput);
 
 void GatherBlockStats(const int16_t* JPEGLI_RESTRICT coeffs,
                       const size_t coeffs_size,
@@ -304,17 +632,46 @@ void GatherBlockStats(const int16_t* JPEGLI_RESTRICT coeffs,
 void WriteToOutput(j_decompress_ptr cinfo, float* JPEGLI_RESTRICT rows[],
                    size_t xoffset, size_t len, size_t num_channels,
                    uint8_t* JPEGLI_RESTRICT output) {
+  JPEGLI_STAGE_TIMER(cinfo->master, JPEGLI_STAGE_WRITE_OUTPUT);
   HWY_DYNAMIC_DISPATCH(WriteToOutput)
   (cinfo, rows, xoffset, len, num_channels, output);
+  JPEGLI_STATS_ADD(cinfo->master, output_bytes,
+                   cinfo->quantize_colors && cinfo->master->quant_pass_ == 1
+                       ? len
+                       : len * num_channels *
+                             jpegli_bytes_per_sample(
+                                 cinfo->master->output_data_type_));
 }
 
 void DecenterRow(float* row, size_t xsize) {
   HWY_DYNAMIC_DISPATCH(DecenterRow)(row, xsize);
 }
 
+void WriteFusedOutput(j_decompress_ptr cinfo, float* rows[kMaxComponents],
+                      uint8_t* output) {
+  jpeg_decomp_master* m = cinfo->master;
+  JPEGLI_STAGE_TIMER(m, JPEGLI_STAGE_WRITE_OUTPUT);
+  (*m->fused_output)(rows, m->xoffset_, cinfo->output_width,
+                     m->output_scratch_, output);
+  JPEGLI_STATS_ADD(m, output_bytes,
+                   cinfo->output_width * cinfo->out_color_components *
+                       jpegli_bytes_per_sample(m->output_data_type_));
+}
+
+void WriteIntegerOutput(j_decompress_ptr cinfo, int16_t* rows[kMaxComponents],
+                        uint8_t* output) {
+  jpeg_decomp_master* m = cinfo->master;
+  JPEGLI_STAGE_TIMER(m, JPEGLI_STAGE_WRITE_OUTPUT);
+  (*m->integer_output)(rows, m->xoffset_, cinfo->output_width,
+                       m->output_scratch_, output);
+  JPEGLI_STATS_ADD(m, output_bytes,
+                   cinfo->output_width * cinfo->out_color_components);
+}
+
 bool ShouldApplyDequantBiases(j_decompress_ptr cinfo, int ci) {
   const auto& compinfo = cinfo->comp_info[ci];
-  return (compinfo.h_samp_factor == cinfo->max_h_samp_factor &&
+  return (!cinfo->master->fixed_point_idct &&
+          compinfo.h_samp_factor == cinfo->max_h_samp_factor &&
           compinfo.v_samp_factor == cinfo->max_v_samp_factor);
 }
 
@@ -576,10 +933,46 @@ void PrepareForOutput(j_decompress_ptr cinfo) {
   }
   JPEGLI_CHECK(ChooseInverseTransform(cinfo));
   ChooseColorTransform(cinfo);
+  UpdateRenderedColumns(cinfo);
+  m->fused_output = HWY_DYNAMIC_DISPATCH(ChooseFusedOutput)(cinfo);
+  m->integer_output = HWY_DYNAMIC_DISPATCH(ChooseIntegerOutput)(cinfo);
+}
+
+void UpdateRenderedColumns(j_decompress_ptr cinfo) {
+  jpeg_decomp_master* m = cinfo->master;
+  if (cinfo->output_iMCU_row != 0) {
+    // Some iMCU rows were already rendered with the previous range.
+    return;
+  }
+  const size_t imcu_width =
+      static_cast<size_t>(cinfo->max_h_samp_factor) * m->min_scaled_dct_size;
+  size_t begin = m->xoffset_ / imcu_width;
+  size_t end = std::min<size_t>(
+      DivCeil(m->xoffset_ + cinfo->output_width, imcu_width), m->iMCU_cols_);
+  if (cinfo->do_fancy_upsampling) {
+    // Horizontal upsampling needs the neighbouring samples of the edge columns.
+    begin = begin > 0 ? begin - 1 : 0;
+    end = std::min<size_t>(end + 1, m->iMCU_cols_);
+  }
+  // The rendered rows, including the downsampled ones, are processed with
+  // aligned loads and stores.
+  const size_t kAlignLanes = HWY_ALIGNMENT / sizeof(float);
+  const auto is_aligned = [&](size_t imcu_col) {
+    const size_t x0 = imcu_col * imcu_width;
+    if (x0 % kAlignLanes != 0) return false;
+    for (int c = 0; c < cinfo->num_components; ++c) {
+      if ((x0 / m->h_factor[c]) % kAlignLanes != 0) return false;
+    }
+    return true;
+  };
+  while (!is_aligned(begin)) --begin;
+  m->imcu_col_begin_ = begin;
+  m->imcu_col_end_ = end;
 }
 
 void DecodeCurrentiMCURow(j_decompress_ptr cinfo) {
   jpeg_decomp_master* m = cinfo->master;
+  JPEGLI_STAGE_TIMER(m, JPEGLI_STAGE_DECODE_IMCU_ROW);
   const size_t imcu_row = cinfo->output_iMCU_row;
   JBLOCKARRAY blocks[kMaxComponents];
   for (int c = 0; c < cinfo->num_components; ++c) {
@@ -616,6 +1009,10 @@ void DecodeCurrentiMCURow(j_decompress_ptr cinfo) {
       }
     }
     RowBuffer<float>* raw_out = &m->raw_output_[c];
+    // Only the blocks of the rendered iMCU columns are transformed.
+    const size_t bx0 = m->imcu_col_begin_ * compinfo.h_samp_factor;
+    const size_t bx1 = std::min<size_t>(
+        m->imcu_col_end_ * compinfo.h_samp_factor, compinfo.width_in_blocks);
     for (int iy = 0; iy < compinfo.v_samp_factor; ++iy) {
       size_t by = block_row + iy;
       if (by >= compinfo.height_in_blocks) {
@@ -624,19 +1021,30 @@ void DecodeCurrentiMCURow(j_decompress_ptr cinfo) {
       size_t dctsize = m->scaled_dct_size[c];
       int16_t* JPEGLI_RESTRICT row_in = &blocks[c][iy][0][0];
       float* JPEGLI_RESTRICT row_out = raw_out->Row(by * dctsize);
-      for (size_t bx = 0; bx < compinfo.width_in_blocks; ++bx) {
-        if (m->apply_smoothing) {
+      if (m->integer_output != nullptr) {
+        // The fixed-point IDCT is the only transform of this path, and it is
+        // never used with smoothing.
+        RowBuffer<int16_t>* raw_out_i16 = &m->raw_output_i16_[c];
+        if (bx0 < bx1) {
+          InverseTransformBlockRowFixedPointI16(
+              &row_in[bx0 * DCTSIZE2], bx1 - bx0, &m->dequant_[k0],
+              &m->biases_[k0], m->idct_scratch_,
+              raw_out_i16->Row(by * dctsize) + bx0 * dctsize,
+              raw_out_i16->stride());
+        }
+      } else if (m->apply_smoothing) {
+        for (size_t bx = bx0; bx < bx1; ++bx) {
           PredictSmooth(cinfo, blocks[c], c, bx, iy);
           (*m->inverse_transform[c])(m->smoothing_scratch_, &m->dequant_[k0],
                                      &m->biases_[k0], m->idct_scratch_,
                                      &row_out[bx * dctsize], raw_out->stride(),
                                      dctsize);
-        } else {
-          (*m->inverse_transform[c])(&row_in[bx * DCTSIZE2], &m->dequant_[k0],
-                                     &m->biases_[k0], m->idct_scratch_,
-                                     &row_out[bx * dctsize], raw_out->stride(),
-                                     dctsize);
         }
+      } else if (bx0 < bx1) {
+        (*m->inverse_transform_row[c])(
+            &row_in[bx0 * DCTSIZE2], bx1 - bx0, &m->dequant_[k0],
+            &m->biases_[k0], m->idct_scratch_, &row_out[bx0 * dctsize],
+            raw_out->stride(), dctsize);
       }
       if (m->streaming_mode_) {
         memset(row_in, 0, compinfo.width_in_blocks * sizeof(JBLOCK));
@@ -670,6 +1078,109 @@ void ProcessRawOutput(j_decompress_ptr cinfo, JSAMPIMAGE data) {
   }
 }
 
+// Upsamples the rows of component c of the iMCU row group starting at output
+// row y to the render rows.
+void UpsampleComponent(j_decompress_ptr cinfo, int c, size_t y, size_t xbegin,
+                       size_t render_width) {
+  jpeg_decomp_master* m = cinfo->master;
+  const size_t vfactor = cinfo->max_v_samp_factor;
+  RowBuffer<float>* raw_out = &m->raw_output_[c];
+  RowBuffer<float>* render_out = &m->render_output_[c];
+  int line_groups = vfactor / m->v_factor[c];
+  size_t downsampled_xbegin = xbegin / m->h_factor[c];
+  size_t downsampled_width = render_width / m->h_factor[c];
+  size_t yc = y / m->v_factor[c];
+  for (int dy = 0; dy < line_groups; ++dy) {
+    size_t ymid = yc + dy;
+    const float* JPEGLI_RESTRICT row_mid =
+        raw_out->Row(ymid) + downsampled_xbegin;
+    if (cinfo->do_fancy_upsampling && m->v_factor[c] == 2) {
+      const float* JPEGLI_RESTRICT row_top =
+          ymid == 0 ? row_mid : raw_out->Row(ymid - 1) + downsampled_xbegin;
+      const float* JPEGLI_RESTRICT row_bot =
+          ymid + 1 == m->raw_height_[c]
+              ? row_mid
+              : raw_out->Row(ymid + 1) + downsampled_xbegin;
+      Upsample2Vertical(row_top, row_mid, row_bot,
+                        render_out->Row(2 * dy) + downsampled_xbegin,
+                        render_out->Row(2 * dy + 1) + downsampled_xbegin,
+                        downsampled_width);
+    } else {
+      for (int yix = 0; yix < m->v_factor[c]; ++yix) {
+        memcpy(render_out->Row(m->v_factor[c] * dy + yix) + downsampled_xbegin,
+               row_mid, downsampled_width * sizeof(float));
+      }
+    }
+    if (m->h_factor[c] > 1) {
+      for (int yix = 0; yix < m->v_factor[c]; ++yix) {
+        int row_ix = m->v_factor[c] * dy + yix;
+        float* JPEGLI_RESTRICT row = render_out->Row(row_ix);
+        float* JPEGLI_RESTRICT tmp =
+            m->upsample_scratch_ + HWY_ALIGNMENT / sizeof(float);
+        if (cinfo->do_fancy_upsampling && m->h_factor[c] == 2) {
+          Upsample2Horizontal(row, tmp, xbegin, render_width);
+        } else {
+          UpsampleHorizontal(row, tmp, m->h_factor[c], xbegin, render_width);
+        }
+      }
+    }
+  }
+}
+
+// Same as above for the 16-bit integer planes. As in libjpeg, the vertical
+// fancy upsampling keeps two extra bits of precision if it is followed by
+// horizontal fancy upsampling.
+void UpsampleComponentI16(j_decompress_ptr cinfo, int c, size_t y,
+                          size_t xbegin, size_t render_width) {
+  jpeg_decomp_master* m = cinfo->master;
+  const size_t vfactor = cinfo->max_v_samp_factor;
+  RowBuffer<int16_t>* raw_out = &m->raw_output_i16_[c];
+  RowBuffer<int16_t>* render_out = &m->render_output_i16_[c];
+  const bool fancy_v = cinfo->do_fancy_upsampling && m->v_factor[c] == 2;
+  const bool fancy_h = cinfo->do_fancy_upsampling && m->h_factor[c] == 2;
+  int line_groups = vfactor / m->v_factor[c];
+  size_t downsampled_xbegin = xbegin / m->h_factor[c];
+  size_t downsampled_width = render_width / m->h_factor[c];
+  size_t yc = y / m->v_factor[c];
+  for (int dy = 0; dy < line_groups; ++dy) {
+    size_t ymid = yc + dy;
+    const int16_t* JPEGLI_RESTRICT row_mid =
+        raw_out->Row(ymid) + downsampled_xbegin;
+    if (fancy_v) {
+      const int16_t* JPEGLI_RESTRICT row_top =
+          ymid == 0 ? row_mid : raw_out->Row(ymid - 1) + downsampled_xbegin;
+      const int16_t* JPEGLI_RESTRICT row_bot =
+          ymid + 1 == m->raw_height_[c]
+              ? row_mid
+              : raw_out->Row(ymid + 1) + downsampled_xbegin;
+      Upsample2VerticalI16(row_top, row_mid, row_bot,
+                           render_out->Row(2 * dy) + downsampled_xbegin,
+                           render_out->Row(2 * dy + 1) + downsampled_xbegin,
+                           downsampled_width, /*descale=*/!fancy_h);
+    } else {
+      for (int yix = 0; yix < m->v_factor[c]; ++yix) {
+        memcpy(render_out->Row(m->v_factor[c] * dy + yix) + downsampled_xbegin,
+               row_mid, downsampled_width * sizeof(int16_t));
+      }
+    }
+    if (m->h_factor[c] > 1) {
+      for (int yix = 0; yix < m->v_factor[c]; ++yix) {
+        int row_ix = m->v_factor[c] * dy + yix;
+        int16_t* JPEGLI_RESTRICT row = render_out->Row(row_ix);
+        int16_t* JPEGLI_RESTRICT tmp =
+            m->upsample_scratch_i16_ + HWY_ALIGNMENT / sizeof(int16_t);
+        if (fancy_h) {
+          Upsample2HorizontalI16(row, tmp, xbegin, render_width,
+                                 fancy_v ? 2 : 0);
+        } else {
+          UpsampleHorizontalI16(row, tmp, m->h_factor[c], xbegin,
+                                render_width);
+        }
+      }
+    }
+  }
+}
+
 void ProcessOutput(j_decompress_ptr cinfo, size_t* num_output_rows,
                    JSAMPARRAY scanlines, size_t max_output_rows) {
   jpeg_decomp_master* m = cinfo->master;
@@ -679,7 +1190,10 @@ void ProcessOutput(j_decompress_ptr cinfo, size_t* num_output_rows,
   const size_t imcu_row = cinfo->output_iMCU_row;
   const size_t imcu_height = vfactor * m->min_scaled_dct_size;
   const size_t imcu_width = hfactor * m->min_scaled_dct_size;
-  const size_t output_width = m->iMCU_cols_ * imcu_width;
+  // Rendered columns, see UpdateRenderedColumns().
+  const size_t xbegin = m->imcu_col_begin_ * imcu_width;
+  const size_t render_width =
+      (m->imcu_col_end_ - m->imcu_col_begin_) * imcu_width;
   if (imcu_row == cinfo->total_iMCU_rows ||
       (imcu_row > context &&
        cinfo->output_scanline < (imcu_row - context) * imcu_height)) {
@@ -693,46 +1207,10 @@ void ProcessOutput(j_decompress_ptr cinfo, size_t* num_output_rows,
     size_t ye = DivCeil(yend, vfactor) * vfactor;
     for (size_t y = yb; y < ye; y += vfactor) {
       for (int c = 0; c < cinfo->num_components; ++c) {
-        RowBuffer<float>* raw_out = &m->raw_output_[c];
-        RowBuffer<float>* render_out = &m->render_output_[c];
-        int line_groups = vfactor / m->v_factor[c];
-        int downsampled_width = output_width / m->h_factor[c];
-        size_t yc = y / m->v_factor[c];
-        for (int dy = 0; dy < line_groups; ++dy) {
-          size_t ymid = yc + dy;
-          const float* JPEGLI_RESTRICT row_mid = raw_out->Row(ymid);
-          if (cinfo->do_fancy_upsampling && m->v_factor[c] == 2) {
-            const float* JPEGLI_RESTRICT row_top =
-                ymid == 0 ? row_mid : raw_out->Row(ymid - 1);
-            const float* JPEGLI_RESTRICT row_bot = ymid + 1 == m->raw_height_[c]
-                                                       ? row_mid
-                                                       : raw_out->Row(ymid + 1);
-            Upsample2Vertical(row_top, row_mid, row_bot,
-                              render_out->Row(2 * dy),
-                              render_out->Row(2 * dy + 1), downsampled_width);
-          } else {
-            for (int yix = 0; yix < m->v_factor[c]; ++yix) {
-              memcpy(render_out->Row(m->v_factor[c] * dy + yix), row_mid,
-                     downsampled_width * sizeof(float));
-            }
-          }
-          if (m->h_factor[c] > 1) {
-            for (int yix = 0; yix < m->v_factor[c]; ++yix) {
-              int row_ix = m->v_factor[c] * dy + yix;
-              float* JPEGLI_RESTRICT row = render_out->Row(row_ix);
-              float* JPEGLI_RESTRICT tmp =
-                  m->upsample_scratch_ + HWY_ALIGNMENT / sizeof(float);
-              if (cinfo->do_fancy_upsampling && m->h_factor[c] == 2) {
-                Upsample2Horizontal(row, tmp, output_width);
-              } else {
-                // TODO(szabadka) SIMDify this.
-                for (size_t x = 0; x < output_width; ++x) {
-                  tmp[x] = row[x / m->h_factor[c]];
-                }
-                memcpy(row, tmp, output_width * sizeof(tmp[0]));
-              }
-            }
-          }
+        if (m->integer_output != nullptr) {
+          UpsampleComponentI16(cinfo, c, y, xbegin, render_width);
+        } else {
+          UpsampleComponent(cinfo, c, y, xbegin, render_width);
         }
       }
       for (size_t yix = 0; yix < vfactor; ++yix) {
@@ -743,15 +1221,36 @@ void ProcessOutput(j_decompress_ptr cinfo, size_t* num_output_rows,
         for (int c = 0; c < num_all_components; ++c) {
           rows[c] = m->render_output_[c].Row(yix);
         }
-        (*m->color_transform)(rows, output_width);
-        for (int c = 0; c < cinfo->out_color_components; ++c) {
-          // Undo the centering of the sample values around zero.
-          DecenterRow(rows[c], output_width);
-        }
-        if (scanlines) {
-          uint8_t* output = scanlines[*num_output_rows];
-          WriteToOutput(cinfo, rows, m->xoffset_, cinfo->output_width,
-                        cinfo->out_color_components, output);
+        if (m->integer_output != nullptr) {
+          if (scanlines) {
+            int16_t* rows_i16[kMaxComponents];
+            for (int c = 0; c < num_all_components; ++c) {
+              rows_i16[c] = m->render_output_i16_[c].Row(yix);
+            }
+            WriteIntegerOutput(cinfo, rows_i16, scanlines[*num_output_rows]);
+          }
+        } else if (m->fused_output != nullptr) {
+          if (scanlines) {
+            WriteFusedOutput(cinfo, rows, scanlines[*num_output_rows]);
+          }
+        } else {
+          {
+            JPEGLI_STAGE_TIMER(m, JPEGLI_STAGE_COLOR_TRANSFORM);
+            float* render_rows[kMaxComponents];
+            for (int c = 0; c < num_all_components; ++c) {
+              render_rows[c] = rows[c] + xbegin;
+            }
+            (*m->color_transform)(render_rows, render_width);
+          }
+          for (int c = 0; c < cinfo->out_color_components; ++c) {
+            // Undo the centering of the sample values around zero.
+            DecenterRow(rows[c] + xbegin, render_width);
+          }
+          if (scanlines) {
+            uint8_t* output = scanlines[*num_output_rows];
+            WriteToOutput(cinfo, rows, m->xoffset_, cinfo->output_width,
+                          cinfo->out_color_components, output);
+          }
         }
         JPEGLI_CHECK(cinfo->output_scanline == y + yix);
         ++cinfo->output_scanline;
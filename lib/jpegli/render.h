@@ -15,6 +15,10 @@ namespace jpegli {
 
 void PrepareForOutput(j_decompress_ptr cinfo);
 
+// Restricts decoding and rendering to the iMCU columns needed for the current
+// crop window. Has no effect once the current output pass has started.
+void UpdateRenderedColumns(j_decompress_ptr cinfo);
+
 void ProcessOutput(j_decompress_ptr cinfo, size_t* num_output_rows,
                    JSAMPARRAY scanlines, size_t max_output_rows);
 
@@ -0,0 +1,71 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#ifndef JPEGLI_LIB_JPEGLI_STATS_H_
+#define JPEGLI_LIB_JPEGLI_STATS_H_
+
+// Instrumentation behind jpegli_get_stats(). Unless the library is built with
+// JPEGLI_ENABLE_STATS=1, the macros below expand to no-ops and the encoder and
+// decoder state has no stats field.
+
+#include "lib/jpegli/types.h"
+
+#ifndef JPEGLI_ENABLE_STATS
+#define JPEGLI_ENABLE_STATS 0
+#endif
+
+#if JPEGLI_ENABLE_STATS
+
+#include <chrono>
+#include <cstring>
+
+namespace jpegli {
+
+// Adds the wall time between its construction and destruction to a stage.
+class StageTimer {
+ public:
+  StageTimer(JpegliStats* stats, JpegliStage stage)
+      : stats_(stats),
+        stage_(stage),
+        start_(std::chrono::steady_clock::now()) {}
+  ~StageTimer() {
+    const auto elapsed = std::chrono::steady_clock::now() - start_;
+    stats_->stage_ns[stage_] +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    ++stats_->stage_calls[stage_];
+  }
+  StageTimer(const StageTimer&) = delete;
+  StageTimer& operator=(const StageTimer&) = delete;
+
+ private:
+  JpegliStats* stats_;
+  JpegliStage stage_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace jpegli
+
+#define JPEGLI_STATS_CONCAT_INNER(a, b) a##b
+#define JPEGLI_STATS_CONCAT(a, b) JPEGLI_STATS_CONCAT_INNER(a, b)
+
+// Times the rest of the enclosing scope as the given stage.
+#define JPEGLI_STAGE_TIMER(master, stage)                           \
+  ::jpegli::StageTimer JPEGLI_STATS_CONCAT(stage_timer_, __LINE__)( \
+      &(master)->stats, stage)
+#define JPEGLI_STATS_ADD(master, field, value) \
+  ((master)->stats.field += (value))
+#define JPEGLI_STATS_RESET(master) \
+  memset(&(master)->stats, 0, sizeof((master)->stats))
+
+#else  // JPEGLI_ENABLE_STATS
+
+#define JPEGLI_STAGE_TIMER(master, stage) static_cast<void>(0)
+#define JPEGLI_STATS_ADD(master, field, value) static_cast<void>(0)
+#define JPEGLI_STATS_RESET(master) static_cast<void>(0)
+
+#endif  // JPEGLI_ENABLE_STATS
+
+#endif  // JPEGLI_LIB_JPEGLI_STATS_H_
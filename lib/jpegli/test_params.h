@@ -100,6 +100,10 @@ struct CompressParams {
   bool xyb_mode = false;
   bool libjpeg_mode = false;
   bool use_adaptive_quantization = true;
+  // If positive, it is set through jpegli_set_max_block_error_target()
+  float block_error_target = 0.0f;
+  // If positive, it is set through jpegli_set_scan_optimization()
+  float scan_search_ms = 0.0f;
   std::vector<uint8_t> icc;
 
   int h_samp(int c) const { return h_sampling.empty() ? 1 : h_sampling[c]; }
@@ -145,6 +149,7 @@ struct DecompressParams {
   bool crop_output = false;
   bool do_block_smoothing = false;
   bool do_fancy_upsampling = true;
+  int dct_method = 0;  // JDCT_ISLOW
   bool skip_scans = false;
   int scale_num = 1;
   int scale_denom = 1;
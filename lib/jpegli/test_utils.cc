@@ -306,6 +306,13 @@ std::ostream& operator<<(std::ostream& os, const CompressParams& jparams) {
   if (!jparams.use_adaptive_quantization) {
     os << "NoAQ";
   }
+  if (jparams.block_error_target > 0) {
+    os << "BlockErr"
+       << static_cast<int>(std::round(10 * jparams.block_error_target));
+  }
+  if (jparams.scan_search_ms > 0) {
+    os << "ScanSearch";
+  }
   if (jparams.restart_interval > 0) {
     os << "R" << jparams.restart_interval;
   }
@@ -639,6 +646,13 @@ void EncodeWithJpegli(const TestImage& input, const CompressParams& jparams,
   jpegli_set_input_format(cinfo, input.data_type, input.endianness);
   jpegli_enable_adaptive_quantization(
       cinfo, TO_JPEGLI_BOOL(jparams.use_adaptive_quantization));
+  if (jparams.block_error_target > 0) {
+    jpegli_set_max_block_error_target(cinfo, jparams.block_error_target,
+                                      0.02f);
+  }
+  if (jparams.scan_search_ms > 0) {
+    jpegli_set_scan_optimization(cinfo, jparams.scan_search_ms);
+  }
   cinfo->restart_interval = jparams.restart_interval;
   cinfo->restart_in_rows = jparams.restart_in_rows;
   cinfo->smoothing_factor = jparams.smoothing_factor;
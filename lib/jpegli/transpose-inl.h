@@ -5,6 +5,7 @@
 // https://developers.google.com/open-source/licenses/bsd
 
 #include <cstddef>
+#include <cstdint>
 
 #if defined(JPEGLI_LIB_JPEGLI_TRANSPOSE_INL_H_) == defined(HWY_TARGET_TOGGLE)
 #ifdef JPEGLI_LIB_JPEGLI_TRANSPOSE_INL_H_
@@ -24,16 +25,18 @@ namespace {
 
 #if HWY_CAP_GE256
 JPEGLI_INLINE void Transpose8x8Block(const float* JPEGLI_RESTRICT from,
-                                     float* JPEGLI_RESTRICT to) {
+                                     size_t from_stride,
+                                     float* JPEGLI_RESTRICT to,
+                                     size_t to_stride) {
   const HWY_CAPPED(float, 8) d;
   auto i0 = Load(d, from);
-  auto i1 = Load(d, from + 1 * 8);
-  auto i2 = Load(d, from + 2 * 8);
-  auto i3 = Load(d, from + 3 * 8);
-  auto i4 = Load(d, from + 4 * 8);
-  auto i5 = Load(d, from + 5 * 8);
-  auto i6 = Load(d, from + 6 * 8);
-  auto i7 = Load(d, from + 7 * 8);
+  auto i1 = Load(d, from + 1 * from_stride);
+  auto i2 = Load(d, from + 2 * from_stride);
+  auto i3 = Load(d, from + 3 * from_stride);
+  auto i4 = Load(d, from + 4 * from_stride);
+  auto i5 = Load(d, from + 5 * from_stride);
+  auto i6 = Load(d, from + 6 * from_stride);
+  auto i7 = Load(d, from + 7 * from_stride);
 
   const auto q0 = InterleaveLower(d, i0, i2);
   const auto q1 = InterleaveLower(d, i1, i3);
@@ -63,24 +66,26 @@ JPEGLI_INLINE void Transpose8x8Block(const float* JPEGLI_RESTRICT from,
   i7 = ConcatUpperUpper(d, r7, r3);
 
   Store(i0, d, to);
-  Store(i1, d, to + 1 * 8);
-  Store(i2, d, to + 2 * 8);
-  Store(i3, d, to + 3 * 8);
-  Store(i4, d, to + 4 * 8);
-  Store(i5, d, to + 5 * 8);
-  Store(i6, d, to + 6 * 8);
-  Store(i7, d, to + 7 * 8);
+  Store(i1, d, to + 1 * to_stride);
+  Store(i2, d, to + 2 * to_stride);
+  Store(i3, d, to + 3 * to_stride);
+  Store(i4, d, to + 4 * to_stride);
+  Store(i5, d, to + 5 * to_stride);
+  Store(i6, d, to + 6 * to_stride);
+  Store(i7, d, to + 7 * to_stride);
 }
 #elif HWY_TARGET != HWY_SCALAR
 JPEGLI_INLINE void Transpose8x8Block(const float* JPEGLI_RESTRICT from,
-                                     float* JPEGLI_RESTRICT to) {
+                                     size_t from_stride,
+                                     float* JPEGLI_RESTRICT to,
+                                     size_t to_stride) {
   const HWY_CAPPED(float, 4) d;
   for (size_t n = 0; n < 8; n += 4) {
     for (size_t m = 0; m < 8; m += 4) {
-      auto p0 = Load(d, from + n * 8 + m);
-      auto p1 = Load(d, from + (n + 1) * 8 + m);
-      auto p2 = Load(d, from + (n + 2) * 8 + m);
-      auto p3 = Load(d, from + (n + 3) * 8 + m);
+      auto p0 = Load(d, from + n * from_stride + m);
+      auto p1 = Load(d, from + (n + 1) * from_stride + m);
+      auto p2 = Load(d, from + (n + 2) * from_stride + m);
+      auto p3 = Load(d, from + (n + 3) * from_stride + m);
       const auto q0 = InterleaveLower(d, p0, p2);
       const auto q1 = InterleaveLower(d, p1, p3);
       const auto q2 = InterleaveUpper(d, p0, p2);
@@ -90,24 +95,64 @@ JPEGLI_INLINE void Transpose8x8Block(const float* JPEGLI_RESTRICT from,
       const auto r1 = InterleaveUpper(d, q0, q1);
       const auto r2 = InterleaveLower(d, q2, q3);
       const auto r3 = InterleaveUpper(d, q2, q3);
-      Store(r0, d, to + m * 8 + n);
-      Store(r1, d, to + (1 + m) * 8 + n);
-      Store(r2, d, to + (2 + m) * 8 + n);
-      Store(r3, d, to + (3 + m) * 8 + n);
+      Store(r0, d, to + m * to_stride + n);
+      Store(r1, d, to + (1 + m) * to_stride + n);
+      Store(r2, d, to + (2 + m) * to_stride + n);
+      Store(r3, d, to + (3 + m) * to_stride + n);
     }
   }
 }
 #else
 static JPEGLI_INLINE void Transpose8x8Block(const float* JPEGLI_RESTRICT from,
-                                            float* JPEGLI_RESTRICT to) {
+                                            size_t from_stride,
+                                            float* JPEGLI_RESTRICT to,
+                                            size_t to_stride) {
   for (size_t n = 0; n < 8; ++n) {
     for (size_t m = 0; m < 8; ++m) {
-      to[8 * n + m] = from[8 * m + n];
+      to[n * to_stride + m] = from[m * from_stride + n];
     }
   }
 }
 #endif
 
+JPEGLI_INLINE void Transpose8x8Block(const float* JPEGLI_RESTRICT from,
+                                     float* JPEGLI_RESTRICT to) {
+  Transpose8x8Block(from, 8, to, 8);
+}
+
+#if HWY_TARGET != HWY_SCALAR
+// Transposes the 8x8 block of 16-bit lanes held in the eight vectors.
+template <class D, class V = hwy::HWY_NAMESPACE::Vec<D>>
+JPEGLI_INLINE void Transpose8x8I16(D d, V& v0, V& v1, V& v2, V& v3, V& v4,
+                                   V& v5, V& v6, V& v7) {
+  const hwy::HWY_NAMESPACE::Repartition<int32_t, D> d32;
+  const auto a0 = BitCast(d32, InterleaveLower(d, v0, v1));
+  const auto a1 = BitCast(d32, InterleaveUpper(d, v0, v1));
+  const auto a2 = BitCast(d32, InterleaveLower(d, v2, v3));
+  const auto a3 = BitCast(d32, InterleaveUpper(d, v2, v3));
+  const auto a4 = BitCast(d32, InterleaveLower(d, v4, v5));
+  const auto a5 = BitCast(d32, InterleaveUpper(d, v4, v5));
+  const auto a6 = BitCast(d32, InterleaveLower(d, v6, v7));
+  const auto a7 = BitCast(d32, InterleaveUpper(d, v6, v7));
+  const V b0 = BitCast(d, InterleaveLower(d32, a0, a2));
+  const V b1 = BitCast(d, InterleaveUpper(d32, a0, a2));
+  const V b2 = BitCast(d, InterleaveLower(d32, a1, a3));
+  const V b3 = BitCast(d, InterleaveUpper(d32, a1, a3));
+  const V b4 = BitCast(d, InterleaveLower(d32, a4, a6));
+  const V b5 = BitCast(d, InterleaveUpper(d32, a4, a6));
+  const V b6 = BitCast(d, InterleaveLower(d32, a5, a7));
+  const V b7 = BitCast(d, InterleaveUpper(d32, a5, a7));
+  v0 = ConcatLowerLower(d, b4, b0);
+  v1 = ConcatUpperUpper(d, b4, b0);
+  v2 = ConcatLowerLower(d, b5, b1);
+  v3 = ConcatUpperUpper(d, b5, b1);
+  v4 = ConcatLowerLower(d, b6, b2);
+  v5 = ConcatUpperUpper(d, b6, b2);
+  v6 = ConcatLowerLower(d, b7, b3);
+  v7 = ConcatUpperUpper(d, b7, b3);
+}
+#endif
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace
 }  // namespace HWY_NAMESPACE
@@ -7,6 +7,8 @@
 #ifndef JPEGLI_LIB_JPEGLI_TYPES_H_
 #define JPEGLI_LIB_JPEGLI_TYPES_H_
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -56,6 +58,58 @@ typedef enum {
 
 int jpegli_bytes_per_sample(JpegliDataType data_type);
 
+/** Encoder and decoder stages that are timed separately by jpegli_get_stats().
+ */
+typedef enum {
+  /** Input (encoder) or output (decoder) color space conversion. When the
+   * decoder converts and writes the output rows in a single pass, this time is
+   * counted as JPEGLI_STAGE_WRITE_OUTPUT instead. */
+  JPEGLI_STAGE_COLOR_TRANSFORM = 0,
+  /** Chroma downsampling of the input rows. */
+  JPEGLI_STAGE_DOWNSAMPLE = 1,
+  /** Computation of the adaptive quantization field. */
+  JPEGLI_STAGE_ADAPTIVE_QUANTIZATION = 2,
+  /** Forward DCT and quantization. In streaming mode this also includes the
+   * tokenization or the entropy coding of the iMCU row. */
+  JPEGLI_STAGE_DCT = 3,
+  /** Tokenization of the quantized coefficients of the whole image. */
+  JPEGLI_STAGE_TOKENIZE = 4,
+  /** Computation of the optimized Huffman codes. */
+  JPEGLI_STAGE_OPTIMIZE_HUFFMAN = 5,
+  /** Entropy coding of the scans after the whole image was tokenized. */
+  JPEGLI_STAGE_WRITE_SCANS = 6,
+  /** Entropy decoding of the scan data. */
+  JPEGLI_STAGE_PROCESS_SCAN = 7,
+  /** Dequantization and inverse DCT of one iMCU row. */
+  JPEGLI_STAGE_DECODE_IMCU_ROW = 8,
+  /** Conversion of the rendered rows to the output sample format. */
+  JPEGLI_STAGE_WRITE_OUTPUT = 9,
+  JPEGLI_NUM_STAGES = 10,
+} JpegliStage;
+
+/** Timing and counters of the current or last compression or decompression,
+ * see jpegli_get_stats().
+ */
+typedef struct {
+  /** Wall time spent in each stage, in nanoseconds. */
+  uint64_t stage_ns[JPEGLI_NUM_STAGES];
+  /** Number of times each stage was entered. */
+  uint64_t stage_calls[JPEGLI_NUM_STAGES];
+  /** Bytes of pixel data (encoder) or compressed data (decoder) consumed. */
+  uint64_t input_bytes;
+  /** Bytes of compressed data (encoder) or pixel data (decoder) produced. */
+  uint64_t output_bytes;
+  /** Number of entropy coding tokens, if the encoder tokenized the image before
+   * writing it, which is the case with optimized Huffman codes or progressive
+   * mode. */
+  uint64_t num_tokens;
+  /** Number of Huffman tables written (encoder) or read (decoder). */
+  uint64_t num_huffman_tables;
+  /** Peak number of bytes allocated through the memory manager since the
+   * creation of the compressor or decompressor. */
+  uint64_t peak_memory_usage;
+} JpegliStats;
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -6,6 +6,7 @@
 
 #include "lib/jpegli/upsample.h"
 
+#include <stdint.h>
 #include <string.h>
 
 #include "lib/base/compiler_specific.h"
@@ -20,8 +21,10 @@ namespace jpegli {
 namespace HWY_NAMESPACE {
 
 // These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Add;
 using hwy::HWY_NAMESPACE::Mul;
 using hwy::HWY_NAMESPACE::MulAdd;
+using hwy::HWY_NAMESPACE::ShiftRight;
 using hwy::HWY_NAMESPACE::Vec;
 
 #if HWY_CAP_GE512
@@ -76,12 +79,14 @@ void StoreInterleaved(const DF df, V v0, V v1, T* mem) {
 }
 
 void Upsample2Horizontal(float* JPEGLI_RESTRICT row,
-                         float* JPEGLI_RESTRICT scratch_space, size_t len_out) {
+                         float* JPEGLI_RESTRICT scratch_space, size_t xoffset,
+                         size_t len_out) {
   HWY_FULL(float) df;
   auto threefour = Set(df, 0.75f);
   auto onefour = Set(df, 0.25f);
   const size_t len_in = (len_out + 1) >> 1;
-  memcpy(scratch_space, row, len_in * sizeof(row[0]));
+  memcpy(scratch_space, row + xoffset / 2, len_in * sizeof(row[0]));
+  row += xoffset;
   scratch_space[-1] = scratch_space[0];
   scratch_space[len_in] = scratch_space[len_in - 1];
   for (size_t x = 0; x < len_in; x += Lanes(df)) {
@@ -94,6 +99,38 @@ void Upsample2Horizontal(float* JPEGLI_RESTRICT row,
   }
 }
 
+void UpsampleHorizontal(float* JPEGLI_RESTRICT row,
+                        float* JPEGLI_RESTRICT scratch_space, size_t factor,
+                        size_t xoffset, size_t len_out) {
+  HWY_FULL(float) df;
+  const size_t N = Lanes(df);
+  const size_t len_in = (len_out + factor - 1) / factor;
+  memcpy(scratch_space, row + xoffset / factor, len_in * sizeof(row[0]));
+  row += xoffset;
+  size_t x = 0;
+  if (len_out % factor == 0) {
+    if (factor == 2) {
+      for (; x + N <= len_in; x += N) {
+        const auto v = Load(df, scratch_space + x);
+        StoreInterleaved2(v, v, df, row + 2 * x);
+      }
+    } else if (factor == 3) {
+      for (; x + N <= len_in; x += N) {
+        const auto v = Load(df, scratch_space + x);
+        StoreInterleaved3(v, v, v, df, row + 3 * x);
+      }
+    } else if (factor == 4) {
+      for (; x + N <= len_in; x += N) {
+        const auto v = Load(df, scratch_space + x);
+        StoreInterleaved4(v, v, v, v, df, row + 4 * x);
+      }
+    }
+  }
+  for (size_t i = x * factor; i < len_out; ++i) {
+    row[i] = scratch_space[i / factor];
+  }
+}
+
 void Upsample2Vertical(const float* JPEGLI_RESTRICT row_top,
                        const float* JPEGLI_RESTRICT row_mid,
                        const float* JPEGLI_RESTRICT row_bot,
@@ -112,6 +149,118 @@ void Upsample2Vertical(const float* JPEGLI_RESTRICT row_top,
   }
 }
 
+// The integer variants below work on 16-bit vectors of at most 8 lanes, so
+// that they do not write past the padding of the rows, whose rendered parts
+// are multiples of 8 samples long.
+using DI16 = HWY_CAPPED(int16_t, 8);
+
+template <int kInputShift>
+void Upsample2HorizontalI16Impl(int16_t* JPEGLI_RESTRICT row,
+                                int16_t* JPEGLI_RESTRICT scratch_space,
+                                size_t xoffset, size_t len_out) {
+  const DI16 di;
+  // Same rounding as in libjpeg's fancy upsampling: the biases alternate
+  // between the left and right output samples.
+  const auto bias_left = Set(di, kInputShift == 0 ? 1 : 8);
+  const auto bias_right = Set(di, kInputShift == 0 ? 2 : 7);
+  const auto three = Set(di, 3);
+  const size_t len_in = (len_out + 1) >> 1;
+  memcpy(scratch_space, row + xoffset / 2, len_in * sizeof(row[0]));
+  row += xoffset;
+  scratch_space[-1] = scratch_space[0];
+  scratch_space[len_in] = scratch_space[len_in - 1];
+  for (size_t x = 0; x < len_in; x += Lanes(di)) {
+    auto current = Mul(LoadU(di, scratch_space + x), three);
+    auto prev = LoadU(di, scratch_space + x - 1);
+    auto next = LoadU(di, scratch_space + x + 1);
+    auto left = ShiftRight<kInputShift + 2>(Add(Add(current, prev), bias_left));
+    auto right =
+        ShiftRight<kInputShift + 2>(Add(Add(current, next), bias_right));
+    StoreInterleaved2(left, right, di, row + x * 2);
+  }
+}
+
+void Upsample2HorizontalI16(int16_t* JPEGLI_RESTRICT row,
+                            int16_t* JPEGLI_RESTRICT scratch_space,
+                            size_t xoffset, size_t len_out, int input_shift) {
+  if (input_shift == 0) {
+    Upsample2HorizontalI16Impl<0>(row, scratch_space, xoffset, len_out);
+  } else {
+    Upsample2HorizontalI16Impl<2>(row, scratch_space, xoffset, len_out);
+  }
+}
+
+void UpsampleHorizontalI16(int16_t* JPEGLI_RESTRICT row,
+                           int16_t* JPEGLI_RESTRICT scratch_space,
+                           size_t factor, size_t xoffset, size_t len_out) {
+  const DI16 di;
+  const size_t N = Lanes(di);
+  const size_t len_in = (len_out + factor - 1) / factor;
+  memcpy(scratch_space, row + xoffset / factor, len_in * sizeof(row[0]));
+  row += xoffset;
+  size_t x = 0;
+  if (len_out % factor == 0) {
+    if (factor == 2) {
+      for (; x + N <= len_in; x += N) {
+        const auto v = LoadU(di, scratch_space + x);
+        StoreInterleaved2(v, v, di, row + 2 * x);
+      }
+    } else if (factor == 3) {
+      for (; x + N <= len_in; x += N) {
+        const auto v = LoadU(di, scratch_space + x);
+        StoreInterleaved3(v, v, v, di, row + 3 * x);
+      }
+    } else if (factor == 4) {
+      for (; x + N <= len_in; x += N) {
+        const auto v = LoadU(di, scratch_space + x);
+        StoreInterleaved4(v, v, v, v, di, row + 4 * x);
+      }
+    }
+  }
+  for (size_t i = x * factor; i < len_out; ++i) {
+    row[i] = scratch_space[i / factor];
+  }
+}
+
+template <bool kDescale>
+void Upsample2VerticalI16Impl(const int16_t* JPEGLI_RESTRICT row_top,
+                              const int16_t* JPEGLI_RESTRICT row_mid,
+                              const int16_t* JPEGLI_RESTRICT row_bot,
+                              int16_t* JPEGLI_RESTRICT row_out0,
+                              int16_t* JPEGLI_RESTRICT row_out1, size_t len) {
+  const DI16 di;
+  const auto three = Set(di, 3);
+  // Same rounding biases as for the horizontal direction, see above.
+  const auto bias0 = Set(di, 1);
+  const auto bias1 = Set(di, 2);
+  for (size_t x = 0; x < len; x += Lanes(di)) {
+    auto im_scaled = Mul(LoadU(di, row_mid + x), three);
+    auto out0 = Add(LoadU(di, row_top + x), im_scaled);
+    auto out1 = Add(LoadU(di, row_bot + x), im_scaled);
+    if (kDescale) {
+      out0 = ShiftRight<2>(Add(out0, bias0));
+      out1 = ShiftRight<2>(Add(out1, bias1));
+    }
+    StoreU(out0, di, row_out0 + x);
+    StoreU(out1, di, row_out1 + x);
+  }
+}
+
+void Upsample2VerticalI16(const int16_t* JPEGLI_RESTRICT row_top,
+                          const int16_t* JPEGLI_RESTRICT row_mid,
+                          const int16_t* JPEGLI_RESTRICT row_bot,
+                          int16_t* JPEGLI_RESTRICT row_out0,
+                          int16_t* JPEGLI_RESTRICT row_out1, size_t len,
+                          bool descale) {
+  if (descale) {
+    Upsample2VerticalI16Impl<true>(row_top, row_mid, row_bot, row_out0,
+                                   row_out1, len);
+  } else {
+    Upsample2VerticalI16Impl<false>(row_top, row_mid, row_bot, row_out0,
+                                    row_out1, len);
+  }
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jpegli
@@ -122,10 +271,23 @@ namespace jpegli {
 
 HWY_EXPORT(Upsample2Horizontal);
 HWY_EXPORT(Upsample2Vertical);
+HWY_EXPORT(UpsampleHorizontal);
+HWY_EXPORT(Upsample2HorizontalI16);
+HWY_EXPORT(Upsample2VerticalI16);
+HWY_EXPORT(UpsampleHorizontalI16);
 
 void Upsample2Horizontal(float* JPEGLI_RESTRICT row,
-                         float* JPEGLI_RESTRICT scratch_space, size_t len_out) {
-  HWY_DYNAMIC_DISPATCH(Upsample2Horizontal)(row, scratch_space, len_out);
+                         float* JPEGLI_RESTRICT scratch_space, size_t xoffset,
+                         size_t len_out) {
+  HWY_DYNAMIC_DISPATCH(Upsample2Horizontal)
+  (row, scratch_space, xoffset, len_out);
+}
+
+void UpsampleHorizontal(float* JPEGLI_RESTRICT row,
+                        float* JPEGLI_RESTRICT scratch_space, size_t factor,
+                        size_t xoffset, size_t len_out) {
+  HWY_DYNAMIC_DISPATCH(UpsampleHorizontal)
+  (row, scratch_space, factor, xoffset, len_out);
 }
 
 void Upsample2Vertical(const float* JPEGLI_RESTRICT row_top,
@@ -136,5 +298,29 @@ void Upsample2Vertical(const float* JPEGLI_RESTRICT row_top,
   HWY_DYNAMIC_DISPATCH(Upsample2Vertical)
   (row_top, row_mid, row_bot, row_out0, row_out1, len);
 }
+
+void Upsample2HorizontalI16(int16_t* JPEGLI_RESTRICT row,
+                            int16_t* JPEGLI_RESTRICT scratch_space,
+                            size_t xoffset, size_t len_out, int input_shift) {
+  HWY_DYNAMIC_DISPATCH(Upsample2HorizontalI16)
+  (row, scratch_space, xoffset, len_out, input_shift);
+}
+
+void UpsampleHorizontalI16(int16_t* JPEGLI_RESTRICT row,
+                           int16_t* JPEGLI_RESTRICT scratch_space,
+                           size_t factor, size_t xoffset, size_t len_out) {
+  HWY_DYNAMIC_DISPATCH(UpsampleHorizontalI16)
+  (row, scratch_space, factor, xoffset, len_out);
+}
+
+void Upsample2VerticalI16(const int16_t* JPEGLI_RESTRICT row_top,
+                          const int16_t* JPEGLI_RESTRICT row_mid,
+                          const int16_t* JPEGLI_RESTRICT row_bot,
+                          int16_t* JPEGLI_RESTRICT row_out0,
+                          int16_t* JPEGLI_RESTRICT row_out1, size_t len,
+                          bool descale) {
+  HWY_DYNAMIC_DISPATCH(Upsample2VerticalI16)
+  (row_top, row_mid, row_bot, row_out0, row_out1, len, descale);
+}
 }  // namespace jpegli
 #endif  // HWY_ONCE
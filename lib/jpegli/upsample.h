@@ -8,13 +8,24 @@
 #define JPEGLI_LIB_JPEGLI_UPSAMPLE_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "lib/base/compiler_specific.h"
 
 namespace jpegli {
 
+// Upsamples the samples of row starting at xoffset / 2 in place, to
+// row[xoffset, xoffset + len_out). The edges of this range are treated as the
+// edges of the image. Both row + xoffset and scratch_space must be aligned.
 void Upsample2Horizontal(float* JPEGLI_RESTRICT row,
-                         float* JPEGLI_RESTRICT scratch_space, size_t len_out);
+                         float* JPEGLI_RESTRICT scratch_space, size_t xoffset,
+                         size_t len_out);
+
+// Same as above, but repeats every sample factor times, as done without
+// fancy upsampling or for factors other than 2.
+void UpsampleHorizontal(float* JPEGLI_RESTRICT row,
+                        float* JPEGLI_RESTRICT scratch_space, size_t factor,
+                        size_t xoffset, size_t len_out);
 
 void Upsample2Vertical(const float* JPEGLI_RESTRICT row_top,
                        const float* JPEGLI_RESTRICT row_mid,
@@ -22,6 +33,27 @@ void Upsample2Vertical(const float* JPEGLI_RESTRICT row_top,
                        float* JPEGLI_RESTRICT row_out0,
                        float* JPEGLI_RESTRICT row_out1, size_t len);
 
+// Integer variants of the above for the centered 8-bit samples of the
+// fixed-point render path, with the rounding of libjpeg's fancy upsampling.
+// The input samples of Upsample2HorizontalI16 are scaled by 1 << input_shift,
+// where input_shift is 0 or 2, and its output samples are 8-bit samples.
+void Upsample2HorizontalI16(int16_t* JPEGLI_RESTRICT row,
+                            int16_t* JPEGLI_RESTRICT scratch_space,
+                            size_t xoffset, size_t len_out, int input_shift);
+
+void UpsampleHorizontalI16(int16_t* JPEGLI_RESTRICT row,
+                           int16_t* JPEGLI_RESTRICT scratch_space,
+                           size_t factor, size_t xoffset, size_t len_out);
+
+// The output samples are scaled by 4, so that a following horizontal
+// upsampling rounds only once, unless descale is set.
+void Upsample2VerticalI16(const int16_t* JPEGLI_RESTRICT row_top,
+                          const int16_t* JPEGLI_RESTRICT row_mid,
+                          const int16_t* JPEGLI_RESTRICT row_bot,
+                          int16_t* JPEGLI_RESTRICT row_out0,
+                          int16_t* JPEGLI_RESTRICT row_out1, size_t len,
+                          bool descale);
+
 }  // namespace jpegli
 
 #endif  // JPEGLI_LIB_JPEGLI_UPSAMPLE_H_
@@ -105,6 +105,8 @@ libjpegli_extras_for_tools_sources = [
     "extras/metrics.h",
     "extras/packed_image_convert.cc",
     "extras/packed_image_convert.h",
+    "extras/ssimulacra2.cc",
+    "extras/ssimulacra2.h",
 ]
 
 libjpegli_extras_sources = [
@@ -123,10 +125,13 @@ libjpegli_extras_sources = [
     "extras/dec/color_hints.h",
     "extras/dec/decode.cc",
     "extras/dec/decode.h",
+    "extras/dec/row_reader.h",
     "extras/enc/encode.cc",
     "extras/enc/encode.h",
     "extras/exif.cc",
     "extras/exif.h",
+    "extras/gauss_blur.cc",
+    "extras/gauss_blur.h",
     "extras/image.cc",
     "extras/image.h",
     "extras/image_color_transform.cc",
@@ -155,6 +160,7 @@ libjpegli_jpegli_libjpeg_helper_files = [
 ]
 
 libjpegli_jpegli_sources = [
+    "jpegli/adaptive_quantization-inl.h",
     "jpegli/adaptive_quantization.cc",
     "jpegli/adaptive_quantization.h",
     "jpegli/bit_writer.cc",
@@ -193,6 +199,7 @@ libjpegli_jpegli_sources = [
     "jpegli/error.h",
     "jpegli/huffman.cc",
     "jpegli/huffman.h",
+    "jpegli/idct-inl.h",
     "jpegli/idct.cc",
     "jpegli/idct.h",
     "jpegli/input.cc",
@@ -206,6 +213,7 @@ libjpegli_jpegli_sources = [
     "jpegli/simd.cc",
     "jpegli/simd.h",
     "jpegli/source_manager.cc",
+    "jpegli/stats.h",
     "jpegli/transpose-inl.h",
     "jpegli/types.h",
     "jpegli/upsample.cc",
@@ -221,9 +229,13 @@ libjpegli_jpegli_testlib_files = [
 ]
 
 libjpegli_jpegli_tests = [
+    "jpegli/adaptive_quantization_test.cc",
+    "jpegli/dct_test.cc",
     "jpegli/decode_api_test.cc",
     "jpegli/encode_api_test.cc",
+    "jpegli/entropy_coding_test.cc",
     "jpegli/error_handling_test.cc",
+    "jpegli/idct_test.cc",
     "jpegli/input_suspension_test.cc",
     "jpegli/output_suspension_test.cc",
     "jpegli/source_manager_test.cc",
@@ -257,7 +269,10 @@ libjpegli_tests = [
     "extras/butteraugli_test.cc",
     "extras/codec_test.cc",
     "extras/dec/color_description_test.cc",
+    "extras/gauss_blur_test.cc",
     "extras/jpegli_test.cc",
+    "extras/metrics_test.cc",
+    "extras/ssimulacra2_test.cc",
     "threads/thread_parallel_runner_test.cc",
 ]
 
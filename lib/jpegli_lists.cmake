@@ -102,6 +102,8 @@ set(JPEGLI_INTERNAL_EXTRAS_FOR_TOOLS_SOURCES
   extras/metrics.h
   extras/packed_image_convert.cc
   extras/packed_image_convert.h
+  extras/ssimulacra2.cc
+  extras/ssimulacra2.h
 )
 
 set(JPEGLI_INTERNAL_EXTRAS_SOURCES
@@ -120,10 +122,13 @@ set(JPEGLI_INTERNAL_EXTRAS_SOURCES
   extras/dec/color_hints.h
   extras/dec/decode.cc
   extras/dec/decode.h
+  extras/dec/row_reader.h
   extras/enc/encode.cc
   extras/enc/encode.h
   extras/exif.cc
   extras/exif.h
+  extras/gauss_blur.cc
+  extras/gauss_blur.h
   extras/image.cc
   extras/image.h
   extras/image_color_transform.cc
@@ -150,6 +155,7 @@ set(JPEGLI_INTERNAL_JPEGLI_LIBJPEG_HELPER_FILES
 )
 
 set(JPEGLI_INTERNAL_JPEGLI_SOURCES
+  jpegli/adaptive_quantization-inl.h
   jpegli/adaptive_quantization.cc
   jpegli/adaptive_quantization.h
   jpegli/bit_writer.cc
@@ -188,6 +194,7 @@ set(JPEGLI_INTERNAL_JPEGLI_SOURCES
   jpegli/error.h
   jpegli/huffman.cc
   jpegli/huffman.h
+  jpegli/idct-inl.h
   jpegli/idct.cc
   jpegli/idct.h
   jpegli/input.cc
@@ -201,6 +208,7 @@ set(JPEGLI_INTERNAL_JPEGLI_SOURCES
   jpegli/simd.cc
   jpegli/simd.h
   jpegli/source_manager.cc
+  jpegli/stats.h
   jpegli/transpose-inl.h
   jpegli/types.h
   jpegli/upsample.cc
@@ -216,9 +224,13 @@ set(JPEGLI_INTERNAL_JPEGLI_TESTLIB_FILES
 )
 
 set(JPEGLI_INTERNAL_JPEGLI_TESTS
+  jpegli/adaptive_quantization_test.cc
+  jpegli/dct_test.cc
   jpegli/decode_api_test.cc
   jpegli/encode_api_test.cc
+  jpegli/entropy_coding_test.cc
   jpegli/error_handling_test.cc
+  jpegli/idct_test.cc
   jpegli/input_suspension_test.cc
   jpegli/output_suspension_test.cc
   jpegli/source_manager_test.cc
@@ -246,7 +258,10 @@ set(JPEGLI_INTERNAL_TESTS
   extras/butteraugli_test.cc
   extras/codec_test.cc
   extras/dec/color_description_test.cc
+  extras/gauss_blur_test.cc
   extras/jpegli_test.cc
+  extras/metrics_test.cc
+  extras/ssimulacra2_test.cc
   threads/thread_parallel_runner_test.cc
 )
 
@@ -33,11 +33,6 @@ if (NOT PNG_FOUND)
   message(FATAL_ERROR "PNG library is required by some tests")
 endif()
 
-list(APPEND JPEGLI_INTERNAL_TESTS
-  # TODO(deymo): Move this to tools/
-  ../tools/gauss_blur_test.cc
-)
-
 set(JPEGLI_WASM_TEST_LINK_FLAGS "")
 if (EMSCRIPTEN)
   # The emscripten linking step takes too much memory and crashes during the
@@ -81,9 +76,6 @@ foreach (TESTFILE IN LISTS JPEGLI_INTERNAL_TESTS)
     jpegli_testlib-internal
     jpegli_extras-internal
   )
-  if(TESTFILE STREQUAL ../tools/gauss_blur_test.cc)
-    target_link_libraries(${TESTNAME} jpegli_gauss_blur)
-  endif()
 
   # Output test targets in the test directory.
   set_target_properties(${TESTNAME} PROPERTIES PREFIX "tests/")
@@ -0,0 +1,135 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "tools/batch.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "tools/file_io.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include "third_party/dirent.h"
+#else
+#include <dirent.h>
+#endif
+
+namespace jpegli_tools {
+namespace {
+
+bool IsDirectory(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool IsRegularFile(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+bool ListDirectory(const std::string& dirname,
+                   std::vector<std::string>* paths) {
+  DIR* dir = opendir(dirname.c_str());
+  if (dir == nullptr) {
+    fprintf(stderr, "Could not open directory %s\n", dirname.c_str());
+    return false;
+  }
+  for (dirent* ent = readdir(dir); ent != nullptr; ent = readdir(dir)) {
+    std::string name = ent->d_name;
+    if (name.empty() || name[0] == '.') continue;
+    std::string path = dirname + "/" + name;
+    if (IsRegularFile(path)) paths->push_back(path);
+  }
+  closedir(dir);
+  std::sort(paths->begin(), paths->end());
+  return true;
+}
+
+bool ReadFileList(const std::string& filename,
+                  std::vector<std::string>* paths) {
+  std::vector<uint8_t> bytes;
+  if (!ReadFile(filename, &bytes)) {
+    fprintf(stderr, "Could not read file list %s\n", filename.c_str());
+    return false;
+  }
+  std::string line;
+  for (size_t i = 0; i <= bytes.size(); ++i) {
+    if (i < bytes.size() && bytes[i] != '\n') {
+      line.push_back(static_cast<char>(bytes[i]));
+      continue;
+    }
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (!line.empty()) paths->push_back(line);
+    line.clear();
+  }
+  return true;
+}
+
+// Returns the file name of path without directory and extension.
+std::string Stem(const std::string& path) {
+  size_t start = path.find_last_of("/\\");
+  start = (start == std::string::npos) ? 0 : start + 1;
+  size_t end = path.find_last_of('.');
+  if (end == std::string::npos || end < start) end = path.size();
+  return path.substr(start, end - start);
+}
+
+std::string OutputPath(const std::string& output_template,
+                       const std::string& stem) {
+  std::string path;
+  size_t pos = 0;
+  for (;;) {
+    size_t next = output_template.find("%s", pos);
+    if (next == std::string::npos) break;
+    path.append(output_template, pos, next - pos);
+    path.append(stem);
+    pos = next + 2;
+  }
+  path.append(output_template, pos, std::string::npos);
+  return path;
+}
+
+}  // namespace
+
+bool GetBatchPaths(const std::string& input, const std::string& output_template,
+                   std::vector<std::string>* inputs,
+                   std::vector<std::string>* outputs) {
+  inputs->clear();
+  outputs->clear();
+  if (IsDirectory(input) ? !ListDirectory(input, inputs)
+                         : !ReadFileList(input, inputs)) {
+    return false;
+  }
+  if (inputs->empty()) {
+    fprintf(stderr, "No input files in %s\n", input.c_str());
+    return false;
+  }
+  if (output_template.empty()) return true;
+  if (output_template.find("%s") == std::string::npos) {
+    fprintf(stderr, "Output template %s does not contain %%s\n",
+            output_template.c_str());
+    return false;
+  }
+  for (const std::string& path : *inputs) {
+    outputs->push_back(OutputPath(output_template, Stem(path)));
+  }
+  std::vector<std::string> sorted = *outputs;
+  std::sort(sorted.begin(), sorted.end());
+  auto it = std::adjacent_find(sorted.begin(), sorted.end());
+  if (it != sorted.end()) {
+    fprintf(stderr, "More than one input is written to %s\n", it->c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace jpegli_tools
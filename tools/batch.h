@@ -0,0 +1,30 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#ifndef JPEGLI_TOOLS_BATCH_H_
+#define JPEGLI_TOOLS_BATCH_H_
+
+// Helpers for the batch mode of the command line tools.
+
+#include <string>
+#include <vector>
+
+namespace jpegli_tools {
+
+// Expands the arguments of a batch run into input and output file paths.
+// `input` is either a directory, whose regular files are taken in name order,
+// or a text file with one input path per line. Each "%s" in
+// `output_template` is replaced by the input file name without directory and
+// extension. If `output_template` is empty, `outputs` is left empty. Prints
+// the reason of the failure and returns false if the input can not be read,
+// has no files, or if two inputs map to the same output.
+bool GetBatchPaths(const std::string& input, const std::string& output_template,
+                   std::vector<std::string>* inputs,
+                   std::vector<std::string>* outputs);
+
+}  // namespace jpegli_tools
+
+#endif  // JPEGLI_TOOLS_BATCH_H_
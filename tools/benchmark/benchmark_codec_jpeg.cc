@@ -309,8 +309,8 @@ class JPEGCodec : public ImageCodec {
       dparams.output_data_type =
           bitdepth_ > 8 ? JPEGLI_TYPE_UINT16 : JPEGLI_TYPE_UINT8;
       dparams.num_colors = num_colors_;
-      JPEGLI_RETURN_IF_ERROR(
-          jpegli::extras::DecodeJpeg(jpeg_bytes, dparams, pool, ppf));
+      JPEGLI_RETURN_IF_ERROR(jpegli::extras::DecodeJpeg(
+          jpegli::Bytes(jpeg_bytes), dparams, pool, ppf));
       const double end = jpegli::Now();
       speed_stats->NotifyElapsed(end - start);
     } else {
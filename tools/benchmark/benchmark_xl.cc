@@ -38,6 +38,7 @@
 #include "lib/extras/metrics.h"
 #include "lib/extras/packed_image.h"
 #include "lib/extras/packed_image_convert.h"
+#include "lib/extras/ssimulacra2.h"
 #include "tools/benchmark/benchmark_args.h"
 #include "tools/benchmark/benchmark_codec.h"
 #include "tools/benchmark/benchmark_file_io.h"
@@ -47,7 +48,6 @@
 #include "tools/file_io.h"
 #include "tools/no_memory_manager.h"
 #include "tools/speed_stats.h"
-#include "tools/ssimulacra2.h"
 #include "tools/thread_pool_internal.h"
 #include "tools/tracking_memory_manager.h"
 
@@ -61,6 +61,7 @@ using ::jpegli::Bytes;
 using ::jpegli::ColorEncoding;
 using ::jpegli::Image3F;
 using ::jpegli::ImageF;
+using ::jpegli::Msssim;
 using ::jpegli::Status;
 using ::jpegli::StatusOr;
 using ::jpegli::ThreadPool;
@@ -266,13 +267,15 @@ Status DoCompress(const std::string& filename, const PackedPixelFile& ppf,
     s->psnr += compressed->empty()
                    ? 0
                    : jpegli::ComputePSNR(memory_manager, ppf, ppf2,
-                                         *JpegliGetDefaultCms()) *
+                                         *JpegliGetDefaultCms(), inner_pool) *
                          input_pixels;
     JPEGLI_ASSIGN_OR_RETURN(
         double pnorm,
         ComputeDistanceP(distmap, ButteraugliParams(), Args()->error_pnorm));
     s->distance_p_norm += pnorm * input_pixels;
-    JPEGLI_ASSIGN_OR_RETURN(Msssim msssim, ComputeSSIMULACRA2(ppf, ppf2));
+    JPEGLI_ASSIGN_OR_RETURN(
+        Msssim msssim,
+        jpegli::ComputeSSIMULACRA2(memory_manager, ppf, ppf2, inner_pool));
     double ssimulacra2 = msssim.Score();
     s->ssimulacra2 += ssimulacra2 * input_pixels;
     s->max_distance = std::max(s->max_distance, distance);
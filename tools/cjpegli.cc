@@ -8,21 +8,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <memory>
 #include <string>
+#include <thread>  // NOLINT
 #include <vector>
 
 #include "lib/base/common.h"
 #include "lib/base/printf_macros.h"
 #include "lib/base/span.h"
+#include "lib/base/status.h"
+#include "lib/extras/dec/color_hints.h"
 #include "lib/extras/dec/decode.h"
+#include "lib/extras/dec/row_reader.h"
 #include "lib/extras/enc/jpegli.h"
 #include "lib/extras/packed_image.h"
 #include "lib/extras/time.h"
 #include "lib/jpegli/encode.h"
 #include "tools/args.h"
+#include "tools/batch.h"
 #include "tools/cmdline.h"
 #include "tools/file_io.h"
 #include "tools/speed_stats.h"
+#include "tools/thread_pool_internal.h"
 
 namespace jpegli_tools {
 namespace {
@@ -73,6 +80,13 @@ struct Args {
         "    Default: 2. Higher number is more scans, 0 means sequential.",
         &settings.progressive_level, &ParseSigned);
 
+    cmdline->AddOptionValue(
+        '\0', "scan_search_ms", "MS",
+        "Search for a smaller progressive scan script for about MS\n"
+        "    milliseconds of work per image. Default: 0, the default script\n"
+        "    is used.",
+        &settings.scan_search_ms, &ParseFloat, 1);
+
     cmdline->AddOptionFlag('\0', "xyb", "Convert to XYB colorspace",
                            &settings.xyb, &SetBooleanTrue, 1);
 
@@ -101,6 +115,20 @@ struct Args {
                             "How many times to compress. (For benchmarking).",
                             &num_reps, &ParseUnsigned, 1);
 
+    cmdline->AddOptionFlag(
+        '\0', "batch",
+        "Compress many images: INPUT is a directory or a file with one input\n"
+        "    path per line, OUTPUT is a template in which %s is replaced by\n"
+        "    the input file name without extension, e.g. out/%s.jpg.",
+        &batch, &SetBooleanTrue, 1);
+
+    cmdline->AddOptionValue(
+        '\0', "num_threads", "N",
+        "Number of worker threads, default is one per CPU. With --batch the\n"
+        "    images are compressed in parallel, otherwise the scans of a\n"
+        "    progressive image are encoded in parallel.",
+        &num_threads, &ParseUnsigned, 1);
+
     cmdline->AddOptionFlag('\0', "quiet", "Suppress informative output", &quiet,
                            &SetBooleanTrue, 1);
 
@@ -117,6 +145,8 @@ struct Args {
   jpegli::extras::JpegSettings settings;
   int quality = 90;
   size_t num_reps = 1;
+  bool batch = false;
+  size_t num_threads = std::thread::hardware_concurrency();
   bool quiet = false;
   bool verbose = false;
   // References (ids) of specific options to check if they were matched.
@@ -143,6 +173,10 @@ bool ValidateArgs(const Args& args) {
     fprintf(stderr, "Invalid --progressive_level argument\n");
     return false;
   }
+  if (settings.scan_search_ms < 0.0) {
+    fprintf(stderr, "Invalid --scan_search_ms argument\n");
+    return false;
+  }
   if (settings.progressive_level > 0 && !settings.optimize_coding) {
     fprintf(stderr, "--fixed_code must be used together with -p 0\n");
     return false;
@@ -168,6 +202,135 @@ bool SetDistance(const Args& args, const CommandLineParser& cmdline,
   return true;
 }
 
+// Per-thread state of the batch mode, reused for all images of the thread.
+struct BatchWorker {
+  BatchWorker() {
+    cinfo.err = jpegli_std_error(&jerr);
+    jpegli_create_compress(&cinfo);
+  }
+  ~BatchWorker() { jpegli_destroy_compress(&cinfo); }
+  BatchWorker(const BatchWorker&) = delete;
+  BatchWorker& operator=(const BatchWorker&) = delete;
+
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr jerr;
+  InputFile input;
+  std::vector<uint8_t> jpeg_bytes;
+  size_t num_pixels = 0;
+  size_t input_size = 0;
+  size_t output_size = 0;
+  size_t num_failures = 0;
+};
+
+// Decodes the input image in `bytes`. Uncompressed (PNM, PFM, PGX) images are
+// only parsed and *rows then reads their pixels from `bytes`, so that the input
+// image is never decoded into memory as a whole; for other formats *rows is
+// null and the pixels are in ppf->frames.
+jpegli::Status DecodeInput(jpegli::Bytes bytes,
+                           const jpegli::extras::ColorHints& color_hints,
+                           jpegli::extras::PackedPixelFile* ppf,
+                           std::unique_ptr<jpegli::extras::RowReader>* rows) {
+  if (jpegli::extras::DecodeBytesRows(bytes, color_hints, ppf, rows)) {
+    return true;
+  }
+  rows->reset();
+  return jpegli::extras::DecodeBytes(bytes, color_hints, ppf);
+}
+
+int CompressBatch(const Args& args) {
+  std::vector<std::string> inputs;
+  std::vector<std::string> outputs;
+  const std::string output_template = args.disable_output ? "" : args.file_out;
+  if (!GetBatchPaths(args.file_in, output_template, &inputs, &outputs)) {
+    return EXIT_FAILURE;
+  }
+
+  ThreadPoolInternal pool(args.num_threads);
+  std::vector<std::unique_ptr<BatchWorker>> workers;
+  const auto init_workers = [&](size_t num_threads) -> jpegli::Status {
+    while (workers.size() < num_threads) {
+      workers.emplace_back(jpegli::make_unique<BatchWorker>());
+    }
+    for (auto& worker : workers) {
+      worker->num_pixels = worker->input_size = worker->output_size = 0;
+      worker->num_failures = 0;
+    }
+    return true;
+  };
+  const auto compress_file = [&](uint32_t task,
+                                 size_t thread) -> jpegli::Status {
+    BatchWorker* worker = workers[thread].get();
+    const std::string& filename = inputs[task];
+    jpegli::extras::PackedPixelFile ppf;
+    std::unique_ptr<jpegli::extras::RowReader> rows;
+    if (!worker->input.Open(filename) ||
+        !DecodeInput(worker->input.bytes(), args.color_hints_proxy.target,
+                     &ppf, &rows)) {
+      fprintf(stderr, "Failed to read input image %s\n", filename.c_str());
+      ++worker->num_failures;
+      return true;
+    }
+    const bool ok =
+        rows ? jpegli::extras::EncodeJpeg(ppf, rows.get(), args.settings,
+                                          &worker->cinfo, nullptr,
+                                          &worker->jpeg_bytes)
+             : jpegli::extras::EncodeJpeg(ppf, args.settings, &worker->cinfo,
+                                          nullptr, &worker->jpeg_bytes);
+    if (!ok) {
+      fprintf(stderr, "jpegli encoding of %s failed\n", filename.c_str());
+      ++worker->num_failures;
+      return true;
+    }
+    if (!outputs.empty() && !WriteFile(outputs[task], worker->jpeg_bytes)) {
+      fprintf(stderr, "Could not write jpeg to %s\n", outputs[task].c_str());
+      ++worker->num_failures;
+      return true;
+    }
+    worker->num_pixels += static_cast<size_t>(ppf.info.xsize) * ppf.info.ysize;
+    worker->input_size += worker->input.bytes().size();
+    worker->output_size += worker->jpeg_bytes.size();
+    return true;
+  };
+
+  jpegli_tools::SpeedStats stats;
+  for (size_t num_rep = 0; num_rep < args.num_reps; ++num_rep) {
+    const double t0 = jpegli::Now();
+    if (!RunOnPool(pool.get(), 0, inputs.size(), init_workers, compress_file,
+                   "CompressBatch")) {
+      fprintf(stderr, "Batch compression failed\n");
+      return EXIT_FAILURE;
+    }
+    const double t1 = jpegli::Now();
+    stats.NotifyElapsed(t1 - t0);
+  }
+
+  size_t num_pixels = 0;
+  size_t input_size = 0;
+  size_t output_size = 0;
+  size_t num_failures = 0;
+  for (const auto& worker : workers) {
+    num_pixels += worker->num_pixels;
+    input_size += worker->input_size;
+    output_size += worker->output_size;
+    num_failures += worker->num_failures;
+  }
+  if (!args.quiet) {
+    fprintf(stderr,
+            "Compressed %" PRIuS " images, %" PRIuS " bytes to %" PRIuS
+            " bytes.\n",
+            inputs.size() - num_failures, input_size, output_size);
+    stats.SetBatchSize(inputs.size() - num_failures, num_pixels);
+    stats.SetFileSize(input_size);
+    stats.Print(workers.size());
+  }
+  if (num_failures > 0) {
+    fprintf(stderr, "Failed to compress %" PRIuS " of %" PRIuS " images.\n",
+            num_failures, inputs.size());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
 int CJpegliMain(int argc, const char* argv[]) {
   Args args;
   CommandLineParser cmdline;
@@ -195,22 +358,30 @@ int CJpegliMain(int argc, const char* argv[]) {
             "Encoding will be performed, but the result will be discarded.\n");
   }
 
-  std::vector<uint8_t> input_bytes;
-  if (!ReadFile(args.file_in, &input_bytes)) {
+  if (args.batch) {
+    if (!ValidateArgs(args) || !SetDistance(args, cmdline, &args.settings)) {
+      return EXIT_FAILURE;
+    }
+    return CompressBatch(args);
+  }
+
+  InputFile input;
+  if (!input.Open(args.file_in)) {
     fprintf(stderr, "Failed to read input image %s\n", args.file_in);
     return EXIT_FAILURE;
   }
 
   jpegli::extras::PackedPixelFile ppf;
-  if (!jpegli::extras::DecodeBytes(jpegli::Bytes(input_bytes),
-                                   args.color_hints_proxy.target, &ppf)) {
+  std::unique_ptr<jpegli::extras::RowReader> rows;
+  if (!DecodeInput(input.bytes(), args.color_hints_proxy.target, &ppf,
+                   &rows)) {
     fprintf(stderr, "Failed to decode input image %s\n", args.file_in);
     return EXIT_FAILURE;
   }
 
   if (!args.quiet) {
     fprintf(stderr, "Read %ux%u image, %" PRIuS " bytes.\n", ppf.info.xsize,
-            ppf.info.ysize, input_bytes.size());
+            ppf.info.ysize, input.bytes().size());
   }
 
   if (!ValidateArgs(args) || !SetDistance(args, cmdline, &args.settings)) {
@@ -232,9 +403,15 @@ int CJpegliMain(int argc, const char* argv[]) {
 
   jpegli_tools::SpeedStats stats;
   std::vector<uint8_t> jpeg_bytes;
+  ThreadPoolInternal pool(args.num_threads);
   for (size_t num_rep = 0; num_rep < args.num_reps; ++num_rep) {
     const double t0 = jpegli::Now();
-    if (!jpegli::extras::EncodeJpeg(ppf, args.settings, nullptr, &jpeg_bytes)) {
+    const bool ok =
+        rows ? jpegli::extras::EncodeJpeg(ppf, rows.get(), args.settings,
+                                          nullptr, pool.get(), &jpeg_bytes)
+             : jpegli::extras::EncodeJpeg(ppf, args.settings, pool.get(),
+                                          &jpeg_bytes);
+    if (!ok) {
       fprintf(stderr, "jpegli encoding failed\n");
       return EXIT_FAILURE;
     }
@@ -10,17 +10,22 @@
 
 #include <memory>
 #include <string>
+#include <thread>  // NOLINT
 #include <vector>
 
+#include "lib/base/common.h"
 #include "lib/base/printf_macros.h"
 #include "lib/base/types.h"
 #include "lib/extras/dec/jpegli.h"
 #include "lib/extras/enc/encode.h"
 #include "lib/extras/packed_image.h"
 #include "lib/extras/time.h"
+#include "lib/jpegli/decode.h"
+#include "tools/batch.h"
 #include "tools/cmdline.h"
 #include "tools/file_io.h"
 #include "tools/speed_stats.h"
+#include "tools/thread_pool_internal.h"
 
 namespace jpegli_tools {
 namespace {
@@ -49,6 +54,19 @@ struct Args {
                             "Used for benchmarking, the default is 1.",
                             &num_reps, &ParseUnsigned);
 
+    cmdline->AddOptionFlag(
+        '\0', "batch",
+        "Decompress many images: INPUT is a directory or a file with one\n"
+        "    input path per line, OUTPUT is a template in which %s is\n"
+        "    replaced by the input file name without extension, e.g.\n"
+        "    out/%s.png.",
+        &batch, &SetBooleanTrue);
+
+    cmdline->AddOptionValue(
+        '\0', "num_threads", "N",
+        "Number of worker threads for --batch, default is one per CPU.",
+        &num_threads, &ParseUnsigned);
+
     cmdline->AddOptionFlag('\0', "quiet", "Silence output (except for errors).",
                            &quiet, &SetBooleanTrue);
   }
@@ -58,6 +76,8 @@ struct Args {
   bool disable_output = false;
   size_t bitdepth = 8;
   size_t num_reps = 1;
+  bool batch = false;
+  size_t num_threads = std::thread::hardware_concurrency();
   bool quiet = false;
 };
 
@@ -85,6 +105,147 @@ void SetDecompressParams(const Args& args, const std::string& extension,
   }
 }
 
+bool GetExtension(const std::string& filename, std::string* extension) {
+  size_t pos = filename.find_last_of('.');
+  if (pos >= filename.size()) {
+    fprintf(stderr, "Unrecognized output extension.\n");
+    return false;
+  }
+  *extension = filename.substr(pos);
+  return true;
+}
+
+bool WriteOutput(const jpegli::extras::PackedPixelFile& ppf,
+                 std::string extension, const std::string& filename) {
+  if (extension == ".pnm") {
+    extension = ppf.info.num_color_channels == 3 ? ".ppm" : ".pgm";
+  }
+
+  std::unique_ptr<jpegli::extras::Encoder> encoder =
+      jpegli::extras::Encoder::FromExtension(extension);
+  if (encoder == nullptr) {
+    fprintf(stderr, "Can't decode to the file extension '%s'\n",
+            extension.c_str());
+    return false;
+  }
+  jpegli::extras::EncodedImage encoded_image;
+  if (!encoder->Encode(ppf, &encoded_image, nullptr) ||
+      encoded_image.bitstreams.empty()) {
+    fprintf(stderr, "Encode failed\n");
+    return false;
+  }
+  if (!WriteFile(filename, encoded_image.bitstreams[0])) {
+    fprintf(stderr, "Failed to write output file %s\n", filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Per-thread state of the batch mode, reused for all images of the thread.
+struct BatchWorker {
+  BatchWorker() {
+    cinfo.err = jpegli_std_error(&jerr);
+    jpegli_create_decompress(&cinfo);
+  }
+  ~BatchWorker() { jpegli_destroy_decompress(&cinfo); }
+  BatchWorker(const BatchWorker&) = delete;
+  BatchWorker& operator=(const BatchWorker&) = delete;
+
+  jpeg_decompress_struct cinfo;
+  jpeg_error_mgr jerr;
+  InputFile input;
+  size_t num_pixels = 0;
+  size_t input_size = 0;
+  size_t num_failures = 0;
+};
+
+int DecompressBatch(const Args& args) {
+  std::vector<std::string> inputs;
+  std::vector<std::string> outputs;
+  std::string extension;
+  if (!args.disable_output) {
+    if (!GetExtension(args.file_out, &extension) ||
+        !GetBatchPaths(args.file_in, args.file_out, &inputs, &outputs)) {
+      return EXIT_FAILURE;
+    }
+  } else if (!GetBatchPaths(args.file_in, "", &inputs, &outputs)) {
+    return EXIT_FAILURE;
+  }
+
+  jpegli::extras::JpegDecompressParams dparams;
+  SetDecompressParams(args, extension, &dparams);
+
+  ThreadPoolInternal pool(args.num_threads);
+  std::vector<std::unique_ptr<BatchWorker>> workers;
+  const auto init_workers = [&](size_t num_threads) -> jpegli::Status {
+    while (workers.size() < num_threads) {
+      workers.emplace_back(jpegli::make_unique<BatchWorker>());
+    }
+    for (auto& worker : workers) {
+      worker->num_pixels = worker->input_size = worker->num_failures = 0;
+    }
+    return true;
+  };
+  const auto decompress_file = [&](uint32_t task,
+                                   size_t thread) -> jpegli::Status {
+    BatchWorker* worker = workers[thread].get();
+    const std::string& filename = inputs[task];
+    if (!worker->input.Open(filename)) {
+      fprintf(stderr, "Failed to read input image %s\n", filename.c_str());
+      ++worker->num_failures;
+      return true;
+    }
+    jpegli::extras::PackedPixelFile ppf;
+    if (!jpegli::extras::DecodeJpeg(worker->input.bytes(), dparams,
+                                    &worker->cinfo, nullptr, &ppf)) {
+      fprintf(stderr, "jpegli decoding of %s failed\n", filename.c_str());
+      ++worker->num_failures;
+      return true;
+    }
+    if (!outputs.empty() && !WriteOutput(ppf, extension, outputs[task])) {
+      ++worker->num_failures;
+      return true;
+    }
+    worker->num_pixels += static_cast<size_t>(ppf.info.xsize) * ppf.info.ysize;
+    worker->input_size += worker->input.bytes().size();
+    return true;
+  };
+
+  jpegli_tools::SpeedStats stats;
+  for (size_t num_rep = 0; num_rep < args.num_reps; ++num_rep) {
+    const double t0 = jpegli::Now();
+    if (!RunOnPool(pool.get(), 0, inputs.size(), init_workers,
+                   decompress_file, "DecompressBatch")) {
+      fprintf(stderr, "Batch decompression failed\n");
+      return EXIT_FAILURE;
+    }
+    const double t1 = jpegli::Now();
+    stats.NotifyElapsed(t1 - t0);
+  }
+
+  size_t num_pixels = 0;
+  size_t input_size = 0;
+  size_t num_failures = 0;
+  for (const auto& worker : workers) {
+    num_pixels += worker->num_pixels;
+    input_size += worker->input_size;
+    num_failures += worker->num_failures;
+  }
+  if (!args.quiet) {
+    fprintf(stderr, "Decompressed %" PRIuS " images, %" PRIuS " bytes.\n",
+            inputs.size() - num_failures, input_size);
+    stats.SetBatchSize(inputs.size() - num_failures, num_pixels);
+    stats.SetFileSize(input_size);
+    stats.Print(workers.size());
+  }
+  if (num_failures > 0) {
+    fprintf(stderr, "Failed to decompress %" PRIuS " of %" PRIuS " images.\n",
+            num_failures, inputs.size());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
 int DJpegliMain(int argc, const char* argv[]) {
   Args args;
   CommandLineParser cmdline;
@@ -116,26 +277,28 @@ int DJpegliMain(int argc, const char* argv[]) {
     return EXIT_FAILURE;
   }
 
-  std::vector<uint8_t> jpeg_bytes;
-  if (!ReadFile(args.file_in, &jpeg_bytes)) {
+  if (args.batch) {
+    return DecompressBatch(args);
+  }
+
+  InputFile input;
+  if (!input.Open(args.file_in)) {
     fprintf(stderr, "Failed to read input image %s\n", args.file_in);
     return EXIT_FAILURE;
   }
 
   if (!args.quiet) {
-    fprintf(stderr, "Read %" PRIuS " compressed bytes.\n", jpeg_bytes.size());
+    fprintf(stderr, "Read %" PRIuS " compressed bytes.\n",
+            input.bytes().size());
   }
 
   std::string filename_out;
   std::string extension;
   if (args.file_out) {
     filename_out = std::string(args.file_out);
-    size_t pos = filename_out.find_last_of('.');
-    if (pos >= filename_out.size()) {
-      fprintf(stderr, "Unrecognized output extension.\n");
+    if (!GetExtension(filename_out, &extension)) {
       return EXIT_FAILURE;
     }
-    extension = filename_out.substr(pos);
   }
 
   jpegli::extras::JpegDecompressParams dparams;
@@ -145,7 +308,7 @@ int DJpegliMain(int argc, const char* argv[]) {
   jpegli_tools::SpeedStats stats;
   for (size_t num_rep = 0; num_rep < args.num_reps; ++num_rep) {
     const double t0 = jpegli::Now();
-    if (!jpegli::extras::DecodeJpeg(jpeg_bytes, dparams, nullptr, &ppf)) {
+    if (!jpegli::extras::DecodeJpeg(input.bytes(), dparams, nullptr, &ppf)) {
       fprintf(stderr, "jpegli decoding failed\n");
       return EXIT_FAILURE;
     }
@@ -162,25 +325,7 @@ int DJpegliMain(int argc, const char* argv[]) {
     return EXIT_SUCCESS;
   }
 
-  if (extension == ".pnm") {
-    extension = ppf.info.num_color_channels == 3 ? ".ppm" : ".pgm";
-  }
-
-  std::unique_ptr<jpegli::extras::Encoder> encoder =
-      jpegli::extras::Encoder::FromExtension(extension);
-  if (encoder == nullptr) {
-    fprintf(stderr, "Can't decode to the file extension '%s'\n",
-            extension.c_str());
-    return EXIT_FAILURE;
-  }
-  jpegli::extras::EncodedImage encoded_image;
-  if (!encoder->Encode(ppf, &encoded_image, nullptr) ||
-      encoded_image.bitstreams.empty()) {
-    fprintf(stderr, "Encode failed\n");
-    return EXIT_FAILURE;
-  }
-  if (!WriteFile(filename_out, encoded_image.bitstreams[0])) {
-    fprintf(stderr, "Failed to write output file %s\n", filename_out.c_str());
+  if (!WriteOutput(ppf, extension, filename_out)) {
     return EXIT_FAILURE;
   }
 
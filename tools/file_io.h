@@ -13,12 +13,14 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
-#include <list>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "lib/base/compiler_specific.h"
+#include "lib/base/span.h"
+#include "lib/base/status.h"
+#include "lib/extras/mmap.h"
 
 #ifdef _WIN32
 #include <fcntl.h>
@@ -86,33 +88,19 @@ static inline bool ReadFile(FileWrapper& f,
   // Get size of file in bytes
   const int64_t size = f.size();
   if (size < 0) {
-    // Size is unknown, loop reading chunks until EOF.
-    bytes->clear();
-    std::list<std::vector<uint8_t>> chunks;
-
+    // Size is unknown (e.g. a pipe), read until EOF, growing the buffer
+    // geometrically.
     size_t total_size = 0;
+    bytes->resize(16 * 1024);
     while (true) {
-      std::vector<uint8_t> chunk(16 * 1024);
-      const size_t bytes_read = fread(chunk.data(), 1, chunk.size(), f);
-      if (ferror(f) || bytes_read > chunk.size()) {
-        return false;
-      }
-
-      chunk.resize(bytes_read);
+      if (total_size == bytes->size()) bytes->resize(2 * bytes->size());
+      const size_t bytes_read = fread(bytes->data() + total_size, 1,
+                                      bytes->size() - total_size, f);
+      if (ferror(f)) return false;
       total_size += bytes_read;
-      if (bytes_read != 0) {
-        chunks.emplace_back(std::move(chunk));
-      }
-      if (feof(f)) {
-        break;
-      }
+      if (feof(f)) break;
     }
     bytes->resize(total_size);
-    size_t pos = 0;
-    for (const auto& chunk : chunks) {
-      memcpy(bytes->data() + pos, chunk.data(), chunk.size());
-      pos += chunk.size();
-    }
   } else {
     // Size is known, read the file directly.
     bytes->resize(static_cast<size_t>(size));
@@ -131,6 +119,37 @@ static inline bool ReadFile(const std::string& filename,
   return ReadFile(f, bytes);
 }
 
+// Contents of an input file. Regular files are memory mapped, which avoids
+// copying them and lets repeated runs read them from the page cache; other
+// inputs (e.g. "-" for stdin) are read into memory. An instance can be reused
+// for several files, bytes() is valid until the next Open().
+class InputFile {
+ public:
+  bool Open(const std::string& pathname) {
+    mapped_ = jpegli::MemoryMappedFile();
+    if (pathname != "-" && Map(pathname)) {
+      bytes_ = jpegli::Bytes(mapped_.data(), mapped_.size());
+      return true;
+    }
+    if (!ReadFile(pathname, &buffer_)) return false;
+    bytes_ = jpegli::Bytes(buffer_);
+    return true;
+  }
+
+  jpegli::Bytes bytes() const { return bytes_; }
+
+ private:
+  jpegli::Status Map(const std::string& pathname) {
+    JPEGLI_ASSIGN_OR_RETURN(mapped_,
+                            jpegli::MemoryMappedFile::Init(pathname.c_str()));
+    return true;
+  }
+
+  jpegli::MemoryMappedFile mapped_;
+  std::vector<uint8_t> buffer_;
+  jpegli::Bytes bytes_;
+};
+
 template <typename ContainerType>
 static inline bool WriteFile(const std::string& filename,
                              const ContainerType& bytes) {
@@ -0,0 +1,187 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package org.jpeg.jpegli.wrapper;
+
+import java.io.IOException;
+import java.lang.ref.Cleaner;
+import java.lang.ref.Reference;
+import java.nio.ByteBuffer;
+
+/**
+ * Jpegli JNI decoder wrapper.
+ *
+ * <p>Each instance owns a native decompress context that is reused across decode calls. Instances
+ * are not thread-safe; use {@link #forCurrentThread()} to get a per-thread instance. The native
+ * context is released by {@link #close()}, or when the instance becomes unreachable.
+ */
+public class Decoder implements AutoCloseable {
+  static {
+    JniHelper.ensureInitialized();
+  }
+
+  /** Dimensions of the decoded image. */
+  public static class Info {
+    public final int width;
+    public final int height;
+
+    Info(int width, int height) {
+      this.width = width;
+      this.height = height;
+    }
+  }
+
+  private static final Cleaner CLEANER = Cleaner.create();
+
+  private static final ThreadLocal<Decoder> THREAD_DECODER = new ThreadLocal<>();
+
+  /** Destroys the native context; must not refer to the Decoder, so that it can be collected. */
+  private static class NativeState implements Runnable {
+    long handle;
+
+    NativeState(long handle) {
+      this.handle = handle;
+    }
+
+    @Override
+    public void run() {
+      if (handle != 0) {
+        nativeDestroy(handle);
+        handle = 0;
+      }
+    }
+  }
+
+  private final NativeState state;
+  private final Cleaner.Cleanable cleanable;
+  private final boolean threadOwned;
+
+  public Decoder() {
+    this(false);
+  }
+
+  private Decoder(boolean threadOwned) {
+    long handle = nativeCreate();
+    if (handle == 0) {
+      throw new IllegalStateException("Failed to create native decoder");
+    }
+    this.state = new NativeState(handle);
+    this.cleanable = CLEANER.register(this, state);
+    this.threadOwned = threadOwned;
+  }
+
+  /**
+   * Returns a decoder owned by the current thread. Its native context is released by {@link
+   * #releaseForCurrentThread()}, or after the thread has terminated; {@link #close()} does nothing
+   * on it.
+   */
+  public static Decoder forCurrentThread() {
+    Decoder decoder = THREAD_DECODER.get();
+    if (decoder == null) {
+      decoder = new Decoder(true);
+      THREAD_DECODER.set(decoder);
+    }
+    return decoder;
+  }
+
+  /** Releases the decoder of the current thread, if any. */
+  public static void releaseForCurrentThread() {
+    Decoder decoder = THREAD_DECODER.get();
+    if (decoder != null) {
+      THREAD_DECODER.remove();
+      decoder.cleanable.clean();
+    }
+  }
+
+  @Override
+  public void close() {
+    // The decoder of a thread can be shared by several users of that thread, so closing it
+    // through one of them would break the others.
+    if (!threadOwned) {
+      cleanable.clean();
+    }
+  }
+
+  private static native long nativeCreate();
+
+  private static native void nativeDestroy(long handle);
+
+  private static native int nativeDecode(long handle, byte[] jpegArray, ByteBuffer jpegBuffer,
+      int jpegSize, int scaleNum, int scaleDenom, int[] info, int[] outArray,
+      ByteBuffer outBuffer);
+
+  /**
+   * Returns the dimensions of the image after scaling by scaleNum / scaleDenom, without decoding
+   * it.
+   */
+  public Info getInfo(byte[] jpeg, int scaleNum, int scaleDenom) throws IOException {
+    return run(jpeg, null, jpeg == null ? 0 : jpeg.length, scaleNum, scaleDenom, null, null);
+  }
+
+  /** Same as above, for JPEG data in the first jpegSize bytes of a direct buffer. */
+  public Info getInfo(ByteBuffer jpeg, int jpegSize, int scaleNum, int scaleDenom)
+      throws IOException {
+    return run(null, checkDirect(jpeg), jpegSize, scaleNum, scaleDenom, null, null);
+  }
+
+  /**
+   * Decodes the image, scaled by scaleNum / scaleDenom, into an array of ARGB ints with no row
+   * padding. The array must have at least width * height elements.
+   */
+  public Info decode(byte[] jpeg, int scaleNum, int scaleDenom, int[] output)
+      throws IOException {
+    if (output == null) {
+      throw new IllegalArgumentException("output is null");
+    }
+    return run(jpeg, null, jpeg == null ? 0 : jpeg.length, scaleNum, scaleDenom, output, null);
+  }
+
+  /**
+   * Decodes the image, scaled by scaleNum / scaleDenom, into a direct buffer of 4-byte pixels in
+   * B, G, R, A order (i.e. the memory layout of ARGB ints on little-endian platforms) with no row
+   * padding, starting at the beginning of the buffer.
+   */
+  public Info decode(ByteBuffer jpeg, int jpegSize, int scaleNum, int scaleDenom,
+      ByteBuffer output) throws IOException {
+    return run(null, checkDirect(jpeg), jpegSize, scaleNum, scaleDenom, null,
+        checkDirect(output));
+  }
+
+  private static ByteBuffer checkDirect(ByteBuffer buffer) {
+    if (buffer == null) {
+      throw new IllegalArgumentException("buffer is null");
+    }
+    if (!buffer.isDirect()) {
+      throw new IllegalArgumentException("buffer is not direct");
+    }
+    return buffer;
+  }
+
+  private Info run(byte[] jpegArray, ByteBuffer jpegBuffer, int jpegSize, int scaleNum,
+      int scaleDenom, int[] outArray, ByteBuffer outBuffer) throws IOException {
+    if (state.handle == 0) {
+      throw new IllegalStateException("Decoder is closed");
+    }
+    if (jpegArray == null && jpegBuffer == null) {
+      throw new IllegalArgumentException("jpeg is null");
+    }
+    if ((jpegSize <= 0) || (scaleNum <= 0) || (scaleDenom <= 0)) {
+      throw new IllegalArgumentException("invalid parameters");
+    }
+    int[] info = new int[2];
+    int status;
+    try {
+      status = nativeDecode(state.handle, jpegArray, jpegBuffer, jpegSize, scaleNum, scaleDenom,
+          info, outArray, outBuffer);
+    } finally {
+      // Otherwise the native context could be destroyed by the cleaner during the call.
+      Reference.reachabilityFence(this);
+    }
+    if (status != 0) {
+      throw new IOException("Jpegli wrapper nativeDecode return code: " + status);
+    }
+    return new Info(info[0], info[1]);
+  }
+}
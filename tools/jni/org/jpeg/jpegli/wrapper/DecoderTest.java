@@ -0,0 +1,130 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+package org.jpeg.jpegli.wrapper;
+
+import java.io.ByteArrayOutputStream;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/**
+ * Tests for jpegli decoder wrapper.
+ */
+public class DecoderTest {
+  static void checkTrue(boolean condition) {
+    if (!condition) {
+      throw new IllegalStateException("check failed");
+    }
+  }
+
+  static int[] makePixels(int width, int height) {
+    int[] pixels = new int[width * height];
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        pixels[x + width * y] = 0xFF000000 | (x * 3) | ((y * 2) << 8) | ((x + y) << 16);
+      }
+    }
+    return pixels;
+  }
+
+  static byte[] encode(int[] pixels, int width, int height) throws IOException {
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    Encoder.encode(pixels, width, height, 95, out);
+    return out.toByteArray();
+  }
+
+  static void checkClose(int expected, int actual) {
+    for (int shift = 0; shift < 32; shift += 8) {
+      int diff = ((expected >>> shift) & 0xFF) - ((actual >>> shift) & 0xFF);
+      checkTrue(Math.abs(diff) <= 8);
+    }
+  }
+
+  static void testRoundtrip() throws IOException {
+    int width = 71;
+    int height = 43;
+    int[] pixels = makePixels(width, height);
+    byte[] jpeg = encode(pixels, width, height);
+
+    Decoder decoder = Decoder.forCurrentThread();
+    Decoder.Info info = decoder.getInfo(jpeg, 1, 1);
+    checkTrue(info.width == width && info.height == height);
+
+    int[] decoded = new int[width * height];
+    info = decoder.decode(jpeg, 1, 1, decoded);
+    checkTrue(info.width == width && info.height == height);
+    for (int i = 0; i < pixels.length; ++i) {
+      checkClose(pixels[i], decoded[i]);
+    }
+
+    // Same result when decoding from and to direct buffers.
+    ByteBuffer jpegBuffer = ByteBuffer.allocateDirect(jpeg.length);
+    jpegBuffer.put(jpeg);
+    ByteBuffer output =
+        ByteBuffer.allocateDirect(4 * width * height).order(ByteOrder.LITTLE_ENDIAN);
+    info = decoder.decode(jpegBuffer, jpeg.length, 1, 1, output);
+    checkTrue(info.width == width && info.height == height);
+    for (int i = 0; i < decoded.length; ++i) {
+      checkTrue(output.getInt(4 * i) == decoded[i]);
+    }
+  }
+
+  static void testScaled() throws IOException {
+    int width = 64;
+    int height = 48;
+    byte[] jpeg = encode(makePixels(width, height), width, height);
+    try (Decoder decoder = new Decoder()) {
+      Decoder.Info info = decoder.getInfo(jpeg, 1, 2);
+      checkTrue(info.width == width / 2 && info.height == height / 2);
+      int[] decoded = new int[info.width * info.height];
+      info = decoder.decode(jpeg, 1, 2, decoded);
+      checkTrue(info.width == width / 2 && info.height == height / 2);
+      // Too small output.
+      boolean failed = false;
+      try {
+        decoder.decode(jpeg, 1, 1, decoded);
+      } catch (IOException ex) {
+        failed = true;
+      }
+      checkTrue(failed);
+      // The context is still usable after an error.
+      info = decoder.decode(jpeg, 1, 2, decoded);
+      checkTrue(info.width == width / 2);
+    }
+  }
+
+  static void testThreadDecoder() throws IOException {
+    int width = 32;
+    int height = 16;
+    byte[] jpeg = encode(makePixels(width, height), width, height);
+    Decoder decoder = Decoder.forCurrentThread();
+    checkTrue(Decoder.forCurrentThread() == decoder);
+    // Closing the decoder of the thread does not break its other users.
+    try (Decoder shared = Decoder.forCurrentThread()) {
+      checkTrue(shared.getInfo(jpeg, 1, 1).width == width);
+    }
+    checkTrue(decoder.getInfo(jpeg, 1, 1).width == width);
+    Decoder.releaseForCurrentThread();
+    boolean failed = false;
+    try {
+      decoder.getInfo(jpeg, 1, 1);
+    } catch (IllegalStateException ex) {
+      failed = true;
+    }
+    checkTrue(failed);
+    Decoder other = Decoder.forCurrentThread();
+    checkTrue(other != decoder);
+    checkTrue(other.getInfo(jpeg, 1, 1).height == height);
+    Decoder.releaseForCurrentThread();
+  }
+
+  // Simple executable to avoid extra dependencies.
+  public static void main(String[] args) throws IOException {
+    testRoundtrip();
+    testScaled();
+    testThreadDecoder();
+  }
+}
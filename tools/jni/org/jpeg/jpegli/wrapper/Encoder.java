@@ -7,6 +7,7 @@ package org.jpeg.jpegli.wrapper;
 
 import java.io.IOException;
 import java.io.OutputStream;
+import java.nio.ByteBuffer;
 import java.nio.channels.Channels;
 import java.nio.channels.WritableByteChannel;
 
@@ -19,19 +20,71 @@ public class Encoder {
   /** Utility library, disable object construction. */
   private Encoder() {}
 
+  /** Chroma subsampling of YCbCr output. */
+  public enum ChromaSubsampling {
+    YUV444,
+    YUV422,
+    YUV420,
+  }
+
+  /** Trade-off between latency and size of the output. */
+  public enum Mode {
+    /** Baseline JPEG; output is written while the image is being encoded. */
+    STREAMING,
+    /** Progressive JPEG with optimized Huffman codes; output is written at the end. */
+    SMALLEST_SIZE,
+  }
+
   // NB(eustas): moving serialized to native might improve performance
   public static class Config {
+    // NB: order must match ConfigOption in encoder_jni.cc
     private enum Options {
       QUALITY,
+      DISTANCE,
+      CHROMA_SUBSAMPLING,
+      ADAPTIVE_QUANTIZATION,
+      RESTART_INTERVAL,
+      MODE,
     }
 
     private int[] serialized = new int[33];
 
+    /** Sets libjpeg-style quality in [1, 100]; either quality or distance is mandatory. */
     public Config setQuality(int quality) {
       setOption(Options.QUALITY, quality);
       return this;
     }
 
+    /** Sets butteraugli distance in (0, 25]; takes precedence over quality. */
+    public Config setDistance(float distance) {
+      setOption(Options.DISTANCE, Float.floatToIntBits(distance));
+      return this;
+    }
+
+    /** Default is YUV444. */
+    public Config setChromaSubsampling(ChromaSubsampling subsampling) {
+      setOption(Options.CHROMA_SUBSAMPLING, subsampling.ordinal());
+      return this;
+    }
+
+    /** Enabled by default. */
+    public Config setAdaptiveQuantization(boolean enabled) {
+      setOption(Options.ADAPTIVE_QUANTIZATION, enabled ? 1 : 0);
+      return this;
+    }
+
+    /** Restart interval in MCUs; 0 (default) disables restart markers. */
+    public Config setRestartInterval(int mcus) {
+      setOption(Options.RESTART_INTERVAL, mcus);
+      return this;
+    }
+
+    /** Default is STREAMING. */
+    public Config setMode(Mode mode) {
+      setOption(Options.MODE, mode.ordinal());
+      return this;
+    }
+
     private void setOption(Options option, int value) {
       int index = option.ordinal();
       serialized[32] |= 1 << index;
@@ -44,6 +97,9 @@ public class Encoder {
   private static native int nativeEncode(
       int width, int height, int[] config, int[] data, WritableByteChannel output);
 
+  private static native int nativeEncodeBuffer(
+      int width, int height, int[] config, ByteBuffer data, WritableByteChannel output);
+
   private static class InitHelper {
     private static final int STATUS = nativeInit();
   }
@@ -76,6 +132,37 @@ public class Encoder {
     }
   }
 
+  /**
+   * One-shot encoding of pixels stored in a direct buffer.
+   *
+   * <p>Pixels are 4 bytes each, in B, G, R, A order (i.e. the memory layout of ARGB ints on
+   * little-endian platforms), rows are not padded and start at the beginning of the buffer; the
+   * alpha channel is ignored. The pixels are read without being copied.
+   */
+  public static void encode(ByteBuffer color, int width, int height, Config config,
+      WritableByteChannel output) throws IOException {
+    if (!ensureInitialized()) {
+      throw new IllegalStateException("Native library not initialized");
+    }
+    if (output == null) {
+      throw new IllegalArgumentException("output is null");
+    }
+    if (color == null) {
+      throw new IllegalArgumentException("color is null");
+    }
+    if (!color.isDirect()) {
+      throw new IllegalArgumentException("color is not a direct buffer");
+    }
+    if ((width <= 0) || (height <= 0) || (color.capacity() / 4 / width < height)) {
+      throw new IllegalArgumentException("invalid image dimensions");
+    }
+
+    int status = nativeEncodeBuffer(width, height, config.serialized, color, output);
+    if (status != 0) {
+      throw new IOException("Jpegli wrapper nativeProcess return code: " + status);
+    }
+  }
+
   /** One-shot encoding. */
   public static void encode(int[] color, int width, int height, int quality, OutputStream output)
       throws IOException {
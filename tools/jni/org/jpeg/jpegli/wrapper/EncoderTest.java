@@ -9,6 +9,11 @@ import static java.nio.charset.StandardCharsets.UTF_8;
 
 import java.io.ByteArrayOutputStream;
 import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.channels.Channels;
+import java.nio.channels.WritableByteChannel;
+import java.util.Arrays;
 import java.util.Base64;
 
 /**
@@ -38,8 +43,99 @@ public class EncoderTest {
     System.err.println("Base64: " + new String(encoded, UTF_8));
   }
 
+  static void testDirectBuffer() throws IOException {
+    int width = 67;
+    int height = 35;
+    int[] pixels = new int[width * height];
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        pixels[x + width * y] = (x * 3) + ((y * 7) << 8) + (((x + y) * 2) << 16);
+      }
+    }
+    ByteBuffer buffer =
+        ByteBuffer.allocateDirect(4 * width * height).order(ByteOrder.LITTLE_ENDIAN);
+    buffer.asIntBuffer().put(pixels);
+    Encoder.Config config = new Encoder.Config().setQuality(90);
+
+    ByteArrayOutputStream expected = new ByteArrayOutputStream();
+    try (WritableByteChannel channel = Channels.newChannel(expected)) {
+      Encoder.encode(pixels, width, height, config, channel);
+    }
+    ByteArrayOutputStream actual = new ByteArrayOutputStream();
+    try (WritableByteChannel channel = Channels.newChannel(actual)) {
+      Encoder.encode(buffer, width, height, config, channel);
+    }
+    checkTrue(expected.size() > 0);
+    checkTrue(Arrays.equals(expected.toByteArray(), actual.toByteArray()));
+  }
+
+  /** Returns the offset of the first marker of the given type, or -1. */
+  static int findMarker(byte[] jpeg, int type) {
+    int pos = 2; // Skip SOI.
+    while (pos + 4 <= jpeg.length && (jpeg[pos] & 0xFF) == 0xFF) {
+      int marker = jpeg[pos + 1] & 0xFF;
+      if (marker == type) {
+        return pos;
+      }
+      if (marker == 0xDA) {
+        break; // Entropy coded data follows.
+      }
+      pos += 2 + (((jpeg[pos + 2] & 0xFF) << 8) | (jpeg[pos + 3] & 0xFF));
+    }
+    return -1;
+  }
+
+  static void testConfig() throws IOException {
+    int width = 64;
+    int height = 64;
+    int[] pixels = new int[width * height];
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        pixels[x + width * y] = (x * 4) + ((y * 4) << 8) + ((x + y) << 16);
+      }
+    }
+
+    Encoder.Config streaming = new Encoder.Config().setQuality(90);
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    try (WritableByteChannel channel = Channels.newChannel(out)) {
+      Encoder.encode(pixels, width, height, streaming, channel);
+    }
+    byte[] jpeg = out.toByteArray();
+    int sof = findMarker(jpeg, 0xC0);
+    checkTrue(sof > 0);
+    // Sampling factors of the first component.
+    checkTrue(jpeg[sof + 11] == 0x11);
+
+    Encoder.Config smallest = new Encoder.Config()
+                                  .setDistance(1.5f)
+                                  .setChromaSubsampling(Encoder.ChromaSubsampling.YUV420)
+                                  .setAdaptiveQuantization(false)
+                                  .setRestartInterval(4)
+                                  .setMode(Encoder.Mode.SMALLEST_SIZE);
+    out = new ByteArrayOutputStream();
+    try (WritableByteChannel channel = Channels.newChannel(out)) {
+      Encoder.encode(pixels, width, height, smallest, channel);
+    }
+    jpeg = out.toByteArray();
+    sof = findMarker(jpeg, 0xC2);
+    checkTrue(sof > 0);
+    checkTrue(jpeg[sof + 11] == 0x22);
+    checkTrue(findMarker(jpeg, 0xDD) > 0);
+
+    // Either quality or distance is mandatory.
+    boolean failed = false;
+    try (WritableByteChannel channel = Channels.newChannel(new ByteArrayOutputStream())) {
+      Encoder.encode(pixels, width, height, new Encoder.Config(), channel);
+    } catch (IOException ex) {
+      failed = true;
+    }
+    checkTrue(failed);
+  }
+
   // Simple executable to avoid extra dependencies.
   public static void main(String[] args) throws IOException {
     test64x64();
+    testDirectBuffer();
+    testConfig();
   }
 }
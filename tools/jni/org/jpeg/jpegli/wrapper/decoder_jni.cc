@@ -0,0 +1,275 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "decoder_jni.h"  // NOLINT: build/include
+
+#include <jni.h>
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+
+#include "lib/base/byte_order.h"
+#include "lib/jpegli/common.h"
+#include "lib/jpegli/decode.h"
+
+namespace org_jpeg_jpegli_wrapper {
+namespace {
+
+jint JNI_VERSION = JNI_VERSION_1_6;
+
+enum ReturnCode {
+  OK = 0,
+  ERROR_ALLOCATION = -1,
+  ERROR_INVALID_PARAMS = -2,
+  ERROR_INTERNAL = -3
+};
+
+#define RETURN_ERROR(T) \
+  return fprintf(stderr, "%s:%d: error " #T "\n", __FILE__, __LINE__), ERROR_##T
+
+// Unlike the encoder, the decompress object survives errors, so that it can be
+// reused for the next image.
+void ExitHandler(j_common_ptr cinfo) {
+  (*cinfo->err->output_message)(cinfo);
+  jmp_buf* env = reinterpret_cast<jmp_buf*>(cinfo->client_data);
+  longjmp(*env, 1);
+}
+
+// Number of rows passed to a single jpegli_read_scanlines call.
+constexpr size_t kMaxLines = 16;
+
+// Output of a single decode call.
+struct Output {
+  uint8_t* pixels;  // nullptr if only the dimensions are requested
+  size_t size;
+  J_COLOR_SPACE color_space;
+  jint width;
+  jint height;
+};
+
+// Native decompress context; owned by a Java Decoder instance and used by one
+// thread at a time.
+class Decoder {
+ public:
+  ~Decoder() {
+    if (created_) jpegli_destroy_decompress(&cinfo_);
+  }
+
+  bool Init() {
+    cinfo_.err = jpegli_std_error(&err_);
+    cinfo_.client_data = reinterpret_cast<void*>(&env_);
+    cinfo_.err->error_exit = &ExitHandler;
+    if (setjmp(env_)) {
+      return false;
+    }
+    jpegli_create_decompress(&cinfo_);
+    created_ = true;
+    return true;
+  }
+
+  int Run(const uint8_t* jpeg, size_t jpeg_size, jint scale_num,
+          jint scale_denom, Output* output) {
+    if (setjmp(env_)) {
+      jpegli_abort_decompress(&cinfo_);
+      RETURN_ERROR(INTERNAL);
+    }
+    jpegli_mem_src(&cinfo_, jpeg, jpeg_size);
+    jpegli_read_header(&cinfo_, TRUE);
+    cinfo_.scale_num = scale_num;
+    cinfo_.scale_denom = scale_denom;
+    cinfo_.out_color_space = output->color_space;
+    jpegli_calc_output_dimensions(&cinfo_);
+    output->width = cinfo_.output_width;
+    output->height = cinfo_.output_height;
+    if (output->pixels == nullptr) {
+      jpegli_abort_decompress(&cinfo_);
+      return OK;
+    }
+    size_t stride = cinfo_.output_width * 4;
+    if (output->size / stride < cinfo_.output_height) {
+      jpegli_abort_decompress(&cinfo_);
+      RETURN_ERROR(INVALID_PARAMS);
+    }
+
+    jpegli_start_decompress(&cinfo_);
+    while (cinfo_.output_scanline < cinfo_.output_height) {
+      size_t lines_left = cinfo_.output_height - cinfo_.output_scanline;
+      size_t num_lines = std::min(kMaxLines, lines_left);
+      for (size_t i = 0; i < num_lines; ++i) {
+        rows_[i] = output->pixels + (cinfo_.output_scanline + i) * stride;
+      }
+      jpegli_read_scanlines(&cinfo_, rows_, num_lines);
+    }
+    jpegli_finish_decompress(&cinfo_);
+    return OK;
+  }
+
+ private:
+  bool created_ = false;
+  jpeg_decompress_struct cinfo_ = {};
+  jpeg_error_mgr err_;
+  jmp_buf env_;
+  JSAMPROW rows_[kMaxLines];
+};
+
+char* kCreateName = const_cast<char*>("nativeCreate");
+char* kCreateSig = const_cast<char*>("()J");
+char* kDestroyName = const_cast<char*>("nativeDestroy");
+char* kDestroySig = const_cast<char*>("(J)V");
+char* kDecodeName = const_cast<char*>("nativeDecode");
+char* kDecodeSig = const_cast<char*>(
+    "(J[BLjava/nio/ByteBuffer;III[I[ILjava/nio/ByteBuffer;)I");
+
+const JNINativeMethod kDecoderMethods[] = {
+    {kCreateName, kCreateSig,
+     reinterpret_cast<void*>(
+         Java_org_jpeg_jpegli_wrapper_Decoder_nativeCreate)},
+    {kDestroyName, kDestroySig,
+     reinterpret_cast<void*>(
+         Java_org_jpeg_jpegli_wrapper_Decoder_nativeDestroy)},
+    {kDecodeName, kDecodeSig,
+     reinterpret_cast<void*>(
+         Java_org_jpeg_jpegli_wrapper_Decoder_nativeDecode)}};
+
+const size_t kNumDecoderMethods = 3;
+
+}  // namespace
+
+jint DecoderJniRegister(JavaVM* vm) {
+  JNIEnv* env;
+  if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION) != JNI_OK) {
+    return JNI_ERR;
+  }
+
+  jclass localClassRef = env->FindClass("org/jpeg/jpegli/wrapper/Decoder");
+  if (localClassRef == nullptr || env->ExceptionCheck()) {
+    return JNI_ERR;
+  }
+  if (env->RegisterNatives(localClassRef, kDecoderMethods, kNumDecoderMethods) <
+      0) {
+    return JNI_ERR;
+  }
+  env->DeleteLocalRef(localClassRef);
+  return JNI_VERSION;
+}
+
+}  // namespace org_jpeg_jpegli_wrapper
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+JNIEXPORT jlong JNICALL Java_org_jpeg_jpegli_wrapper_Decoder_nativeCreate(
+    JNIEnv* env, jobject /*jobj*/) {
+  using org_jpeg_jpegli_wrapper::Decoder;
+
+  Decoder* decoder = new (std::nothrow) Decoder();
+  if (decoder == nullptr) return 0;
+  if (!decoder->Init()) {
+    delete decoder;
+    return 0;
+  }
+  return reinterpret_cast<jlong>(decoder);
+}
+
+JNIEXPORT void JNICALL Java_org_jpeg_jpegli_wrapper_Decoder_nativeDestroy(
+    JNIEnv* env, jobject /*jobj*/, jlong handle) {
+  using org_jpeg_jpegli_wrapper::Decoder;
+
+  delete reinterpret_cast<Decoder*>(handle);
+}
+
+JNIEXPORT jint JNICALL Java_org_jpeg_jpegli_wrapper_Decoder_nativeDecode(
+    JNIEnv* env, jobject /*jobj*/, jlong handle, jbyteArray jpeg_array,
+    jobject jpeg_buffer, jint jpeg_size, jint scale_num, jint scale_denom,
+    jintArray info, jintArray out_array, jobject out_buffer) {
+  using org_jpeg_jpegli_wrapper::Decoder;
+  using org_jpeg_jpegli_wrapper::ERROR_INTERNAL;
+  using org_jpeg_jpegli_wrapper::ERROR_INVALID_PARAMS;
+  using org_jpeg_jpegli_wrapper::OK;
+  using org_jpeg_jpegli_wrapper::Output;
+
+  Decoder* decoder = reinterpret_cast<Decoder*>(handle);
+  if (decoder == nullptr || jpeg_size <= 0 || scale_num <= 0 ||
+      scale_denom <= 0) {
+    RETURN_ERROR(INVALID_PARAMS);
+  }
+  if (jpeg_buffer != nullptr &&
+      env->GetDirectBufferCapacity(jpeg_buffer) < jpeg_size) {
+    RETURN_ERROR(INVALID_PARAMS);
+  }
+  if (jpeg_array != nullptr && env->GetArrayLength(jpeg_array) < jpeg_size) {
+    RETURN_ERROR(INVALID_PARAMS);
+  }
+  size_t out_array_size = 0;
+  if (out_array != nullptr) {
+    out_array_size = static_cast<size_t>(env->GetArrayLength(out_array)) * 4;
+  }
+
+  Output output = {};
+  // ARGB ints are BGRA bytes in memory on little-endian platforms; direct
+  // buffers are always filled in BGRA byte order.
+  output.color_space =
+      (out_array == nullptr || IsLittleEndian()) ? JCS_EXT_BGRA : JCS_EXT_ARGB;
+  if (out_buffer != nullptr) {
+    output.pixels =
+        reinterpret_cast<uint8_t*>(env->GetDirectBufferAddress(out_buffer));
+    jlong capacity = env->GetDirectBufferCapacity(out_buffer);
+    if (output.pixels == nullptr || capacity < 0) {
+      RETURN_ERROR(INVALID_PARAMS);
+    }
+    output.size = capacity;
+  }
+
+  // The arrays are pinned or copied for the whole decode, which can take a
+  // while for large images, so they are not accessed in a critical region,
+  // where the garbage collector could be blocked for all that time.
+  jbyte* jpeg_elements = nullptr;
+  const uint8_t* jpeg = nullptr;
+  if (jpeg_buffer != nullptr) {
+    jpeg = reinterpret_cast<const uint8_t*>(
+        env->GetDirectBufferAddress(jpeg_buffer));
+  } else if (jpeg_array != nullptr) {
+    jpeg_elements = env->GetByteArrayElements(jpeg_array, nullptr);
+    jpeg = reinterpret_cast<const uint8_t*>(jpeg_elements);
+  }
+  if (jpeg == nullptr) {
+    RETURN_ERROR(INVALID_PARAMS);
+  }
+  jint* out_elements = nullptr;
+  if (out_array != nullptr) {
+    out_elements = env->GetIntArrayElements(out_array, nullptr);
+    output.pixels = reinterpret_cast<uint8_t*>(out_elements);
+    output.size = out_array_size;
+  }
+  int status = ERROR_INTERNAL;
+  if (out_array == nullptr || out_elements != nullptr) {
+    status = decoder->Run(jpeg, jpeg_size, scale_num, scale_denom, &output);
+  }
+  if (out_elements != nullptr) {
+    // Nothing needs to be copied back if the decoding failed.
+    env->ReleaseIntArrayElements(out_array, out_elements,
+                                 status == OK ? 0 : JNI_ABORT);
+  }
+  if (jpeg_elements != nullptr) {
+    env->ReleaseByteArrayElements(jpeg_array, jpeg_elements, JNI_ABORT);
+  }
+  if (status != OK) return status;
+
+  jint dimensions[2] = {output.width, output.height};
+  env->SetIntArrayRegion(info, 0, 2, dimensions);
+  if (env->ExceptionCheck()) {
+    RETURN_ERROR(INVALID_PARAMS);
+  }
+  return OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,47 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef JPEGLI_TOOLS_JNI_ORG_JPEG_JPEGLI_WRAPPER_DECODER_JNI
+#define JPEGLI_TOOLS_JNI_ORG_JPEG_JPEGLI_WRAPPER_DECODER_JNI
+
+#include <jni.h>
+
+namespace org_jpeg_jpegli_wrapper {
+jint DecoderJniRegister(JavaVM* vm);
+}  // namespace org_jpeg_jpegli_wrapper
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Create a native decompress context; returns 0 on failure.
+ */
+JNIEXPORT jlong JNICALL Java_org_jpeg_jpegli_wrapper_Decoder_nativeCreate(
+    JNIEnv* env, jobject /*jobj*/);
+
+/**
+ * Release a native decompress context.
+ */
+JNIEXPORT void JNICALL Java_org_jpeg_jpegli_wrapper_Decoder_nativeDestroy(
+    JNIEnv* env, jobject /*jobj*/, jlong handle);
+
+/**
+ * Decode image with jpegli.
+ *
+ * Exactly one of jpeg_array / jpeg_buffer is non-null; at most one of
+ * out_array / out_buffer is non-null. If both are null, only the output
+ * dimensions are stored to info.
+ */
+JNIEXPORT jint JNICALL Java_org_jpeg_jpegli_wrapper_Decoder_nativeDecode(
+    JNIEnv* env, jobject /*jobj*/, jlong handle, jbyteArray jpeg_array,
+    jobject jpeg_buffer, jint jpeg_size, jint scale_num, jint scale_denom,
+    jintArray info, jintArray out_array, jobject out_buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // JPEGLI_TOOLS_JNI_ORG_JPEG_JPEGLI_WRAPPER_DECODER_JNI
@@ -9,6 +9,7 @@
 
 #include <algorithm>
 #include <array>
+#include <cmath>
 #include <csetjmp>
 #include <cstddef>
 #include <cstdint>
@@ -17,6 +18,7 @@
 #include <memory>
 #include <new>
 
+#include "lib/base/byte_order.h"
 #include "lib/jpegli/common.h"
 #include "lib/jpegli/encode.h"
 
@@ -27,6 +29,9 @@ jint JNI_VERSION = JNI_VERSION_1_6;
 
 jclass JC_WritableByteChannel;
 jmethodID JMID_WritableByteChannel_write;
+jclass JC_Buffer;
+jmethodID JMID_Buffer_clear;
+jmethodID JMID_Buffer_limit;
 
 enum ReturnCode {
   OK = 0,
@@ -55,6 +60,8 @@ struct DestinationManager {
 
   JNIEnv* jenv;
   jobject sink;
+  // Direct ByteBuffer wrapping the whole output buffer; reused for all writes.
+  jobject byte_buffer = nullptr;
   bool has_error = false;
 
   DestinationManager() {
@@ -73,21 +80,32 @@ struct DestinationManager {
     if (to_write == 0) {
       return;
     }
-    jobject byte_buffer = jenv->NewDirectByteBuffer(output.get(), to_write);
-    if (byte_buffer == nullptr || jenv->ExceptionCheck()) {
+    if (!SetLimit(to_write)) {
       has_error = true;
       Rewind();
       return;
     }
     jint num_written =
         jenv->CallIntMethod(sink, JMID_WritableByteChannel_write, byte_buffer);
-    jenv->DeleteLocalRef(byte_buffer);
     if (num_written != static_cast<jint>(to_write) || jenv->ExceptionCheck()) {
       has_error = true;
     }
     Rewind();
   }
 
+  // Makes the first "size" bytes of the output buffer the remaining content of
+  // byte_buffer.
+  bool SetLimit(size_t size) {
+    jobject result = jenv->CallObjectMethod(byte_buffer, JMID_Buffer_clear);
+    if (jenv->ExceptionCheck()) return false;
+    jenv->DeleteLocalRef(result);
+    result = jenv->CallObjectMethod(byte_buffer, JMID_Buffer_limit,
+                                    static_cast<jint>(size));
+    if (jenv->ExceptionCheck()) return false;
+    jenv->DeleteLocalRef(result);
+    return true;
+  }
+
   static void init_destination(j_compress_ptr cinfo) {
     auto* self = reinterpret_cast<DestinationManager*>(cinfo->dest);
     self->Rewind();
@@ -109,22 +127,84 @@ struct DestinationManager {
 
 using Config = std::array<jint, 33>;
 
+// Indices of the options in Config; the last element is the bitmask of the
+// options present. Must match Encoder.Config.Options.
+enum ConfigOption {
+  CONFIG_QUALITY = 0,
+  CONFIG_DISTANCE = 1,
+  CONFIG_CHROMA_SUBSAMPLING = 2,
+  CONFIG_ADAPTIVE_QUANTIZATION = 3,
+  CONFIG_RESTART_INTERVAL = 4,
+  CONFIG_MODE = 5,
+};
+
+// Values of CONFIG_CHROMA_SUBSAMPLING; must match Encoder.ChromaSubsampling.
+constexpr size_t kLumaSamplingFactors[][2] = {{1, 1}, {2, 1}, {2, 2}};
+
+// Values of CONFIG_MODE; must match Encoder.Mode.
+enum EncodingMode {
+  // Baseline sequential with fixed Huffman codes; output is produced while the
+  // image is being encoded.
+  MODE_STREAMING = 0,
+  // Progressive with optimized Huffman codes; output is produced at the end.
+  MODE_SMALLEST_SIZE = 1,
+};
+
 class Encoder {
  public:
+  // Exactly one of "input" and "input_pixels" is used. The former is an array
+  // of ARGB ints, the latter points to 4-byte pixels in BGRA byte order.
   Encoder(JNIEnv* jenv, jint width, jint height, const Config& config,
-          jintArray input, jobject output)
-      : jenv_(jenv), width_(width), height_(height), input_(input) {
+          jintArray input, const uint8_t* input_pixels, jobject output)
+      : jenv_(jenv),
+        width_(width),
+        height_(height),
+        input_(input),
+        input_pixels_(input_pixels) {
     healthy_ = (static_cast<jint>(width_) == width) &&
                (static_cast<jint>(height_) == height);
 
     jint config_present = config[32];
-    if (config_present & 1) {
-      quality_ = config[0];
-      healthy_ &= (static_cast<jint>(quality_) == config[0]);
+    auto present = [config_present](ConfigOption option) {
+      return (config_present & (1 << option)) != 0;
+    };
+    if (present(CONFIG_QUALITY)) {
+      quality_ = config[CONFIG_QUALITY];
+      healthy_ &= (static_cast<jint>(quality_) == config[CONFIG_QUALITY]);
       healthy_ &= (quality_ >= 1 && quality_ <= 100);
-    } else {
-      healthy_ = false;  // quality is mandatory
     }
+    if (present(CONFIG_DISTANCE)) {
+      // Transferred as the bits of a float.
+      memcpy(&distance_, &config[CONFIG_DISTANCE], sizeof(distance_));
+      healthy_ &= std::isfinite(distance_) && distance_ > 0.0f &&
+                  distance_ <= 25.0f;
+    } else if (!present(CONFIG_QUALITY)) {
+      healthy_ = false;  // quality or distance is mandatory
+    }
+    if (present(CONFIG_CHROMA_SUBSAMPLING)) {
+      jint subsampling = config[CONFIG_CHROMA_SUBSAMPLING];
+      if (subsampling >= 0 && subsampling <= 2) {
+        h_sampling_ = kLumaSamplingFactors[subsampling][0];
+        v_sampling_ = kLumaSamplingFactors[subsampling][1];
+      } else {
+        healthy_ = false;
+      }
+    }
+    if (present(CONFIG_ADAPTIVE_QUANTIZATION)) {
+      adaptive_quantization_ = (config[CONFIG_ADAPTIVE_QUANTIZATION] != 0);
+    }
+    if (present(CONFIG_RESTART_INTERVAL)) {
+      jint restart_interval = config[CONFIG_RESTART_INTERVAL];
+      healthy_ &= (restart_interval >= 0 && restart_interval <= 65535);
+      restart_interval_ = restart_interval;
+    }
+    if (present(CONFIG_MODE)) {
+      mode_ = config[CONFIG_MODE];
+      healthy_ &= (mode_ == MODE_STREAMING || mode_ == MODE_SMALLEST_SIZE);
+    }
+    // Feeding the encoder one iMCU row at a time lets it emit output as soon
+    // as possible in streaming mode.
+    batch_lines_ = DCTSIZE * v_sampling_;
 
     dest_.jenv = jenv;
     dest_.sink = output;
@@ -136,7 +216,10 @@ class Encoder {
     output_buffer_size_ = output_buffer_tmp;
   }
 
-  ~Encoder() { jpegli_destroy_compress(&cinfo_); }
+  ~Encoder() {
+    jpegli_destroy_compress(&cinfo_);
+    if (dest_.byte_buffer != nullptr) jenv_->DeleteLocalRef(dest_.byte_buffer);
+  }
 
   int Run() {
     if (!healthy_) RETURN_ERROR(INVALID_PARAMS);
@@ -145,20 +228,24 @@ class Encoder {
                                                JSAMPROW[batch_lines_]};
     if (!batch_rows) RETURN_ERROR(ALLOCATION);
 
-    size_t input_stride = width_ * 4;
-    std::unique_ptr<uint8_t[]> batch{new (std::nothrow)
-                                         uint8_t[input_stride * batch_lines_]};
-    if (!batch) RETURN_ERROR(ALLOCATION);
-
-    size_t stride = width_ * 3;
-    for (size_t i = 0; i < batch_lines_; ++i) {
-      batch_rows[i] = batch.get() + i * stride;
+    // Pixels are passed to jpegli as they are, the 4-byte to 3-component
+    // conversion is done by its color transform.
+    size_t stride = width_ * 4;
+    std::unique_ptr<uint8_t[]> batch;
+    if (input_pixels_ == nullptr) {
+      batch.reset(new (std::nothrow) uint8_t[stride * batch_lines_]);
+      if (!batch) RETURN_ERROR(ALLOCATION);
     }
 
     dest_.output_size = output_buffer_size_;
     dest_.output = std::unique_ptr<uint8_t[]>{new (std::nothrow)
                                                   uint8_t[output_buffer_size_]};
     if (!dest_.output) RETURN_ERROR(ALLOCATION);
+    dest_.byte_buffer =
+        jenv_->NewDirectByteBuffer(dest_.output.get(), output_buffer_size_);
+    if (dest_.byte_buffer == nullptr || jenv_->ExceptionCheck()) {
+      RETURN_ERROR(ALLOCATION);
+    }
     dest_.Rewind();
 
     // Setup error handling.
@@ -174,23 +261,46 @@ class Encoder {
 
     cinfo_.image_width = width_;
     cinfo_.image_height = height_;
-    cinfo_.input_components = 3;
-    cinfo_.in_color_space = JCS_RGB;
+    cinfo_.input_components = 4;
+    // ARGB ints are BGRA bytes in memory on little-endian platforms.
+    cinfo_.in_color_space = (input_pixels_ != nullptr || IsLittleEndian())
+                                ? JCS_EXT_BGRX
+                                : JCS_EXT_XRGB;
     jpegli_set_defaults(&cinfo_);
-    jpegli_set_quality(&cinfo_, quality_, TRUE);
-    cinfo_.comp_info[0].v_samp_factor = v_sampling_[0];
-    jpegli_set_progressive_level(&cinfo_, 0);
-    cinfo_.optimize_coding = FALSE;
+    if (distance_ > 0.0f) {
+      jpegli_set_distance(&cinfo_, distance_, TRUE);
+    } else {
+      jpegli_set_quality(&cinfo_, quality_, TRUE);
+    }
+    cinfo_.comp_info[0].h_samp_factor = h_sampling_;
+    cinfo_.comp_info[0].v_samp_factor = v_sampling_;
+    jpegli_enable_adaptive_quantization(&cinfo_,
+                                        adaptive_quantization_ ? TRUE : FALSE);
+    cinfo_.restart_interval = restart_interval_;
+    if (mode_ == MODE_SMALLEST_SIZE) {
+      jpegli_set_progressive_level(&cinfo_, 2);
+      cinfo_.optimize_coding = TRUE;
+    } else {
+      jpegli_set_progressive_level(&cinfo_, 0);
+      cinfo_.optimize_coding = FALSE;
+    }
     jpegli_start_compress(&cinfo_, TRUE);
 
     while (cinfo_.next_scanline < cinfo_.image_height) {
       size_t lines_left = cinfo_.image_height - cinfo_.next_scanline;
       size_t num_lines = std::min(batch_lines_, lines_left);
-      // We use batch buffer both for temporary storage of input RGBA and pixel
-      // data passed to encoder.
-      if (!ReadBatch(cinfo_.next_scanline, num_lines,
-                     reinterpret_cast<jint*>(batch.get()), batch.get())) {
-        RETURN_ERROR(INTERNAL);
+      const uint8_t* pixels;
+      if (input_pixels_ != nullptr) {
+        pixels = input_pixels_ + cinfo_.next_scanline * stride;
+      } else {
+        if (!ReadBatch(cinfo_.next_scanline, num_lines,
+                       reinterpret_cast<jint*>(batch.get()))) {
+          RETURN_ERROR(INTERNAL);
+        }
+        pixels = batch.get();
+      }
+      for (size_t i = 0; i < num_lines; ++i) {
+        batch_rows[i] = const_cast<JSAMPROW>(pixels + i * stride);
       }
       size_t lines_done = 0;
       while (lines_done < num_lines) {
@@ -216,19 +326,12 @@ class Encoder {
   }
 
  private:
-  bool ReadBatch(size_t y0, size_t num_lines, jint* tmp_buffer,
-                 uint8_t* buffer) {
+  // The array can not be pinned with GetPrimitiveArrayCritical, since the
+  // output is written to a Java channel while the rows are being encoded.
+  bool ReadBatch(size_t y0, size_t num_lines, jint* buffer) {
     size_t num_pixels = num_lines * width_;
-    jenv_->GetIntArrayRegion(input_, y0 * width_, num_pixels, tmp_buffer);
-    if (jenv_->ExceptionCheck()) return false;
-    // TODO(eustas): speedup
-    for (size_t i = 0; i < num_pixels; ++i) {
-      // TODO(eustas): take care of endianness.
-      memcpy(buffer + 3 * i, tmp_buffer + i, 4);
-      // Convert BGRA input data to RGB.
-      std::swap(buffer[3 * i], buffer[3 * i + 2]);
-    }
-    return true;
+    jenv_->GetIntArrayRegion(input_, y0 * width_, num_pixels, buffer);
+    return !jenv_->ExceptionCheck();
   }
 
   // Interface
@@ -236,13 +339,18 @@ class Encoder {
   JNIEnv* jenv_;
   size_t width_;
   size_t height_;
-  size_t quality_;
-  // TODO(eustas): make configurable
-  size_t v_sampling_[3] = {1, 1, 1};
-  // TODO(eustas): depends on v_sampling_; make configurable
-  size_t batch_lines_ = 32;
+  size_t quality_ = 0;
+  float distance_ = 0.0f;  // 0 if quality is used instead
+  // Sampling factors of the luma component; chroma components use 1x1.
+  size_t h_sampling_ = 1;
+  size_t v_sampling_ = 1;
+  bool adaptive_quantization_ = true;
+  unsigned int restart_interval_ = 0;
+  jint mode_ = MODE_STREAMING;
+  size_t batch_lines_;
   size_t output_buffer_size_;
   jintArray input_;
+  const uint8_t* input_pixels_;
 
   // Jpegli encoder
   jpeg_compress_struct cinfo_ = {};
@@ -255,12 +363,19 @@ char* kEncodeName = const_cast<char*>("nativeEncode");
 char* kEncodeSig =
     const_cast<char*>("(II[I[ILjava/nio/channels/WritableByteChannel;)I");
 
+char* kEncodeBufferName = const_cast<char*>("nativeEncodeBuffer");
+char* kEncodeBufferSig = const_cast<char*>(
+    "(II[ILjava/nio/ByteBuffer;Ljava/nio/channels/WritableByteChannel;)I");
+
 const JNINativeMethod kEncoderMethods[] = {
     {kEncodeName, kEncodeSig,
      reinterpret_cast<void*>(
-         Java_org_jpeg_jpegli_wrapper_Encoder_nativeEncode)}};
+         Java_org_jpeg_jpegli_wrapper_Encoder_nativeEncode)},
+    {kEncodeBufferName, kEncodeBufferSig,
+     reinterpret_cast<void*>(
+         Java_org_jpeg_jpegli_wrapper_Encoder_nativeEncodeBuffer)}};
 
-const size_t kNumEncoderMethods = 1;
+const size_t kNumEncoderMethods = 2;
 
 }  // namespace
 
@@ -291,7 +406,10 @@ extern "C" {
 JNIEXPORT jint JNICALL
 Java_org_jpeg_jpegli_wrapper_Encoder_nativeInit(JNIEnv* env, jobject /*jobj*/) {
   using org_jpeg_jpegli_wrapper::ERROR_INTERNAL;
+  using org_jpeg_jpegli_wrapper::JC_Buffer;
   using org_jpeg_jpegli_wrapper::JC_WritableByteChannel;
+  using org_jpeg_jpegli_wrapper::JMID_Buffer_clear;
+  using org_jpeg_jpegli_wrapper::JMID_Buffer_limit;
   using org_jpeg_jpegli_wrapper::JMID_WritableByteChannel_write;
   using org_jpeg_jpegli_wrapper::OK;
 
@@ -312,6 +430,27 @@ Java_org_jpeg_jpegli_wrapper_Encoder_nativeInit(JNIEnv* env, jobject /*jobj*/) {
     RETURN_ERROR(INTERNAL);
   }
 
+  localClassRef = env->FindClass("java/nio/Buffer");
+  if (localClassRef == nullptr || env->ExceptionCheck()) {
+    RETURN_ERROR(INTERNAL);
+  }
+  JC_Buffer = (jclass)env->NewGlobalRef(localClassRef);
+  if (JC_Buffer == nullptr || env->ExceptionCheck()) {
+    RETURN_ERROR(INTERNAL);
+  }
+  env->DeleteLocalRef(localClassRef);
+
+  JMID_Buffer_clear =
+      env->GetMethodID(JC_Buffer, "clear", "()Ljava/nio/Buffer;");
+  if (JMID_Buffer_clear == nullptr || env->ExceptionCheck()) {
+    RETURN_ERROR(INTERNAL);
+  }
+  JMID_Buffer_limit =
+      env->GetMethodID(JC_Buffer, "limit", "(I)Ljava/nio/Buffer;");
+  if (JMID_Buffer_limit == nullptr || env->ExceptionCheck()) {
+    RETURN_ERROR(INTERNAL);
+  }
+
   return OK;
 }
 
@@ -330,7 +469,35 @@ JNIEXPORT jint JNICALL Java_org_jpeg_jpegli_wrapper_Encoder_nativeEncode(
   }
 
   std::unique_ptr<Encoder> encoder{new (std::nothrow) Encoder(
-      env, width, height, config_values, input, output)};
+      env, width, height, config_values, input, nullptr, output)};
+  if (!encoder) RETURN_ERROR(ALLOCATION);
+  return encoder->Run();
+}
+
+JNIEXPORT jint JNICALL Java_org_jpeg_jpegli_wrapper_Encoder_nativeEncodeBuffer(
+    JNIEnv* env, jobject /*jobj*/, jint width, jint height, jintArray config,
+    jobject input, jobject output) {
+  using org_jpeg_jpegli_wrapper::Config;
+  using org_jpeg_jpegli_wrapper::Encoder;
+  using org_jpeg_jpegli_wrapper::ERROR_ALLOCATION;
+  using org_jpeg_jpegli_wrapper::ERROR_INVALID_PARAMS;
+
+  Config config_values;
+  env->GetIntArrayRegion(config, 0, 33, config_values.data());
+  if (env->ExceptionCheck()) {
+    RETURN_ERROR(INVALID_PARAMS);
+  }
+
+  const uint8_t* pixels =
+      reinterpret_cast<const uint8_t*>(env->GetDirectBufferAddress(input));
+  jlong capacity = env->GetDirectBufferCapacity(input);
+  if (pixels == nullptr || width <= 0 || height <= 0 ||
+      capacity / 4 / width < height) {
+    RETURN_ERROR(INVALID_PARAMS);
+  }
+
+  std::unique_ptr<Encoder> encoder{new (std::nothrow) Encoder(
+      env, width, height, config_values, nullptr, pixels, output)};
   if (!encoder) RETURN_ERROR(ALLOCATION);
   return encoder->Run();
 }
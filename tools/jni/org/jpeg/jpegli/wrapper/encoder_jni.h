@@ -30,6 +30,13 @@ JNIEXPORT jint JNICALL Java_org_jpeg_jpegli_wrapper_Encoder_nativeEncode(
     JNIEnv* env, jobject /*jobj*/, jint width, jint height, jintArray config,
     jintArray input, jobject output);
 
+/**
+ * Encode image with jpegli; pixels are read directly from a direct ByteBuffer.
+ */
+JNIEXPORT jint JNICALL Java_org_jpeg_jpegli_wrapper_Encoder_nativeEncodeBuffer(
+    JNIEnv* env, jobject /*jobj*/, jint width, jint height, jintArray config,
+    jobject input, jobject output);
+
 #ifdef __cplusplus
 }
 #endif
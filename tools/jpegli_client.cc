@@ -0,0 +1,505 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Command line client of jpegli_server, mostly for testing and benchmarking
+// the server. The encode and decode commands produce the same output as
+// cjpegli resp. djpegli with the same options.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lib/base/common.h"
+#include "lib/base/printf_macros.h"
+#include "lib/base/span.h"
+#include "lib/base/status.h"
+#include "lib/base/types.h"
+#include "lib/extras/dec/color_hints.h"
+#include "lib/extras/dec/decode.h"
+#include "lib/extras/enc/encode.h"
+#include "lib/extras/packed_image.h"
+#include "lib/extras/time.h"
+#include "lib/jpegli/encode.h"
+#include "tools/cmdline.h"
+#include "tools/file_io.h"
+#include "tools/server_protocol.h"
+#include "tools/speed_stats.h"
+
+namespace jpegli_tools {
+namespace {
+
+struct Args {
+  void AddCommandLineOptions(CommandLineParser* cmdline) {
+    cmdline->AddPositionalOption("SOCKET", /* required = */ true,
+                                 "The socket of the jpegli_server.",
+                                 &socket_path);
+    cmdline->AddPositionalOption("COMMAND", /* required = */ true,
+                                 "encode, decode or stats.", &command);
+    cmdline->AddPositionalOption("INPUT", /* required = */ false,
+                                 "The input image resp. JPEG file.", &file_in);
+    cmdline->AddPositionalOption("OUTPUT", /* required = */ false,
+                                 "The output JPEG resp. image file.",
+                                 &file_out);
+
+    opt_distance_id = cmdline->AddOptionValue(
+        'd', "distance", "maxError",
+        "Max. butteraugli distance, lower = higher quality.\n"
+        "    Mutually exclusive with --quality.",
+        &params.distance, &ParseFloat);
+
+    opt_quality_id = cmdline->AddOptionValue(
+        'q', "quality", "QUALITY",
+        "Quality setting (is remapped to --distance).\n"
+        "    Mutually exclusive with --distance.",
+        &quality, &ParseSigned);
+
+    cmdline->AddOptionValue('\0', "chroma_subsampling", "444|440|422|420",
+                            "Chroma subsampling setting.", &chroma_subsampling,
+                            &ParseString);
+
+    cmdline->AddOptionValue('p', "progressive_level", "N",
+                            "Progressive level setting. Range: 0 .. 2.",
+                            &progressive_level, &ParseSigned);
+
+    cmdline->AddOptionFlag('\0', "xyb", "Convert to XYB colorspace", &xyb,
+                           &SetBooleanTrue, 1);
+
+    cmdline->AddOptionFlag(
+        '\0', "std_quant",
+        "Use quantization tables based on Annex K of the JPEG standard.",
+        &std_quant, &SetBooleanTrue, 1);
+
+    cmdline->AddOptionFlag(
+        '\0', "noadaptive_quantization", "Disable adaptive quantization.",
+        &adaptive_quantization, &SetBooleanFalse, 1);
+
+    cmdline->AddOptionFlag(
+        '\0', "fixed_code",
+        "Disable Huffman code optimization. Must be used together with -p 0.",
+        &optimize_coding, &SetBooleanFalse, 1);
+
+    cmdline->AddOptionValue('\0', "bitdepth", "8|16",
+                            "Sets the output bitdepth of decode for integer "
+                            "based formats, can be 8 (default) or 16.",
+                            &bitdepth, &ParseUnsigned);
+
+    cmdline->AddOptionValue('\0', "num_reps", "N",
+                            "How many times to send the request. (For "
+                            "benchmarking).",
+                            &num_reps, &ParseUnsigned, 1);
+
+    cmdline->AddOptionFlag('\0', "quiet", "Suppress informative output", &quiet,
+                           &SetBooleanTrue, 1);
+  }
+
+  const char* socket_path = nullptr;
+  const char* command = nullptr;
+  const char* file_in = nullptr;
+  const char* file_out = nullptr;
+  ServerEncodeParams params = {1.0f, 2, 0, 0, 1, 1, {}};
+  int quality = 90;
+  std::string chroma_subsampling;
+  int progressive_level = 2;
+  bool xyb = false;
+  bool std_quant = false;
+  bool adaptive_quantization = true;
+  bool optimize_coding = true;
+  size_t bitdepth = 8;
+  size_t num_reps = 1;
+  bool quiet = false;
+  CommandLineParser::OptionId opt_distance_id = -1;
+  CommandLineParser::OptionId opt_quality_id = -1;
+};
+
+bool SetEncodeParams(const CommandLineParser& cmdline, Args* args) {
+  ServerEncodeParams& params = args->params;
+  const bool distance_set = cmdline.GetOption(args->opt_distance_id)->matched();
+  const bool quality_set = cmdline.GetOption(args->opt_quality_id)->matched();
+  if (distance_set && quality_set) {
+    fprintf(stderr, "Only one of --distance or --quality can be set.\n");
+    return false;
+  }
+  if (quality_set) {
+    if (args->quality <= 0 || args->quality > 100) {
+      fprintf(stderr, "Invalid --quality argument\n");
+      return false;
+    }
+    params.distance = jpegli_quality_to_distance(args->quality);
+  }
+  if (params.distance < 0.0 || params.distance > 25.0) {
+    fprintf(stderr, "Invalid --distance argument\n");
+    return false;
+  }
+  const std::string& cs = args->chroma_subsampling;
+  if (!cs.empty() && cs != "444" && cs != "440" && cs != "422" && cs != "420") {
+    fprintf(stderr, "Invalid --chroma_subsampling argument\n");
+    return false;
+  }
+  if (args->progressive_level < 0 || args->progressive_level > 2) {
+    fprintf(stderr, "Invalid --progressive_level argument\n");
+    return false;
+  }
+  if (args->progressive_level > 0 && !args->optimize_coding) {
+    fprintf(stderr, "--fixed_code must be used together with -p 0\n");
+    return false;
+  }
+  memcpy(params.chroma_subsampling, cs.data(), cs.size());
+  params.progressive_level = args->progressive_level;
+  params.xyb = args->xyb;
+  params.use_std_quant_tables = args->std_quant;
+  params.use_adaptive_quantization = args->adaptive_quantization;
+  params.optimize_coding = args->optimize_coding;
+  return true;
+}
+
+// Sends `request` with the shared memory `fd` attached (unless it is -1) and
+// receives the response, whose shared memory is mapped to `output`.
+bool RoundTrip(const char* socket_path, const ServerRequest& request, int fd,
+               ServerResponse* response, SharedMemory* output) {
+  struct sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path is too long.\n");
+    return false;
+  }
+  strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+  const int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (socket_fd == -1 ||
+      connect(socket_fd, reinterpret_cast<struct sockaddr*>(&address),
+              sizeof(address)) != 0) {
+    fprintf(stderr, "Could not connect to %s: %s\n", socket_path,
+            strerror(errno));
+    if (socket_fd != -1) close(socket_fd);
+    return false;
+  }
+  int out_fd = -1;
+  const bool ok =
+      SendMessage(socket_fd, &request, sizeof(request), fd) &&
+      ReceiveMessage(socket_fd, response, sizeof(*response), &out_fd);
+  close(socket_fd);
+  if (!ok || response->magic != kServerMagic) {
+    fprintf(stderr, "Invalid response from the server.\n");
+    if (out_fd != -1) close(out_fd);
+    return false;
+  }
+  if (response->status != kServerOk) {
+    fprintf(stderr, "The server failed with status %u.\n",
+            static_cast<uint32_t>(response->status));
+    if (out_fd != -1) close(out_fd);
+    return false;
+  }
+  if (output && response->data_size > 0) {
+    const bool mapped = out_fd != -1 &&
+                        output->Map(out_fd, response->data_size,
+                                    /*writable=*/false);
+    if (out_fd != -1) close(out_fd);
+    if (!mapped) {
+      fprintf(stderr, "Could not map the output of the server.\n");
+      return false;
+    }
+  } else if (out_fd != -1) {
+    close(out_fd);
+  }
+  return true;
+}
+
+// Creates the encode request for `ppf`, with its pixels and ICC profile
+// copied to the shared memory *fd.
+bool PrepareEncode(const jpegli::extras::PackedPixelFile& ppf,
+                   const ServerEncodeParams& params, ServerRequest* request,
+                   int* fd) {
+  if (ppf.frames.size() != 1 || !ppf.frames[0].extra_channels.empty()) {
+    fprintf(stderr, "Unsupported input image.\n");
+    return false;
+  }
+  const jpegli::extras::PackedImage& color = ppf.frames[0].color;
+  const bool has_icc = ppf.primary_color_representation ==
+                       jpegli::extras::PackedPixelFile::kIccIsPrimary;
+  ServerImage& image = request->image;
+  image.xsize = color.xsize;
+  image.ysize = color.ysize;
+  image.num_channels = color.format.num_channels;
+  image.bits_per_sample = ppf.info.bits_per_sample;
+  image.endianness = color.format.endianness;
+  image.icc_size = has_icc ? ppf.icc.size() : 0;
+  image.color_encoding = ppf.color_encoding;
+  const size_t pixels_size = ServerImagePixelsSize(image);
+  if (pixels_size == 0 ||
+      color.pixel_stride() * 8 != image.num_channels * image.bits_per_sample) {
+    fprintf(stderr, "Unsupported input pixel format.\n");
+    return false;
+  }
+  request->magic = kServerMagic;
+  request->op = kServerEncode;
+  request->encode_params = params;
+  request->data_size = pixels_size + image.icc_size;
+
+  *fd = CreateSharedMemory(request->data_size);
+  {
+    SharedMemory input;
+    if (*fd == -1 || !input.Map(*fd, request->data_size, /*writable=*/true)) {
+      fprintf(stderr, "Could not create shared memory.\n");
+      return false;
+    }
+    const size_t row_size = pixels_size / image.ysize;
+    const uint8_t* pixels = static_cast<const uint8_t*>(color.pixels());
+    for (size_t y = 0; y < image.ysize; ++y) {
+      memcpy(input.data() + y * row_size, pixels + y * color.stride, row_size);
+    }
+    if (has_icc) {
+      memcpy(input.data() + pixels_size, ppf.icc.data(), ppf.icc.size());
+    }
+  }
+  // The writable mapping is gone, so the object can be sealed.
+  if (!SealSharedMemory(*fd)) {
+    fprintf(stderr, "Could not seal shared memory.\n");
+    return false;
+  }
+  return true;
+}
+
+// Same as djpegli.
+bool PrepareDecode(const Args& args, const std::string& extension,
+                   ServerRequest* request) {
+  ServerImage& image = request->image;
+  request->magic = kServerMagic;
+  request->op = kServerDecode;
+  image.bits_per_sample = 8;
+  image.endianness = JPEGLI_NATIVE_ENDIAN;
+  if (extension == ".pfm") {
+    image.bits_per_sample = 32;
+    image.endianness = JPEGLI_BIG_ENDIAN;
+  } else if (args.bitdepth == 16) {
+    image.bits_per_sample = 16;
+    image.endianness = JPEGLI_BIG_ENDIAN;
+  } else if (args.bitdepth != 8) {
+    fprintf(stderr, "Invalid --bitdepth argument\n");
+    return false;
+  }
+  image.num_channels = 0;
+  if (extension == ".pgm") {
+    image.num_channels = 1;
+  } else if (extension == ".ppm") {
+    image.num_channels = 3;
+  }
+  return true;
+}
+
+jpegli::Status ToPackedPixelFile(const ServerImage& image,
+                                 const SharedMemory& output,
+                                 jpegli::extras::PackedPixelFile* ppf) {
+  const size_t pixels_size = ServerImagePixelsSize(image);
+  JPEGLI_ENSURE(pixels_size > 0 && output.size() >= pixels_size &&
+                output.size() - pixels_size >= image.icc_size);
+  const bool is_float = image.bits_per_sample == 32;
+  JpegliBasicInfo& info = ppf->info;
+  info.xsize = image.xsize;
+  info.ysize = image.ysize;
+  info.num_color_channels = image.num_channels < 3 ? 1 : 3;
+  info.bits_per_sample = image.bits_per_sample;
+  info.exponent_bits_per_sample = is_float ? 8 : 0;
+  info.orientation = JPEGLI_ORIENT_IDENTITY;
+  if (image.icc_size > 0) {
+    const uint8_t* icc = output.data() + pixels_size;
+    ppf->icc.assign(icc, icc + image.icc_size);
+    ppf->primary_color_representation =
+        jpegli::extras::PackedPixelFile::kIccIsPrimary;
+  }
+  ppf->color_encoding = image.color_encoding;
+  const JpegliPixelFormat format = {
+      image.num_channels,
+      image.bits_per_sample == 8    ? JPEGLI_TYPE_UINT8
+      : image.bits_per_sample == 16 ? JPEGLI_TYPE_UINT16
+                                    : JPEGLI_TYPE_FLOAT,
+      image.endianness, 0};
+  JPEGLI_ASSIGN_OR_RETURN(
+      jpegli::extras::PackedFrame frame,
+      jpegli::extras::PackedFrame::Create(image.xsize, image.ysize, format));
+  const size_t row_size = pixels_size / image.ysize;
+  uint8_t* pixels = static_cast<uint8_t*>(frame.color.pixels());
+  for (size_t y = 0; y < image.ysize; ++y) {
+    memcpy(pixels + y * frame.color.stride, output.data() + y * row_size,
+           row_size);
+  }
+  ppf->frames.emplace_back(std::move(frame));
+  return true;
+}
+
+bool WriteOutput(const jpegli::extras::PackedPixelFile& ppf,
+                 std::string extension, const std::string& filename) {
+  if (extension == ".pnm") {
+    extension = ppf.info.num_color_channels == 3 ? ".ppm" : ".pgm";
+  }
+  std::unique_ptr<jpegli::extras::Encoder> encoder =
+      jpegli::extras::Encoder::FromExtension(extension);
+  if (encoder == nullptr) {
+    fprintf(stderr, "Can't decode to the file extension '%s'\n",
+            extension.c_str());
+    return false;
+  }
+  jpegli::extras::EncodedImage encoded_image;
+  if (!encoder->Encode(ppf, &encoded_image, nullptr) ||
+      encoded_image.bitstreams.empty()) {
+    fprintf(stderr, "Encode failed\n");
+    return false;
+  }
+  if (!WriteFile(filename, encoded_image.bitstreams[0])) {
+    fprintf(stderr, "Failed to write output file %s\n", filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+void PrintStats(const ServerStats& stats) {
+  const uint64_t n = std::max<uint64_t>(stats.num_requests, 1);
+  printf("workers: %u\nbusy_workers: %u\nqueue_depth: %u\n"
+         "max_queue_depth: %u\nrequests: %" PRIu64 "\nfailures: %" PRIu64
+         "\nmean_queue_time_ms: %.3f\nmean_latency_ms: %.3f\n"
+         "max_latency_ms: %.3f\n",
+         stats.num_workers, stats.num_busy_workers, stats.queue_depth,
+         stats.max_queue_depth, stats.num_requests, stats.num_failures,
+         stats.total_queue_time_us * 1e-3 / n,
+         stats.total_latency_us * 1e-3 / n, stats.max_latency_us * 1e-3);
+}
+
+int JpegliClientMain(int argc, const char* argv[]) {
+  Args args;
+  CommandLineParser cmdline;
+  args.AddCommandLineOptions(&cmdline);
+
+  if (!cmdline.Parse(argc, const_cast<const char**>(argv))) {
+    // Parse already printed the actual error cause.
+    fprintf(stderr, "Use '%s -h' for more information.\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (cmdline.HelpFlagPassed() || !args.socket_path || !args.command) {
+    cmdline.PrintHelp();
+    return EXIT_SUCCESS;
+  }
+
+  const std::string command = args.command;
+  ServerRequest request = {};
+  ServerResponse response = {};
+  if (command == "stats") {
+    request.magic = kServerMagic;
+    request.op = kServerStats;
+    if (!RoundTrip(args.socket_path, request, -1, &response, nullptr)) {
+      return EXIT_FAILURE;
+    }
+    PrintStats(response.stats);
+    return EXIT_SUCCESS;
+  }
+  if (command != "encode" && command != "decode") {
+    fprintf(stderr, "Unknown command %s\n", args.command);
+    return EXIT_FAILURE;
+  }
+  if (!args.file_in || !args.file_out) {
+    fprintf(stderr, "Missing INPUT or OUTPUT.\n");
+    return EXIT_FAILURE;
+  }
+
+  InputFile input;
+  if (!input.Open(args.file_in)) {
+    fprintf(stderr, "Failed to read input %s\n", args.file_in);
+    return EXIT_FAILURE;
+  }
+  const std::string filename_out = args.file_out;
+  std::string extension;
+  int fd = -1;
+  if (command == "encode") {
+    jpegli::extras::PackedPixelFile ppf;
+    if (!SetEncodeParams(cmdline, &args) ||
+        !jpegli::extras::DecodeBytes(input.bytes(),
+                                     jpegli::extras::ColorHints(), &ppf) ||
+        !PrepareEncode(ppf, args.params, &request, &fd)) {
+      fprintf(stderr, "Failed to prepare the request for %s\n", args.file_in);
+      if (fd != -1) close(fd);
+      return EXIT_FAILURE;
+    }
+  } else {
+    const size_t pos = filename_out.find_last_of('.');
+    if (pos >= filename_out.size()) {
+      fprintf(stderr, "Unrecognized output extension.\n");
+      return EXIT_FAILURE;
+    }
+    extension = filename_out.substr(pos);
+    if (!PrepareDecode(args, extension, &request)) return EXIT_FAILURE;
+    const jpegli::Bytes jpeg = input.bytes();
+    request.data_size = jpeg.size();
+    fd = CreateSharedMemory(jpeg.size());
+    bool copied = false;
+    if (fd != -1) {
+      SharedMemory shared;
+      copied = shared.Map(fd, jpeg.size(), /*writable=*/true);
+      if (copied) memcpy(shared.data(), jpeg.data(), jpeg.size());
+    }
+    if (!copied || !SealSharedMemory(fd)) {
+      fprintf(stderr, "Could not create shared memory.\n");
+      if (fd != -1) close(fd);
+      return EXIT_FAILURE;
+    }
+  }
+
+  jpegli_tools::SpeedStats stats;
+  SharedMemory output;
+  for (size_t num_rep = 0; num_rep < args.num_reps; ++num_rep) {
+    const double t0 = jpegli::Now();
+    // Only the output of the last repetition is kept.
+    const bool last = (num_rep + 1 == args.num_reps);
+    if (!RoundTrip(args.socket_path, request, fd, &response,
+                   last ? &output : nullptr)) {
+      close(fd);
+      return EXIT_FAILURE;
+    }
+    const double t1 = jpegli::Now();
+    stats.NotifyElapsed(t1 - t0);
+  }
+  close(fd);
+
+  if (command == "encode") {
+    if (!WriteFile(filename_out, output)) {
+      fprintf(stderr, "Could not write jpeg to %s\n", args.file_out);
+      return EXIT_FAILURE;
+    }
+  } else {
+    jpegli::extras::PackedPixelFile ppf;
+    if (!ToPackedPixelFile(response.image, output, &ppf)) {
+      fprintf(stderr, "Invalid decoded image.\n");
+      return EXIT_FAILURE;
+    }
+    if (!WriteOutput(ppf, extension, filename_out)) return EXIT_FAILURE;
+  }
+  if (!args.quiet) {
+    fprintf(stderr, "%s %s to %" PRIuS " bytes\n",
+            command == "encode" ? "Compressed" : "Decompressed", args.file_in,
+            output.size());
+    const ServerImage& image =
+        command == "encode" ? request.image : response.image;
+    stats.SetImageSize(image.xsize, image.ysize);
+    stats.Print(1);
+  }
+  return EXIT_SUCCESS;
+}
+
+}  // namespace
+}  // namespace jpegli_tools
+
+int main(int argc, const char* argv[]) {
+  return jpegli_tools::JpegliClientMain(argc, argv);
+}
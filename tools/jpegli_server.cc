@@ -0,0 +1,610 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Long-running encode/decode service for local clients, which saves the
+// process startup, dispatch target selection and allocator warm-up that a
+// cjpegli / djpegli invocation pays for every image. See
+// tools/server_protocol.h for the protocol and tools/jpegli_client.cc for a
+// client.
+
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <condition_variable>  // NOLINT
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "lib/base/common.h"
+#include "lib/base/printf_macros.h"
+#include "lib/base/span.h"
+#include "lib/base/types.h"
+#include "lib/cms/color_encoding_internal.h"
+#include "lib/extras/dec/jpegli.h"
+#include "lib/extras/dec/row_reader.h"
+#include "lib/extras/enc/jpegli.h"
+#include "lib/extras/packed_image.h"
+#include "lib/extras/size_constraints.h"
+#include "lib/extras/time.h"
+#include "lib/jpegli/decode.h"
+#include "lib/jpegli/encode.h"
+#include "tools/cmdline.h"
+#include "tools/server_protocol.h"
+
+namespace jpegli_tools {
+namespace {
+
+struct Args {
+  void AddCommandLineOptions(CommandLineParser* cmdline) {
+    cmdline->AddPositionalOption("SOCKET", /* required = */ true,
+                                 "Path of the Unix domain socket to listen on.",
+                                 &socket_path);
+
+    cmdline->AddOptionValue(
+        '\0', "num_threads", "N",
+        "Number of worker threads, default is one per CPU.", &num_threads,
+        &ParseUnsigned, 1);
+
+    cmdline->AddOptionValue(
+        '\0', "max_pixels", "N",
+        "Maximum number of pixels of an image to encode or decode, larger "
+        "requests fail. Default: 2^27.",
+        &max_pixels, &ParseUnsigned, 1);
+
+    cmdline->AddOptionValue(
+        '\0', "socket_mode", "MODE",
+        "Permissions of the socket, as an octal number with a leading 0. "
+        "Default: 0600, only the user of the server can connect.",
+        &socket_mode, &ParseUnsigned, 1);
+
+    cmdline->AddOptionFlag('\0', "quiet", "Suppress informative output", &quiet,
+                           &SetBooleanTrue, 1);
+  }
+
+  const char* socket_path = nullptr;
+  size_t num_threads = std::thread::hardware_concurrency();
+  size_t max_pixels = static_cast<size_t>(1) << 27;
+  size_t socket_mode = 0600;
+  bool quiet = false;
+};
+
+// A request that does not arrive as a whole within this time fails, so that
+// slow or stuck clients can not block a worker. The request is a small struct
+// that clients send with a single write.
+constexpr int kReceiveTimeoutMs = 1000;
+
+volatile sig_atomic_t stop_requested = 0;
+
+void RequestStop(int /*signal*/) { stop_requested = 1; }
+
+// Per-thread codec state, reused for all requests of the thread.
+class ServerWorker {
+ public:
+  ServerWorker() {
+    dinfo_.err = jpegli_std_error(&derr_);
+    jpegli_create_decompress(&dinfo_);
+  }
+  ~ServerWorker() {
+    for (size_t i = 0; i < kNumCompressors; ++i) {
+      if (created_[i]) jpegli_destroy_compress(&cinfo_[i]);
+    }
+    jpegli_destroy_decompress(&dinfo_);
+  }
+  ServerWorker(const ServerWorker&) = delete;
+  ServerWorker& operator=(const ServerWorker&) = delete;
+
+  // The XYB mode and the quantization table choice stick to a compress object
+  // (see EncodeJpeg()), so each combination has its own.
+  jpeg_compress_struct* Compressor(bool xyb, bool std_quant) {
+    const size_t index = (xyb ? 2 : 0) + (std_quant ? 1 : 0);
+    if (!created_[index]) {
+      cinfo_[index].err = jpegli_std_error(&cerr_[index]);
+      jpegli_create_compress(&cinfo_[index]);
+      created_[index] = true;
+    }
+    return &cinfo_[index];
+  }
+
+  jpeg_decompress_struct* Decompressor() { return &dinfo_; }
+
+  std::vector<uint8_t> compressed;
+
+ private:
+  static constexpr size_t kNumCompressors = 4;
+  jpeg_compress_struct cinfo_[kNumCompressors];
+  jpeg_error_mgr cerr_[kNumCompressors];
+  bool created_[kNumCompressors] = {};
+  jpeg_decompress_struct dinfo_;
+  jpeg_error_mgr derr_;
+};
+
+// The fields of a request come from the client and are checked before they are
+// used as codec parameters.
+bool IsValidEndianness(JpegliEndianness endianness) {
+  return endianness == JPEGLI_NATIVE_ENDIAN ||
+         endianness == JPEGLI_LITTLE_ENDIAN || endianness == JPEGLI_BIG_ENDIAN;
+}
+
+bool IsValidColorEncoding(const JpegliColorEncoding& color_encoding,
+                          size_t num_color_channels) {
+  const JpegliColorSpace expected_color_space =
+      num_color_channels == 1 ? JPEGLI_COLOR_SPACE_GRAY
+                              : JPEGLI_COLOR_SPACE_RGB;
+  if (color_encoding.color_space != expected_color_space) return false;
+  // Checks the white point, primaries, transfer function (and gamma) and
+  // rendering intent.
+  jpegli::ColorEncoding c;
+  return static_cast<bool>(c.FromExternal(color_encoding));
+}
+
+JpegliPixelFormat PixelFormat(const ServerImage& image) {
+  const JpegliDataType data_type =
+      image.bits_per_sample == 8    ? JPEGLI_TYPE_UINT8
+      : image.bits_per_sample == 16 ? JPEGLI_TYPE_UINT16
+                                    : JPEGLI_TYPE_FLOAT;
+  return {image.num_channels, data_type, image.endianness, 0};
+}
+
+// Input bytes of a request. The client keeps its shared memory object, so the
+// object is only mapped in place if it is sealed: otherwise the client could
+// truncate it while the server reads it, which would crash the server (and
+// all the other requests in flight) with SIGBUS. Where sealing is not
+// available, the input is copied with pread(), which fails cleanly instead.
+class RequestInput {
+ public:
+  bool Open(int fd, size_t size) {
+    if (fd == -1 || size == 0) return false;
+    if (kSharedMemorySealing) {
+      if (!IsSealedSharedMemory(fd) ||
+          !mapping_.Map(fd, size, /*writable=*/false)) {
+        return false;
+      }
+      data_ = mapping_.data();
+    } else {
+      if (!ReadSharedMemory(fd, size, &copy_)) return false;
+      data_ = copy_.data();
+    }
+    size_ = size;
+    return true;
+  }
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  SharedMemory mapping_;
+  std::vector<uint8_t> copy_;
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Returns a new shared memory object with a copy of `size` bytes of `data`, or
+// -1 on failure.
+int CopyToSharedMemory(const uint8_t* data, size_t size) {
+  const int fd = CreateSharedMemory(size);
+  if (fd == -1) return -1;
+  SharedMemory output;
+  if (!output.Map(fd, size, /*writable=*/true)) {
+    close(fd);
+    return -1;
+  }
+  memcpy(output.data(), data, size);
+  return fd;
+}
+
+ServerStatus Encode(const ServerRequest& request,
+                    const jpegli::SizeConstraints& constraints, int fd,
+                    ServerWorker* worker, ServerResponse* response,
+                    int* out_fd) {
+  const ServerImage& image = request.image;
+  const size_t pixels_size = ServerImagePixelsSize(image);
+  if (pixels_size == 0 || request.data_size < pixels_size ||
+      request.data_size - pixels_size < image.icc_size ||
+      !jpegli::VerifyDimensions(&constraints, image.xsize, image.ysize) ||
+      !IsValidEndianness(image.endianness) ||
+      (image.icc_size == 0 &&
+       !IsValidColorEncoding(image.color_encoding,
+                             image.num_channels < 3 ? 1 : 3))) {
+    return kServerInvalidRequest;
+  }
+  // The pixels are read right from the client's shared memory if it is
+  // sealed.
+  RequestInput input;
+  if (!input.Open(fd, request.data_size)) {
+    return kServerInvalidRequest;
+  }
+
+  jpegli::extras::PackedPixelFile ppf;
+  JpegliBasicInfo& info = ppf.info;
+  const bool has_alpha = (image.num_channels % 2 == 0);
+  info.xsize = image.xsize;
+  info.ysize = image.ysize;
+  info.num_color_channels = image.num_channels < 3 ? 1 : 3;
+  info.bits_per_sample = image.bits_per_sample;
+  info.exponent_bits_per_sample = image.bits_per_sample == 32 ? 8 : 0;
+  info.alpha_bits = has_alpha ? info.bits_per_sample : 0;
+  info.alpha_exponent_bits = has_alpha ? info.exponent_bits_per_sample : 0;
+  info.num_extra_channels = has_alpha ? 1 : 0;
+  info.uses_original_profile = JPEGLI_TRUE;
+  info.orientation = JPEGLI_ORIENT_IDENTITY;
+  if (image.icc_size > 0) {
+    const uint8_t* icc = input.data() + pixels_size;
+    ppf.icc.assign(icc, icc + image.icc_size);
+    ppf.primary_color_representation =
+        jpegli::extras::PackedPixelFile::kIccIsPrimary;
+  } else {
+    ppf.color_encoding = image.color_encoding;
+  }
+
+  const ServerEncodeParams& params = request.encode_params;
+  jpegli::extras::JpegSettings settings;
+  settings.distance = params.distance;
+  settings.progressive_level = params.progressive_level;
+  settings.xyb = params.xyb;
+  settings.use_std_quant_tables = params.use_std_quant_tables;
+  settings.use_adaptive_quantization = params.use_adaptive_quantization;
+  settings.optimize_coding = params.optimize_coding;
+  settings.chroma_subsampling.assign(
+      params.chroma_subsampling,
+      strnlen(params.chroma_subsampling, sizeof(params.chroma_subsampling)));
+
+  const JpegliPixelFormat format = PixelFormat(image);
+  jpegli::extras::StridedRowReader rows(input.data(), pixels_size / image.ysize,
+                                        image.xsize, image.ysize, format);
+  jpeg_compress_struct* cinfo =
+      worker->Compressor(settings.xyb, settings.use_std_quant_tables);
+  if (!jpegli::extras::EncodeJpeg(ppf, &rows, settings, cinfo, nullptr,
+                                  &worker->compressed)) {
+    return kServerCodecError;
+  }
+  *out_fd = CopyToSharedMemory(worker->compressed.data(),
+                               worker->compressed.size());
+  if (*out_fd == -1) return kServerCodecError;
+  response->data_size = worker->compressed.size();
+  return kServerOk;
+}
+
+ServerStatus Decode(const ServerRequest& request,
+                    const jpegli::SizeConstraints& constraints, int fd,
+                    ServerWorker* worker, ServerResponse* response,
+                    int* out_fd) {
+  jpegli::extras::JpegDecompressParams dparams;
+  const ServerImage& requested = request.image;
+  switch (requested.bits_per_sample) {
+    case 8:
+      dparams.output_data_type = JPEGLI_TYPE_UINT8;
+      break;
+    case 16:
+      dparams.output_data_type = JPEGLI_TYPE_UINT16;
+      break;
+    case 32:
+      dparams.output_data_type = JPEGLI_TYPE_FLOAT;
+      break;
+    default:
+      return kServerInvalidRequest;
+  }
+  if (!IsValidEndianness(requested.endianness)) {
+    return kServerInvalidRequest;
+  }
+  dparams.output_endianness = requested.endianness;
+  if (requested.num_channels == 1) {
+    dparams.force_grayscale = true;
+  } else if (requested.num_channels == 3) {
+    dparams.force_rgb = true;
+  } else if (requested.num_channels != 0) {
+    return kServerInvalidRequest;
+  }
+  RequestInput input;
+  if (!input.Open(fd, request.data_size)) {
+    return kServerInvalidRequest;
+  }
+
+  jpegli::extras::PackedPixelFile ppf;
+  if (!jpegli::extras::DecodeJpeg(jpegli::Bytes(input.data(), input.size()),
+                                  dparams, worker->Decompressor(), nullptr,
+                                  &ppf, &constraints) ||
+      ppf.frames.size() != 1) {
+    return kServerCodecError;
+  }
+  const jpegli::extras::PackedImage& decoded = ppf.frames[0].color;
+  const bool has_icc = (ppf.primary_color_representation ==
+                        jpegli::extras::PackedPixelFile::kIccIsPrimary);
+  ServerImage& image = response->image;
+  image.xsize = decoded.xsize;
+  image.ysize = decoded.ysize;
+  image.num_channels = decoded.format.num_channels;
+  image.bits_per_sample = ppf.info.bits_per_sample;
+  image.endianness = decoded.format.endianness;
+  image.icc_size = has_icc ? ppf.icc.size() : 0;
+  image.color_encoding = ppf.color_encoding;
+
+  const size_t pixels_size = ServerImagePixelsSize(image);
+  const size_t row_size = pixels_size / image.ysize;
+  const size_t size = pixels_size + image.icc_size;
+  *out_fd = CreateSharedMemory(size);
+  SharedMemory output;
+  if (*out_fd == -1 || !output.Map(*out_fd, size, /*writable=*/true)) {
+    return kServerCodecError;
+  }
+  const uint8_t* pixels = static_cast<const uint8_t*>(decoded.pixels());
+  for (size_t y = 0; y < image.ysize; ++y) {
+    memcpy(output.data() + y * row_size, pixels + y * decoded.stride,
+           row_size);
+  }
+  if (has_icc) {
+    memcpy(output.data() + pixels_size, ppf.icc.data(), ppf.icc.size());
+  }
+  response->data_size = size;
+  return kServerOk;
+}
+
+struct Connection {
+  int fd;
+  double accept_time;
+};
+
+// Queue of accepted connections, served by a fixed set of worker threads.
+class Server {
+ public:
+  Server(size_t num_workers, const jpegli::SizeConstraints& constraints)
+      : constraints_(constraints) {
+    stats_.num_workers = num_workers;
+    for (size_t i = 0; i < num_workers; ++i) {
+      threads_.emplace_back([this] { WorkerLoop(); });
+    }
+  }
+
+  void Push(int fd) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back({fd, jpegli::Now()});
+    stats_.queue_depth = queue_.size();
+    stats_.max_queue_depth =
+        std::max<uint32_t>(stats_.max_queue_depth, stats_.queue_depth);
+    cv_.notify_one();
+  }
+
+  // Serves the connections that are still in the queue, then stops the
+  // workers.
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) thread.join();
+    threads_.clear();
+  }
+
+  ServerStats Stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+ private:
+  void WorkerLoop() {
+    ServerWorker worker;
+    while (true) {
+      Connection connection;
+      double queue_time;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+        connection = queue_.front();
+        queue_.pop_front();
+        stats_.queue_depth = queue_.size();
+        ++stats_.num_busy_workers;
+        queue_time = jpegli::Now() - connection.accept_time;
+      }
+      const ServerOp op = Serve(connection.fd, &worker);
+      close(connection.fd);
+      const double latency = jpegli::Now() - connection.accept_time;
+      std::lock_guard<std::mutex> lock(mutex_);
+      --stats_.num_busy_workers;
+      if (op == kServerEncode || op == kServerDecode) {
+        const uint64_t latency_us = latency * 1e6;
+        ++stats_.num_requests;
+        stats_.total_queue_time_us += queue_time * 1e6;
+        stats_.total_latency_us += latency_us;
+        stats_.max_latency_us = std::max(stats_.max_latency_us, latency_us);
+      }
+    }
+  }
+
+  // Handles the request of the client on `socket`, returns its operation.
+  ServerOp Serve(int socket, ServerWorker* worker) {
+    ServerRequest request;
+    ServerResponse response = {};
+    response.magic = kServerMagic;
+    response.status = kServerInvalidRequest;
+    int fd = -1;
+    int out_fd = -1;
+    if (!ReceiveMessage(socket, &request, sizeof(request), &fd,
+                        kReceiveTimeoutMs)) {
+      // Not counted as a request, e.g. the client gave up.
+      return kServerStats;
+    }
+    if (request.magic == kServerMagic) {
+      if (request.op == kServerEncode) {
+        response.status = Encode(request, constraints_, fd, worker, &response,
+                                 &out_fd);
+      } else if (request.op == kServerDecode) {
+        response.status = Decode(request, constraints_, fd, worker, &response,
+                                 &out_fd);
+      } else if (request.op == kServerStats) {
+        response.stats = Stats();
+        response.status = kServerOk;
+      }
+    }
+    if (response.status != kServerOk) {
+      response.data_size = 0;
+      if (out_fd != -1) close(out_fd);
+      out_fd = -1;
+      if (request.op != kServerStats) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++stats_.num_failures;
+      }
+    }
+    SendMessage(socket, &response, sizeof(response), out_fd);
+    if (fd != -1) close(fd);
+    if (out_fd != -1) close(out_fd);
+    return request.op;
+  }
+
+  const jpegli::SizeConstraints constraints_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Connection> queue_;
+  bool stopping_ = false;
+  ServerStats stats_ = {};
+  std::vector<std::thread> threads_;
+};
+
+void PrintStats(const ServerStats& stats) {
+  const uint64_t n = std::max<uint64_t>(stats.num_requests, 1);
+  fprintf(stderr,
+          "%" PRIu64 " requests, %" PRIu64 " failed, max queue depth %u, "
+          "mean queue time %.3f ms, mean latency %.3f ms, max latency "
+          "%.3f ms\n",
+          stats.num_requests, stats.num_failures, stats.max_queue_depth,
+          stats.total_queue_time_us * 1e-3 / n,
+          stats.total_latency_us * 1e-3 / n, stats.max_latency_us * 1e-3);
+}
+
+// Removes the socket left behind by a server that did not shut down cleanly,
+// so that bind() does not fail. Fails if another server is listening on it or
+// if the path is not a socket.
+bool RemoveStaleSocket(const struct sockaddr_un& address) {
+  struct stat s = {};
+  if (lstat(address.sun_path, &s) != 0) return true;
+  if (!S_ISSOCK(s.st_mode)) {
+    fprintf(stderr, "%s exists and is not a socket.\n", address.sun_path);
+    return false;
+  }
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) return false;
+  const bool in_use =
+      connect(fd, reinterpret_cast<const struct sockaddr*>(&address),
+              sizeof(address)) == 0;
+  close(fd);
+  if (in_use) {
+    fprintf(stderr, "Another server is listening on %s.\n", address.sun_path);
+    return false;
+  }
+  return unlink(address.sun_path) == 0;
+}
+
+int JpegliServerMain(int argc, const char* argv[]) {
+  Args args;
+  CommandLineParser cmdline;
+  args.AddCommandLineOptions(&cmdline);
+
+  if (!cmdline.Parse(argc, const_cast<const char**>(argv))) {
+    // Parse already printed the actual error cause.
+    fprintf(stderr, "Use '%s -h' for more information.\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (cmdline.HelpFlagPassed() || !args.socket_path) {
+    cmdline.PrintHelp();
+    return EXIT_SUCCESS;
+  }
+  if (args.num_threads == 0) {
+    fprintf(stderr, "Invalid --num_threads argument\n");
+    return EXIT_FAILURE;
+  }
+  if (args.max_pixels == 0) {
+    fprintf(stderr, "Invalid --max_pixels argument\n");
+    return EXIT_FAILURE;
+  }
+  if (args.socket_mode > 0777) {
+    fprintf(stderr, "Invalid --socket_mode argument\n");
+    return EXIT_FAILURE;
+  }
+  jpegli::SizeConstraints constraints;
+  constraints.dec_max_pixels = args.max_pixels;
+
+  struct sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (strlen(args.socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path is too long.\n");
+    return EXIT_FAILURE;
+  }
+  strncpy(address.sun_path, args.socket_path, sizeof(address.sun_path) - 1);
+  if (!RemoveStaleSocket(address)) return EXIT_FAILURE;
+  // The socket is created without any permissions for others, and only gets
+  // the requested ones before clients can connect.
+  const mode_t saved_umask = umask(0177);
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  const bool bound =
+      listen_fd != -1 &&
+      bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address),
+           sizeof(address)) == 0;
+  umask(saved_umask);
+  if (!bound || chmod(args.socket_path, args.socket_mode) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "Could not listen on %s: %s\n", args.socket_path,
+            strerror(errno));
+    if (bound) unlink(args.socket_path);
+    if (listen_fd != -1) close(listen_fd);
+    return EXIT_FAILURE;
+  }
+
+  // Only the main thread handles SIGINT and SIGTERM, which stop the server
+  // after the queued requests are served.
+  signal(SIGPIPE, SIG_IGN);
+  struct sigaction action = {};
+  action.sa_handler = &RequestStop;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  sigset_t stop_signals;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+  Server server(args.num_threads, constraints);
+  pthread_sigmask(SIG_UNBLOCK, &stop_signals, nullptr);
+
+  if (!args.quiet) {
+    fprintf(stderr, "Listening on %s with %" PRIuS " threads.\n",
+            args.socket_path, args.num_threads);
+  }
+  while (!stop_requested) {
+    // The timeout only covers a signal that arrives right before poll().
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 1000) <= 0) continue;
+    const int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd == -1) continue;
+    server.Push(fd);
+  }
+  close(listen_fd);
+  unlink(args.socket_path);
+  server.Stop();
+  if (!args.quiet) PrintStats(server.Stats());
+  return EXIT_SUCCESS;
+}
+
+}  // namespace
+}  // namespace jpegli_tools
+
+int main(int argc, const char* argv[]) {
+  return jpegli_tools::JpegliServerMain(argc, argv);
+}
@@ -115,7 +115,7 @@ def SplitLibFiles(repo_files):
   # TODO(eustas): move to separate folder?
   extras_for_tools_sources, extras_sources = Filter(extras_sources, ContainsFn(
     '/codec', '/hlg', '/metrics', '/packed_image_convert', '/render_hdr',
-    '/tone_mapping'))
+    '/ssimulacra2', '/tone_mapping'))
 
 
   return codecs | {'base_sources': base_sources,
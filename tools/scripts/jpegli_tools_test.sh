@@ -100,6 +100,70 @@ cjpeg_test() {
   verify_max_bpp "${infn}" "${jpgfn}" "${maxbpp}"
 }
 
+# Test that the --batch mode of cjpegli and djpegli gives the same results as
+# processing the files one by one.
+cjpegli_djpegli_batch_test() {
+  local encargs="$1"
+  local indir="$(mktemp -d -p "${tmpdir}")"
+  local jpgdir="$(mktemp -d -p "${tmpdir}")"
+  local outdir="$(mktemp -d -p "${tmpdir}")"
+  local listfn="$(mktemp -p "${tmpdir}")"
+  shift
+  for fn in "$@"; do
+    cp "${JPEGLI_TEST_DATA_PATH}/${fn}" "${indir}/"
+  done
+
+  "${cjpegli}" --batch --num_threads 2 "${indir}" "${jpgdir}/%s.jpg" $encargs
+  ls "${jpgdir}"/*.jpg > "${listfn}"
+  "${djpegli}" --batch --num_threads 2 "${listfn}" "${outdir}/%s.png"
+
+  for infn in "${indir}"/*; do
+    local name="$(basename "${infn%.*}")"
+    local jpgfn="$(mktemp -p "${tmpdir}")"
+    local outfn="$(mktemp -p "${tmpdir}").png"
+    "${cjpegli}" "${infn}" "${jpgfn}" $encargs
+    cmp "${jpgfn}" "${jpgdir}/${name}.jpg"
+    "${djpegli}" "${jpgfn}" "${outfn}"
+    cmp "${outfn}" "${outdir}/${name}.png"
+  done
+}
+
+# Test that jpegli_server gives the same results as cjpegli and djpegli.
+jpegli_server_test() {
+  local encargs="$1"
+  local socket="${tmpdir}/server.sock"
+  shift
+
+  "${jpegli_server}" "${socket}" --num_threads 2 --quiet &
+  local server_pid=$!
+  for i in $(seq 50); do
+    [[ -S "${socket}" ]] && break
+    sleep 0.1
+  done
+
+  for fn in "$@"; do
+    local infn="${JPEGLI_TEST_DATA_PATH}/${fn}"
+    local jpgfn="$(mktemp -p "${tmpdir}")"
+    local jpgfn2="$(mktemp -p "${tmpdir}")"
+    "${cjpegli}" "${infn}" "${jpgfn}" $encargs --quiet
+    "${jpegli_client}" "${socket}" encode "${infn}" "${jpgfn2}" $encargs \
+      --num_reps 2 --quiet
+    cmp "${jpgfn}" "${jpgfn2}"
+    for ext in ppm pfm; do
+      local outfn="$(mktemp -p "${tmpdir}").${ext}"
+      local outfn2="$(mktemp -p "${tmpdir}").${ext}"
+      "${djpegli}" "${jpgfn}" "${outfn}" --quiet
+      "${jpegli_client}" "${socket}" decode "${jpgfn}" "${outfn2}" --quiet
+      cmp "${outfn}" "${outfn2}"
+    done
+  done
+  "${jpegli_client}" "${socket}" stats
+
+  kill "${server_pid}"
+  wait "${server_pid}"
+  [[ ! -e "${socket}" ]]
+}
+
 # Test decoding of jpeg files with the djpegli binary.
 djpegli_test() {
   local infn="${JPEGLI_TEST_DATA_PATH}/$1"
@@ -200,6 +264,8 @@ main() {
 
   local cjpegli="${build_dir}/tools/cjpegli"
   local djpegli="${build_dir}/tools/djpegli"
+  local jpegli_server="${build_dir}/tools/jpegli_server"
+  local jpegli_client="${build_dir}/tools/jpegli_client"
   local ssimulacra2="${build_dir}/tools/ssimulacra2"
   local rgb_in="jxl/flower/flower_small.rgb.png"
   local gray_in="jxl/flower/flower_small.g.png"
@@ -235,6 +301,17 @@ main() {
   cjpegli_djpegli_test "${rgb_in}" "" 89 1.7
   cjpegli_djpegli_test "${rgb_in}" "--xyb" 87 1.5
 
+  cjpegli_djpegli_batch_test "" "${rgb_in}" "${gray_in}" \
+    "jxl/flower/flower_small.rgb.depth16.ppm"
+  cjpegli_djpegli_batch_test "--xyb" "${rgb_in}" \
+    "jxl/flower/flower_small.rgb.depth16.ppm"
+
+  if [[ -x "${jpegli_server}" ]]; then
+    jpegli_server_test "" "${rgb_in}" "${gray_in}" \
+      "jxl/flower/flower_small.rgb.depth16.ppm"
+    jpegli_server_test "--xyb -q 80" "${rgb_in}"
+  fi
+
   djpegli_test "${ppm_rgb}" "-q 95" 92
   djpegli_test "${ppm_rgb}" "-q 95 -sample 1x1" 93
   #djpegli_test "${ppm_gray}" "-q 95 -gray" 94
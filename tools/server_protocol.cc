@@ -0,0 +1,216 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "tools/server_protocol.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>  // NOLINT
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Not available everywhere; the tools ignore SIGPIPE anyway.
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
+#if defined(__linux__) && defined(F_ADD_SEALS) && defined(MFD_ALLOW_SEALING)
+#define JPEGLI_SERVER_SEALING 1
+#else
+#define JPEGLI_SERVER_SEALING 0
+#endif
+
+namespace jpegli_tools {
+
+size_t ServerImagePixelsSize(const ServerImage& image) {
+  if (image.num_channels < 1 || image.num_channels > 4) return 0;
+  if (image.bits_per_sample != 8 && image.bits_per_sample != 16 &&
+      image.bits_per_sample != 32) {
+    return 0;
+  }
+  // Keeps the product below from overflowing.
+  constexpr uint64_t kMaxPixels = uint64_t{1} << 40;
+  const uint64_t num_pixels = static_cast<uint64_t>(image.xsize) * image.ysize;
+  if (num_pixels == 0 || num_pixels > kMaxPixels) return 0;
+  const uint64_t size =
+      num_pixels * image.num_channels * (image.bits_per_sample / 8);
+  if (size > SIZE_MAX) return 0;
+  return static_cast<size_t>(size);
+}
+
+int CreateSharedMemory(size_t size) {
+#if JPEGLI_SERVER_SEALING
+  int fd = memfd_create("jpegli_server", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#elif defined(__linux__)
+  int fd = memfd_create("jpegli_server", MFD_CLOEXEC);
+#else
+  // Anonymous POSIX shared memory: the name is removed right after creation.
+  char name[64];
+  snprintf(name, sizeof(name), "/jpegli_server.%d.%p",
+           static_cast<int>(getpid()), static_cast<void*>(&size));
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd != -1) shm_unlink(name);
+#endif
+  if (fd == -1) return -1;
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+const bool kSharedMemorySealing = JPEGLI_SERVER_SEALING;
+
+bool SealSharedMemory(int fd) {
+#if JPEGLI_SERVER_SEALING
+  return fcntl(fd, F_ADD_SEALS,
+               F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == 0;
+#else
+  return true;
+#endif
+}
+
+bool IsSealedSharedMemory(int fd) {
+#if JPEGLI_SERVER_SEALING
+  const int required = F_SEAL_SHRINK | F_SEAL_WRITE;
+  const int seals = fcntl(fd, F_GET_SEALS);
+  return seals != -1 && (seals & required) == required;
+#else
+  return false;
+#endif
+}
+
+bool ReadSharedMemory(int fd, size_t size, std::vector<uint8_t>* data) {
+  data->resize(size);
+  size_t pos = 0;
+  while (pos < size) {
+    const ssize_t bytes = pread(fd, data->data() + pos, size - pos, pos);
+    if (bytes < 0 && errno == EINTR) continue;
+    if (bytes <= 0) return false;
+    pos += bytes;
+  }
+  return true;
+}
+
+SharedMemory::~SharedMemory() {
+  if (data_ != nullptr) munmap(data_, size_);
+}
+
+bool SharedMemory::Map(int fd, size_t size, bool writable) {
+  if (data_ != nullptr || fd == -1 || size == 0) return false;
+  struct stat s = {};
+  if (fstat(fd, &s) != 0 || s.st_size < 0 ||
+      static_cast<uint64_t>(s.st_size) < size) {
+    return false;
+  }
+  const int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  void* data = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) return false;
+  data_ = static_cast<uint8_t*>(data);
+  size_ = size;
+  return true;
+}
+
+bool SendMessage(int socket, const void* message, size_t size, int fd) {
+  const uint8_t* data = static_cast<const uint8_t*>(message);
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  while (size > 0) {
+    struct iovec iov = {const_cast<uint8_t*>(data), size};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd != -1) {
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    const ssize_t sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) continue;
+    if (sent <= 0) return false;
+    // The descriptor goes with the first chunk.
+    fd = -1;
+    data += sent;
+    size -= sent;
+  }
+  return true;
+}
+
+bool ReceiveMessage(int socket, void* message, size_t size, int* fd,
+                    int timeout_ms) {
+  uint8_t* data = static_cast<uint8_t*>(message);
+  *fd = -1;
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (size > 0) {
+    if (timeout_ms >= 0) {
+      // The deadline is for the whole message, so that a client that sends it
+      // byte by byte can not hold the receiver for longer.
+      const auto remaining =
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              deadline - std::chrono::steady_clock::now());
+      struct pollfd pfd = {socket, POLLIN, 0};
+      const int ready =
+          remaining.count() > 0 ? poll(&pfd, 1, remaining.count()) : 0;
+      if (ready < 0 && errno == EINTR) continue;
+      if (ready <= 0) {
+        if (*fd != -1) close(*fd);
+        *fd = -1;
+        return false;
+      }
+    }
+    struct iovec iov = {data, size};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    const ssize_t received = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+    if (received < 0 && errno == EINTR) continue;
+    if (received > 0) {
+      for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+           cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(sizeof(int))) {
+          continue;
+        }
+        int received_fd;
+        memcpy(&received_fd, CMSG_DATA(cmsg), sizeof(int));
+        if (*fd == -1) {
+          *fd = received_fd;
+        } else {
+          close(received_fd);
+        }
+      }
+    }
+    if (received <= 0 || (msg.msg_flags & MSG_CTRUNC)) {
+      if (*fd != -1) close(*fd);
+      *fd = -1;
+      return false;
+    }
+    data += received;
+    size -= received;
+  }
+  return true;
+}
+
+}  // namespace jpegli_tools
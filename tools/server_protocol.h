@@ -0,0 +1,164 @@
+// Copyright (c) the JPEG XL Project Authors.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#ifndef JPEGLI_TOOLS_SERVER_PROTOCOL_H_
+#define JPEGLI_TOOLS_SERVER_PROTOCOL_H_
+
+// Protocol between jpegli_server and its clients. A client connects to the
+// Unix domain stream socket of the server, sends one ServerRequest and
+// receives one ServerResponse. Pixels and JPEG bytes do not go through the
+// socket: they are in shared memory objects whose file descriptors are
+// attached to the messages (SCM_RIGHTS) and mapped by the receiver.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lib/base/types.h"
+#include "lib/cms/color_encoding.h"
+
+namespace jpegli_tools {
+
+// Also identifies the protocol version; both sides are built from the same
+// tree, so the structs below are sent as they are.
+constexpr uint32_t kServerMagic = 0x4A4C5331;  // "JLS1"
+
+enum ServerOp : uint32_t {
+  kServerEncode = 1,
+  kServerDecode = 2,
+  kServerStats = 3,
+};
+
+enum ServerStatus : uint32_t {
+  kServerOk = 0,
+  kServerInvalidRequest = 1,
+  kServerCodecError = 2,
+};
+
+// Layout of an image in shared memory: interleaved pixels without row padding,
+// followed by icc_size bytes of ICC profile.
+struct ServerImage {
+  uint32_t xsize;
+  uint32_t ysize;
+  // 1: gray, 2: gray + alpha, 3: RGB, 4: RGBA
+  uint32_t num_channels;
+  // 8 or 16 for unsigned integers, 32 for floats.
+  uint32_t bits_per_sample;
+  JpegliEndianness endianness;
+  // If zero, color_encoding describes the pixels.
+  uint32_t icc_size;
+  JpegliColorEncoding color_encoding;
+};
+
+// Subset of jpegli::extras::JpegSettings.
+struct ServerEncodeParams {
+  float distance;
+  int32_t progressive_level;
+  uint32_t xyb;
+  uint32_t use_std_quant_tables;
+  uint32_t use_adaptive_quantization;
+  uint32_t optimize_coding;
+  // "444", "440", "422", "420" or empty for the default.
+  char chroma_subsampling[4];
+};
+
+struct ServerRequest {
+  uint32_t magic;
+  ServerOp op;
+  // kServerEncode: the input image in the attached shared memory.
+  // kServerDecode: the requested output; num_channels 0 keeps the JPEG color
+  // space, xsize, ysize and icc_size are ignored.
+  ServerImage image;
+  ServerEncodeParams encode_params;
+  // Number of input bytes in the attached shared memory.
+  uint64_t data_size;
+};
+
+struct ServerStats {
+  uint32_t num_workers;
+  uint32_t num_busy_workers;
+  // Accepted connections that wait for a worker.
+  uint32_t queue_depth;
+  uint32_t max_queue_depth;
+  // Completed encode and decode requests, including the failed ones.
+  uint64_t num_requests;
+  uint64_t num_failures;
+  // Sums over the completed requests of the time between accepting the
+  // connection and starting to work on it, resp. sending the response.
+  uint64_t total_queue_time_us;
+  uint64_t total_latency_us;
+  uint64_t max_latency_us;
+};
+
+struct ServerResponse {
+  uint32_t magic;
+  ServerStatus status;
+  // kServerDecode: the decoded image in the attached shared memory.
+  ServerImage image;
+  // Number of output bytes in the attached shared memory.
+  uint64_t data_size;
+  ServerStats stats;
+};
+
+// Returns the number of pixel bytes of `image`, or 0 if the image is empty or
+// its layout is not supported.
+size_t ServerImagePixelsSize(const ServerImage& image);
+
+// Returns the file descriptor of a new shared memory object of `size` bytes,
+// or -1 on failure.
+int CreateSharedMemory(size_t size);
+
+// True if shared memory objects can be sealed on this platform. In that case
+// the server only accepts sealed input objects, otherwise it copies the input
+// with ReadSharedMemory().
+extern const bool kSharedMemorySealing;
+
+// Seals `fd` against resizing and writing, so that the receiver can map it
+// without the sender truncating it (which would make the receiver crash with
+// SIGBUS) or changing it. The object must not be mapped writable. Does
+// nothing if kSharedMemorySealing is false.
+bool SealSharedMemory(int fd);
+
+// Returns true if `fd` is sealed against shrinking and writing.
+bool IsSealedSharedMemory(int fd);
+
+// Copies the first `size` bytes of `fd` to `data`; fails if the object is
+// smaller.
+bool ReadSharedMemory(int fd, size_t size, std::vector<uint8_t>* data);
+
+// Mapping of (the beginning of) a shared memory object.
+class SharedMemory {
+ public:
+  SharedMemory() = default;
+  ~SharedMemory();
+  SharedMemory(const SharedMemory&) = delete;
+  SharedMemory& operator=(const SharedMemory&) = delete;
+
+  // Maps the first `size` bytes of `fd`; fails if the object is smaller.
+  bool Map(int fd, size_t size, bool writable);
+
+  uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Sends `size` bytes of `message` over the connected `socket`, with the file
+// descriptor `fd` attached unless it is -1.
+bool SendMessage(int socket, const void* message, size_t size, int fd);
+
+// Receives exactly `size` bytes into `message`. *fd is the attached file
+// descriptor, which the caller has to close, or -1 if there is none. If
+// `timeout_ms` is not negative, fails if the whole message does not arrive
+// within that time.
+bool ReceiveMessage(int socket, void* message, size_t size, int* fd,
+                    int timeout_ms = -1);
+
+}  // namespace jpegli_tools
+
+#endif  // JPEGLI_TOOLS_SERVER_PROTOCOL_H_
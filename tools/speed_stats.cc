@@ -104,7 +104,8 @@ bool SpeedStats::Print(size_t worker_threads) {
   if (!GetSummary(&s)) {
     return false;
   }
-  std::string mps_stats = SummaryStat(xsize_ * ysize_ * 1e-6, "MP", s, ", ");
+  const size_t num_pixels = num_images_ > 0 ? num_pixels_ : xsize_ * ysize_;
+  std::string mps_stats = SummaryStat(num_pixels * 1e-6, "MP", s, ", ");
   std::string mbs_stats = SummaryStat(file_size_ * 1e-6, "MB", s, ", ");
   size_t reps = elapsed_.size();
   std::string reps_str;
@@ -112,9 +113,15 @@ bool SpeedStats::Print(size_t worker_threads) {
     reps_str = ", " + std::to_string(reps) + " reps";
   }
 
-  fprintf(stderr, "%d x %d%s%s%s, %d threads.\n", static_cast<int>(xsize_),
-          static_cast<int>(ysize_), mps_stats.c_str(), mbs_stats.c_str(),
-          reps_str.c_str(), static_cast<int>(worker_threads));
+  std::string size_str;
+  if (num_images_ > 0) {
+    size_str = std::to_string(num_images_) + " images";
+  } else {
+    size_str = std::to_string(xsize_) + " x " + std::to_string(ysize_);
+  }
+  fprintf(stderr, "%s%s%s%s, %d threads.\n", size_str.c_str(),
+          mps_stats.c_str(), mbs_stats.c_str(), reps_str.c_str(),
+          static_cast<int>(worker_threads));
   return true;
 }
 
@@ -39,14 +39,23 @@ class SpeedStats {
   // Sets the file size to allow computing MB/s values.
   void SetFileSize(size_t file_size) { file_size_ = file_size; }
 
-  // Calls GetSummary and prints megapixels/sec. SetImageSize() must be called
-  // once before this can be used.
+  // Sets the number of images and their total number of pixels processed in
+  // each repetition, instead of the size of a single image.
+  void SetBatchSize(size_t num_images, size_t num_pixels) {
+    num_images_ = num_images;
+    num_pixels_ = num_pixels;
+  }
+
+  // Calls GetSummary and prints megapixels/sec. SetImageSize() or
+  // SetBatchSize() must be called once before this can be used.
   bool Print(size_t worker_threads);
 
  private:
   std::vector<double> elapsed_;
   size_t xsize_ = 0;
   size_t ysize_ = 0;
+  size_t num_images_ = 0;
+  size_t num_pixels_ = 0;
 
   // Size of the source binary file, meaningful when decoding a recompressed
   // JPEG.
@@ -14,8 +14,10 @@
 #include "lib/extras/dec/color_hints.h"
 #include "lib/extras/dec/decode.h"
 #include "lib/extras/packed_image.h"
+#include "lib/extras/ssimulacra2.h"
 #include "tools/file_io.h"
-#include "tools/ssimulacra2.h"
+#include "tools/no_memory_manager.h"
+#include "tools/thread_pool_internal.h"
 
 #define QUIT(M)               \
   fprintf(stderr, "%s\n", M); \
@@ -96,8 +98,12 @@ int main(int argc, char** argv) {
     QUIT("Image size mismatch\n");
   }
 
-  JPEGLI_ASSIGN_OR_QUIT(Msssim msssim, ComputeSSIMULACRA2(ppf1, ppf2),
-                        "ComputeSSIMULACRA2 failed.");
+  jpegli_tools::ThreadPoolInternal pool;
+  JPEGLI_ASSIGN_OR_QUIT(
+      jpegli::Msssim msssim,
+      jpegli::ComputeSSIMULACRA2(jpegli_tools::NoMemoryManager(), ppf1, ppf2,
+                                 pool.get()),
+      "ComputeSSIMULACRA2 failed.");
   printf("%.8f\n", msssim.Score());
   return EXIT_SUCCESS;
 }